@@ -110,7 +110,7 @@ double PRAlgorithms::LinearRct::ReconstructX(PRAlgorithms::_neighbor_pads pads,
         return 0.0;
     }
 
-    auto section = iter->second;
+    const auto &section = iter->second;
 
     // auto fmPadFactors = section._factors;
     auto leftPad = pads.first;
@@ -127,9 +127,6 @@ double PRAlgorithms::LinearRct::ReconstructX(PRAlgorithms::_neighbor_pads pads,
     if (normedSignalLeft < 10 && normedSignalRight < 10) // approximately 10/20=0.5 fC
         return 0.0;
 
-    static int count_left_small = 0;
-    static int count_right_small = 0;
-    static int count_normal = 0;
     if (normedSignalLeft < 0.15 * (normedSignalLeft + normedSignalRight))
     {
         double posrightEdge = section._edgeX.second;
@@ -170,7 +167,7 @@ bool PRAlgorithms::LinearRct::PRfromWaveInfo(const std::map<int, WFDataProcessor
     // Generate neighbor pads signals map
     std::map<_neighbor_pads, _neighbor_pads_signals> neighborPadsSignalsMap;
     std::map<_neighbor_pads, _neighbor_pads_signals> neighborPadsNormSignalsMap;
-    auto dataMap = GetPRDataMapConst();
+    const auto &dataMap = GetPRDataMapConst();
     for (auto iter : dataMap.GetValidPadX())
     {
         auto pad_xy = iter;
@@ -3,27 +3,146 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
 
 #include "lcparser.h"
 
 #include <TFile.h>
 #include <iostream>
 #include <TTree.h>
+#include <TChain.h>
+#include <TParameter.h>
 
 class TFile;
 class TTree;
+class TCanvas;
 class ScopeData;
 
 namespace WFDataProcessor
 {
 
     typedef std::pair<double, double> _signal_range;
+
+    /// @brief Feature mask selecting every _waveinfo field, bit i stands for field i of GetWaveInfoFields()
+    constexpr uint32_t kAllFeatures = 0xFFFFFFFFu;
+    /// @brief Value of the fields left out of a feature mask, distinct from the -100e9 of a crossing not found
+    constexpr double kFeatureSkipped = -200e9;
+
+    /// @brief Sub-sample interpolation of the threshold and constant-fraction crossings
+    enum InterpolationMethod
+    {
+        kLinearInterpolation = 0, ///  Straight line between the two samples around the crossing
+        kCubicInterpolation = 1,  ///  Catmull-Rom cubic through 4 samples
+        kSincInterpolation = 2,   ///  Lanczos windowed sinc through 8 samples
+    };
+
+    /// @brief Filter stage applied to the samples before the features are extracted
+    enum FilterType
+    {
+        kNoFilter = 0,
+        kMovingAverage = 1,  ///  Centered average of taps samples
+        kLowPassFIR = 2,     ///  Centered Hamming-windowed sinc of taps samples, cutoff frequency in GHz
+        kSinglePoleIIR = 3,  ///  y[i] = y[i-1] + alpha * (x[i] - y[i-1]), alpha from the cutoff frequency in GHz, delays the pulse
+        kDifferentiator = 4, ///  y[i] = x[i] - x[i - taps]
+    };
+
+    struct _filter_config
+    {
+        FilterType type{kNoFilter};
+        int taps{5};        // moving average and FIR length (rounded up to odd, at most 255), differentiator delay, in samples
+        double cutoff{1.0}; // GHz, FIR and IIR cutoff frequency
+    };
+
+    /// @brief Estimator of the start and end pedestals
+    enum BaselineMethod
+    {
+        kMeanBaseline = 0,        ///  Mean and standard deviation of the samples
+        kMedianBaseline = 1,      ///  Mean of the running median of window samples, spread of the samples around it
+        kTrimmedMeanBaseline = 2, ///  Mean and standard deviation of the samples left after trimming both tails
+    };
+
+    struct _baseline_config
+    {
+        BaselineMethod method{kMeanBaseline};
+        int window{15};   // running median window, in samples (rounded up to odd)
+        double trim{0.1}; // fraction of the samples removed at each end by the trimmed mean
+    };
+
+    /// @brief Reference pulse of the template-matching estimator (t_tmpl, amp_tmpl)
+    struct _template_config
+    {
+        std::vector<double> shape; // reference pulse above its pedestal, any unit (scaled to a unit peak), empty to disable
+        double dt{0.0};            // ns, sampling interval of shape, 0 if sampled like the records
+        double t_ref{0.0};         // ns, time of the reference point after shape[0] (e.g. its 50% leading edge), reported as t_tmpl
+    };
+
+    /// @brief Window applied to the noise segments before their FFT
+    enum SpectrumWindow
+    {
+        kRectangularWindow = 0,    ///  No window, narrowest bins but the most leakage
+        kHannWindow = 1,           ///  Raised cosine
+        kBlackmanHarrisWindow = 2, ///  4-term Blackman-Harris, lowest leakage
+    };
+
+    /// @brief Averaged noise power spectrum of the samples just before the search range, see _noise_spectrum
+    struct _spectrum_config
+    {
+        int length{0};                      // samples per segment, a power of two, 0 to disable
+        SpectrumWindow window{kHannWindow}; // window of the segments
+        int every{1};                       // one event in every is added to the average
+    };
+
+    /// @brief Average pulse shape on a fine grid aligned on toa, see _average_pulse
+    struct _pulse_shape_config
+    {
+        double step{0.0};                                      // ns, spacing of the grid, 0 to disable
+        double start{-2.0};                                    // ns, first grid point relative to toa
+        double stop{6.0};                                      // ns, last grid point relative to toa
+        InterpolationMethod interpolation{kSincInterpolation}; // fractional shift of the records onto the grid
+        bool normalize{false};                                 // divide by amp, so that pulses of all amplitudes have a unit peak
+        std::vector<double> amp_bins{};                        // mV, ascending edges of the amplitude classes, empty for a single class
+
+        /// @brief Number of grid points, 0 if disabled
+        int Points() const { return step > 0 && stop >= start ? static_cast<int>((stop - start) / step + 1e-9) + 1 : 0; }
+        /// @brief Time of grid point j relative to toa (in ns)
+        double Time(int j) const { return start + j * step; }
+    };
+
+    /// @brief Search range of each event placed on the toa of a reference channel (e.g. the trigger), which the
+    /// extractor processes first. Events without a reference toa fall back to the fixed search_range.
+    struct _relative_range
+    {
+        int reference{-1};  // channel whose toa places the window, -1 for the fixed search_range
+        double offset{0.0}; // ns, start of the window relative to the reference toa
+        double width{0.0};  // ns, length of the window
+    };
+
     struct _extract_config
     {
         _signal_range search_range{-10.0, 10.0}; // ns
         double threshold{20.0};                  // mV
         bool need_draw{false};
         std::string savePrefix{""};
+        uint32_t features{kAllFeatures}; // fields to compute, see MakeFeatureMask; the writer only creates their branches
+        double cfd_fraction{0.0};        // fraction of the constant-fraction discriminator (t_cfd), 0 to disable it
+        double cfd_delay{1.0};           // ns, delay of the constant-fraction discriminator, rounded to whole samples
+        InterpolationMethod interpolation{kLinearInterpolation}; // crossings of the kernels in WFKernels.h, plotting always uses linear
+        _filter_config filter{};                                  // filter stage between decode and feature extraction
+        bool find_pulses{false};                                  // pulse finder: every pulse above threshold in the search range, see _pulse_list
+        _baseline_config baseline{};                              // pedestal estimator, robust against pulses and ringing in the pedestal regions
+        _template_config pulse_template{};                        // template matching (t_tmpl, amp_tmpl), disabled without a shape
+        std::vector<double> tot_thresholds{};                     // mV, ascending: crossings and time over threshold of the main pulse at each level, see _tot_list
+        _spectrum_config noise_spectrum{};                        // averaged noise spectrum of the pre-signal region, WFDataExtractor only
+        _pulse_shape_config pulse_shape{};                        // average pulse aligned on toa, WFDataExtractor only
+        _relative_range relative_range{};                         // per-event search range from a reference channel, WFDataExtractor only
     };
 
     /// @brief Invalid code enumeration for waveform analysis
@@ -40,6 +159,9 @@ namespace WFDataProcessor
         NO_T2_50_FOUND = 1 << 7,
         NO_T2_90_FOUND = 1 << 8,
         RANGE_ERROR = 1 << 9,
+        NO_CFD_FOUND = 1 << 10,
+        PILEUP = 1 << 11, ///  Pulse finder only: more than one pulse in the search range
+        NO_TEMPLATE_MATCH = 1 << 12, ///  Template matching only: no positive fit with the template peak in the search range
     };
 
     /// @brief Structure to hold extracted waveform information
@@ -70,6 +192,46 @@ namespace WFDataProcessor
         double charge_pm2ns;      ///  Charge integrated from t_amp-2ns to t_amp+2ns (in mV*ns)
         double t_min;             ///  Time of minimum amplitude (in ns)
         double amp_min;           ///  Minimum amplitude of the waveform (in mV), subtract backend pedestal, only find within search range
+        double t_cfd;             ///  Zero crossing of the constant-fraction discriminator within the search range (in ns), -100e9 if disabled
+        double t_tmpl;            ///  Time of the template reference point at the best template position (in ns), -100e9 if disabled
+        double amp_tmpl;          ///  Peak amplitude of the least-squares template fit at that position (in mV), -100e9 if disabled
+    };
+
+    /// @brief Description of one _waveinfo member, every branch layout is generated from GetWaveInfoFields()
+    struct _waveinfo_field
+    {
+        const char *name; ///  Branch name without channel, e.g. "amp" -> "ch1_amp" or "amp[nch]"
+        char type;        ///  ROOT leaf type code, 'I', 'i' or 'D'
+        size_t offset;    ///  Offset of the member inside _waveinfo
+        size_t size;      ///  Size of the member in bytes
+    };
+    /// @brief Table of all _waveinfo members, in branch order
+    const std::vector<_waveinfo_field> &GetWaveInfoFields();
+    /// @brief Position of a field in GetWaveInfoFields() by its branch name (e.g. "toa", "q_50"), -1 if not found
+    int FindWaveInfoField(const std::string &name);
+    /// @brief Feature mask for _extract_config::features from branch names, e.g. {"amp", "toa"}.
+    /// Unknown names are reported and ignored. An empty list selects all features.
+    uint32_t MakeFeatureMask(const std::vector<std::string> &features);
+    /// @brief Whether field i of GetWaveInfoFields() is computed and written under a feature mask,
+    /// "valid" and "nsamples" always are
+    bool IsFeatureSelected(uint32_t features, int field);
+
+    /// @brief Columns of a batch of entries read by WFDataTreeReader::ReadBatch, all values converted to double
+    struct _waveinfo_columns
+    {
+        Long64_t first = 0;                                              ///  First entry of the batch
+        Long64_t size = 0;                                               ///  Number of entries in the batch
+        std::map<int, std::map<std::string, std::vector<double>>> data; ///  channel -> feature -> values
+        std::vector<int> file_index;                                     ///  LeCroy waveform index of each entry, -1 if unknown
+
+        const std::vector<double> &Column(int channel, const std::string &feature) const { return data.at(channel).at(feature); }
+    };
+
+    /// @brief Branch layout of the extracted "waveinfo" tree
+    enum WaveInfoLayout
+    {
+        kScalarBranches = 0, ///  One scalar branch per field and channel: "ch1_amp", "ch1_toa", ...
+        kFeatureArrays = 1,  ///  One array branch per field indexed by channel: "amp[nch]", ..., channel numbers stored in "ch_id[nch]"
     };
 
     /// @brief Get interpolated time of arrival at given threshold, using linear interpolation
@@ -122,20 +284,244 @@ namespace WFDataProcessor
     /// @param chDataHasDataMap [out] map of channel number to boolean indicating whether data was successfully read
     /// @param mid_name what is the middle name part
     /// @param ext extension of the file, default is .trc
+    /// @param rawOnly only keep the raw ADC codes (ScopeData::InitRawData), without the x/y arrays
     /// @return return true if all specified channels have data, false otherwise
-    bool ReadAllWF(const std::string &folder, int idx_lecroy_wf, std::map<int, ScopeData *> &chDataMap, std::map<int, bool> &chDataHasDataMap, std::string mid_name = "--Trace--", std::string ext = ".trc");
+    bool ReadAllWF(const std::string &folder, int idx_lecroy_wf, std::map<int, ScopeData *> &chDataMap, std::map<int, bool> &chDataHasDataMap, std::string mid_name = "--Trace--", std::string ext = ".trc", bool rawOnly = false);
+
+    /// @brief Coefficients of a _filter_config for one sampling interval, see DesignFilter in WFKernels.h
+    struct _filter_design
+    {
+        _filter_config config{};     ///  Configuration the design was made for
+        double dt = 0;               ///  Sampling interval the design was made for (in ns)
+        FilterType type = kNoFilter; ///  Filter applied, kNoFilter if the configuration is invalid
+        int taps = 0;                ///  FIR length or differentiator delay
+        double alpha = 0;            ///  Single-pole IIR coefficient
+        double dc_gain = 1;          ///  Gain for a constant input, 0 for the differentiator
+        std::vector<double> h;       ///  FIR coefficients, h[taps / 2] on the output sample
+    };
+
+    /// @brief Tables of a radix-2 complex FFT, see MakeFFTPlan in WFKernels.h
+    struct _fft_plan
+    {
+        int n = 0;                   ///  Number of points, a power of two
+        std::vector<double> twiddle; ///  e^{-i pi k / half} of the stage of blocks of half points at [half, 2 * half), interleaved
+        std::vector<int> bitrev;     ///  Bit-reversed index of every point
+    };
+
+    /// @brief Template of a _template_config at the sampling interval of the records, see DesignTemplate in WFKernels.h
+    struct _template_design
+    {
+        _template_config config{};    ///  Configuration the design was made for
+        double dt = 0;                ///  Sampling interval the design was made for (in ns)
+        bool valid = false;           ///  false if the configuration is empty or invalid
+        std::vector<double> h;        ///  Template resampled at dt, scaled to a unit peak
+        int peak = 0;                 ///  Sample of the peak of h
+        double sum = 0;               ///  Sum of h
+        double norm = 0;              ///  Sum of h^2
+        int block = 0;                ///  Lags per FFT block (overlap-save), 0 for short templates, always correlated directly
+        _fft_plan plan;               ///  FFT of one block
+        std::vector<double> spectrum; ///  Conjugate FFT of h zero-padded to plan.n, interleaved complex
+    };
+
+    /// @brief Running average of the one-sided power spectral density of noise segments, see AccumulateNoiseSpectrum
+    /// in WFKernels.h. Segments are transformed two at a time, one in the real and one in the imaginary part of
+    /// a complex FFT, so a segment may wait in z until the next one (FinishNoiseSpectrum).
+    struct _noise_spectrum
+    {
+        _spectrum_config config{};  ///  Configuration the window and plan were made for
+        double dt = 0;              ///  Sampling interval of the averaged segments (in ns), set by the first one
+        long long events = 0;       ///  Segments in power, a pending one is not counted yet
+        long long offered = 0;      ///  Events offered, for _spectrum_config::every
+        long long skipped = 0;      ///  Events without a full segment before the search range, or with another sampling
+        std::vector<double> power;  ///  Average density at bin k, frequency k / (length * dt) (in mV^2/GHz), length / 2 + 1 bins
+        std::vector<double> window; ///  Window of one segment
+        double window_norm = 0;     ///  Sum of the squared window
+        _fft_plan plan;             ///  FFT of one segment
+        std::vector<double> z;      ///  Two windowed segments, interleaved complex
+        bool pending = false;       ///  z holds one segment not transformed yet
+
+        /// @brief Frequency of bin k (in GHz)
+        double Frequency(int k) const { return config.length > 0 && dt > 0 ? k / (config.length * dt) : 0; }
+    };
+
+    /// @brief Running mean and variance of pulses resampled on the grid of a _pulse_shape_config, see AccumulatePulseShape
+    /// in WFKernels.h. Every pulse covers the whole grid, so all points have the same count.
+    struct _average_pulse
+    {
+        long long count = 0;      ///  Pulses averaged
+        std::vector<double> mean; ///  Mean amplitude above the start pedestal at grid point j (in mV, or a fraction of amp if normalized)
+        std::vector<double> m2;   ///  Sum of the squared deviations from the mean at grid point j
+
+        /// @brief Spread of the pulses at grid point j
+        double StdDev(int j) const { return count > 0 ? std::sqrt(m2[j] / count) : 0; }
+    };
+
+    /// @brief Pulses found by the pulse finder (_extract_config::find_pulses) in one waveform, in time order.
+    /// A pulse spans the samples above threshold; a pulse falling by more than threshold below its peak and
+    /// rising again by more than threshold is split at the valley, so piled-up pulses are kept apart.
+    struct _pulse_list
+    {
+        std::vector<double> amp;    ///  Peak amplitude above the start pedestal (in mV)
+        std::vector<double> toa;    ///  Leading-edge crossing of 50% of the peak amplitude (in ns)
+        std::vector<double> charge; ///  Charge of the samples of the pulse (in mV*ns)
+        std::vector<double> width;  ///  Time over threshold, up to the valley for a split pulse (in ns)
+
+        /// @brief Remove all pulses, keeping the capacity
+        void Clear()
+        {
+            amp.clear();
+            toa.clear();
+            charge.clear();
+            width.clear();
+        }
+        int Size() const { return amp.size(); }
+    };
+
+    /// @brief Leading and trailing crossings of the main pulse (the maximum of the search range) at each level of
+    /// _extract_config::tot_thresholds, found in one walk from the peak to each side of the search window.
+    /// Levels at or above the peak, or not crossed before the edge of the window, give -100e9.
+    struct _tot_list
+    {
+        std::vector<double> t_lead;  ///  Leading-edge crossing (in ns)
+        std::vector<double> t_trail; ///  Trailing-edge crossing (in ns)
+        std::vector<double> tot;     ///  Time over threshold, t_trail - t_lead (in ns), -100e9 if either is not found
+
+        /// @brief Remove all levels, keeping the capacity
+        void Clear()
+        {
+            t_lead.clear();
+            t_trail.clear();
+            tot.clear();
+        }
+        int Size() const { return tot.size(); }
+    };
+
+    /// @brief Reusable buffers of processWave, grown to the longest record length seen and never shrunk,
+    /// so that steady-state extraction does no heap allocation. Not shared between threads.
+    struct _wave_workspace
+    {
+        std::vector<double> t;           ///  Time of the current waveform (in ns)
+        std::vector<double> a;           ///  Amplitude of the current waveform (in mV)
+        std::vector<double> filtered;    ///  Output of the filter stage, one record or one batch slot
+        int filtered_samples = 0;        ///  Samples of the current record in filtered, 0 if the filter stage did not run on it
+        double filtered_gain = 1;        ///  filtered to V: filtered_gain * filtered - filtered_offset, filtered holds codes or V
+        double filtered_offset = 0;      ///  see filtered_gain
+        std::vector<double> decoded;     ///  Time (in s) then amplitude (in V) of a record processWaveRaw hands to processWave
+        _filter_design filter;           ///  Filter coefficients, rebuilt when the configuration or the sampling changes
+        _pulse_list pulses;              ///  Pulses of the current waveform, filled when _extract_config::find_pulses is set
+        _tot_list tot;                   ///  Multi-threshold crossings of the current waveform, filled when _extract_config::tot_thresholds is set
+        std::vector<double> baseline;    ///  Window values of the running median, or partitioned copy of the trimmed mean
+        std::vector<int> baseline_slots; ///  Heaps of the running median
+        _template_design match;          ///  Template and its FFT, rebuilt when the template or the sampling changes
+        std::vector<double> correlation; ///  Correlation of the template with the current waveform, and FFT blocks
+        int sample_up = 0;               ///  First sample of the search range of the current waveform
+        int sample_down = 0;             ///  Last sample of the search range of the current waveform
+
+        void Reserve(int Nsamples)
+        {
+            if ((int)t.size() < Nsamples)
+            {
+                t.resize(Nsamples);
+                a.resize(Nsamples);
+            }
+        }
+    };
 
     /// @brief Process a single waveform to extract features such as pedestal, amplitude, charge, and time of arrival.
     /// Charge in mV*ns, Amplitude in mV, Time in ns, signal was search between low_range_t0 and high_range_t0 for each channel.
-    /// @param ch Channel number (1-based index)
     /// @param t Time array (in seconds)
     /// @param a Amplitude array (in volts)
     /// @param Nsamples Number of samples in the waveform
-    /// @param threshold [in] Threshold for t1 and t2 calculation (in mV), default is 20.0 mV
-    void processWave(const double *t, const double *a, int Nsamples, _waveinfo &winfo, _extract_config config);
-
-    void GenerateBranchForWaveInfo(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_waveinfo *winfo);
+    /// @param config search range and threshold (in mV) for t1 and t2 calculation, and filter stage applied first
+    /// @param workspace caller-owned buffers, reused from call to call. It also keeps the filter and template designs,
+    /// so channels with different settings should each have their own.
+    /// With config.need_draw the waveform is drawn and saved before returning, WFDataExtractor draws on a
+    /// background thread instead (see WFPlotRenderer). Reentrant: threads with their own workspaces can run it concurrently,
+    /// plotting from several threads also needs ROOT::EnableThreadSafety() and batch mode.
+    void processWave(const double *t, const double *a, int Nsamples, _waveinfo &winfo, const _extract_config &config, _wave_workspace &workspace);
+    /// @brief Same as above, using a workspace owned by the calling thread
+    void processWave(const double *t, const double *a, int Nsamples, _waveinfo &winfo, const _extract_config &config);
+    /// @brief Original multi-pass implementation of processWave, kept as reference for the fused kernel (see WFKernels.h)
+    /// and used for records with a non-monotonic time axis. It does not plot.
+    void processWaveReference(const double *t, const double *a, int Nsamples, _waveinfo &winfo, const _extract_config &config, _wave_workspace &workspace);
+
+    /// @brief Copy of a waveform and of its features, everything DrawPlotJob needs
+    struct _plot_job
+    {
+        std::vector<double> t;        // ns
+        std::vector<double> a;        // mV, the record the features were extracted from, i.e. after the filter stage
+        _waveinfo winfo{};
+        _signal_range search_range{}; // ns
+        double threshold{0.0};        // mV
+        std::string savePrefix{""};   // saved as savePrefix + ".png"
+    };
+    /// @brief Copy a waveform (t in s, a in V) and its features into job, the buffers of job are reused
+    void FillPlotJob(const double *t, const double *a, int Nsamples, const _waveinfo &winfo, const _extract_config &config, _plot_job &job);
+    /// @brief Draw the waveform with its search range, pedestal band, threshold, 50% and maximum levels and crossings, and
+    /// save it as png. Markers of features not found or left out of the feature mask are not drawn.
+    void DrawPlotJob(const _plot_job &job, TCanvas *canvas);
+
+    /// @brief Create the scalar branches of one channel, only for the fields selected by features
+    void GenerateBranchForWaveInfo(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_waveinfo *winfo, uint32_t features = kAllFeatures);
+    /// @brief Bind the scalar branches of one channel, fields without a branch are set to kFeatureSkipped
     void SetBranchAddressToWaveInfo(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_waveinfo *winfo);
+    /// @brief Create the per-pulse branches of one channel, "ch1_pulse_amp", "ch1_pulse_toa", ... holding std::vector<double>
+    void GenerateBranchForPulses(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_pulse_list *pulses);
+    /// @brief Bind the per-pulse branches of one channel
+    /// @return false if the tree has no such branches
+    bool SetBranchAddressToPulses(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_pulse_list *pulses);
+    /// @brief Create the multi-threshold branches of one channel, "ch1_tot_lead", "ch1_tot_trail", "ch1_tot" holding
+    /// std::vector<double> with one element per level
+    void GenerateBranchForTot(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_tot_list *tot);
+    /// @brief Bind the multi-threshold branches of one channel
+    /// @return false if the tree has no such branches
+    bool SetBranchAddressToTot(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_tot_list *tot);
+
+    /// @brief Column buffers of the kFeatureArrays layout. The writer packs the per-channel _waveinfo into one array
+    /// per field before Fill, the reader unpacks them after GetEntry.
+    class WaveInfoArrayBuffer
+    {
+    public:
+        /// @brief Create "ch_id" and one array branch per field selected by features, with one element per channel
+        void Branch(TTree *tree, const std::vector<int> &channels, uint32_t features = kAllFeatures);
+        /// @brief Bind the array branches of an existing tree, the channel list is read from "ch_id" of the first entry.
+        /// Fields without a branch read as kFeatureSkipped.
+        bool SetBranchAddress(TTree *tree);
+        static bool IsFeatureArrayTree(TTree *tree) { return tree && tree->GetBranch("ch_id"); }
+
+        void Pack(const std::map<int, _waveinfo *> &chData);
+        /// @brief Copy the current entry into the channels present in the tree, other channels are left untouched
+        /// @param channels channels to update, empty for all
+        /// @param fieldIndices indices in GetWaveInfoFields() of the members to update, empty for all
+        void Unpack(const std::map<int, _waveinfo *> &chData, const std::set<int> &channels = {}, const std::vector<int> &fieldIndices = {}) const;
+
+        const std::vector<int> &GetChannels() const { return fChannels; }
+        void Clear();
+
+    private:
+        void Allocate(int nch);
+
+        std::vector<int> fChannels;              // array slot -> channel number
+        std::map<int, int> fmSlot;               // channel number -> array slot
+        std::vector<std::vector<char>> fColumns; // field -> values of all channels
+    };
+
+    /// @brief Collect all values of the "file_index" branch of an existing tree, used to resume an interrupted job
+    /// @param tree tree written by a previous job
+    /// @param indices [out] set of LeCroy waveform indices already stored in the tree
+    /// @param branchName name of the branch holding the waveform index
+    /// @return false if the tree has no such branch, i.e. it cannot be resumed
+    bool ReadProcessedIndices(TTree *tree, std::set<int> &indices, const std::string &branchName = "file_index");
+
+    /// @brief Read a chain manifest written by a writer with output rollover enabled
+    /// @param manifest path of the manifest file (usually ends with ".manifest")
+    /// @param treeName [out] name of the tree stored in each file
+    /// @param files [out] full paths of the files, in writing order
+    /// @return false if the manifest cannot be opened or lists no file
+    bool ReadChainManifest(const std::string &manifest, std::string &treeName, std::vector<std::string> &files);
+    /// @brief Write a chain manifest, file names are stored relative to the manifest folder
+    bool WriteChainManifest(const std::string &manifest, const std::string &treeName, const std::vector<std::string> &files);
+    bool IsChainManifest(const std::string &filename);
 
 }
 
@@ -149,6 +535,7 @@ namespace WFDataProcessor
         virtual ~VMultiIO();
 
         virtual bool AddChannel(int channel);
+        /// @brief Open a ROOT file. Readers also accept a ".manifest" written by a splitting writer, and read all parts as one TChain
         virtual bool OpenFile(const std::string &filename);
         virtual void CloseFile();
 
@@ -157,8 +544,13 @@ namespace WFDataProcessor
 
         const std::map<int, T *> &GetChannelDataMap() const { return fmChData; };
         const std::map<int, bool> &GetChannelDataHasDataMap() const { return fmChDataHasData; };
+        /// @brief Last reader or writer of this type constructed on the calling thread (gWFDataExtractor, ...),
+        /// so that jobs running on several threads do not see each other's instances
         static VMultiIO<T> *&CurrentInstance();
 
+        /// @brief LeCroy waveform index of the current entry, -1 if unknown (e.g. files written before "file_index" existed)
+        int GetFileIndex() const { return fFileIndex; }
+
     protected:
         VMultiIO(bool isRead) : fIsRead(isRead) { CurrentInstance() = this; };
         VMultiIO(bool isRead, std::vector<int> channelsToRead);
@@ -170,10 +562,14 @@ namespace WFDataProcessor
 
         TFile *fFile = nullptr;
         TTree *fTree = nullptr;
+        TChain *fChain = nullptr; // Readers only: set when opened from a chain manifest
         virtual void ClearMap();
 
         virtual bool InitTree() = 0;
+        virtual const char *GetTreeName() const = 0;
         bool fIsRead = false;
+        bool fResume = false; // Writers only: open with "UPDATE" and append to an existing tree
+        int fFileIndex = -1;  // LeCroy waveform index of the current entry, stored in "file_index" branch
     };
 
     template <typename T>
@@ -182,6 +578,25 @@ namespace WFDataProcessor
     public:
         VMultiChannelReader() : VMultiIO<T>(true) {}
         VMultiChannelReader(std::vector<int> channelsToRead) : VMultiIO<T>(true, channelsToRead) {}
+
+        /// @brief Read one entry into the channel data, prefer it over GetTree()->GetEntry() since some layouts need unpacking
+        virtual Long64_t GetEntry(Long64_t entry) { return this->fTree ? this->fTree->GetEntry(entry) : 0; }
+
+        /// @brief Only read the given channels, the branches of other channels are disabled. Empty to read all channels.
+        /// Can be called before or after OpenFile, data of inactive channels is not updated by GetEntry.
+        void SetActiveChannels(const std::vector<int> &channels)
+        {
+            fActiveChannels = std::set<int>(channels.begin(), channels.end());
+            if (this->fTree)
+                ApplyBranchStatus();
+        }
+        bool IsChannelActive(int channel) const { return fActiveChannels.empty() || fActiveChannels.count(channel); }
+
+    protected:
+        /// @brief Enable only the branches needed by the active channels (and features), called at the end of InitTree
+        virtual void ApplyBranchStatus() = 0;
+
+        std::set<int> fActiveChannels; // empty means all channels
     };
 
     template <typename T>
@@ -194,8 +609,48 @@ namespace WFDataProcessor
         bool GetForceMatch() const { return fForceMatch; }
         void SetForceMatch(bool forceMatch) { fForceMatch = forceMatch; }
 
+        /// @brief Resumable mode, must be set before OpenFile. The output file is opened with "UPDATE",
+        /// entries of an existing tree are kept, and waveform indices already stored are skipped.
+        void SetResume(bool resume) { this->fResume = resume; }
+        bool GetResume() const { return this->fResume; }
+        /// @brief Write the tree header and a "checkpoint" parameter every nFills entries (0 to disable)
+        void SetCheckpointInterval(int nFills) { fCheckpointInterval = nFills; }
+        bool Checkpoint();
+
+        void SetFileIndex(int idx_file) { this->fFileIndex = idx_file; }
+        bool IsProcessed(int idx_file) const { return fProcessedIndices.find(idx_file) != fProcessedIndices.end(); }
+        const std::set<int> &GetProcessedIndices() const { return fProcessedIndices; }
+        bool GetLastSkipped() const { return fLastSkipped; }
+
+        /// @brief Split the output into "name_0000.root", "name_0001.root", ... plus "name.manifest", must be set before OpenFile.
+        /// A new part is started when the current one holds maxEntries entries or maxBytes compressed bytes (0 to ignore a limit).
+        void SetRollover(Long64_t maxEntries, Long64_t maxBytes = 0);
+        bool IsRollover() const { return fRolloverEntries > 0 || fRolloverBytes > 0; }
+        const std::vector<std::string> &GetPartFiles() const { return fPartFiles; }
+        std::string GetManifestName() const { return fBaseName + ".manifest"; }
+
+        bool OpenFile(const std::string &filename) override;
+
     protected:
         bool fForceMatch = true; // Whether to force match all channels when reading data
+
+        std::set<int> fProcessedIndices; // waveform indices already in the tree
+        int fCheckpointInterval = 100;
+        int fFillsSinceCheckpoint = 0;
+        bool fLastSkipped = false; // whether the last requested index was skipped as already processed
+
+        Long64_t fRolloverEntries = 0;
+        Long64_t fRolloverBytes = 0;
+        std::string fBaseName = "";          // output name without ".root" when splitting
+        std::vector<std::string> fPartFiles; // all parts written so far, as listed in the manifest
+        bool fPartFailed = false;            // the next part could not be opened, nothing more is written until OpenFile
+
+        /// @brief In resume mode, take over an existing tree and its processed indices; leaves fTree null otherwise
+        bool AttachTree(const char *treeName);
+        /// @brief Fill the current entry, and start the next part when the current one is full
+        /// @return false if the next part cannot be opened (the entry is in the closed part), and for every later entry
+        bool FillTree();
+        bool OpenNextPart();
     };
 
 }
@@ -206,17 +661,144 @@ namespace WFDataProcessor
     class WFtrc2ROOT;
     class WFROOTReader;
 
+    /// @brief Events plotted by WFDataExtractor on the channels with plotting on, an event must pass all conditions
+    struct _plot_policy
+    {
+        int every{1};             // one event in every, counted on the extracted events
+        bool invalid_only{false}; // only waveforms with a non-zero valid flag
+        std::function<bool(int channel, const _waveinfo &winfo)> predicate{}; // empty to accept all
+    };
+
+    /// @brief Draws _plot_job copies into png files on a background thread, so that plotting does not hold up extraction.
+    /// The thread and its batch-mode canvas are created by the first Submit.
+    class WFPlotRenderer
+    {
+    public:
+        /// @param maxPending jobs waiting to be drawn, further jobs are dropped until the thread catches up
+        explicit WFPlotRenderer(size_t maxPending = 256) : fMaxPending(maxPending) {}
+        /// @brief Draws the pending jobs, then stops the thread
+        ~WFPlotRenderer();
+        WFPlotRenderer(const WFPlotRenderer &) = delete;
+        WFPlotRenderer &operator=(const WFPlotRenderer &) = delete;
+
+        /// @brief Queue a job. Its buffers are swapped with those of a job already drawn, so steady-state plotting does not allocate.
+        /// @return false if the queue is full, the job is dropped
+        bool Submit(_plot_job &job);
+        /// @brief Wait until every queued job is saved
+        void Flush();
+
+        size_t GetDrawn() const;
+        size_t GetDropped() const;
+
+    private:
+        void Start();
+        void Run();
+
+        std::once_flag fStarted;
+        std::thread fThread;
+        mutable std::mutex fMutex;
+        std::condition_variable fWake; // a job was queued, or the thread has to stop
+        std::condition_variable fIdle; // the queue was drained
+        std::deque<_plot_job> fPending;
+        std::vector<_plot_job> fRecycled; // drawn jobs, their buffers are handed back by Submit
+        TCanvas *fCanvas = nullptr;       // only used by the thread
+        size_t fMaxPending = 256;
+        size_t fDrawn = 0;
+        size_t fDropped = 0;
+        bool fBusy = false; // the thread is drawing a job taken from the queue
+        bool fStop = false;
+    };
+
+    /// @brief Flight recorder of WFDataExtractor: the last events are kept, and dumped when one of them triggers
+    struct _flight_policy
+    {
+        int capacity{0};                // events kept, 0 to disable
+        std::string prefix{"flight"};   // dumps go to prefix + "_<event>.root"
+        uint32_t valid_mask{0};         // dump when a channel has one of these valid flags (e.g. NO_WAVEFORM | PILEUP), 0 to ignore
+        double amp_above{0};            // mV, dump when the amplitude of a channel exceeds it, 0 to ignore
+        int max_dumps{10};              // triggered dumps per job, later triggers are counted only
+        bool dump_at_end{false};        // dump the last events when the extractor is destroyed
+        std::function<bool(int channel, const _waveinfo &winfo)> trigger{}; // extra trigger condition, empty for none
+    };
+
+    /// @brief One channel of an event kept by WFFlightRecorder. The buffers are only grown, so a slot is overwritten
+    /// without allocating once it has held, or was reserved for, a record of the same length.
+    struct _recorded_channel
+    {
+        int channel = -1;
+        bool has_data = false;
+        _waveinfo winfo{};
+        std::vector<float> samples;  ///  Raw ADC codes, or amplitudes (in V) of records decoded without codes
+        int nsamples = 0;            ///  Samples in use
+        double vertical_gain = 1;    ///  Amplitude (V) = vertical_gain * sample - vertical_offset
+        double vertical_offset = 0;  ///  See vertical_gain
+        double horiz_interval = 0;   ///  Time (s) = i * horiz_interval + horiz_offset
+        double horiz_offset = 0;     ///  See horiz_interval
+    };
+
+    struct _recorded_event
+    {
+        long long event = -1; ///  Extracted event counter, that of the next event for one rejected by SetForceMatch
+        int file_index = -1;  ///  LeCroy waveform index
+        std::vector<_recorded_channel> channels;
+    };
+
+    /// @brief Ring buffer of the last events, for debugging long runs without plotting. Recording an event copies its
+    /// samples into the oldest slot, which is preallocated; the dump decodes the slots into a small ROOT file.
+    class WFFlightRecorder
+    {
+    public:
+        /// @brief Allocate capacity slots, the kept events are dropped
+        void SetCapacity(int capacity);
+        /// @brief Grow every slot to nChannels channels of nSamples samples, so that recording does not allocate
+        void Reserve(int nChannels, int nSamples);
+        int GetCapacity() const { return fSlots.size(); }
+        /// @brief Events kept, at most the capacity
+        int Size() const { return fSize; }
+        /// @brief Kept event i, 0 being the oldest
+        const _recorded_event &Get(int i) const { return fSlots[(fNext + fSlots.size() - fSize + i) % fSlots.size()]; }
+        void Clear() { fSize = 0; }
+
+        /// @brief Slot of the next event, the oldest one once the buffer is full; kept after Commit
+        _recorded_event &NextSlot() { return fSlots[fNext]; }
+        void Commit();
+        /// @brief Copy one record into a channel of a slot
+        static void Record(const ScopeData &data, bool hasData, const _waveinfo &winfo, _recorded_channel &slot);
+
+        /// @brief Write the kept events, oldest first, to a tree "flight" with "event", "file_index", and per channel the
+        /// _waveinfo branches, "chN_has_data", "chN_time" (ns) and "chN_amp" (mV)
+        bool Dump(const std::string &filename) const;
+
+        /// @brief Ask every flight recorder for a dump after its current event. Async-signal-safe.
+        static void RequestDump();
+        /// @brief Call RequestDump on signum (SIGUSR1 by default), e.g. "kill -USR1 <pid>" during a run
+        static bool InstallSignalHandler(int signum = -1);
+        /// @brief Whether RequestDump was called since the last call, for each recorder
+        bool DumpRequested();
+
+    private:
+        std::vector<_recorded_event> fSlots;
+        int fNext = 0; // slot of the next event
+        int fSize = 0;
+        int fRequestsSeen = 0;
+        int fReservedChannels = 0; // every slot holds at least these channels
+        int fReservedSamples = 0;  // and samples per channel
+    };
+
     /// @brief Extract information from a ScopeData object
     class WFDataExtractor : public VMultiChannelWriter<_waveinfo>
     {
     public:
         WFDataExtractor() = default;
         WFDataExtractor(std::vector<int> channelsToRead);
+        ~WFDataExtractor() override;
 
         bool AddChannel(int channel) override;
 
         const std::map<int, _extract_config> &GetExtractConfig() const { return fmChExtractConfig; };
         bool GetExtractConfig(int channel, _extract_config &config) const;
+        /// @brief Search range, threshold, plotting and feature mask of a channel. The feature mask, the pulse finder and the
+        /// multi-threshold levels decide which branches are created, so they must be set before OpenFile.
         bool SetExtractConfig(int channel, _extract_config range);
         int SetExtractConfig(const std::map<int, _extract_config> &chRangeMap);
 
@@ -225,18 +807,112 @@ namespace WFDataProcessor
         bool ExtractFromWFtrc2ROOT(const WFDataProcessor::WFtrc2ROOT &convertor);
         bool ExtractFromWFROOTReader(const WFDataProcessor::WFROOTReader &reader);
 
+        /// @brief Plot the waveforms of a channel to savePrefix + "_counter_<event>.png". The waveform and its features are
+        /// copied to a background renderer, extraction does not wait for the plots (see SetPlotPolicy and FlushPlots).
         bool TurnOnPlot(int channel, const std::string &savePrefix, bool bswitch = true);
         bool TurnOffPlot(int channel) { return TurnOnPlot(channel, "", false); };
         int TurnOnPlots(const std::string &savePrefix = "", bool bswitch = true);
         int TurnOffPlots() { return TurnOnPlots("", false); };
+        /// @brief Events plotted on the channels with plotting on, all of them by default
+        void SetPlotPolicy(const _plot_policy &policy) { fPlotPolicy = policy; }
+        const _plot_policy &GetPlotPolicy() const { return fPlotPolicy; }
+        /// @brief Wait until every queued plot is saved
+        void FlushPlots() { fRenderer.Flush(); }
+        const WFPlotRenderer &GetPlotRenderer() const { return fRenderer; }
+
+        /// @brief Branch layout of the output tree, must be set before OpenFile. A resumed tree keeps its own layout.
+        void SetBranchLayout(WaveInfoLayout layout) { fLayout = layout; }
+        WaveInfoLayout GetBranchLayout() const { return fLayout; }
+
+        /// @brief Let ExtractFromTRCFiles compute the features straight from the raw ADC codes (processWaveRaw),
+        /// without decoding the records to double arrays. Only the events picked for plotting are decoded.
+        void SetDecodeRaw(bool decodeRaw = true) { fDecodeRaw = decodeRaw; }
+        bool GetDecodeRaw() const { return fDecodeRaw; }
+
+        /// @brief Averaged noise spectrum of a channel with _extract_config::noise_spectrum set, nullptr before its first event.
+        /// Covers the events since the output file (or part) was opened. A segment still waiting for its FFT partner is transformed first.
+        const _noise_spectrum *GetNoiseSpectrum(int channel);
+        /// @brief Write the noise spectra into the output file as TH1D "chN_noise_psd" (mV^2/GHz against GHz), called by CloseFile.
+        /// Each part of a split output gets the average of its own events. In a resumed file, the spectrum written by the previous
+        /// job is merged with the new one, weighted by their entries (segments).
+        bool WriteNoiseSpectra();
+        /// @brief Class of the next events for the average pulses (e.g. the index of a scan position), -1 for none.
+        /// The average pulses are kept per channel, class and amplitude class.
+        void SetScanPosition(int position) { fScanPosition = position; }
+        int GetScanPosition() const { return fScanPosition; }
+        /// @brief Average pulse of a channel with _extract_config::pulse_shape set, nullptr if no pulse was averaged
+        /// since the output file (or part) was opened
+        /// @param ampClass index of the amplitude class, see _pulse_shape_config::amp_bins
+        const _average_pulse *GetAveragePulse(int channel, int position = -1, int ampClass = 0) const;
+        /// @brief Write the average pulses into the output file as TH1D "chN_pulse_mean" (errors on the mean) and "chN_pulse_rms",
+        /// with "_posP" and "_ampK" suffixes for scan positions and amplitude classes, called by CloseFile. Each part of a split
+        /// output gets the pulses of its own events. In a resumed file, the pulses written by the previous job are merged with
+        /// the new ones (see MergeAveragePulse).
+        bool WritePulseShapes();
+        void CloseFile() override;
+
+        /// @brief Keep the last policy.capacity events (raw records and _waveinfo of every channel) in a flight recorder,
+        /// dumped when an event triggers, on WFFlightRecorder::RequestDump (e.g. from a signal), on demand, or at the end of the job
+        void SetFlightPolicy(const _flight_policy &policy);
+        const _flight_policy &GetFlightPolicy() const { return fFlightPolicy; }
+        /// @brief Dump the kept events, to policy.prefix + "_<event>.root" if filename is empty
+        bool DumpFlightRecorder(const std::string &filename = "");
+        const WFFlightRecorder &GetFlightRecorder() const { return fFlight; }
+        /// @brief Events that met a trigger condition, dumped or not (see _flight_policy::max_dumps)
+        int GetFlightTriggers() const { return fFlightTriggers; }
 
     private:
         bool InitTree() override;
+        const char *GetTreeName() const override { return "waveinfo"; }
+        /// @brief Create (or bind, for a resumed tree) the per-pulse branches of the channels with the pulse finder on,
+        /// and the multi-threshold branches of the channels with tot_thresholds
+        void InitVectorBranches(bool create);
+        bool IsPlotSelected(int channel, const _waveinfo &winfo) const;
+        /// @brief Copy an extracted waveform to the renderer
+        /// @param record amplitudes the features were extracted from, nullptr for a record only holding raw codes
+        void QueuePlot(const _waveinfo &winfo, ScopeData *chData, const double *record, const _extract_config &config, _wave_workspace &workspace);
+        /// @brief Add the samples before the search range of a record to the noise spectrum of its channel
+        void AccumulateNoise(const ScopeData *chData, bool rawOnly, const _extract_config &config, _noise_spectrum &spectrum);
+        /// @brief Noise spectrum of a channel found in the output file when it was first written to, empty unless resuming
+        const _noise_spectrum &ResumedNoiseSpectrum(int channel);
+        /// @brief Average pulse found in the output file when it was first written to, empty unless resuming or on another grid
+        const _average_pulse &ResumedAveragePulse(const std::tuple<int, int, int> &key, const _pulse_shape_config &shape);
+        /// @brief Add a valid pulse to the average pulse of its channel, scan position and amplitude class
+        /// @param record amplitudes the features were extracted from, nullptr for a record only holding raw codes
+        void AccumulatePulse(int channel, const ScopeData *chData, const double *record, const _waveinfo &winfo, const _extract_config &config,
+                             const _wave_workspace &workspace);
+        /// @brief Config of a channel for the current event, with the search range placed by relative_range
+        const _extract_config &EventConfig(int channel, const std::map<int, bool> &chDataHasDataMap);
+        /// @brief Copy the current event into the flight recorder, and dump it if the event triggers
+        void RecordFlight(const std::map<int, ScopeData *> &chDataMap, const std::map<int, bool> &chDataHasDataMap);
+        bool IsFlightTrigger(int channel, const _waveinfo &winfo) const;
 
         virtual void ClearMap() override;
         int fExtractedCounter = 0;
 
+        WaveInfoLayout fLayout = kScalarBranches;
+        WaveInfoArrayBuffer fArrays; // only used by kFeatureArrays
+
         std::map<int, _extract_config> fmChExtractConfig; // channel -> search range
+        std::map<int, _pulse_list> fmChPulses;            // channel -> pulses of the current event, channels with the pulse finder on
+        std::map<int, _tot_list> fmChTot;                 // channel -> multi-threshold crossings of the current event, channels with tot_thresholds
+        std::map<int, _wave_workspace> fmChWorkspace;     // channel -> processWave buffers and filter/template designs, reused for every event
+        std::map<int, _noise_spectrum> fmChNoise;         // channel -> averaged noise spectrum, channels with noise_spectrum set
+        std::map<int, _noise_spectrum> fmChNoiseResumed;  // channel -> spectrum already in the output file, read once by ResumedNoiseSpectrum
+        std::map<int, _extract_config> fmChEventConfig;   // channel -> config with the search range of the current event, channels with relative_range set
+        std::map<std::tuple<int, int, int>, _average_pulse> fmPulseShapes; // (channel, scan position, amplitude class) -> average pulse
+        std::map<std::tuple<int, int, int>, _average_pulse> fmPulseShapesResumed; // same keys -> pulses already in the output file
+        int fScanPosition = -1;                                            // class of the current events, see SetScanPosition
+
+        _flight_policy fFlightPolicy;
+        WFFlightRecorder fFlight;
+        int fFlightTriggers = 0;
+        int fFlightDumps = 0; // triggered dumps
+        bool fDecodeRaw = false;                          // ExtractFromTRCFiles keeps the raw ADC codes only
+
+        _plot_policy fPlotPolicy;
+        _plot_job fPlotJob; // buffers of the next plot, swapped with those of a drawn one by WFPlotRenderer::Submit
+        WFPlotRenderer fRenderer;
     };
 
     class WFDataTreeReader : public VMultiChannelReader<_waveinfo>
@@ -244,8 +920,30 @@ namespace WFDataProcessor
     public:
         WFDataTreeReader(std::vector<int> channelsToRead) : VMultiChannelReader<_waveinfo>(channelsToRead) {};
 
+        Long64_t GetEntry(Long64_t entry) override;
+        /// @brief Layout of the opened tree, detected from its branches
+        WaveInfoLayout GetBranchLayout() const { return fLayout; }
+
+        /// @brief Only read the given features, names as in GetWaveInfoFields() (e.g. {"toa", "charge"}), empty to read all.
+        /// Other members of _waveinfo are not updated by GetEntry. Can be called before or after OpenFile.
+        /// @return false if a feature name is unknown, it is ignored
+        bool SetActiveFeatures(const std::vector<std::string> &features);
+
+        /// @brief Read entries [first, first + nEntries) of the active channels and features into columns.
+        /// Columns of channels or features that are not active any more are removed, the others keep their capacity.
+        /// @return number of entries read, 0 at the end of the tree
+        Long64_t ReadBatch(Long64_t first, Long64_t nEntries, _waveinfo_columns &columns);
+
     private:
         bool InitTree() override;
+        const char *GetTreeName() const override { return "waveinfo"; }
+        void ApplyBranchStatus() override;
+        std::vector<int> GetActiveFieldIndices() const;
+
+        std::vector<int> fActiveFeatures; // field indices, empty means all features
+
+        WaveInfoLayout fLayout = kScalarBranches;
+        WaveInfoArrayBuffer fArrays; // only used by kFeatureArrays
     };
 
     /// @brief Convert LeCroy .trc waveform files into ROOT TTree format, supporting multiple channels and optional channel matching.
@@ -260,6 +958,7 @@ namespace WFDataProcessor
 
     private:
         bool InitTree() override;
+        const char *GetTreeName() const override { return "waveform"; }
     };
 
     class WFROOTReader : public VMultiChannelReader<ScopeData *>
@@ -267,11 +966,24 @@ namespace WFDataProcessor
     public:
         WFROOTReader(std::vector<int> channelsToRead) : VMultiChannelReader<ScopeData *>(channelsToRead) {};
 
+        /// @brief Whether to read the file metadata of ScopeData (instrument, coupling, trigger time...), only x, y
+        /// and the scaling factors are read when false. Can be called before or after OpenFile.
+        void SetReadMetadata(bool readMetadata)
+        {
+            fReadMetadata = readMetadata;
+            if (fTree)
+                ApplyBranchStatus();
+        }
+
     private:
         bool InitTree() override;
+        const char *GetTreeName() const override { return "waveform"; }
+        void ApplyBranchStatus() override;
+
+        bool fReadMetadata = true;
     };
 
-    int ConvertAllTRC(std::string sWriteFile, std::string sDataFolder, int maxFiles);
+    int ConvertAllTRC(std::string sWriteFile, std::string sDataFolder, int maxFiles, bool resume = false);
     void ConvertAllTRC();
     std::string ExtractLastDir(const std::string &path);
 
@@ -376,7 +1088,7 @@ namespace WFDataProcessor
     template <typename T>
     inline bool VMultiIO<T>::InitTree()
     {
-        if (!fFile)
+        if (!fFile && !fChain)
             return false;
         if (fTree)
         {
@@ -389,8 +1101,7 @@ namespace WFDataProcessor
     template <typename T>
     inline VMultiIO<T> *&VMultiIO<T>::CurrentInstance()
     {
-        // TODO: insert return statement here
-        static VMultiIO<T> *instance = nullptr;
+        static thread_local VMultiIO<T> *instance = nullptr;
         return instance;
     }
 
@@ -435,16 +1146,31 @@ namespace WFDataProcessor
     template <typename T>
     inline bool VMultiIO<T>::OpenFile(const std::string &filename)
     {
-        if (fFile)
+        if (fFile || fChain)
         {
             std::cerr << "File already opened. Close it before opening a new file." << std::endl;
             return false;
         }
 
+        if (fIsRead && IsChainManifest(filename))
+        {
+            std::string treeName;
+            std::vector<std::string> files;
+            if (!ReadChainManifest(filename, treeName, files) || treeName != GetTreeName())
+            {
+                std::cerr << "Invalid chain manifest: " << filename << std::endl;
+                return false;
+            }
+            fChain = new TChain(treeName.c_str());
+            for (const auto &file : files)
+                fChain->Add(file.c_str());
+            return InitTree();
+        }
+
         if (fIsRead)
             fFile = TFile::Open(filename.c_str());
         else
-            fFile = TFile::Open(filename.c_str(), "RECREATE");
+            fFile = TFile::Open(filename.c_str(), fResume ? "UPDATE" : "RECREATE");
 
         if (!fFile || fFile->IsZombie())
             return false;
@@ -455,12 +1181,18 @@ namespace WFDataProcessor
     template <typename T>
     inline void VMultiIO<T>::CloseFile()
     {
+        if (fChain)
+        {
+            delete fChain;
+            fChain = nullptr;
+            fTree = nullptr;
+        }
         if (fFile)
         {
             if (fTree && fFile->IsWritable())
             {
                 fFile->cd();
-                fTree->Write();
+                fTree->Write("", TObject::kOverwrite);
             }
 
             fFile->Close();
@@ -469,5 +1201,134 @@ namespace WFDataProcessor
             fTree = nullptr;
         }
     }
+
+    template <typename T>
+    inline void VMultiChannelWriter<T>::SetRollover(Long64_t maxEntries, Long64_t maxBytes)
+    {
+        if (this->fFile)
+        {
+            std::cerr << "Cannot change output rollover after the file has been opened." << std::endl;
+            return;
+        }
+        fRolloverEntries = maxEntries > 0 ? maxEntries : 0;
+        fRolloverBytes = maxBytes > 0 ? maxBytes : 0;
+    }
+
+    template <typename T>
+    inline bool VMultiChannelWriter<T>::OpenFile(const std::string &filename)
+    {
+        fProcessedIndices.clear();
+        fFillsSinceCheckpoint = 0;
+        fPartFiles.clear();
+        fPartFailed = false;
+        if (!IsRollover())
+            return VMultiIO<T>::OpenFile(filename);
+        if (this->fFile)
+        {
+            std::cerr << "File already opened. Close it before opening a new file." << std::endl;
+            return false;
+        }
+
+        fBaseName = filename;
+        if (fBaseName.size() > 5 && fBaseName.compare(fBaseName.size() - 5, 5, ".root") == 0)
+            fBaseName.erase(fBaseName.size() - 5);
+
+        // Resuming a split output: keep the existing parts untouched, collect their indices and continue with a new part
+        std::string treeName;
+        if (this->fResume && ReadChainManifest(GetManifestName(), treeName, fPartFiles))
+        {
+            for (const auto &part : fPartFiles)
+            {
+                auto file = TFile::Open(part.c_str());
+                auto tree = (file && !file->IsZombie()) ? (TTree *)file->Get(this->GetTreeName()) : nullptr;
+                if (tree && !ReadProcessedIndices(tree, fProcessedIndices))
+                    std::cerr << "Part " << part << " has no file_index branch, its entries cannot be skipped." << std::endl;
+                delete file;
+            }
+            std::cout << "Resuming split output " << GetManifestName() << " with " << fPartFiles.size() << " parts and "
+                      << fProcessedIndices.size() << " processed waveforms." << std::endl;
+        }
+        return OpenNextPart();
+    }
+
+    template <typename T>
+    inline bool VMultiChannelWriter<T>::OpenNextPart()
+    {
+        std::string partName = Form("%s_%04d.root", fBaseName.c_str(), (int)fPartFiles.size());
+        fPartFiles.push_back(partName);
+        if (!WriteChainManifest(GetManifestName(), this->GetTreeName(), fPartFiles))
+            std::cerr << "Failed to write chain manifest " << GetManifestName() << std::endl;
+        return VMultiIO<T>::OpenFile(partName);
+    }
+
+    template <typename T>
+    inline bool VMultiChannelWriter<T>::AttachTree(const char *treeName)
+    {
+        if (!this->fResume)
+            return true;
+
+        auto tree = (TTree *)this->fFile->Get(treeName);
+        if (!tree)
+            return true; // Nothing to resume, a new tree will be created
+
+        if (!ReadProcessedIndices(tree, fProcessedIndices))
+        {
+            std::cerr << "Cannot resume tree \"" << treeName << "\": no file_index branch found." << std::endl;
+            return false;
+        }
+        this->fTree = tree;
+        this->fTree->SetBranchAddress("file_index", &this->fFileIndex);
+
+        auto checkpoint = (TParameter<int> *)this->fFile->Get("checkpoint");
+        std::cout << "Resuming tree \"" << treeName << "\" with " << fProcessedIndices.size() << " processed waveforms";
+        if (checkpoint)
+            std::cout << ", last checkpoint at index " << checkpoint->GetVal();
+        std::cout << std::endl;
+        return true;
+    }
+
+    template <typename T>
+    inline bool VMultiChannelWriter<T>::FillTree()
+    {
+        if (fPartFailed)
+            return false;
+        if (!this->fTree)
+            return true;
+        this->fTree->Fill();
+        fProcessedIndices.insert(this->fFileIndex);
+
+        if (fCheckpointInterval > 0 && ++fFillsSinceCheckpoint >= fCheckpointInterval)
+            Checkpoint();
+
+        // Start a new part once the current one is full, the compressed size only counts flushed baskets
+        bool full = (fRolloverEntries > 0 && this->fTree->GetEntries() >= fRolloverEntries) ||
+                    (fRolloverBytes > 0 && this->fTree->GetZipBytes() >= fRolloverBytes);
+        if (IsRollover() && full)
+        {
+            this->CloseFile();
+            fFillsSinceCheckpoint = 0;
+            if (!OpenNextPart())
+            {
+                std::cerr << "Cannot open output part " << fPartFiles.back() << ", the following events are not written." << std::endl;
+                fPartFailed = true;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename T>
+    inline bool VMultiChannelWriter<T>::Checkpoint()
+    {
+        if (!this->fTree || !this->fFile || !this->fFile->IsWritable())
+            return false;
+        fFillsSinceCheckpoint = 0;
+
+        this->fFile->cd();
+        this->fTree->AutoSave("SaveSelf");
+        TParameter<int> checkpoint("checkpoint", this->fFileIndex);
+        checkpoint.Write("checkpoint", TObject::kOverwrite);
+        return true;
+    }
 }
 #endif // WFDataConverter_H
\ No newline at end of file
@@ -0,0 +1,150 @@
+#ifndef WFEventStore_H
+#define WFEventStore_H
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <cstdint>
+
+class ScopeData;
+
+namespace WFDataProcessor
+{
+    class WFtrc2ROOT;
+
+    /// @brief Layout of the flat event store, all values in host byte order.
+    ///
+    /// [_flat_file_header][event 0][event 1]...[event N-1][uint64 offset index x N][_flat_file_trailer]
+    /// Each event has a fixed size: [_flat_event_header][channel block x nChannels],
+    /// and each channel block is [_flat_channel_header][int16 codes x nSamples][padding to 8 bytes].
+    /// The offset index and trailer are written by CloseFile, a file without them (interrupted job) is
+    /// still readable since every event has the same stride.
+    namespace FlatStore
+    {
+        constexpr char kMagic[8] = {'L', 'C', 'F', 'L', 'A', 'T', '0', '1'};
+        constexpr uint32_t kVersion = 1;
+        constexpr int kMaxChannels = 16;
+
+        struct _flat_file_header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t nChannels;
+            uint32_t nSamples;
+            uint32_t channelBlockSize; // bytes per channel block, including header and padding
+            uint64_t headerSize;       // bytes before the first event
+            uint64_t eventSize;        // bytes per event, i.e. the fixed stride
+            double horizInterval;      // sampling interval (in s)
+            int32_t channels[kMaxChannels];
+        };
+
+        struct _flat_event_header
+        {
+            int32_t file_index; // LeCroy waveform index
+            uint32_t hasData;   // bit i set if channel i (in header order) has data
+        };
+
+        struct _flat_channel_header
+        {
+            float verticalGain; // volts = verticalGain * code - verticalOffset
+            float verticalOffset;
+            double horizOffset; // time of first sample (in s), changes with the trigger of each event
+        };
+
+        struct _flat_file_trailer
+        {
+            uint64_t indexOffset; // position of the offset index
+            uint64_t nEvents;
+            char magic[8];
+        };
+    }
+
+    /// @brief Zero-copy view of one waveform inside a memory-mapped flat event store
+    struct _waveform_view
+    {
+        const int16_t *codes = nullptr; // raw ADC codes, points into the mapped file
+        int nsamples = 0;
+        float verticalGain = 0;
+        float verticalOffset = 0;
+        double horizInterval = 0;
+        double horizOffset = 0;
+
+        double Volt(int i) const { return verticalGain * codes[i] - verticalOffset; }
+        double Time(int i) const { return i * horizInterval + horizOffset; }
+        bool IsValid() const { return codes != nullptr && nsamples > 0; }
+    };
+
+    /// @brief Write LeCroy waveforms into a flat, fixed-stride binary file for O(1) random access.
+    /// All channels must have the same number of samples and sampling interval, set by the first event.
+    class WFFlatWriter
+    {
+    public:
+        WFFlatWriter(std::vector<int> channelsToWrite);
+        ~WFFlatWriter();
+        WFFlatWriter(const WFFlatWriter &) = delete;
+        WFFlatWriter &operator=(const WFFlatWriter &) = delete;
+
+        bool OpenFile(const std::string &filename);
+        void CloseFile();
+
+        /// @brief Append one event, the header is written with the first event
+        /// @return false if the event does not match the record length of the file
+        bool Fill(const std::map<int, ScopeData *> &chDataMap, const std::map<int, bool> &chDataHasDataMap, int file_index);
+        /// @brief Read the raw ADC codes of one waveform index from the .trc files and append them unchanged
+        bool FillFromTRCFiles(const std::string &folder, int idx_file, std::string mid_name = "--Trace--", std::string ext = ".trc");
+        /// @brief Append the records of a converter, the codes are recovered from the decoded amplitudes
+        bool FillFromWFtrc2ROOT(const WFtrc2ROOT &convertor);
+
+        long long GetEntries() const { return (long long)fOffsets.size(); }
+
+    private:
+        bool WriteHeader(int nSamples, double horizInterval);
+
+        std::vector<int> fChannels;
+        std::ofstream fOut;
+        std::string fFileName = "";
+        FlatStore::_flat_file_header fHeader{};
+        bool fHeaderWritten = false;
+        std::vector<uint64_t> fOffsets;  // event offsets, written as index on CloseFile
+        std::vector<char> fEventBuffer; // one event, reused for every Fill
+        std::map<int, ScopeData *> fmChRecord; // records read by FillFromTRCFiles, reused for every event
+        std::map<int, bool> fmChRecordHasData;
+    };
+
+    /// @brief Memory-mapped reader of the flat event store, waveforms are returned as views without copy
+    class WFFlatReader
+    {
+    public:
+        WFFlatReader() = default;
+        ~WFFlatReader();
+        WFFlatReader(const WFFlatReader &) = delete;
+        WFFlatReader &operator=(const WFFlatReader &) = delete;
+
+        bool OpenFile(const std::string &filename);
+        void CloseFile();
+
+        long long GetEntries() const { return fNEvents; }
+        int GetNChannels() const { return fHeader ? (int)fHeader->nChannels : 0; }
+        int GetNSamples() const { return fHeader ? (int)fHeader->nSamples : 0; }
+        double GetHorizInterval() const { return fHeader ? fHeader->horizInterval : 0; }
+        const std::vector<int> &GetChannels() const { return fChannels; }
+
+        /// @brief Get the waveform of a channel in an event, O(1) and without copy
+        /// @return false if the event or channel does not exist, or the channel has no data in this event
+        bool GetWaveform(long long evt, int channel, _waveform_view &view) const;
+        int GetFileIndex(long long evt) const;
+
+    private:
+        const char *EventPointer(long long evt) const;
+
+        const char *fData = nullptr;
+        size_t fSize = 0;
+        const FlatStore::_flat_file_header *fHeader = nullptr;
+        const uint64_t *fIndex = nullptr; // nullptr if the file has no trailer, fixed stride is used instead
+        long long fNEvents = 0;
+        std::vector<int> fChannels;
+        std::map<int, int> fmChannelSlot; // channel -> position inside an event
+    };
+}
+
+#endif // WFEventStore_H
@@ -0,0 +1,727 @@
+#ifndef WFKernels_H
+#define WFKernels_H
+
+#include "WFDataConverter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace WFDataProcessor
+{
+    /// @brief Find the samples bounding the search range, same definition as processWaveReference:
+    /// up is the sample where the time first reaches range.first, down the one where it reaches range.second.
+    /// If the range is never crossed, up = 0 and down = Nsamples - 1.
+    /// Time must increase monotonically, which holds for every LeCroy record. Uniformly sampled records
+    /// take O(1), the index is computed from the sampling interval; others fall back to a binary search.
+    /// @param t Time array (in seconds)
+    /// @param range search range (in ns)
+    void FindSearchWindow(const double *t, int Nsamples, const _signal_range &range, int &sample_up, int &sample_down);
+
+    /// @brief Set the fields left out of a feature mask to kFeatureSkipped, and clear the NO_*_FOUND flags
+    /// of crossings no selected field depends on. Every kernel applies it when _extract_config::features
+    /// is not kAllFeatures, after skipping the passes and scans the selected fields do not need.
+    void ApplyFeatureMask(_waveinfo &winfo, uint32_t features);
+
+    /// @brief Fused version of processWave, gives the same _waveinfo without the unit-converted copies.
+    /// Start pedestal, window extrema and charge, and end pedestal are accumulated in one pass over three
+    /// consecutive sample ranges, with units applied per sample. The peak-relative features (±2 ns charge,
+    /// t1/t2, 10/50/90% crossings and charges) are found by local scans starting at the peak.
+    /// With a feature mask, the end pedestal, window, ±2 ns and crossing work of unselected fields is skipped.
+    /// The reductions use the instruction set selected in WFSimd.h, bit-identical only at Simd::kScalar.
+    /// Time must increase monotonically, plotting is not supported (see processWaveReference).
+    void processWaveFused(const double *t, const double *a, int Nsamples, _waveinfo &winfo, const _extract_config &config, _wave_workspace &workspace);
+
+    /// @brief Affine conversion of raw samples, as in a LeCroy record:
+    /// amplitude (V) = vertical_gain * code - vertical_offset, time (s) = i * horiz_interval + horiz_offset
+    struct _sample_scale
+    {
+        double vertical_gain = 1;
+        double vertical_offset = 0;
+        double horiz_interval = 0;
+        double horiz_offset = 0;
+    };
+
+    /// @brief Scale of the raw ADC codes of a record
+    _sample_scale GetSampleScale(const ScopeData &data);
+
+    /// @brief processWave on raw samples with an implicit time axis, without converting the record to ns and mV.
+    /// Thresholds are converted to sample units once per waveform, comparisons and sums run on the codes
+    /// (64-bit integer sums for integer samples), and only the final features are scaled.
+    /// Results agree with processWaveFused on the decoded record within its float precision (ScopeData decodes
+    /// amplitudes in single precision).
+    /// Instantiated for int8_t, int16_t, float and double samples. A non-positive gain or interval falls back to
+    /// decoding into workspace.decoded and processWave with the same workspace, which then holds the pulse and
+    /// crossing lists as usual. The filter stage runs on the codes, into the workspace.
+    /// @param codes raw samples
+    /// @param scale conversion of samples and indices to volts and seconds
+    template <typename S>
+    void processWaveRaw(const S *codes, int Nsamples, const _sample_scale &scale, _waveinfo &winfo, const _extract_config &config, _wave_workspace &workspace);
+
+    /// @brief processWaveRaw on the ADC codes of a record read by ScopeData::InitRawData
+    void processWaveRaw(const ScopeData &data, _waveinfo &winfo, const _extract_config &config, _wave_workspace &workspace);
+
+    /// @brief Coefficients of a filter configuration for a sampling interval, kept if the design already matches,
+    /// so that steady-state extraction does not allocate
+    /// @return false if the configuration is invalid, the design then applies no filter
+    bool DesignFilter(const _filter_config &config, double dt_ns, _filter_design &design);
+
+    /// @brief Filter stage on one record, y[i] in the units of x[i]. Samples outside the record repeat the first
+    /// and last ones. The FIR filters run through Simd::FIR; raw codes are converted in blocks that stay
+    /// in cache, without a decoded copy of the record.
+    /// Instantiated for int8_t, int16_t, float and double samples.
+    /// @param y output, Nsamples values, must not overlap x
+    template <typename S>
+    void FilterRecord(const S *x, int Nsamples, const _filter_design &design, double *y);
+
+    /// @brief Filter stage on the sample-major records of a batch slot (see _wave_batch), same result as
+    /// FilterRecord on each event, vectorized across events (including the recursive IIR)
+    void FilterRows(const double *x, int nEvents, int Nsamples, const _filter_design &design, double *y);
+
+    /// @brief Equal-length records of nEvents events for several channels, input of processWaveBatch.
+    /// Within a channel the samples are stored sample-major, so that the same sample of consecutive events
+    /// is contiguous and the per-sample work vectorizes across events. All events of a channel share one time axis.
+    struct _wave_batch
+    {
+        std::vector<int> channels; ///  Channel number of each slot
+        int nEvents = 0;           ///  Number of events in the batch
+        int nSamples = 0;          ///  Number of samples of every record
+        std::vector<double> t;     ///  Time axis of slot s at t[s * nSamples + i] (in s)
+        std::vector<double> a;     ///  Sample i of event e in slot s at a[(s * nSamples + i) * nEvents + e] (in V)
+
+        /// @brief Set the shape, the buffers are only grown
+        void Resize(const std::vector<int> &channelList, int events, int samples);
+        /// @brief Copy one record into the batch, t is only taken from the first event
+        void SetRecord(int slot, int event, const double *time, const double *amplitude);
+    };
+
+    /// @brief processWave on every record of a batch, results in columns named as in GetWaveInfoFields(),
+    /// one value per event (the same layout as WFDataTreeReader::ReadBatch).
+    /// Pedestals and window extrema/charge do not depend on the waveform shape and run across events,
+    /// the peak-relative scans run per event. Bit-identical to processWaveFused at Simd::kScalar; at vector levels
+    /// the sums across events are ordered differently from those along each record, and agree within rounding.
+    /// Channels with plotting on, a robust pedestal, the pulse finder or a non-monotonic time axis go through
+    /// processWave event by event, so that valid has the same flags (PILEUP) as in processWaveFused.
+    /// The filter stage of a channel is applied to the whole slot first (FilterRows).
+    /// Only columns are returned: the pulse lists and multi-threshold crossings of the events are not kept.
+    /// @param configs extraction configuration of every channel of the batch
+    /// @return false if a channel has no configuration
+    bool processWaveBatch(const _wave_batch &batch, const std::map<int, _extract_config> &configs, _waveinfo_columns &columns, _wave_workspace &workspace);
+
+    /// @brief Precomputed interpolation filter of a method other than linear. The value at i + p / kPhases,
+    /// p in [0, kPhases], is the sum of coef[p * taps + k] * x[i - taps / 2 + 1 + k] over the taps.
+    /// Both methods reproduce the samples at p = 0 and p = kPhases.
+    struct _interp_table
+    {
+        static constexpr int kPhases = 256; ///  Tabulated fractional positions per sample interval
+        int taps = 0;                       ///  Samples per position
+        std::vector<double> coef;           ///  (kPhases + 1) * taps coefficients, each phase sums to 1
+
+        /// @brief Interpolated value at i + p / kPhases, sample indices clamped to [lowest, highest]
+        /// @param amp callable, value of sample j
+        template <typename Amp>
+        double Value(int lowest, int highest, int i, int p, Amp amp) const
+        {
+            const double *c = coef.data() + static_cast<size_t>(p) * taps;
+            double sum = 0;
+            for (int k = 0, j = i - taps / 2 + 1; k < taps; k++, j++)
+                sum += c[k] * amp(std::min(std::max(j, lowest), highest));
+            return sum;
+        }
+    };
+
+    /// @brief Table of an interpolation method, built on first use, nullptr for kLinearInterpolation
+    const _interp_table *GetInterpolationTable(InterpolationMethod method);
+
+    /// @brief Fraction u in [0, 1] of the sample interval [i, i + 1] where the interpolated record crosses level,
+    /// amp(i) and amp(i + 1) being on either side of it. Bisection over the tabulated phases, then linear
+    /// between the two bracketing phases: log2(kPhases) evaluations of table.taps samples per crossing.
+    template <typename Amp>
+    double RefineCrossing(const _interp_table &table, int lowest, int highest, int i, double level, Amp amp)
+    {
+        int low = 0, high = _interp_table::kPhases;
+        double v_low = amp(i) - level, v_high = amp(i + 1) - level;
+        if (v_low == v_high)
+            return 0;
+        const bool rising = v_low < v_high;
+        while (high - low > 1)
+        {
+            const int mid = (low + high) / 2;
+            const double v_mid = table.Value(lowest, highest, i, mid, amp) - level;
+            if ((v_mid < 0) == rising)
+            {
+                low = mid;
+                v_low = v_mid;
+            }
+            else
+            {
+                high = mid;
+                v_high = v_mid;
+            }
+        }
+        const double step = v_high - v_low;
+        const double frac = step != 0 ? -v_low / step : 0;
+        return (low + std::min(std::max(frac, 0.0), 1.0)) / _interp_table::kPhases;
+    }
+
+    /// @brief Delay of the constant-fraction discriminator in whole samples, at least one
+    inline int CFDDelaySamples(double delay_ns, double dt_ns)
+    {
+        return dt_ns > 0 ? std::max(1, static_cast<int>(std::lround(delay_ns / dt_ns))) : 1;
+    }
+
+    /// @brief Search range of an event from the toa of the reference channel, see _relative_range
+    /// @param reference_toa toa of the reference channel in this event (in ns), -100e9 if not found
+    /// @return the fixed search_range if the reference has no toa or the window is empty
+    inline _signal_range RelativeSearchRange(const _extract_config &config, double reference_toa)
+    {
+        const _relative_range &relative = config.relative_range;
+        if (!(reference_toa > -100e9) || !(relative.width > 0))
+            return config.search_range;
+        return _signal_range(reference_toa + relative.offset, reference_toa + relative.offset + relative.width);
+    }
+
+    /// @brief Digital constant-fraction discriminator over samples [first, last], in one forward pass.
+    /// The CFD signal is cfd(i) = fraction * x(i) - x(i - delay), with x the amplitude relative to the pedestal
+    /// and x = 0 before the record. It is armed once cfd exceeds fraction * arm_level (i.e. the leading edge
+    /// rose above about arm_level), and the time is its next crossing of zero, linear between the two samples.
+    /// Each sample is read once as is and once delayed, so the discriminator can follow any per-sample
+    /// transformation (decoding, filtering) given as amp.
+    /// @param amp callable, amplitude of sample i relative to the pedestal, in any unit proportional to arm_level
+    /// @param time_ns callable, time of sample i (in ns)
+    /// @param result zero-crossing time (in ns), untouched if not found
+    /// @param table interpolation of the CFD signal around the crossing, linear if nullptr
+    /// @return whether a crossing was found
+    template <typename Amp, typename TimeNs>
+    bool CFDCrossing(int first, int last, int delay, double fraction, double arm_level, Amp amp, TimeNs time_ns, double &result, const _interp_table *table = nullptr)
+    {
+        auto signal = [&](int i)
+        { return fraction * amp(i) - (i - delay >= 0 ? amp(i - delay) : 0.0); };
+        bool armed = false;
+        double previous = 0;
+        for (int i = first; i <= last; i++)
+        {
+            const double cfd = signal(i);
+            if (armed && cfd <= 0)
+            {
+                const double t_before = time_ns(i - 1), t_after = time_ns(i);
+                const double u = table ? RefineCrossing(*table, first, last, i - 1, 0.0, signal) : previous / (previous - cfd);
+                result = t_before + (t_after - t_before) * u;
+                return true;
+            }
+            armed |= cfd > fraction * arm_level;
+            previous = cfd;
+        }
+        return false;
+    }
+
+    /// @brief Pulse finder over samples [first, last] in one forward pass, see _pulse_list. Each sample is compared
+    /// once with the threshold and the running peak and valley; the 50% crossing of a pulse is then found by
+    /// walking back from its peak along the leading edge, never before the end of the previous pulse.
+    /// After a pulse the finder re-arms only below half the threshold, or after a rise of half the threshold above
+    /// the lowest sample since, so noise on a tail near the threshold does not start new pulses.
+    /// Crossings are linear between samples. A pulse still above threshold at last ends there.
+    /// @param threshold pulse threshold, in the unit of amp (in mV)
+    /// @param dt sampling interval (in ns)
+    /// @param amp callable, amplitude of sample i relative to the pedestal (in mV)
+    /// @param time_ns callable, time of sample i (in ns)
+    /// @param pulses [out] cleared, then one entry per pulse
+    /// @return number of pulses found
+    template <typename Amp, typename TimeNs>
+    int FindPulses(int first, int last, double threshold, double dt, Amp amp, TimeNs time_ns, _pulse_list &pulses)
+    {
+        pulses.Clear();
+        // Time where the record crosses level between samples i - 1 and i
+        auto cross = [&](int i, double level)
+        {
+            const double a_before = amp(i - 1), a_after = amp(i);
+            const double t_before = time_ns(i - 1), t_after = time_ns(i);
+            return a_after != a_before ? t_before + (t_after - t_before) * (level - a_before) / (a_after - a_before) : t_after;
+        };
+
+        bool in_pulse = false, falling = false, armed = true;
+        int low = first; // first sample the leading edge of the current pulse may reach back to
+        int peak = first, valley = first;
+        double peak_amp = 0, valley_amp = 0, sum = 0, sum_valley = 0, t_start = 0, rest = 0;
+        auto close = [&](double t_end, double pulse_sum)
+        {
+            const double half = 0.5 * peak_amp;
+            int j = peak;
+            while (j > low && amp(j - 1) > half)
+                j--;
+            pulses.amp.push_back(peak_amp);
+            pulses.toa.push_back(j > low ? cross(j, half) : time_ns(j));
+            pulses.charge.push_back(pulse_sum * dt);
+            pulses.width.push_back(t_end - t_start);
+        };
+
+        for (int i = first; i <= last; i++)
+        {
+            double v = amp(i);
+            if (!in_pulse)
+            {
+                if (armed)
+                {
+                    // Baseline, only compared with the threshold
+                    while (!(v > threshold) && i < last)
+                        v = amp(++i);
+                }
+                else
+                {
+                    rest = std::min(rest, v);
+                    armed = v < 0.5 * threshold || v > rest + 0.5 * threshold;
+                }
+                if (!armed || !(v > threshold))
+                    continue;
+                in_pulse = true;
+                falling = false;
+                peak = i;
+                peak_amp = v;
+                sum = 0;
+                t_start = i > first ? cross(i, threshold) : time_ns(i);
+            }
+            else if (!(v > threshold))
+            {
+                close(cross(i, threshold), sum);
+                in_pulse = false;
+                armed = v < 0.5 * threshold;
+                rest = v;
+                low = i;
+                continue;
+            }
+
+            sum += v;
+            if (falling)
+            {
+                if (v < valley_amp)
+                {
+                    valley = i;
+                    valley_amp = v;
+                    sum_valley = sum;
+                }
+                else if (v > valley_amp + threshold)
+                {
+                    // A second pulse rising on the tail of the first one
+                    close(time_ns(valley), sum_valley);
+                    low = valley;
+                    t_start = time_ns(valley);
+                    sum -= sum_valley;
+                    peak = i;
+                    peak_amp = v;
+                    falling = false;
+                }
+            }
+            else if (v > peak_amp)
+            {
+                peak = i;
+                peak_amp = v;
+            }
+            else if (v < peak_amp - threshold)
+            {
+                falling = true;
+                valley = i;
+                valley_amp = v;
+                sum_valley = sum;
+            }
+        }
+        if (in_pulse)
+            close(time_ns(last), sum);
+        return pulses.Size();
+    }
+
+    /// @brief Crossings of ascending levels on both sides of the peak, see _tot_list. Each side is walked once from the
+    /// peak outwards, keeping the highest level not crossed yet: the levels crossed between two samples are resolved
+    /// together, and the walk stops once the lowest level is crossed. The cost is the samples walked plus the levels.
+    /// As for t1 and t2, a level is crossed at the first sample below it, interpolated towards the peak.
+    /// @param first,last samples the walks may reach, samples outside are not read
+    /// @param peak sample of the maximum
+    /// @param levels ascending, in the unit of amp (in mV)
+    /// @param amp callable, amplitude of sample i relative to the pedestal
+    /// @param time_ns callable, time of sample i (in ns)
+    /// @param tot [out] one entry per level
+    /// @param table interpolation of the crossings, linear if nullptr
+    template <typename Amp, typename TimeNs>
+    void MultiThresholdCrossings(int first, int last, int peak, const std::vector<double> &levels, Amp amp, TimeNs time_ns, _tot_list &tot,
+                                 const _interp_table *table = nullptr)
+    {
+        const double not_found = -100e9;
+        const int n = levels.size();
+        tot.t_lead.assign(n, not_found);
+        tot.t_trail.assign(n, not_found);
+        tot.tot.assign(n, not_found);
+        if (n == 0 || peak < first || peak > last)
+            return;
+
+        // Levels at or above the peak are never crossed
+        const int top = static_cast<int>(std::lower_bound(levels.begin(), levels.end(), amp(peak)) - levels.begin()) - 1;
+        // Time where the record crosses level between samples i and i + 1
+        auto cross = [&](int i, double level)
+        {
+            double u;
+            if (table)
+                u = RefineCrossing(*table, first, last, i, level, amp);
+            else
+            {
+                const double a_before = amp(i), a_after = amp(i + 1);
+                u = (level - a_before) / (a_after - a_before);
+            }
+            return time_ns(i) + (time_ns(i + 1) - time_ns(i)) * u;
+        };
+        int k = top;
+        for (int i = peak - 1; k >= 0 && i >= first; i--)
+        {
+            const double v = amp(i);
+            for (; k >= 0 && v < levels[k]; k--)
+                tot.t_lead[k] = cross(i, levels[k]);
+        }
+        k = top;
+        for (int i = peak + 1; k >= 0 && i <= last; i++)
+        {
+            const double v = amp(i);
+            for (; k >= 0 && v < levels[k]; k--)
+                tot.t_trail[k] = cross(i - 1, levels[k]);
+        }
+        for (int j = 0; j <= top; j++)
+            if (tot.t_lead[j] != not_found && tot.t_trail[j] != not_found)
+                tot.tot[j] = tot.t_trail[j] - tot.t_lead[j];
+    }
+
+    /// @brief Moves the k-th smallest of b[0, n) to b[k], smaller values before it and larger ones after, as std::nth_element.
+    /// Quickselect with a median-of-three pivot and a three-way partition that swaps on every sample and advances on the
+    /// comparison, so noise-like data do not pay a mispredicted branch per sample. Runs of equal values end the search.
+    inline void SelectKth(double *b, int n, int k)
+    {
+        int lo = 0, hi = n - 1;
+        while (lo < hi)
+        {
+            const double x = b[lo], y = b[lo + (hi - lo) / 2], z = b[hi];
+            const double pivot = std::max(std::min(x, y), std::min(std::max(x, y), z));
+            int less = lo;
+            for (int j = lo; j <= hi; j++)
+            {
+                const double v = b[j];
+                b[j] = b[less];
+                b[less] = v;
+                less += v < pivot;
+            }
+            if (k < less)
+            {
+                hi = less - 1;
+                continue;
+            }
+            int equal = less;
+            for (int j = less; j <= hi; j++)
+            {
+                const double v = b[j];
+                b[j] = b[equal];
+                b[equal] = v;
+                equal += !(pivot < v);
+            }
+            if (k < equal)
+                return;
+            lo = equal;
+        }
+    }
+
+    /// @brief Median of a sliding window with two indexed heaps, the lower half in a max-heap and the upper half in a
+    /// min-heap. Samples sit in window slots (sample index modulo the window), and every slot knows its position in
+    /// its heap, so the sample leaving the window is removed directly: insertions and removals are O(log window).
+    /// The buffers are owned by the caller and only grown, a running median does not allocate in the steady state.
+    struct _running_median
+    {
+        double *value = nullptr; ///  Value of each slot
+        int *low = nullptr;      ///  Max-heap of the slots of the lower half, one more than high for an odd count
+        int *high = nullptr;     ///  Min-heap of the slots of the upper half
+        int *where = nullptr;    ///  Position of each slot, p in low or ~p in high
+        int n_low = 0;
+        int n_high = 0;
+
+        /// @brief Empty median of at most capacity slots, values needs capacity doubles and slots 3 * capacity ints
+        void Reset(int capacity, std::vector<double> &values, std::vector<int> &slots)
+        {
+            if ((int)values.size() < capacity)
+                values.resize(capacity);
+            if ((int)slots.size() < 3 * capacity)
+                slots.resize(3 * capacity);
+            value = values.data();
+            low = slots.data();
+            high = low + capacity;
+            where = high + capacity;
+            n_low = 0;
+            n_high = 0;
+        }
+        int Size() const { return n_low + n_high; }
+        /// @brief Middle value, or mean of the two middle values for an even count; Size() must be positive
+        double Median() const { return n_low > n_high ? value[low[0]] : 0.5 * (value[low[0]] + value[high[0]]); }
+
+        void Insert(int slot, double x)
+        {
+            value[slot] = x;
+            if (n_low == 0 || !(x > value[low[0]]))
+                Push(low, n_low, slot, true);
+            else
+                Push(high, n_high, slot, false);
+            Balance();
+        }
+        /// @brief Remove the value of a slot and insert x into it, in place when x stays in the same half
+        void Replace(int slot, double x)
+        {
+            const int pos = where[slot];
+            const bool inLow = pos >= 0;
+            if (inLow ? (n_high == 0 || !(x > value[high[0]])) : !(x < value[low[0]]))
+            {
+                int *heap = inLow ? low : high;
+                value[slot] = x;
+                SiftDown(heap, inLow ? n_low : n_high, SiftUp(heap, inLow ? pos : ~pos, inLow), inLow);
+                return;
+            }
+            Remove(slot);
+            Insert(slot, x);
+        }
+        void Remove(int slot)
+        {
+            const int pos = where[slot];
+            if (pos >= 0)
+                Erase(low, n_low, pos, true);
+            else
+                Erase(high, n_high, ~pos, false);
+            Balance();
+        }
+
+    private:
+        bool Before(int a, int b, bool isLow) const { return isLow ? value[a] > value[b] : value[a] < value[b]; }
+        void Place(int *heap, int pos, int slot, bool isLow)
+        {
+            heap[pos] = slot;
+            where[slot] = isLow ? pos : ~pos;
+        }
+        int SiftUp(int *heap, int pos, bool isLow)
+        {
+            const int slot = heap[pos];
+            for (int parent = (pos - 1) / 2; pos > 0 && Before(slot, heap[parent], isLow); parent = (pos - 1) / 2)
+            {
+                Place(heap, pos, heap[parent], isLow);
+                pos = parent;
+            }
+            Place(heap, pos, slot, isLow);
+            return pos;
+        }
+        void SiftDown(int *heap, int n, int pos, bool isLow)
+        {
+            const int slot = heap[pos];
+            for (int child = 2 * pos + 1; child < n; child = 2 * pos + 1)
+            {
+                if (child + 1 < n && Before(heap[child + 1], heap[child], isLow))
+                    child++;
+                if (!Before(heap[child], slot, isLow))
+                    break;
+                Place(heap, pos, heap[child], isLow);
+                pos = child;
+            }
+            Place(heap, pos, slot, isLow);
+        }
+        void Push(int *heap, int &n, int slot, bool isLow)
+        {
+            Place(heap, n, slot, isLow);
+            SiftUp(heap, n++, isLow);
+        }
+        void Erase(int *heap, int &n, int pos, bool isLow)
+        {
+            const int last = heap[--n];
+            if (pos == n)
+                return;
+            Place(heap, pos, last, isLow);
+            SiftDown(heap, n, SiftUp(heap, pos, isLow), isLow);
+        }
+        int Pop(int *heap, int &n, bool isLow)
+        {
+            const int top = heap[0];
+            Erase(heap, n, 0, isLow);
+            return top;
+        }
+        void Balance()
+        {
+            while (n_low > n_high + 1)
+                Push(high, n_high, Pop(low, n_low, true), false);
+            while (n_high > n_low)
+                Push(low, n_low, Pop(high, n_high, false), true);
+        }
+    };
+
+    /// @brief Robust pedestal of samples [begin, end), for the methods other than kMeanBaseline.
+    /// kMedianBaseline slides a window over the samples with a _running_median, O(log window) per step. The pedestal is
+    /// the mean of the running median and the deviation that of the samples from it, so short pulses and slow ringing
+    /// do not enter either.
+    /// kTrimmedMeanBaseline partitions a copy of the samples with SelectKth, O(n), and keeps the central ones.
+    /// Means and variances are accumulated with Welford's update, without the cancellation of sum of squares - mean^2.
+    /// @param amp callable, amplitude of sample i (in mV)
+    /// @param buffer scratch space, only grown
+    /// @param slots scratch space of the running median heaps, only grown
+    /// @param mean [out] pedestal, 0 without samples
+    /// @param std_dev [out] standard deviation, 0 without samples
+    template <typename Amp>
+    void RobustBaseline(const _baseline_config &config, int begin, int end, Amp amp, std::vector<double> &buffer, std::vector<int> &slots,
+                        double &mean, double &std_dev)
+    {
+        mean = 0;
+        std_dev = 0;
+        const int n = end - begin;
+        if (n <= 0)
+            return;
+        double m2 = 0;
+        int count = 0;
+
+        if (config.method == kTrimmedMeanBaseline)
+        {
+            if ((int)buffer.size() < n)
+                buffer.resize(n);
+            double *b = buffer.data();
+            for (int k = 0; k < n; k++)
+                b[k] = amp(begin + k);
+            const int cut = std::min(static_cast<int>(std::max(config.trim, 0.0) * n), (n - 1) / 2);
+            SelectKth(b, n, cut);
+            SelectKth(b + cut, n - cut, n - 2 * cut - 1);
+            for (int k = cut; k < n - cut; k++)
+            {
+                const double delta = b[k] - mean;
+                mean += delta * (1.0 / ++count);
+                m2 += delta * (b[k] - mean);
+            }
+            std_dev = std::sqrt(m2 / count);
+            return;
+        }
+
+        // Centered window [k - half, k + half], clipped to the samples. Sample j sits in slot j % width, so the one
+        // entering the window replaces the one leaving it in the same slot.
+        const int half = std::max(config.window, 1) / 2, width = 2 * half + 1;
+        _running_median median;
+        median.Reset(std::min(width, n), buffer, slots);
+        const int nslots = std::min(width, n);
+        for (int k = 0; k < std::min(half, n); k++)
+            median.Insert(k % nslots, amp(begin + k));
+        double residual_mean = 0;
+        for (int k = 0; k < n; k++)
+        {
+            const bool enters = k + half < n, leaves = k - half - 1 >= 0;
+            if (enters && leaves)
+                median.Replace((k + half) % nslots, amp(begin + k + half));
+            else if (enters)
+                median.Insert((k + half) % nslots, amp(begin + k + half));
+            else if (leaves)
+                median.Remove((k - half - 1) % nslots);
+            const double value = median.Median();
+            const double residual = amp(begin + k) - value;
+            const double weight = 1.0 / ++count;
+            mean += (value - mean) * weight;
+            const double delta = residual - residual_mean;
+            residual_mean += delta * weight;
+            m2 += delta * (residual - residual_mean);
+        }
+        std_dev = std::sqrt(m2 / count);
+    }
+
+    /// @brief Tables of an FFT of n points, n a power of two, kept if the plan already has n points
+    void MakeFFTPlan(int n, _fft_plan &plan);
+    /// @brief In-place FFT of the plan.n complex points z[2k] + i z[2k + 1], unscaled, e^{+i} kernel if inverse
+    void FFT(const _fft_plan &plan, double *z, bool inverse = false);
+
+    /// @brief Add the noise segment x[up - length, up) of one record to a running average spectrum. The segment mean is
+    /// removed, then it is windowed; the plan and window are made once, when the configuration changes (which also
+    /// restarts the average). The cost per event is one segment and half a complex FFT of length points, whatever
+    /// the record length. Instantiated for int8_t, int16_t, float and double samples.
+    /// @param up first sample of the search window (see FindSearchWindow), the segment ends just before it
+    /// @param mv_per_unit scale of x to mV, offsets do not matter
+    /// @param dt_ns sampling interval, events sampled differently from the first one are skipped
+    /// @return false if the event is not averaged: not picked by config.every, or no full segment before up
+    template <typename S>
+    bool AccumulateNoiseSpectrum(const S *x, int Nsamples, int up, double mv_per_unit, double dt_ns, const _spectrum_config &config,
+                                 _noise_spectrum &spectrum);
+    /// @brief Transform the pending segment alone, so that power holds every segment accumulated so far
+    void FinishNoiseSpectrum(_noise_spectrum &spectrum);
+    /// @brief Add the segments of another average (e.g. read back from an output file) to spectrum, the two averages
+    /// weighted by their segment counts. The pending segment of spectrum is transformed first, that of other is ignored.
+    /// @return false if both hold segments of other bins or another sampling interval, spectrum is then unchanged
+    bool MergeNoiseSpectrum(const _noise_spectrum &other, _noise_spectrum &spectrum);
+
+    /// @brief Add one pulse to an average pulse: the record is resampled at toa + config.Time(j) for every grid point j,
+    /// each value taken with the tabulated fractional-shift filter of config.interpolation (taps samples per point,
+    /// the phase rounded to 1 / kPhases of a sample). The average restarts if the number of grid points changes.
+    /// @param t0_ns,dt_ns time of sample 0 and sampling interval of the record (in ns), the axis must be uniform
+    /// @param toa time the grid is aligned on (in ns)
+    /// @param scale factor applied to amp, e.g. 1 / amplitude to normalize
+    /// @param amp callable, amplitude of sample i relative to the pedestal
+    /// @return false if the grid, with the filter taps, does not fit in the record; the pulse is then not averaged
+    template <typename Amp>
+    bool AccumulatePulseShape(int Nsamples, double t0_ns, double dt_ns, double toa, double scale, Amp amp, const _pulse_shape_config &config,
+                              _average_pulse &average)
+    {
+        const int points = config.Points();
+        if (points == 0 || !(dt_ns > 0))
+            return false;
+        const _interp_table *table = GetInterpolationTable(config.interpolation);
+        // Samples needed before and after the interval of each grid point
+        const int before = table ? table->taps / 2 - 1 : 0, after = table ? table->taps / 2 : 1;
+        const double x0 = (toa + config.start - t0_ns) / dt_ns, dx = config.step / dt_ns;
+        const double x_last = x0 + (points - 1) * dx;
+        if (!(x0 >= before) || !(x_last + after <= Nsamples - 1))
+            return false;
+
+        if (static_cast<int>(average.mean.size()) != points)
+        {
+            average.count = 0;
+            average.mean.assign(points, 0.0);
+            average.m2.assign(points, 0.0);
+        }
+        const double weight = 1.0 / ++average.count;
+        for (int j = 0; j < points; j++)
+        {
+            const double x = x0 + j * dx;
+            const int i = static_cast<int>(x);
+            const double u = x - i;
+            double value;
+            if (table)
+                value = table->Value(0, Nsamples - 1, i, static_cast<int>(std::lround(u * _interp_table::kPhases)), amp);
+            else
+                value = amp(i) + u * (amp(i + 1) - amp(i));
+            value *= scale;
+            const double delta = value - average.mean[j];
+            average.mean[j] += delta * weight;
+            average.m2[j] += delta * (value - average.mean[j]);
+        }
+        return true;
+    }
+
+    /// @brief Add the pulses of another average on the same grid (e.g. read back from an output file) to average,
+    /// combining the means and squared deviations as in Chan's parallel update of the variance
+    /// @return false if both hold pulses on grids of different sizes, average is then unchanged
+    bool MergeAveragePulse(const _average_pulse &other, _average_pulse &average);
+
+    /// @brief Template of a configuration at the sampling interval of the records, kept if the design already matches,
+    /// so that the template FFT is computed once per channel (one workspace per channel) and not per waveform.
+    /// The shape is resampled linearly if its interval differs from dt_ns and scaled to a unit peak. Templates longer
+    /// than 16 samples also get the spectrum of overlap-save FFT blocks of at least 4 template lengths.
+    /// @return false if the configuration is empty or invalid, the design is then not valid
+    bool DesignTemplate(const _template_config &config, double dt_ns, _template_design &design);
+
+    /// @brief Template fit at every placement with the template peak on a sample of [first, last].
+    /// The correlation c(i) = sum_k h[k] x[i + k] is maximal where the least-squares fit of the template
+    /// (the amplitude) is best, since sum h^2 does not depend on i; the pedestal only shifts c by a constant.
+    /// The correlation runs directly (Simd::FIR) or by FFT blocks, whichever takes fewer operations for the number
+    /// of placements: FFT blocks pay off for long templates searched over long ranges, mostly at Simd::kScalar.
+    /// The maximum is refined by a parabola through its neighbours.
+    /// Instantiated for int8_t, int16_t, float and double samples.
+    /// @param pedestal pedestal in the units of x
+    /// @param scratch correlation and FFT blocks, only grown
+    /// @param amplitude [out] peak of the fitted template above the pedestal, in the units of x
+    /// @param position [out] fractional sample where h[0] is placed
+    /// @return false if no placement fits or the best fit is not positive
+    template <typename S>
+    bool MatchTemplate(const _template_design &design, const S *x, int Nsamples, int first, int last, double pedestal,
+                       std::vector<double> &scratch, double &amplitude, double &position);
+
+    /// @brief interpolateTOA2 on arrays in seconds and volts, scaled on the fly to ns and mV
+    /// @param table interpolation around the crossing, linear (as interpolateTOA2) if nullptr
+    bool interpolateTOAScaled(const double *t, const double *a, int Nsamples, int sample_point_around_threshold, double threshold, double pedestal, double &result, const _interp_table *table = nullptr);
+}
+
+#endif // WFKernels_H
@@ -0,0 +1,62 @@
+#ifndef WFSimd_H
+#define WFSimd_H
+
+#include <cstddef>
+
+namespace WFDataProcessor
+{
+    /// @brief Vectorized reductions over sample ranges used by the waveform kernels.
+    /// The instruction set is chosen at run time (AVX-512, AVX2, or scalar). The scalar level reproduces the
+    /// sequential loops of processWaveReference bit by bit, vector levels agree within floating-point
+    /// tolerance since the sums are reordered. Extrema values and indices are always exact.
+    namespace Simd
+    {
+        enum Level
+        {
+            kScalar = 0,
+            kAVX2 = 1,   ///  AVX2 without FMA (x * scale - offset is rounded twice, as in the scalar loops), 4 doubles per instruction
+            kAVX512 = 2, ///  AVX-512F, 8 doubles per instruction
+        };
+
+        /// @brief Best level supported by this CPU and compiler
+        Level DetectLevel();
+        /// @brief Level used by the reductions, DetectLevel() unless changed by SetLevel
+        Level GetLevel();
+        /// @brief Force a level, e.g. kScalar for bit-exact results, process-wide
+        /// @return false if the level is not supported, the current level is kept
+        bool SetLevel(Level level);
+        const char *LevelName(Level level);
+
+        /// @brief sum += x[i] * scale and sum_sq += (x[i] * scale)^2 for i in [0, n)
+        void ScaledSumSquares(const double *x, int n, double scale, double &sum, double &sum_sq);
+
+        /// @brief sum += (x[i] * scale - offset) * weight for i in [0, n)
+        void ScaledSum(const double *x, int n, double scale, double offset, double weight, double &sum);
+
+        /// @brief Weighted sum and extrema of v[i] = x[i] * scale - offset for i in [0, n).
+        /// max/min are updated only by values strictly above/below their input, the index is the first
+        /// occurrence, and is left untouched when nothing is updated.
+        void ScaledWindowStats(const double *x, int n, double scale, double offset, double weight, double &sum,
+                               double &max, int &argmax, double &min, int &argmin);
+
+        /// @brief FIR filter y[i] = h[0] * x[i] + h[1] * x[i + 1] + ... + h[taps - 1] * x[i + taps - 1] for i in [0, n),
+        /// summed in tap order without fused multiply-add, so every level gives the scalar result.
+        /// x holds n + taps - 1 samples, y must not overlap x.
+        void FIR(const double *x, int n, const double *h, int taps, double *y);
+
+        /// @brief Maximum number of lanes of the Lane* reductions
+        constexpr int kLanes = 8;
+
+        /// @brief ScaledSumSquares with one independent sum per lane, over x[r * stride + l] for rows r in [0, rows)
+        /// and lanes l in [0, lanes), lanes <= kLanes. Each lane is summed in row order, so every level gives
+        /// the same result as the scalar loop on that lane alone.
+        void LaneSumSquares(const double *x, size_t stride, int rows, int lanes, double scale, double *sum, double *sum_sq);
+
+        /// @brief ScaledWindowStats per lane, with a per-lane offset, same layout as LaneSumSquares.
+        /// argmax/argmin are row indices, updated only by strictly larger/smaller values. Exact at every level.
+        void LaneWindowStats(const double *x, size_t stride, int rows, int lanes, double scale, const double *offset, double weight,
+                             double *sum, double *max, int *argmax, double *min, int *argmin);
+    }
+}
+
+#endif // WFSimd_H
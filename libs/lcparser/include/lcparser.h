@@ -64,6 +64,9 @@ private:
     int trigTimeArray = 0;
     int waveArray1 = 0;
 
+    // 原始ADC码, 本机字节序, 只由InitRawData填充
+    std::vector<char> rawData{}; //!
+
     // 常量列表
     static const std::vector<std::string> waveSourceList;       //!
     static const std::vector<std::string> verticalCouplingList; //!
@@ -87,6 +90,10 @@ public:
     ScopeData(const std::string &path = "", bool parseAll = false, int sparse = -1);
     void Clean();
     errorCodes InitData(const std::string &path = "", bool parseAll = false, int sparse = -1);
+    // 只解析元数据和原始ADC码, 不生成X/Y数据 (见 WFDataProcessor::processWaveRaw)
+    errorCodes InitRawData(const std::string &path);
+    // 由原始ADC码生成X/Y数据, 与InitData结果相同
+    void DecodeRawData();
 
     // 获取X数据
     const std::vector<double> &getX() const { return x; }
@@ -108,6 +115,17 @@ public:
     const std::string &getTimeBase() const { return timeBase; }
     const std::string &getTriggerTime() const { return triggerTime; }
 
+    // 获取原始数据的换算系数: y = verticalGain * code - verticalOffset, x = i * horizInterval + horizOffset
+    float getVerticalGain() const { return verticalGain; }
+    float getVerticalOffset() const { return verticalOffset; }
+    double getHorizInterval() const { return horizInterval; }
+    double getHorizOffset() const { return horizOffset; }
+
+    // 获取原始ADC码: commType为0时每个采样为int8, 否则为int16
+    const std::vector<char> &getRawData() const { return rawData; }
+    int getRawSampleSize() const { return commType == 0 ? 1 : 2; }
+    int getRawSampleCount() const { return static_cast<int>(rawData.size()) / getRawSampleSize(); }
+
     // 重载输出运算符
     friend std::ostream &operator<<(std::ostream &os, const ScopeData &data);
 
@@ -117,9 +135,18 @@ private:
     // 解析单个文件
     errorCodes parseFile(const std::string &path, std::vector<double> &x, std::vector<double> &y, int sparse);
 
+    // 读取整个文件
+    errorCodes readFile(const std::string &path, std::vector<char> &buffer);
+
     // 解析数据
     errorCodes parseData(const std::vector<char> &data, std::vector<double> &x, std::vector<double> &y, int sparse);
 
+    // 解析元数据, start 为波形数据的起始位置
+    errorCodes parseHeader(const std::vector<char> &data, size_t &start);
+
+    // 将ADC码换算为X/Y数据
+    void decodeSamples(const char *codes, size_t nbytes, bool swap, std::vector<double> &x, std::vector<double> &y) const;
+
     // 从数据中解析16位整数
     int16_t parseInt16(const std::vector<char> &data, size_t pos) const;
 
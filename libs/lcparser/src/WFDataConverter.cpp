@@ -1,5 +1,6 @@
 // plot_waveform.cpp
 #include "WFDataConverter.h"
+#include "WFKernels.h"
 #include "lcparser.h"
 
 #include "TApplication.h"
@@ -11,9 +12,17 @@
 #include "TSystem.h"
 #include "TFile.h"
 #include "TTree.h"
+#include "TH1D.h"
 
 #include <iostream>
 #include <fstream>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <vector>
 
 // #define DEBUG_DRAW
@@ -22,18 +31,41 @@ using namespace WFDataProcessor;
 std::vector<std::string> gDirs{"../W2Die7/7-11_110V", "../W2Die7/7-11_110V_Multitrigger", "../W2Die7/7-11_110V_Reftrigger"};
 std::vector<int> gMaxFiles{2020, 41492, 99999};
 
-int WFDataProcessor::ConvertAllTRC(std::string sWriteFile, std::string sDataFolder, int maxFiles)
+int WFDataProcessor::ConvertAllTRC(std::string sWriteFile, std::string sDataFolder, int maxFiles, bool resume)
 {
     gSystem->mkdir("../plots", true);
 
-    auto fileWriter = new TFile(Form("%s", sWriteFile.c_str()), "RECREATE");
-
-    auto tree = new TTree("tree", "Waveforms from LeCroy .trc files");
-    tree->SetDirectory(fileWriter);
+    auto fileWriter = new TFile(Form("%s", sWriteFile.c_str()), resume ? "UPDATE" : "RECREATE");
 
     ScopeData ch2sd, ch3sd;
-    tree->Branch("ch2", &ch2sd);
-    tree->Branch("ch3", &ch3sd);
+    ScopeData *ptrCh2 = &ch2sd, *ptrCh3 = &ch3sd;
+    int file_index = -1;
+    std::set<int> processed;
+
+    // In resume mode, append to the existing tree and skip indices already stored
+    auto tree = resume ? (TTree *)fileWriter->Get("tree") : nullptr;
+    if (tree && ReadProcessedIndices(tree, processed))
+    {
+        tree->SetBranchAddress("ch2", &ptrCh2);
+        tree->SetBranchAddress("ch3", &ptrCh3);
+        tree->SetBranchAddress("file_index", &file_index);
+        std::cout << "Resuming " << sWriteFile << " with " << processed.size() << " processed waveforms." << std::endl;
+    }
+    else
+    {
+        if (tree)
+        {
+            std::cerr << "Cannot resume " << sWriteFile << ": no file_index branch found." << std::endl;
+            fileWriter->Close();
+            delete fileWriter;
+            return -1;
+        }
+        tree = new TTree("tree", "Waveforms from LeCroy .trc files");
+        tree->SetDirectory(fileWriter);
+        tree->Branch("ch2", &ch2sd);
+        tree->Branch("ch3", &ch3sd);
+        tree->Branch("file_index", &file_index, "file_index/I");
+    }
 
     std::ifstream testFile;
 
@@ -46,6 +78,9 @@ int WFDataProcessor::ConvertAllTRC(std::string sWriteFile, std::string sDataFold
         if (idx_file == maxFiles - 1)
             std::cout << std::endl;
 
+        if (processed.count(idx_file))
+            continue;
+
         // Generate file names
         char cnum[6];
         sprintf(cnum, "%05d", idx_file);
@@ -87,9 +122,14 @@ int WFDataProcessor::ConvertAllTRC(std::string sWriteFile, std::string sDataFold
             continue;
         }
 
+        file_index = idx_file;
         tree->Fill();
         entryCounter++;
 
+        // Keep the file recoverable in case the job is interrupted
+        if (entryCounter % 100 == 0)
+            tree->AutoSave("SaveSelf");
+
 #ifdef DEBUG_DRAW
         // Debug
         auto tg2 = ch2sd.createGraph();
@@ -107,7 +147,8 @@ int WFDataProcessor::ConvertAllTRC(std::string sWriteFile, std::string sDataFold
 #endif
     }
 
-    fileWriter->Write();
+    fileWriter->cd();
+    tree->Write("", TObject::kOverwrite);
     fileWriter->Close();
     delete fileWriter;
 
@@ -158,16 +199,79 @@ bool JudgeAllChannelsHaveData(const std::map<int, bool> &chDataHasData)
 
 #include <TMath.h>
 #include <TLine.h>
-void WFDataProcessor::processWave(const double *t, const double *a, int Nsamples, _waveinfo &winfo, _extract_config config)
+void WFDataProcessor::processWave(const double *t, const double *a, int Nsamples, _waveinfo &winfo, const _extract_config &config)
+{
+    static thread_local _wave_workspace workspace;
+    processWave(t, a, Nsamples, winfo, config, workspace);
+}
+
+namespace
+{
+    // processWave without plotting, returns the amplitudes the features were extracted from (after the filter stage)
+    const double *ExtractFeatures(const double *t, const double *a, int Nsamples, WFDataProcessor::_waveinfo &winfo,
+                                  const WFDataProcessor::_extract_config &config, WFDataProcessor::_wave_workspace &workspace)
+    {
+        using namespace WFDataProcessor;
+        workspace.filtered_samples = 0;
+        // No record: only flagged NO_WAVEFORM, before the filter stage and the dispatch read the samples
+        if (Nsamples <= 0 || t == nullptr || a == nullptr)
+        {
+            processWaveFused(t, a, Nsamples, winfo, config, workspace);
+            return a;
+        }
+        // Filter stage into the workspace, the features are then extracted from the filtered record
+        if (config.filter.type != kNoFilter && Nsamples >= 2 && DesignFilter(config.filter, (t[1] - t[0]) * 1.0e9, workspace.filter))
+        {
+            if ((int)workspace.filtered.size() < Nsamples)
+                workspace.filtered.resize(Nsamples);
+            FilterRecord(a, Nsamples, workspace.filter, workspace.filtered.data());
+            workspace.filtered_samples = Nsamples;
+            workspace.filtered_gain = 1;
+            workspace.filtered_offset = 0;
+            a = workspace.filtered.data();
+        }
+        // The fused kernel needs a monotonic time axis
+        if (Nsamples < 2 || t[1] <= t[0])
+        {
+            processWaveReference(t, a, Nsamples, winfo, config, workspace);
+            if (config.features != kAllFeatures)
+                ApplyFeatureMask(winfo, config.features);
+        }
+        else
+            processWaveFused(t, a, Nsamples, winfo, config, workspace);
+        return a;
+    }
+}
+
+void WFDataProcessor::processWave(const double *t, const double *a, int Nsamples, _waveinfo &winfo, const _extract_config &config, _wave_workspace &workspace)
+{
+    const double *extracted = ExtractFeatures(t, a, Nsamples, winfo, config, workspace);
+    if (!config.need_draw || Nsamples <= 0 || t == nullptr || a == nullptr)
+        return;
+
+    // Reentrant: each thread draws into its own canvas and job buffers, made on its first plot and kept until the thread exits,
+    // only the counter of the default file names is shared
+    static std::atomic<int> count(0);
+    static thread_local std::unique_ptr<TCanvas> canvas;
+    static thread_local _plot_job job;
+    FillPlotJob(t, extracted, Nsamples, winfo, config, job);
+    if (job.savePrefix.empty())
+        job.savePrefix = Form("../plots/waveform_%05d", count++);
+    if (!canvas)
+        canvas.reset(new TCanvas(Form("waveform_%p", static_cast<void *>(&canvas)), "Waveform", 800, 600));
+    DrawPlotJob(job, canvas.get());
+}
+
+void WFDataProcessor::processWaveReference(const double *t, const double *a, int Nsamples, _waveinfo &winfo, const _extract_config &config, _wave_workspace &workspace)
 {
     // Extract configuration
     double _threshold = config.threshold;
-    _signal_range search_range = config.search_range;
-    auto need_draw = config.need_draw;
-    auto savePrefix = config.savePrefix;
+    const _signal_range &search_range = config.search_range;
     // double _threshold = 5 * _ped_std_dev; // 5 sigma above pedestal
 
     winfo.valid = VALID; // Assume valid until proven otherwise
+    workspace.pulses.Clear();
+    workspace.tot.Clear();
     if (Nsamples <= 0 || t == nullptr || a == nullptr)
     {
         winfo.valid = NO_WAVEFORM;
@@ -195,9 +299,10 @@ void WFDataProcessor::processWave(const double *t, const double *a, int Nsamples
     double _min_t = 0;
     double _min_a = 1.0e9;
 
-    // Generate new array inside
-    auto _t = new double[Nsamples];
-    auto _a = new double[Nsamples];
+    // Unit converted copies live in the workspace, allocated only when a longer record shows up
+    workspace.Reserve(Nsamples);
+    double *_t = workspace.t.data();
+    double *_a = workspace.a.data();
 
     // Find sample point for up and down range
     int _sample_up = 0;
@@ -231,6 +336,10 @@ void WFDataProcessor::processWave(const double *t, const double *a, int Nsamples
     }
     double _ped_start = _ped_start_count > 0 ? _ped_sum / _ped_start_count : 0;
     double _ped_start_std_dev = _ped_start_count > 0 ? TMath::Sqrt((_ped_square_sum / _ped_start_count) - (_ped_start * _ped_start)) : 0;
+    auto _baseline_amp = [&](int i)
+    { return _a[i]; };
+    if (config.baseline.method != kMeanBaseline)
+        RobustBaseline(config.baseline, 0, _sample_up, _baseline_amp, workspace.baseline, workspace.baseline_slots, _ped_start, _ped_start_std_dev);
 
     // _ped = 0, _ped_std_dev = 0; // Reset pedestal and std dev for debugging
 
@@ -448,6 +557,51 @@ void WFDataProcessor::processWave(const double *t, const double *a, int Nsamples
     }
     double _ped_end = _ped_count_end > 0 ? _ped_sum_end / _ped_count_end : 0;
     double _ped_end_std_dev = _ped_count_end > 0 ? TMath::Sqrt((_ped_square_sum_end / _ped_count_end) - (_ped_end * _ped_end)) : 0;
+    if (config.baseline.method != kMeanBaseline)
+    {
+        // The robust estimators need a contiguous region: from the first sample after the start of the range
+        int _tail = _sample_down;
+        while (_tail < Nsamples && !(_t[_tail] > search_range.first))
+            _tail++;
+        RobustBaseline(config.baseline, _tail, Nsamples, _baseline_amp, workspace.baseline, workspace.baseline_slots, _ped_end, _ped_end_std_dev);
+    }
+
+    // Constant-fraction discriminator and pulse finder over the search range
+    int _first = _sample_up, _last = _sample_down;
+    while (_first <= _last && _t[_first] < search_range.first)
+        _first++;
+    while (_last >= _first && _t[_last] > search_range.second)
+        _last--;
+    auto _range_amp = [&](int i)
+    { return _a[i] - _ped_start; };
+    auto _range_time = [&](int i)
+    { return _t[i]; };
+    double _t_cfd = -100e9;
+    if (config.cfd_fraction > 0)
+    {
+        if (!CFDCrossing(_first, _last, CFDDelaySamples(config.cfd_delay, _dt), config.cfd_fraction, _threshold, _range_amp, _range_time, _t_cfd))
+            winfo.valid |= NO_CFD_FOUND;
+    }
+    if (config.find_pulses && FindPulses(_first, _last, _threshold, _dt, _range_amp, _range_time, workspace.pulses) > 1)
+        winfo.valid |= PILEUP;
+    if (!config.tot_thresholds.empty())
+        MultiThresholdCrossings(_sample_up, _sample_down, _sample_max, config.tot_thresholds, _range_amp, _range_time, workspace.tot);
+
+    // Template matching over the search range
+    double _t_tmpl = -100e9, _amp_tmpl = -100e9;
+    if (!config.pulse_template.shape.empty())
+    {
+        double _amplitude, _position;
+        if (DesignTemplate(config.pulse_template, _dt, workspace.match) &&
+            MatchTemplate(workspace.match, _a, Nsamples, _first, _last, _ped_start, workspace.correlation, _amplitude, _position))
+        {
+            int _sample = static_cast<int>(std::floor(_position));
+            _t_tmpl = _t[_sample] + (_position - _sample) * _dt + config.pulse_template.t_ref;
+            _amp_tmpl = _amplitude;
+        }
+        else
+            winfo.valid |= NO_TEMPLATE_MATCH;
+    }
     // std::cout << "Channel " << ch << " pedestal: " << _ped_end << " mV, std dev: " << _ped_end_std_dev * 1.0e3 << " mV" << std::endl;
 
     winfo.nsamples = Nsamples;
@@ -474,98 +628,12 @@ void WFDataProcessor::processWave(const double *t, const double *a, int Nsamples
     winfo.charge = winfo.charge_50; // for backward compatibility
     winfo.t_min = _min_t;
     winfo.amp_min = _min_a + _ped_start - _ped_end; // subtract backend pedestal
+    winfo.t_cfd = _t_cfd;
+    winfo.t_tmpl = _t_tmpl;
+    winfo.amp_tmpl = _amp_tmpl;
 
-    if (!need_draw)
-    {
-        delete[] _t;
-        delete[] _a;
-        return;
-    }
-    // if (_toa == -100e9)
-    // if (ch == 2 && amp > 50)
-    {
-
-        TGraph tg(Nsamples, _t, _a);
-        tg.SetTitle(Form(";Time (ns);Amplitude (mV)"));
-
-        double _tg_y_low = tg.GetYaxis()->GetXmin();
-        double _tg_y_high = tg.GetYaxis()->GetXmax();
-        // std::cout << "Y axis range: " << _tg_y_low << " to " << _tg_y_high << std::endl;
-
-        static TCanvas *c1 = new TCanvas("c1", "Waveform", 800, 600);
-        tg.Draw("AL");
-        static int count = 0;
-        // Gray for range & pedestal
-        TLine liney1(search_range.first, _tg_y_low, search_range.first, _tg_y_high);
-        liney1.SetLineColor(kGray);
-        liney1.SetLineStyle(2);
-        liney1.Draw("same");
-        TLine liney2(search_range.second, _tg_y_low, search_range.second, _tg_y_high);
-        liney2.SetLineColor(kGray);
-        liney2.SetLineStyle(2);
-        liney2.Draw("same");
-        // Green for max
-        TLine liney3(_max_t, _tg_y_low, _max_t, _tg_y_high);
-        liney3.SetLineColor(kGreen + 2);
-        liney3.SetLineStyle(2);
-        liney3.Draw("same");
-        // Red for t1 and t2 & threshold
-        TLine liney4(_t1, _tg_y_low, _t1, _tg_y_high);
-        liney4.SetLineColor(kRed);
-        liney4.SetLineStyle(2);
-        liney4.Draw("same");
-        TLine liney5(_t2, _tg_y_low, _t2, _tg_y_high);
-        liney5.SetLineColor(kRed);
-        liney5.SetLineStyle(2);
-        liney5.Draw("same");
-        // Blue for toa & 50% threshold
-        TLine liney6(_toa, _tg_y_low, _toa, _tg_y_high);
-        liney6.SetLineColor(kBlue);
-        liney6.SetLineStyle(2);
-        liney6.Draw("same");
-
-        TLine linex1(search_range.first, _ped_start, search_range.second, _ped_start); // convert to V
-        linex1.SetLineColor(kGray);
-        linex1.SetLineStyle(2);
-        linex1.Draw("same");
-        TLine linex1_up(search_range.first, _ped_start + 3 * _ped_start_std_dev, search_range.second, _ped_start + 3 * _ped_start_std_dev); // convert to V
-        linex1_up.SetLineColor(kGray);
-        linex1_up.SetLineStyle(2);
-        linex1_up.Draw("same");
-        TLine linex1_down(search_range.first, _ped_start - 3 * _ped_start_std_dev, search_range.second, _ped_start - 3 * _ped_start_std_dev); // convert to V
-        linex1_down.SetLineColor(kGray);
-        linex1_down.SetLineStyle(2);
-        linex1_down.Draw("same");
-
-        TLine linex2(search_range.first, _ped_start + _threshold, search_range.second, _ped_start + _threshold); // convert to V
-        linex2.SetLineColor(kRed);
-        linex2.SetLineStyle(2);
-        linex2.Draw("same");
-
-        TLine linex3(search_range.first, _ped_start + _amp_50, search_range.second, _ped_start + _amp_50); // convert to V
-        linex3.SetLineColor(kBlue);
-        linex3.SetLineStyle(2);
-        linex3.Draw("same");
-
-        TLine linex4(search_range.first, _ped_start + _max_a, search_range.second, _ped_start + _max_a); // convert to V
-        linex4.SetLineColor(kGreen + 2);
-        linex4.SetLineStyle(2);
-        linex4.Draw("same");
-
-        TLine linex5(search_range.second, _ped_end, _t_end, _ped_end); // convert to V
-        linex5.SetLineColor(kGray + 2);
-        linex5.SetLineStyle(2);
-        linex5.SetLineWidth(3);
-        linex5.Draw("same");
-
-        if (savePrefix.empty())
-            savePrefix = Form("../plots/waveform_%05d", count++);
-        c1->SaveAs(Form("%s.png", savePrefix.c_str()));
-        // std::cout << count << '\t' << _toa << '\t' << _t1 << '\t' << _t2 << '\t' << '\t' << _max_t << '\t' << t[_sample_up] * 1.0e9 << '\t' << t[_sample_down] * 1.0e9 << std::endl;
-    }
-    delete[] _t;
-    delete[] _a;
-    return;
+    workspace.sample_up = _sample_up;
+    workspace.sample_down = _sample_down;
 }
 
 std::string WFDataProcessor::GenerateScopeFileName(const std::string &folder, int channel, int idx_lecroy_wf, std::string mid_name, std::string ext)
@@ -575,62 +643,315 @@ std::string WFDataProcessor::GenerateScopeFileName(const std::string &folder, in
     return filepath;
 }
 
-void WFDataProcessor::GenerateBranchForWaveInfo(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_waveinfo *winfo)
-{
-    tree->Branch(Form("%s_valid", branchNamePrefix.c_str()), &winfo->valid, Form("%s_valid/i", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_nsamples", branchNamePrefix.c_str()), &winfo->nsamples, Form("%s_nsamples/I", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_ped_start", branchNamePrefix.c_str()), &winfo->ped_start, Form("%s_ped_start/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_ped_start_std_dev", branchNamePrefix.c_str()), &winfo->ped_start_std_dev, Form("%s_ped_start_std_dev/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_ped_end", branchNamePrefix.c_str()), &winfo->ped_end, Form("%s_ped_end/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_ped_end_std_dev", branchNamePrefix.c_str()), &winfo->ped_end_std_dev, Form("%s_ped_end_std_dev/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_amp", branchNamePrefix.c_str()), &winfo->amp, Form("%s_amp/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_t_amp", branchNamePrefix.c_str()), &winfo->t_amp, Form("%s_t_amp/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_t1", branchNamePrefix.c_str()), &winfo->t1, Form("%s_t1/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_t1_10", branchNamePrefix.c_str()), &winfo->t1_10, Form("%s_t1_10/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_t1_50", branchNamePrefix.c_str()), &winfo->t1_50, Form("%s_t1_50/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_t1_90", branchNamePrefix.c_str()), &winfo->t1_90, Form("%s_t1_90/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_toa", branchNamePrefix.c_str()), &winfo->toa, Form("%s_toa/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_charge", branchNamePrefix.c_str()), &winfo->charge, Form("%s_charge/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_t2", branchNamePrefix.c_str()), &winfo->t2, Form("%s_t2/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_t2_10", branchNamePrefix.c_str()), &winfo->t2_10, Form("%s_t2_10/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_t2_50", branchNamePrefix.c_str()), &winfo->t2_50, Form("%s_t2_50/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_t2_90", branchNamePrefix.c_str()), &winfo->t2_90, Form("%s_t2_90/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_q_10", branchNamePrefix.c_str()), &winfo->charge_10, Form("%s_q_10/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_q_50", branchNamePrefix.c_str()), &winfo->charge_50, Form("%s_q_50/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_q_90", branchNamePrefix.c_str()), &winfo->charge_90, Form("%s_q_90/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_q_pm2ns", branchNamePrefix.c_str()), &winfo->charge_pm2ns, Form("%s_q_pm2ns/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_q_full", branchNamePrefix.c_str()), &winfo->charge_full, Form("%s_q_full/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_t_min", branchNamePrefix.c_str()), &winfo->t_min, Form("%s_t_min/D", branchNamePrefix.c_str()));
-    tree->Branch(Form("%s_amp_min", branchNamePrefix.c_str()), &winfo->amp_min, Form("%s_amp_min/D", branchNamePrefix.c_str()));
+bool WFDataProcessor::ReadProcessedIndices(TTree *tree, std::set<int> &indices, const std::string &branchName)
+{
+    if (!tree)
+        return false;
+    auto branch = tree->GetBranch(branchName.c_str());
+    if (!branch)
+        return false;
+
+    // Read only the index branch, without touching the (large) waveform branches
+    int idx_file = -1;
+    branch->SetAddress(&idx_file);
+    for (Long64_t entry = 0; entry < tree->GetEntries(); entry++)
+    {
+        branch->GetEntry(entry);
+        indices.insert(idx_file);
+    }
+    tree->ResetBranchAddresses();
+    return true;
+}
+
+bool WFDataProcessor::IsChainManifest(const std::string &filename)
+{
+    const std::string ext = ".manifest";
+    return filename.size() > ext.size() && filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+bool WFDataProcessor::ReadChainManifest(const std::string &manifest, std::string &treeName, std::vector<std::string> &files)
+{
+    std::ifstream fin(manifest);
+    if (!fin.is_open())
+        return false;
+
+    std::string folder = manifest.substr(0, manifest.find_last_of('/') + 1);
+    std::string line;
+    while (std::getline(fin, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        auto pos = line.find(' ');
+        std::string key = line.substr(0, pos);
+        std::string value = (pos == std::string::npos) ? "" : line.substr(pos + 1);
+        if (key == "tree")
+            treeName = value;
+        else if (key == "file")
+            files.push_back(value.empty() || value[0] == '/' ? value : folder + value);
+    }
+    return !files.empty();
+}
+
+bool WFDataProcessor::WriteChainManifest(const std::string &manifest, const std::string &treeName, const std::vector<std::string> &files)
+{
+    // Write to a temporary file first, so that a crash never leaves a truncated manifest
+    std::string tmpName = manifest + ".tmp";
+    std::ofstream fout(tmpName);
+    if (!fout.is_open())
+        return false;
+
+    fout << "# ProcessLecroyWF chain manifest, open with WFROOTReader / WFDataTreeReader" << std::endl;
+    fout << "tree " << treeName << std::endl;
+    for (const auto &file : files)
+        fout << "file " << file.substr(file.find_last_of('/') + 1) << std::endl;
+    fout.close();
+    return std::rename(tmpName.c_str(), manifest.c_str()) == 0;
+}
+
+const std::vector<WFDataProcessor::_waveinfo_field> &WFDataProcessor::GetWaveInfoFields()
+{
+#define WAVEINFO_FIELD(name, type, member) {name, type, offsetof(_waveinfo, member), sizeof(_waveinfo::member)}
+    static const std::vector<_waveinfo_field> fields = {
+        WAVEINFO_FIELD("valid", 'i', valid),
+        WAVEINFO_FIELD("nsamples", 'I', nsamples),
+        WAVEINFO_FIELD("ped_start", 'D', ped_start),
+        WAVEINFO_FIELD("ped_start_std_dev", 'D', ped_start_std_dev),
+        WAVEINFO_FIELD("ped_end", 'D', ped_end),
+        WAVEINFO_FIELD("ped_end_std_dev", 'D', ped_end_std_dev),
+        WAVEINFO_FIELD("amp", 'D', amp),
+        WAVEINFO_FIELD("t_amp", 'D', t_amp),
+        WAVEINFO_FIELD("t1", 'D', t1),
+        WAVEINFO_FIELD("t1_10", 'D', t1_10),
+        WAVEINFO_FIELD("t1_50", 'D', t1_50),
+        WAVEINFO_FIELD("t1_90", 'D', t1_90),
+        WAVEINFO_FIELD("toa", 'D', toa),
+        WAVEINFO_FIELD("charge", 'D', charge),
+        WAVEINFO_FIELD("t2", 'D', t2),
+        WAVEINFO_FIELD("t2_10", 'D', t2_10),
+        WAVEINFO_FIELD("t2_50", 'D', t2_50),
+        WAVEINFO_FIELD("t2_90", 'D', t2_90),
+        WAVEINFO_FIELD("q_10", 'D', charge_10),
+        WAVEINFO_FIELD("q_50", 'D', charge_50),
+        WAVEINFO_FIELD("q_90", 'D', charge_90),
+        WAVEINFO_FIELD("q_pm2ns", 'D', charge_pm2ns),
+        WAVEINFO_FIELD("q_full", 'D', charge_full),
+        WAVEINFO_FIELD("t_min", 'D', t_min),
+        WAVEINFO_FIELD("amp_min", 'D', amp_min),
+        WAVEINFO_FIELD("t_cfd", 'D', t_cfd),
+        WAVEINFO_FIELD("t_tmpl", 'D', t_tmpl),
+        WAVEINFO_FIELD("amp_tmpl", 'D', amp_tmpl),
+    };
+#undef WAVEINFO_FIELD
+    return fields;
+}
+
+int WFDataProcessor::FindWaveInfoField(const std::string &name)
+{
+    const auto &fields = GetWaveInfoFields();
+    for (size_t i = 0; i < fields.size(); i++)
+        if (name == fields[i].name)
+            return i;
+    return -1;
+}
+
+uint32_t WFDataProcessor::MakeFeatureMask(const std::vector<std::string> &features)
+{
+    if (features.empty())
+        return kAllFeatures;
+    uint32_t mask = 0;
+    for (const auto &feature : features)
+    {
+        int idx = FindWaveInfoField(feature);
+        if (idx < 0)
+        {
+            std::cerr << "Unknown waveinfo feature: " << feature << std::endl;
+            continue;
+        }
+        mask |= 1u << idx;
+    }
+    return mask;
+}
+
+bool WFDataProcessor::IsFeatureSelected(uint32_t features, int field)
+{
+    // Only the double fields can be left out, the flags and sample count are always there
+    return GetWaveInfoFields()[field].type != 'D' || ((features >> field) & 1u);
+}
+
+void WFDataProcessor::GenerateBranchForWaveInfo(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_waveinfo *winfo, uint32_t features)
+{
+    const auto &fields = GetWaveInfoFields();
+    for (size_t i = 0; i < fields.size(); i++)
+    {
+        if (!IsFeatureSelected(features, i))
+            continue;
+        std::string name = branchNamePrefix + "_" + fields[i].name;
+        tree->Branch(name.c_str(), (char *)winfo + fields[i].offset, Form("%s/%c", name.c_str(), fields[i].type));
+    }
 }
 
 void WFDataProcessor::SetBranchAddressToWaveInfo(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_waveinfo *winfo)
 {
-    tree->SetBranchAddress(Form("%s_valid", branchNamePrefix.c_str()), &winfo->valid);
-    tree->SetBranchAddress(Form("%s_nsamples", branchNamePrefix.c_str()), &winfo->nsamples);
-    tree->SetBranchAddress(Form("%s_ped_start", branchNamePrefix.c_str()), &winfo->ped_start);
-    tree->SetBranchAddress(Form("%s_ped_start_std_dev", branchNamePrefix.c_str()), &winfo->ped_start_std_dev);
-    tree->SetBranchAddress(Form("%s_ped_end", branchNamePrefix.c_str()), &winfo->ped_end);
-    tree->SetBranchAddress(Form("%s_ped_end_std_dev", branchNamePrefix.c_str()), &winfo->ped_end_std_dev);
-    tree->SetBranchAddress(Form("%s_amp", branchNamePrefix.c_str()), &winfo->amp);
-    tree->SetBranchAddress(Form("%s_t_amp", branchNamePrefix.c_str()), &winfo->t_amp);
-    tree->SetBranchAddress(Form("%s_t1", branchNamePrefix.c_str()), &winfo->t1);
-    tree->SetBranchAddress(Form("%s_t1_10", branchNamePrefix.c_str()), &winfo->t1_10);
-    tree->SetBranchAddress(Form("%s_t1_50", branchNamePrefix.c_str()), &winfo->t1_50);
-    tree->SetBranchAddress(Form("%s_t1_90", branchNamePrefix.c_str()), &winfo->t1_90);
-    tree->SetBranchAddress(Form("%s_toa", branchNamePrefix.c_str()), &winfo->toa);
-    tree->SetBranchAddress(Form("%s_charge", branchNamePrefix.c_str()), &winfo->charge);
-    tree->SetBranchAddress(Form("%s_t2", branchNamePrefix.c_str()), &winfo->t2);
-    tree->SetBranchAddress(Form("%s_t2_10", branchNamePrefix.c_str()), &winfo->t2_10);
-    tree->SetBranchAddress(Form("%s_t2_50", branchNamePrefix.c_str()), &winfo->t2_50);
-    tree->SetBranchAddress(Form("%s_t2_90", branchNamePrefix.c_str()), &winfo->t2_90);
-    tree->SetBranchAddress(Form("%s_q_10", branchNamePrefix.c_str()), &winfo->charge_10);
-    tree->SetBranchAddress(Form("%s_q_50", branchNamePrefix.c_str()), &winfo->charge_50);
-    tree->SetBranchAddress(Form("%s_q_90", branchNamePrefix.c_str()), &winfo->charge_90);
-    tree->SetBranchAddress(Form("%s_q_pm2ns", branchNamePrefix.c_str()), &winfo->charge_pm2ns);
-    tree->SetBranchAddress(Form("%s_q_full", branchNamePrefix.c_str()), &winfo->charge_full);
-    tree->SetBranchAddress(Form("%s_t_min", branchNamePrefix.c_str()), &winfo->t_min);
-    tree->SetBranchAddress(Form("%s_amp_min", branchNamePrefix.c_str()), &winfo->amp_min);
+    for (const auto &field : GetWaveInfoFields())
+    {
+        std::string name = branchNamePrefix + "_" + field.name;
+        if (tree->GetBranch(name.c_str()))
+            tree->SetBranchAddress(name.c_str(), (char *)winfo + field.offset);
+        else if (field.type == 'D')
+            *(double *)((char *)winfo + field.offset) = kFeatureSkipped; // written with a feature mask
+    }
+}
+
+namespace
+{
+    // Members of _pulse_list and their branch names after the channel prefix
+    const std::pair<const char *, std::vector<double> WFDataProcessor::_pulse_list::*> kPulseMembers[] = {
+        {"pulse_amp", &WFDataProcessor::_pulse_list::amp},
+        {"pulse_toa", &WFDataProcessor::_pulse_list::toa},
+        {"pulse_charge", &WFDataProcessor::_pulse_list::charge},
+        {"pulse_width", &WFDataProcessor::_pulse_list::width},
+    };
+
+    // Members of _tot_list and their branch names after the channel prefix
+    const std::pair<const char *, std::vector<double> WFDataProcessor::_tot_list::*> kTotMembers[] = {
+        {"tot_lead", &WFDataProcessor::_tot_list::t_lead},
+        {"tot_trail", &WFDataProcessor::_tot_list::t_trail},
+        {"tot", &WFDataProcessor::_tot_list::tot},
+    };
+}
+
+void WFDataProcessor::GenerateBranchForPulses(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_pulse_list *pulses)
+{
+    for (const auto &member : kPulseMembers)
+        tree->Branch((branchNamePrefix + "_" + member.first).c_str(), &(pulses->*member.second));
+}
+
+bool WFDataProcessor::SetBranchAddressToPulses(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_pulse_list *pulses)
+{
+    bool found = true;
+    for (const auto &member : kPulseMembers)
+    {
+        // Object branches keep a pointer to the vector, SetObject binds the vector itself
+        TBranch *branch = tree->GetBranch((branchNamePrefix + "_" + member.first).c_str());
+        if (branch)
+            branch->SetObject(&(pulses->*member.second));
+        found &= branch != nullptr;
+    }
+    return found;
+}
+
+void WFDataProcessor::GenerateBranchForTot(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_tot_list *tot)
+{
+    for (const auto &member : kTotMembers)
+        tree->Branch((branchNamePrefix + "_" + member.first).c_str(), &(tot->*member.second));
+}
+
+bool WFDataProcessor::SetBranchAddressToTot(TTree *tree, const std::string &branchNamePrefix, WFDataProcessor::_tot_list *tot)
+{
+    bool found = true;
+    for (const auto &member : kTotMembers)
+    {
+        TBranch *branch = tree->GetBranch((branchNamePrefix + "_" + member.first).c_str());
+        if (branch)
+            branch->SetObject(&(tot->*member.second));
+        found &= branch != nullptr;
+    }
+    return found;
+}
+
+void WFDataProcessor::WaveInfoArrayBuffer::Allocate(int nch)
+{
+    const auto &fields = GetWaveInfoFields();
+    fColumns.resize(fields.size());
+    for (size_t i = 0; i < fields.size(); i++)
+        fColumns[i].assign(fields[i].size * nch, 0);
+}
+
+void WFDataProcessor::WaveInfoArrayBuffer::Clear()
+{
+    fChannels.clear();
+    fmSlot.clear();
+    fColumns.clear();
+}
+
+void WFDataProcessor::WaveInfoArrayBuffer::Branch(TTree *tree, const std::vector<int> &channels, uint32_t features)
+{
+    Clear();
+    fChannels = channels;
+    for (size_t slot = 0; slot < fChannels.size(); slot++)
+        fmSlot[fChannels[slot]] = slot;
+    Allocate(fChannels.size());
+
+    int nch = fChannels.size();
+    tree->Branch("ch_id", fChannels.data(), Form("ch_id[%d]/I", nch));
+    const auto &fields = GetWaveInfoFields();
+    for (size_t i = 0; i < fields.size(); i++)
+        if (IsFeatureSelected(features, i))
+            tree->Branch(fields[i].name, fColumns[i].data(), Form("%s[%d]/%c", fields[i].name, nch, fields[i].type));
+}
+
+bool WFDataProcessor::WaveInfoArrayBuffer::SetBranchAddress(TTree *tree)
+{
+    Clear();
+    auto leaf = tree->GetLeaf("ch_id");
+    if (!leaf)
+    {
+        std::cerr << "Tree has no ch_id branch, not a feature array layout." << std::endl;
+        return false;
+    }
+    int nch = leaf->GetLenStatic();
+    fChannels.assign(nch, -1);
+    Allocate(nch);
+
+    // The channel list is the same for every entry, read it once from the first entry
+    TBranch *brChId = nullptr;
+    tree->SetBranchAddress("ch_id", fChannels.data(), &brChId);
+    if (tree->LoadTree(0) >= 0 && brChId)
+        brChId->GetEntry(0);
+    for (int slot = 0; slot < nch; slot++)
+        fmSlot[fChannels[slot]] = slot;
+
+    const auto &fields = GetWaveInfoFields();
+    for (size_t i = 0; i < fields.size(); i++)
+    {
+        if (tree->GetBranch(fields[i].name))
+            tree->SetBranchAddress(fields[i].name, fColumns[i].data());
+        else if (fields[i].type == 'D')
+            std::fill((double *)fColumns[i].data(), (double *)fColumns[i].data() + nch, kFeatureSkipped);
+    }
+    return true;
+}
+
+void WFDataProcessor::WaveInfoArrayBuffer::Pack(const std::map<int, _waveinfo *> &chData)
+{
+    const auto &fields = GetWaveInfoFields();
+    for (const auto &pair : chData)
+    {
+        auto iter = fmSlot.find(pair.first);
+        if (iter == fmSlot.end())
+            continue;
+        const char *src = (const char *)pair.second;
+        for (size_t i = 0; i < fields.size(); i++)
+            std::memcpy(fColumns[i].data() + iter->second * fields[i].size, src + fields[i].offset, fields[i].size);
+    }
+}
+
+void WFDataProcessor::WaveInfoArrayBuffer::Unpack(const std::map<int, _waveinfo *> &chData, const std::set<int> &channels, const std::vector<int> &fieldIndices) const
+{
+    const auto &fields = GetWaveInfoFields();
+    const int nFields = fieldIndices.empty() ? fields.size() : fieldIndices.size();
+    for (const auto &pair : chData)
+    {
+        auto iter = fmSlot.find(pair.first);
+        if (iter == fmSlot.end() || (!channels.empty() && !channels.count(pair.first)))
+            continue;
+        char *dst = (char *)pair.second;
+        for (int k = 0; k < nFields; k++)
+        {
+            const int i = fieldIndices.empty() ? k : fieldIndices[k];
+            std::memcpy(dst + fields[i].offset, fColumns[i].data() + iter->second * fields[i].size, fields[i].size);
+        }
+    }
 }
 
 WFDataProcessor::WFDataExtractor::WFDataExtractor(std::vector<int> channelsToRead) : VMultiChannelWriter<_waveinfo>(channelsToRead)
@@ -666,6 +987,7 @@ bool WFDataProcessor::WFDataExtractor::SetExtractConfig(int channel, _extract_co
         return false;
     }
     fmChExtractConfig[channel] = config;
+    fmChEventConfig.erase(channel);
     return true;
 }
 
@@ -695,44 +1017,76 @@ bool WFDataProcessor::WFDataExtractor::ExtractFromScopeData(const std::map<int,
             return false;
         }
     }
-    // Already checked whether all channels have data when reading the data here
-    if (fForceMatch)
-    {
-        // Check if all channels have data
-        bool allHaveData = JudgeAllChannelsHaveData(chDataHasDataMap);
-        if (!allHaveData)
-            return false;
-    }
+    // Already checked whether all channels have data when reading the data here. An incomplete event is not written,
+    // its features are only extracted for the flight recorder.
+    const bool rejected = fForceMatch && !JudgeAllChannelsHaveData(chDataHasDataMap);
+    if (rejected && fFlight.GetCapacity() == 0)
+        return false;
 
-    // Extract waveform information for each channel
-    for (const auto &pair : fmChData)
-    {
-        int channel = pair.first;
-        ScopeData *chData = chDataMap.at(channel);
-        bool hasData = chDataHasDataMap.at(channel);
-        if (!hasData)
+    // Extract waveform information for each channel, those with a relative search range after their reference
+    for (int pass = 0; pass < 2; pass++)
+        for (const auto &pair : fmChData)
         {
-            fmChDataHasData[channel] = false;
-            continue;
+            int channel = pair.first;
+            if ((fmChExtractConfig.at(channel).relative_range.reference >= 0) != (pass == 1))
+                continue;
+            ScopeData *chData = chDataMap.at(channel);
+            bool hasData = chDataHasDataMap.at(channel);
+            if (!hasData)
+            {
+                fmChDataHasData[channel] = false;
+                if (fmChPulses.count(channel))
+                    fmChPulses[channel].Clear();
+                if (fmChTot.count(channel))
+                    fmChTot[channel].Clear();
+                continue;
+            }
+            const _extract_config &config = EventConfig(channel, chDataHasDataMap);
+            // One workspace per channel, so that filter and template designs are only made once
+            _wave_workspace &workspace = fmChWorkspace[channel];
+            // Records read with ScopeData::InitRawData only hold the ADC codes
+            const bool rawOnly = chData->getX().empty() && !chData->getRawData().empty();
+            const double *record = nullptr; // amplitudes the features were extracted from, kept for plotting
+            if (rawOnly)
+                WFDataProcessor::processWaveRaw(*chData, *pair.second, config, workspace);
+            else
+                record = ExtractFeatures(chData->getX().data(), chData->getY().data(), chData->getX().size(), *pair.second, config, workspace);
+            if (rejected)
+                continue; // no averages, plots or branches for an event that is not written
+            if (config.noise_spectrum.length > 0)
+                AccumulateNoise(chData, rawOnly, config, fmChNoise[channel]);
+            if (config.pulse_shape.step > 0)
+                AccumulatePulse(channel, chData, record, *pair.second, config, workspace);
+            if (config.need_draw && IsPlotSelected(channel, *pair.second))
+                QueuePlot(*pair.second, chData, record, config, workspace);
+            fmChDataHasData[channel] = true;
+            // Vector assignment reuses the capacity of the previous events
+            auto itPulses = fmChPulses.find(channel);
+            if (itPulses != fmChPulses.end())
+                itPulses->second = workspace.pulses;
+            auto itTot = fmChTot.find(channel);
+            if (itTot != fmChTot.end())
+                itTot->second = workspace.tot;
         }
-        _extract_config config = fmChExtractConfig.at(channel);
-        if (config.need_draw)
-            config.savePrefix += "_counter_" + std::to_string(fExtractedCounter);
-
-        WFDataProcessor::processWave(chData->getX().data(), chData->getY().data(), chData->getX().size(), *pair.second, config);
-        fmChDataHasData[channel] = true;
-    }
+    if (fFlight.GetCapacity() > 0)
+        RecordFlight(chDataMap, chDataHasDataMap);
+    if (rejected)
+        return false;
     // Increment extracted counter
     fExtractedCounter++;
 
-    if (fTree)
-        fTree->Fill();
-
-    return true;
+    if (fLayout == kFeatureArrays)
+        fArrays.Pack(fmChData);
+    return FillTree();
 }
 
 bool WFDataProcessor::WFDataExtractor::ExtractFromTRCFiles(const std::string &folder, int idx_file, std::string mid_name, std::string ext)
 {
+    fFileIndex = idx_file;
+    fLastSkipped = IsProcessed(idx_file);
+    if (fLastSkipped)
+        return true;
+
     std::map<int, ScopeData *> chDataMap;
     std::map<int, bool> chDataHasDataMap;
     for (const auto &pair : fmChData)
@@ -742,7 +1096,7 @@ bool WFDataProcessor::WFDataExtractor::ExtractFromTRCFiles(const std::string &fo
         chDataHasDataMap[channel] = false;
     }
 
-    ReadAllWF(folder, idx_file, chDataMap, chDataHasDataMap, mid_name, ext);
+    ReadAllWF(folder, idx_file, chDataMap, chDataHasDataMap, mid_name, ext, fDecodeRaw);
     auto rtn = ExtractFromScopeData(chDataMap, chDataHasDataMap);
 
     for (const auto &pair : chDataMap)
@@ -752,11 +1106,25 @@ bool WFDataProcessor::WFDataExtractor::ExtractFromTRCFiles(const std::string &fo
 
 bool WFDataProcessor::WFDataExtractor::ExtractFromWFtrc2ROOT(const WFDataProcessor::WFtrc2ROOT &convertor)
 {
+    fFileIndex = convertor.GetFileIndex();
+    fLastSkipped = IsProcessed(fFileIndex);
+    if (fLastSkipped)
+        return true;
+    if (convertor.GetLastSkipped())
+    {
+        std::cerr << "Waveform index " << fFileIndex << " was skipped by the converter, no data to extract." << std::endl;
+        return false;
+    }
     return ExtractFromScopeData(convertor.GetChannelDataMap(), convertor.GetChannelDataHasDataMap());
 }
 
 bool WFDataProcessor::WFDataExtractor::ExtractFromWFROOTReader(const WFDataProcessor::WFROOTReader &reader)
 {
+    fFileIndex = reader.GetFileIndex();
+    fLastSkipped = fFileIndex >= 0 && IsProcessed(fFileIndex);
+    if (fLastSkipped)
+        return true;
+
     std::map<int, ScopeData *> readDataMap;
     std::map<int, bool> readDataHasDataMap;
     for (auto &pair : reader.GetChannelDataMap())
@@ -780,9 +1148,363 @@ bool WFDataProcessor::WFDataExtractor::TurnOnPlot(int channel, const std::string
     }
     fmChExtractConfig[channel].need_draw = bswitch;
     fmChExtractConfig[channel].savePrefix = savePrefix;
+    fmChEventConfig.erase(channel);
     return true;
 }
 
+bool WFDataProcessor::WFDataExtractor::IsPlotSelected(int channel, const _waveinfo &winfo) const
+{
+    if (fPlotPolicy.every > 1 && fExtractedCounter % fPlotPolicy.every != 0)
+        return false;
+    if (fPlotPolicy.invalid_only && winfo.valid == VALID)
+        return false;
+    return !fPlotPolicy.predicate || fPlotPolicy.predicate(channel, winfo);
+}
+
+void WFDataProcessor::WFDataExtractor::QueuePlot(const _waveinfo &winfo, ScopeData *chData, const double *record, const _extract_config &config, _wave_workspace &workspace)
+{
+    if (record == nullptr)
+    {
+        // Extracted from the raw codes: decode this event only, and filter it as the kernel did
+        chData->DecodeRawData();
+        record = chData->getY().data();
+        if (workspace.filtered_samples > 0)
+        {
+            if (workspace.filtered.size() < chData->getY().size())
+                workspace.filtered.resize(chData->getY().size());
+            FilterRecord(record, chData->getY().size(), workspace.filter, workspace.filtered.data());
+            record = workspace.filtered.data();
+        }
+    }
+    FillPlotJob(chData->getX().data(), record, chData->getX().size(), winfo, config, fPlotJob);
+    fPlotJob.savePrefix = config.savePrefix + "_counter_" + std::to_string(fExtractedCounter);
+    fRenderer.Submit(fPlotJob);
+}
+
+void WFDataProcessor::WFDataExtractor::AccumulateNoise(const ScopeData *chData, bool rawOnly, const _extract_config &config, _noise_spectrum &spectrum)
+{
+    if (rawOnly)
+    {
+        // First sample at the start of the search range on the implicit time axis, 0 if outside as in FindSearchWindow
+        const _sample_scale scale = GetSampleScale(*chData);
+        const int Nsamples = chData->getRawSampleCount();
+        const double dt_ns = scale.horiz_interval * 1e9;
+        int up = dt_ns > 0 ? static_cast<int>(std::ceil((config.search_range.first - scale.horiz_offset * 1e9) / dt_ns)) : 0;
+        if (up < 0 || up >= Nsamples)
+            up = 0;
+        const std::vector<char> &raw = chData->getRawData();
+        if (chData->getRawSampleSize() == 1)
+            AccumulateNoiseSpectrum(reinterpret_cast<const int8_t *>(raw.data()), Nsamples, up, scale.vertical_gain * 1e3, dt_ns, config.noise_spectrum, spectrum);
+        else
+            AccumulateNoiseSpectrum(reinterpret_cast<const int16_t *>(raw.data()), Nsamples, up, scale.vertical_gain * 1e3, dt_ns, config.noise_spectrum, spectrum);
+        return;
+    }
+    const std::vector<double> &t = chData->getX();
+    const int Nsamples = t.size();
+    int up = 0, down = Nsamples - 1;
+    if (Nsamples > 1)
+        FindSearchWindow(t.data(), Nsamples, config.search_range, up, down);
+    const double dt_ns = Nsamples > 1 ? (t.back() - t.front()) / (Nsamples - 1) * 1e9 : 0;
+    AccumulateNoiseSpectrum(chData->getY().data(), Nsamples, up, 1e3, dt_ns, config.noise_spectrum, spectrum);
+}
+
+void WFDataProcessor::WFDataExtractor::AccumulatePulse(int channel, const ScopeData *chData, const double *record, const _waveinfo &winfo,
+                                                       const _extract_config &config, const _wave_workspace &workspace)
+{
+    const _pulse_shape_config &shape = config.pulse_shape;
+    if (winfo.valid != VALID || !(winfo.toa > -100e9) || (shape.normalize && !(winfo.amp > 0)))
+        return;
+    int ampClass = 0;
+    if (!shape.amp_bins.empty())
+    {
+        ampClass = static_cast<int>(std::upper_bound(shape.amp_bins.begin(), shape.amp_bins.end(), winfo.amp) - shape.amp_bins.begin()) - 1;
+        if (ampClass < 0 || ampClass + 1 >= static_cast<int>(shape.amp_bins.size()))
+            return;
+    }
+    _average_pulse &average = fmPulseShapes[std::make_tuple(channel, fScanPosition, ampClass)];
+    const double scale = shape.normalize ? 1.0 / winfo.amp : 1.0;
+    const double ped_start = winfo.ped_start;
+    if (record != nullptr)
+    {
+        const std::vector<double> &t = chData->getX();
+        const int Nsamples = t.size();
+        if (Nsamples < 2)
+            return;
+        const double dt_ns = (t.back() - t.front()) / (Nsamples - 1) * 1e9;
+        AccumulatePulseShape(Nsamples, t.front() * 1e9, dt_ns, winfo.toa, scale, [record, ped_start](int i)
+                             { return record[i] * 1e3 - ped_start; }, shape, average);
+        return;
+    }
+
+    // Raw codes, or the filtered record the features were extracted from (codes, or volts if the kernel decoded them)
+    const _sample_scale sampleScale = GetSampleScale(*chData);
+    const int Nsamples = chData->getRawSampleCount();
+    const double t0_ns = sampleScale.horiz_offset * 1e9, dt_ns = sampleScale.horiz_interval * 1e9;
+    const double mv_per_code = sampleScale.vertical_gain * 1e3;
+    if (workspace.filtered_samples == Nsamples)
+    {
+        const double *filtered = workspace.filtered.data();
+        const double mv_per_unit = workspace.filtered_gain * 1e3, offset = workspace.filtered_offset * 1e3 + ped_start;
+        AccumulatePulseShape(Nsamples, t0_ns, dt_ns, winfo.toa, scale, [filtered, mv_per_unit, offset](int i)
+                             { return mv_per_unit * filtered[i] - offset; }, shape, average);
+        return;
+    }
+    const double offset = sampleScale.vertical_offset * 1e3 + ped_start;
+    const std::vector<char> &raw = chData->getRawData();
+    if (chData->getRawSampleSize() == 1)
+    {
+        const int8_t *codes = reinterpret_cast<const int8_t *>(raw.data());
+        AccumulatePulseShape(Nsamples, t0_ns, dt_ns, winfo.toa, scale, [codes, mv_per_code, offset](int i)
+                             { return mv_per_code * codes[i] - offset; }, shape, average);
+    }
+    else
+    {
+        const int16_t *codes = reinterpret_cast<const int16_t *>(raw.data());
+        AccumulatePulseShape(Nsamples, t0_ns, dt_ns, winfo.toa, scale, [codes, mv_per_code, offset](int i)
+                             { return mv_per_code * codes[i] - offset; }, shape, average);
+    }
+}
+
+const WFDataProcessor::_average_pulse *WFDataProcessor::WFDataExtractor::GetAveragePulse(int channel, int position, int ampClass) const
+{
+    auto it = fmPulseShapes.find(std::make_tuple(channel, position, ampClass));
+    return it != fmPulseShapes.end() && it->second.count > 0 ? &it->second : nullptr;
+}
+
+namespace
+{
+    // "_posP" and "_ampK" suffixes of the histograms of an average pulse
+    std::string PulseShapeSuffix(int position, int ampClass, const WFDataProcessor::_pulse_shape_config &shape)
+    {
+        std::string suffix = position >= 0 ? Form("_pos%d", position) : "";
+        if (!shape.amp_bins.empty())
+            suffix += Form("_amp%d", ampClass);
+        return suffix;
+    }
+}
+
+const WFDataProcessor::_average_pulse &WFDataProcessor::WFDataExtractor::ResumedAveragePulse(const std::tuple<int, int, int> &key,
+                                                                                             const _pulse_shape_config &shape)
+{
+    // Read before the first write into this file, later writes overwrite the histograms with the merged average
+    auto it = fmPulseShapesResumed.find(key);
+    if (it != fmPulseShapesResumed.end())
+        return it->second;
+    _average_pulse &resumed = fmPulseShapesResumed[key];
+    if (!fResume || !fFile)
+        return resumed;
+    int channel, position, ampClass;
+    std::tie(channel, position, ampClass) = key;
+    const std::string suffix = PulseShapeSuffix(position, ampClass, shape);
+    const std::string meanName = Form("ch%d_pulse_mean%s", channel, suffix.c_str());
+    const std::string rmsName = Form("ch%d_pulse_rms%s", channel, suffix.c_str());
+    auto mean = (TH1D *)fFile->Get(meanName.c_str());
+    auto rms = (TH1D *)fFile->Get(rmsName.c_str());
+    if (mean && rms && mean->GetEntries() > 0)
+    {
+        const int points = shape.Points();
+        if (mean->GetNbinsX() == points && rms->GetNbinsX() == points && std::fabs(mean->GetBinWidth(1) - shape.step) <= 1e-6 * shape.step)
+        {
+            resumed.count = std::llround(mean->GetEntries());
+            resumed.mean.resize(points);
+            resumed.m2.resize(points);
+            for (int j = 0; j < points; j++)
+            {
+                const double spread = rms->GetBinContent(j + 1);
+                resumed.mean[j] = mean->GetBinContent(j + 1);
+                resumed.m2[j] = spread * spread * resumed.count;
+            }
+        }
+        else
+            std::cerr << meanName << " in " << fFile->GetName() << " is on another grid, overwritten with the new pulses only." << std::endl;
+    }
+    delete mean;
+    delete rms;
+    return resumed;
+}
+
+bool WFDataProcessor::WFDataExtractor::WritePulseShapes()
+{
+    if (!fFile || !fFile->IsWritable())
+        return false;
+    fFile->cd();
+    for (const auto &pair : fmPulseShapes)
+    {
+        int channel, position, ampClass;
+        std::tie(channel, position, ampClass) = pair.first;
+        auto itConfig = fmChExtractConfig.find(channel);
+        if (pair.second.count == 0 || itConfig == fmChExtractConfig.end())
+            continue;
+        const _pulse_shape_config &shape = itConfig->second.pulse_shape;
+        const int points = pair.second.mean.size();
+        if (points != shape.Points())
+            continue;
+        // Pulses already in a resumed file and those of this job
+        _average_pulse average = pair.second;
+        MergeAveragePulse(ResumedAveragePulse(pair.first, shape), average);
+        const std::string suffix = PulseShapeSuffix(position, ampClass, shape);
+        const char *unit = shape.normalize ? "Amplitude / amp" : "Amplitude (mV)";
+        const std::string meanName = Form("ch%d_pulse_mean%s", channel, suffix.c_str());
+        const std::string rmsName = Form("ch%d_pulse_rms%s", channel, suffix.c_str());
+        // Bins centred on the grid points
+        const double low = shape.Time(0) - 0.5 * shape.step, high = shape.Time(points - 1) + 0.5 * shape.step;
+        TH1D mean(meanName.c_str(), Form("Average pulse of channel %d;Time - toa (ns);%s", channel, unit), points, low, high);
+        TH1D rms(rmsName.c_str(), Form("Spread of the pulses of channel %d;Time - toa (ns);%s", channel, unit), points, low, high);
+        mean.SetDirectory(nullptr);
+        rms.SetDirectory(nullptr);
+        for (int j = 0; j < points; j++)
+        {
+            mean.SetBinContent(j + 1, average.mean[j]);
+            mean.SetBinError(j + 1, average.StdDev(j) / std::sqrt(static_cast<double>(average.count)));
+            rms.SetBinContent(j + 1, average.StdDev(j));
+        }
+        mean.SetEntries(average.count);
+        rms.SetEntries(average.count);
+        mean.Write("", TObject::kOverwrite);
+        rms.Write("", TObject::kOverwrite);
+    }
+    return true;
+}
+
+const WFDataProcessor::_noise_spectrum *WFDataProcessor::WFDataExtractor::GetNoiseSpectrum(int channel)
+{
+    auto it = fmChNoise.find(channel);
+    if (it == fmChNoise.end())
+        return nullptr;
+    FinishNoiseSpectrum(it->second);
+    return &it->second;
+}
+
+const WFDataProcessor::_noise_spectrum &WFDataProcessor::WFDataExtractor::ResumedNoiseSpectrum(int channel)
+{
+    // Read before the first write into this file, later writes overwrite the histogram with the merged average
+    auto it = fmChNoiseResumed.find(channel);
+    if (it != fmChNoiseResumed.end())
+        return it->second;
+    _noise_spectrum &resumed = fmChNoiseResumed[channel];
+    auto hist = (fResume && fFile) ? (TH1D *)fFile->Get(Form("ch%d_noise_psd", channel)) : nullptr;
+    if (hist && hist->GetNbinsX() >= 3 && hist->GetEntries() > 0)
+    {
+        const int bins = hist->GetNbinsX();
+        resumed.config.length = 2 * (bins - 1);
+        resumed.dt = 1.0 / (resumed.config.length * hist->GetBinWidth(1));
+        resumed.events = std::llround(hist->GetEntries());
+        resumed.power.resize(bins);
+        for (int k = 0; k < bins; k++)
+            resumed.power[k] = hist->GetBinContent(k + 1);
+    }
+    delete hist;
+    return resumed;
+}
+
+bool WFDataProcessor::WFDataExtractor::WriteNoiseSpectra()
+{
+    if (!fFile || !fFile->IsWritable())
+        return false;
+    fFile->cd();
+    for (auto &pair : fmChNoise)
+    {
+        _noise_spectrum spectrum = pair.second;
+        if (!MergeNoiseSpectrum(ResumedNoiseSpectrum(pair.first), spectrum))
+            std::cerr << "Noise spectrum of channel " << pair.first << " in " << fFile->GetName()
+                      << " has other bins or another sampling, overwritten with the new events only." << std::endl;
+        if (spectrum.events == 0)
+            continue;
+        // Bins centred on the frequencies of the FFT
+        const int bins = spectrum.power.size();
+        const double df = spectrum.Frequency(1);
+        const std::string name = Form("ch%d_noise_psd", pair.first);
+        TH1D hist(name.c_str(), Form("Noise spectrum of channel %d;Frequency (GHz);PSD (mV^{2}/GHz)", pair.first), bins, -0.5 * df, (bins - 0.5) * df);
+        hist.SetDirectory(nullptr);
+        for (int k = 0; k < bins; k++)
+            hist.SetBinContent(k + 1, spectrum.power[k]);
+        hist.SetEntries(spectrum.events);
+        hist.Write("", TObject::kOverwrite);
+        if (spectrum.skipped > 0)
+            std::cout << "Noise spectrum of channel " << pair.first << ": " << spectrum.events << " segments, " << spectrum.skipped
+                      << " events skipped (no full segment before the search range, or another sampling)" << std::endl;
+    }
+    return true;
+}
+
+void WFDataProcessor::WFDataExtractor::SetFlightPolicy(const _flight_policy &policy)
+{
+    fFlightPolicy = policy;
+    fFlight.SetCapacity(policy.capacity);
+    fFlight.Reserve(fmChData.size(), 0);
+    fFlightTriggers = 0;
+    fFlightDumps = 0;
+}
+
+bool WFDataProcessor::WFDataExtractor::DumpFlightRecorder(const std::string &filename)
+{
+    return fFlight.Dump(filename.empty() ? fFlightPolicy.prefix + "_" + std::to_string(fExtractedCounter) + ".root" : filename);
+}
+
+bool WFDataProcessor::WFDataExtractor::IsFlightTrigger(int channel, const _waveinfo &winfo) const
+{
+    if (fFlightPolicy.valid_mask != 0 && (static_cast<uint32_t>(winfo.valid) & fFlightPolicy.valid_mask) != 0)
+        return true;
+    if (fFlightPolicy.amp_above > 0 && winfo.amp > fFlightPolicy.amp_above)
+        return true;
+    return fFlightPolicy.trigger && fFlightPolicy.trigger(channel, winfo);
+}
+
+void WFDataProcessor::WFDataExtractor::RecordFlight(const std::map<int, ScopeData *> &chDataMap, const std::map<int, bool> &chDataHasDataMap)
+{
+    // Every slot is grown to the longest record of the event, so that the copies do not allocate past the first events
+    int nSamples = 0;
+    for (const auto &pair : fmChData)
+        if (chDataHasDataMap.at(pair.first))
+        {
+            const ScopeData &data = *chDataMap.at(pair.first);
+            nSamples = std::max<int>(nSamples, data.getRawData().empty() ? data.getY().size() : data.getRawSampleCount());
+        }
+    fFlight.Reserve(fmChData.size(), nSamples);
+
+    // Copies into the slot, then the trigger conditions on the new event. The features of a channel without data are
+    // those of an earlier event, it is kept as NO_WAVEFORM.
+    _waveinfo missing{};
+    missing.valid = NO_WAVEFORM;
+    _recorded_event &slot = fFlight.NextSlot();
+    slot.event = fExtractedCounter;
+    slot.file_index = fFileIndex;
+    bool trigger = false;
+    int k = 0;
+    for (const auto &pair : fmChData)
+    {
+        _recorded_channel &channel = slot.channels[k++];
+        channel.channel = pair.first;
+        const bool hasData = chDataHasDataMap.at(pair.first);
+        const _waveinfo &winfo = hasData ? *pair.second : missing;
+        WFFlightRecorder::Record(*chDataMap.at(pair.first), hasData, winfo, channel);
+        trigger |= IsFlightTrigger(pair.first, winfo);
+    }
+    fFlight.Commit();
+
+    if (trigger)
+        fFlightTriggers++;
+    if (trigger && fFlightDumps < fFlightPolicy.max_dumps && DumpFlightRecorder())
+        fFlightDumps++;
+    if (fFlight.DumpRequested())
+        DumpFlightRecorder();
+}
+
+void WFDataProcessor::WFDataExtractor::CloseFile()
+{
+    WriteNoiseSpectra();
+    WritePulseShapes();
+    VMultiChannelWriter<_waveinfo>::CloseFile();
+}
+
+WFDataProcessor::WFDataExtractor::~WFDataExtractor()
+{
+    if (fFlightPolicy.dump_at_end && fFlight.Size() > 0)
+        DumpFlightRecorder();
+    // The base destructor would only run the base CloseFile
+    CloseFile();
+}
+
 int WFDataProcessor::WFDataExtractor::TurnOnPlots(const std::string &savePrefix, bool bswitch)
 {
     int setCount = 0;
@@ -801,27 +1523,132 @@ bool WFDataProcessor::WFDataExtractor::InitTree()
     auto rtn = VMultiIO::InitTree();
     if (!rtn)
         return false;
+    // The averages written into a file (or part of a split output) cover its own events
+    fmChNoise.clear();
+    fmChNoiseResumed.clear();
+    fmPulseShapes.clear();
+    fmPulseShapesResumed.clear();
 
-    fTree = new TTree("waveinfo", "Extracted waveform information");
+    if (!AttachTree(GetTreeName()))
+        return false;
+    if (fTree)
+    {
+        // Keep the layout of the resumed tree, whatever was requested
+        fLayout = WaveInfoArrayBuffer::IsFeatureArrayTree(fTree) ? kFeatureArrays : kScalarBranches;
+        InitVectorBranches(false);
+        if (fLayout == kFeatureArrays)
+            return fArrays.SetBranchAddress(fTree);
+        for (const auto &pair : fmChData)
+            SetBranchAddressToWaveInfo(fTree, Form("ch%d", pair.first), pair.second);
+        return true;
+    }
+
+    fTree = new TTree(GetTreeName(), "Extracted waveform information");
     fTree->SetDirectory(fFile);
 
-    for (const auto &pair : fmChData)
+    if (fLayout == kFeatureArrays)
     {
-        int channel = pair.first;
-        GenerateBranchForWaveInfo(fTree, Form("ch%d", channel), pair.second);
+        // The arrays are shared by all channels, a field is written if any channel computes it
+        std::vector<int> channels;
+        uint32_t features = 0;
+        for (const auto &pair : fmChData)
+        {
+            channels.push_back(pair.first);
+            features |= fmChExtractConfig[pair.first].features;
+        }
+        fArrays.Branch(fTree, channels, features);
     }
+    else
+    {
+        for (const auto &pair : fmChData)
+        {
+            int channel = pair.first;
+            GenerateBranchForWaveInfo(fTree, Form("ch%d", channel), pair.second, fmChExtractConfig[channel].features);
+        }
+    }
+    InitVectorBranches(true);
+    fTree->Branch("file_index", &fFileIndex, "file_index/I");
     return true;
 }
 
+void WFDataProcessor::WFDataExtractor::InitVectorBranches(bool create)
+{
+    // Per-channel branches in both layouts, only for the channels with the pulse finder on or with threshold levels
+    fmChPulses.clear();
+    fmChTot.clear();
+    for (const auto &pair : fmChExtractConfig)
+    {
+        if (!fmChData.count(pair.first))
+            continue;
+        if (pair.second.find_pulses)
+        {
+            _pulse_list *pulses = &fmChPulses[pair.first];
+            if (create)
+                GenerateBranchForPulses(fTree, Form("ch%d", pair.first), pulses);
+            else if (!SetBranchAddressToPulses(fTree, Form("ch%d", pair.first), pulses))
+            {
+                std::cerr << "Resumed tree has no pulse branches for channel " << pair.first << ", its pulses are not written." << std::endl;
+                fmChPulses.erase(pair.first);
+            }
+        }
+        if (!pair.second.tot_thresholds.empty())
+        {
+            _tot_list *tot = &fmChTot[pair.first];
+            if (create)
+                GenerateBranchForTot(fTree, Form("ch%d", pair.first), tot);
+            else if (!SetBranchAddressToTot(fTree, Form("ch%d", pair.first), tot))
+            {
+                std::cerr << "Resumed tree has no multi-threshold branches for channel " << pair.first << ", its crossings are not written." << std::endl;
+                fmChTot.erase(pair.first);
+            }
+        }
+    }
+}
+
+const WFDataProcessor::_extract_config &WFDataProcessor::WFDataExtractor::EventConfig(int channel, const std::map<int, bool> &chDataHasDataMap)
+{
+    const _extract_config &config = fmChExtractConfig.at(channel);
+    const int reference = config.relative_range.reference;
+    if (reference < 0)
+        return config;
+    // Only the search range of the copy changes from event to event, it keeps the capacity of its vectors
+    auto itEvent = fmChEventConfig.find(channel);
+    if (itEvent == fmChEventConfig.end())
+        itEvent = fmChEventConfig.emplace(channel, config).first;
+    _extract_config &eventConfig = itEvent->second;
+
+    // A reference which is itself relative was extracted in the same pass, its toa may be of the previous event
+    double toa = -100e9;
+    auto itData = fmChData.find(reference);
+    auto itHasData = chDataHasDataMap.find(reference);
+    if (reference != channel && itData != fmChData.end() && itHasData != chDataHasDataMap.end() && itHasData->second &&
+        fmChExtractConfig.at(reference).relative_range.reference < 0)
+        toa = itData->second->toa;
+    eventConfig.search_range = RelativeSearchRange(config, toa);
+    return eventConfig;
+}
+
 void WFDataProcessor::WFDataExtractor::ClearMap()
 {
     VMultiIO::ClearMap();
     fmChExtractConfig.clear();
+    fmChPulses.clear();
+    fmChTot.clear();
+    fmChWorkspace.clear();
+    fmChNoise.clear();
+    fmChEventConfig.clear();
+    fmPulseShapes.clear();
     fExtractedCounter = 0;
 }
 
 bool WFDataProcessor::WFtrc2ROOT::ReadAllAndFill(const std::string &folder, int idx_file, std::string mid_name, std::string ext)
 {
+    // Already stored by a previous (interrupted) job
+    fFileIndex = idx_file;
+    fLastSkipped = IsProcessed(idx_file);
+    if (fLastSkipped)
+        return true;
+
     auto rtn = ReadAllWF(folder, idx_file, fmChData, fmChDataHasData, mid_name, ext);
 
     // If force match is enabled, check if all channels have data
@@ -829,12 +1656,10 @@ bool WFDataProcessor::WFtrc2ROOT::ReadAllAndFill(const std::string &folder, int
         return false;
 
     // Fill the tree
-    if (fTree)
-        fTree->Fill();
-    return true;
+    return FillTree();
 }
 
-bool WFDataProcessor::ReadAllWF(const std::string &folder, int idx_lecroy_wf, std::map<int, ScopeData *> &chDataMap, std::map<int, bool> &chDataHasDataMap, std::string mid_name, std::string ext)
+bool WFDataProcessor::ReadAllWF(const std::string &folder, int idx_lecroy_wf, std::map<int, ScopeData *> &chDataMap, std::map<int, bool> &chDataHasDataMap, std::string mid_name, std::string ext, bool rawOnly)
 {
     bool rtn = true;
     for (auto &pair : chDataMap)
@@ -842,7 +1667,7 @@ bool WFDataProcessor::ReadAllWF(const std::string &folder, int idx_lecroy_wf, st
         int channel = pair.first;
         ScopeData *chData = pair.second;
         std::string filepath = GenerateScopeFileName(folder, channel, idx_lecroy_wf, mid_name, ext);
-        ScopeData::errorCodes err = chData->InitData(filepath);
+        ScopeData::errorCodes err = rawOnly ? chData->InitRawData(filepath) : chData->InitData(filepath);
 
         if (err == ScopeData::kSUCCESS)
         {
@@ -864,7 +1689,16 @@ bool WFDataProcessor::WFtrc2ROOT::InitTree()
     if (!rtn)
         return false;
 
-    fTree = new TTree("waveform", "Waveforms from LeCroy .trc files");
+    if (!AttachTree(GetTreeName()))
+        return false;
+    if (fTree)
+    {
+        for (auto &pair : fmChData)
+            fTree->SetBranchAddress(Form("ch%d", pair.first), &pair.second);
+        return true;
+    }
+
+    fTree = new TTree(GetTreeName(), "Waveforms from LeCroy .trc files");
     fTree->SetDirectory(fFile);
 
     for (const auto &pair : fmChData)
@@ -872,6 +1706,7 @@ bool WFDataProcessor::WFtrc2ROOT::InitTree()
         int channel = pair.first;
         fTree->Branch(Form("ch%d", channel), pair.second);
     }
+    fTree->Branch("file_index", &fFileIndex, "file_index/I");
     return true;
 }
 
@@ -881,7 +1716,7 @@ bool WFDataProcessor::WFROOTReader::InitTree()
     if (!rtn)
         return false;
 
-    fTree = (TTree *)fFile->Get("waveform");
+    fTree = fChain ? fChain : (TTree *)fFile->Get(GetTreeName());
     if (!fTree)
         return false;
     for (const auto &pair : fmChData)
@@ -890,22 +1725,207 @@ bool WFDataProcessor::WFROOTReader::InitTree()
         *pair.second = nullptr;
         fTree->SetBranchAddress(Form("ch%d", channel), pair.second);
     }
+    if (fTree->GetBranch("file_index"))
+        fTree->SetBranchAddress("file_index", &fFileIndex);
+    ApplyBranchStatus();
     return true;
 }
 
+void WFDataProcessor::WFROOTReader::ApplyBranchStatus()
+{
+    // ScopeData is split, sub-branches are matched as "ch1.x", "ch1.y", ...
+    static const std::vector<std::string> dataMembers = {"x", "y", "verticalGain", "verticalOffset", "horizInterval", "horizOffset"};
+    fTree->SetBranchStatus("*", 0);
+    if (fTree->GetBranch("file_index"))
+        fTree->SetBranchStatus("file_index", 1);
+    for (const auto &pair : fmChData)
+    {
+        int channel = pair.first;
+        if (!IsChannelActive(channel) || !fTree->GetBranch(Form("ch%d", channel)))
+            continue;
+        fTree->SetBranchStatus(Form("ch%d", channel), 1);
+        if (fReadMetadata)
+        {
+            fTree->SetBranchStatus(Form("ch%d.*", channel), 1);
+            continue;
+        }
+        for (const auto &member : dataMembers)
+            fTree->SetBranchStatus(Form("ch%d.%s", channel, member.c_str()), 1);
+    }
+}
+
 bool WFDataProcessor::WFDataTreeReader::InitTree()
 {
     auto rtn = VMultiIO::InitTree();
     if (!rtn)
         return false;
 
-    fTree = (TTree *)fFile->Get("waveinfo");
+    fTree = fChain ? fChain : (TTree *)fFile->Get(GetTreeName());
     if (!fTree)
         return false;
+    fLayout = WaveInfoArrayBuffer::IsFeatureArrayTree(fTree) ? kFeatureArrays : kScalarBranches;
+    if (fLayout == kFeatureArrays)
+    {
+        if (!fArrays.SetBranchAddress(fTree))
+            return false;
+        for (const auto &pair : fmChData)
+            if (std::find(fArrays.GetChannels().begin(), fArrays.GetChannels().end(), pair.first) == fArrays.GetChannels().end())
+                std::cerr << "Channel " << pair.first << " not found in tree " << GetTreeName() << std::endl;
+    }
+    else
+    {
+        for (const auto &pair : fmChData)
+        {
+            int channel = pair.first;
+            SetBranchAddressToWaveInfo(fTree, Form("ch%d", channel), pair.second);
+        }
+    }
+    if (fTree->GetBranch("file_index"))
+        fTree->SetBranchAddress("file_index", &fFileIndex);
+    ApplyBranchStatus();
+    return true;
+}
+
+Long64_t WFDataProcessor::WFDataTreeReader::GetEntry(Long64_t entry)
+{
+    if (!fTree)
+        return 0;
+    auto nbytes = fTree->GetEntry(entry);
+    // Like the scalar branches, inactive channels and features keep their values
+    if (fLayout == kFeatureArrays && nbytes > 0)
+        fArrays.Unpack(fmChData, fActiveChannels, fActiveFeatures);
+    return nbytes;
+}
+
+bool WFDataProcessor::WFDataTreeReader::SetActiveFeatures(const std::vector<std::string> &features)
+{
+    bool rtn = true;
+    fActiveFeatures.clear();
+    for (const auto &feature : features)
+    {
+        int idx = FindWaveInfoField(feature);
+        if (idx < 0)
+        {
+            std::cerr << "Unknown waveinfo feature: " << feature << std::endl;
+            rtn = false;
+            continue;
+        }
+        fActiveFeatures.push_back(idx);
+    }
+    if (fTree)
+        ApplyBranchStatus();
+    return rtn;
+}
+
+std::vector<int> WFDataProcessor::WFDataTreeReader::GetActiveFieldIndices() const
+{
+    if (!fActiveFeatures.empty())
+        return fActiveFeatures;
+    std::vector<int> all(GetWaveInfoFields().size());
+    for (size_t i = 0; i < all.size(); i++)
+        all[i] = i;
+    return all;
+}
+
+void WFDataProcessor::WFDataTreeReader::ApplyBranchStatus()
+{
+    const auto &fields = GetWaveInfoFields();
+    auto active = GetActiveFieldIndices();
+
+    fTree->SetBranchStatus("*", 0);
+    if (fTree->GetBranch("file_index"))
+        fTree->SetBranchStatus("file_index", 1);
+
+    if (fLayout == kFeatureArrays)
+    {
+        // One array holds all channels, so only features can be selected
+        fTree->SetBranchStatus("ch_id", 1);
+        for (int idx : active)
+            if (fTree->GetBranch(fields[idx].name))
+                fTree->SetBranchStatus(fields[idx].name, 1);
+        return;
+    }
+
     for (const auto &pair : fmChData)
     {
         int channel = pair.first;
-        SetBranchAddressToWaveInfo(fTree, Form("ch%d", channel), pair.second);
+        if (!IsChannelActive(channel))
+            continue;
+        for (int idx : active)
+        {
+            std::string name = Form("ch%d_%s", channel, fields[idx].name);
+            if (fTree->GetBranch(name.c_str()))
+                fTree->SetBranchStatus(name.c_str(), 1);
+        }
     }
-    return true;
+}
+
+Long64_t WFDataProcessor::WFDataTreeReader::ReadBatch(Long64_t first, Long64_t nEntries, _waveinfo_columns &columns)
+{
+    columns.first = first;
+    columns.size = 0;
+    columns.file_index.clear();
+    Long64_t last = fTree && first >= 0 ? std::min(first + nEntries, fTree->GetEntries()) : first;
+    if (last <= first)
+    {
+        columns.data.clear();
+        return 0;
+    }
+
+    // Resolve the source member and destination column once, the entry loop only copies values
+    struct _binding
+    {
+        const char *src;
+        char type;
+        std::vector<double> *dst;
+    };
+    std::vector<_binding> bindings;
+    const auto &fields = GetWaveInfoFields();
+    auto active = GetActiveFieldIndices();
+    for (const auto &pair : fmChData)
+    {
+        if (!IsChannelActive(pair.first))
+            continue;
+        for (int idx : active)
+        {
+            auto &column = columns.data[pair.first][fields[idx].name];
+            column.clear();
+            column.reserve(last - first);
+            bindings.push_back({(const char *)pair.second + fields[idx].offset, fields[idx].type, &column});
+        }
+    }
+    // Columns of channels or fields read by an earlier call but no longer active, their values would be stale
+    for (auto itChannel = columns.data.begin(); itChannel != columns.data.end();)
+    {
+        auto &features = itChannel->second;
+        for (auto itFeature = features.begin(); itFeature != features.end();)
+        {
+            bool bound = false;
+            for (const auto &binding : bindings)
+                bound |= binding.dst == &itFeature->second;
+            itFeature = bound ? std::next(itFeature) : features.erase(itFeature);
+        }
+        itChannel = features.empty() ? columns.data.erase(itChannel) : std::next(itChannel);
+    }
+    columns.file_index.reserve(last - first);
+
+    for (Long64_t entry = first; entry < last; entry++)
+    {
+        if (GetEntry(entry) <= 0)
+            break;
+        for (const auto &binding : bindings)
+        {
+            double value;
+            if (binding.type == 'D')
+                value = *(const double *)binding.src;
+            else if (binding.type == 'i')
+                value = *(const uint32_t *)binding.src;
+            else
+                value = *(const int *)binding.src;
+            binding.dst->push_back(value);
+        }
+        columns.file_index.push_back(fFileIndex);
+        columns.size++;
+    }
+    return columns.size;
 }
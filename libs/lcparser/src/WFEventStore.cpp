@@ -0,0 +1,355 @@
+#include "WFEventStore.h"
+#include "WFDataConverter.h"
+#include "lcparser.h"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace WFDataProcessor::FlatStore;
+
+namespace
+{
+    uint32_t AlignTo8(uint64_t size)
+    {
+        return (uint32_t)((size + 7) / 8 * 8);
+    }
+
+    // Samples of a record, counted on the raw codes when it was read with ScopeData::InitRawData
+    size_t RecordLength(const ScopeData *chData)
+    {
+        return chData->getRawData().empty() ? chData->getY().size() : chData->getRawSampleCount();
+    }
+}
+
+WFDataProcessor::WFFlatWriter::WFFlatWriter(std::vector<int> channelsToWrite) : fChannels(channelsToWrite)
+{
+    if ((int)fChannels.size() > kMaxChannels)
+    {
+        std::cerr << "Flat event store supports at most " << kMaxChannels << " channels, extra channels are ignored." << std::endl;
+        fChannels.resize(kMaxChannels);
+    }
+    for (int channel : fChannels)
+    {
+        fmChRecord[channel] = new ScopeData();
+        fmChRecordHasData[channel] = false;
+    }
+}
+
+WFDataProcessor::WFFlatWriter::~WFFlatWriter()
+{
+    CloseFile();
+    for (auto &pair : fmChRecord)
+        delete pair.second;
+}
+
+bool WFDataProcessor::WFFlatWriter::OpenFile(const std::string &filename)
+{
+    if (fOut.is_open())
+    {
+        std::cerr << "File already opened. Close it before opening a new file." << std::endl;
+        return false;
+    }
+    fOut.open(filename, std::ios::binary | std::ios::trunc);
+    if (!fOut.is_open())
+    {
+        std::cerr << "Cannot open flat event store: " << filename << std::endl;
+        return false;
+    }
+    fFileName = filename;
+    fHeaderWritten = false;
+    fOffsets.clear();
+    return true;
+}
+
+bool WFDataProcessor::WFFlatWriter::WriteHeader(int nSamples, double horizInterval)
+{
+    std::memset(&fHeader, 0, sizeof(fHeader));
+    std::memcpy(fHeader.magic, kMagic, sizeof(kMagic));
+    fHeader.version = kVersion;
+    fHeader.nChannels = fChannels.size();
+    fHeader.nSamples = nSamples;
+    fHeader.channelBlockSize = AlignTo8(sizeof(_flat_channel_header) + sizeof(int16_t) * (uint64_t)nSamples);
+    fHeader.headerSize = AlignTo8(sizeof(_flat_file_header));
+    fHeader.eventSize = sizeof(_flat_event_header) + (uint64_t)fHeader.channelBlockSize * fHeader.nChannels;
+    fHeader.horizInterval = horizInterval;
+    for (size_t i = 0; i < fChannels.size(); i++)
+        fHeader.channels[i] = fChannels[i];
+
+    std::vector<char> header(fHeader.headerSize, 0);
+    std::memcpy(header.data(), &fHeader, sizeof(fHeader));
+    fOut.write(header.data(), header.size());
+    fEventBuffer.assign(fHeader.eventSize, 0);
+    fHeaderWritten = true;
+    return fOut.good();
+}
+
+bool WFDataProcessor::WFFlatWriter::Fill(const std::map<int, ScopeData *> &chDataMap, const std::map<int, bool> &chDataHasDataMap, int file_index)
+{
+    if (!fOut.is_open())
+        return false;
+
+    // The first event with data defines the record length of the whole file
+    if (!fHeaderWritten)
+    {
+        for (int channel : fChannels)
+        {
+            auto iter = chDataMap.find(channel);
+            auto iterHas = chDataHasDataMap.find(channel);
+            if (iter == chDataMap.end() || iterHas == chDataHasDataMap.end() || !iterHas->second)
+                continue;
+            if (!WriteHeader(RecordLength(iter->second), iter->second->getHorizInterval()))
+                return false;
+            break;
+        }
+        if (!fHeaderWritten)
+            return false;
+    }
+
+    std::memset(fEventBuffer.data(), 0, fEventBuffer.size());
+    auto evtHeader = reinterpret_cast<_flat_event_header *>(fEventBuffer.data());
+    evtHeader->file_index = file_index;
+
+    for (size_t slot = 0; slot < fChannels.size(); slot++)
+    {
+        int channel = fChannels[slot];
+        auto iter = chDataMap.find(channel);
+        auto iterHas = chDataHasDataMap.find(channel);
+        if (iter == chDataMap.end() || iterHas == chDataHasDataMap.end() || !iterHas->second)
+            continue;
+
+        const ScopeData *chData = iter->second;
+        const size_t nSamples = RecordLength(chData);
+        if (nSamples != fHeader.nSamples || chData->getVerticalGain() == 0)
+        {
+            std::cerr << "Channel " << channel << " of waveform " << file_index << " has " << nSamples
+                      << " samples, but the flat event store expects " << fHeader.nSamples << std::endl;
+            return false;
+        }
+
+        char *block = fEventBuffer.data() + sizeof(_flat_event_header) + slot * fHeader.channelBlockSize;
+        auto chHeader = reinterpret_cast<_flat_channel_header *>(block);
+        chHeader->verticalGain = chData->getVerticalGain();
+        chHeader->verticalOffset = chData->getVerticalOffset();
+        chHeader->horizOffset = chData->getHorizOffset();
+
+        auto codes = reinterpret_cast<int16_t *>(block + sizeof(_flat_channel_header));
+        const std::vector<char> &raw = chData->getRawData();
+        if (!raw.empty() && chData->getRawSampleSize() == 2)
+            std::memcpy(codes, raw.data(), sizeof(int16_t) * fHeader.nSamples);
+        else if (!raw.empty())
+        {
+            for (uint32_t i = 0; i < fHeader.nSamples; i++)
+                codes[i] = static_cast<int8_t>(raw[i]);
+        }
+        else
+        {
+            // Decoded records only (e.g. read back from ROOT files, which do not keep the codes): recover them from
+            // y = gain * code - offset, computed in single precision by the parser
+            const auto &y = chData->getY();
+            double invGain = 1.0 / chHeader->verticalGain;
+            for (uint32_t i = 0; i < fHeader.nSamples; i++)
+            {
+                long code = std::lround((y[i] + chHeader->verticalOffset) * invGain);
+                if (code > std::numeric_limits<int16_t>::max())
+                    code = std::numeric_limits<int16_t>::max();
+                if (code < std::numeric_limits<int16_t>::min())
+                    code = std::numeric_limits<int16_t>::min();
+                codes[i] = (int16_t)code;
+            }
+        }
+        evtHeader->hasData |= (1u << slot);
+    }
+
+    fOffsets.push_back(fHeader.headerSize + fOffsets.size() * fHeader.eventSize);
+    fOut.write(fEventBuffer.data(), fEventBuffer.size());
+    return fOut.good();
+}
+
+bool WFDataProcessor::WFFlatWriter::FillFromTRCFiles(const std::string &folder, int idx_file, std::string mid_name, std::string ext)
+{
+    // Only the raw codes are read, they are stored as they are
+    if (!ReadAllWF(folder, idx_file, fmChRecord, fmChRecordHasData, mid_name, ext, true))
+    {
+        bool anyData = false;
+        for (const auto &pair : fmChRecordHasData)
+            anyData |= pair.second;
+        if (!anyData)
+            return false;
+    }
+    return Fill(fmChRecord, fmChRecordHasData, idx_file);
+}
+
+bool WFDataProcessor::WFFlatWriter::FillFromWFtrc2ROOT(const WFDataProcessor::WFtrc2ROOT &convertor)
+{
+    if (convertor.GetLastSkipped())
+        return false;
+    return Fill(convertor.GetChannelDataMap(), convertor.GetChannelDataHasDataMap(), convertor.GetFileIndex());
+}
+
+void WFDataProcessor::WFFlatWriter::CloseFile()
+{
+    if (!fOut.is_open())
+        return;
+
+    if (fHeaderWritten)
+    {
+        _flat_file_trailer trailer;
+        trailer.indexOffset = fHeader.headerSize + fOffsets.size() * fHeader.eventSize;
+        trailer.nEvents = fOffsets.size();
+        std::memcpy(trailer.magic, kMagic, sizeof(kMagic));
+        fOut.write(reinterpret_cast<const char *>(fOffsets.data()), fOffsets.size() * sizeof(uint64_t));
+        fOut.write(reinterpret_cast<const char *>(&trailer), sizeof(trailer));
+    }
+    fOut.close();
+    fOffsets.clear();
+    fHeaderWritten = false;
+}
+
+WFDataProcessor::WFFlatReader::~WFFlatReader()
+{
+    CloseFile();
+}
+
+bool WFDataProcessor::WFFlatReader::OpenFile(const std::string &filename)
+{
+    if (fData)
+    {
+        std::cerr << "File already opened. Close it before opening a new file." << std::endl;
+        return false;
+    }
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Cannot open flat event store: " << filename << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(_flat_file_header))
+    {
+        close(fd);
+        std::cerr << "Invalid flat event store: " << filename << std::endl;
+        return false;
+    }
+    void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays valid
+    if (ptr == MAP_FAILED)
+    {
+        std::cerr << "Cannot map flat event store: " << filename << std::endl;
+        return false;
+    }
+    fData = static_cast<const char *>(ptr);
+    fSize = st.st_size;
+
+    // Every size is checked against the one it contains, so that an event never reaches past the mapping.
+    // Sizes are multiples of 8, which keeps the codes and doubles of the mapped events aligned.
+    fHeader = reinterpret_cast<const _flat_file_header *>(fData);
+    const uint64_t headerSize = fHeader->headerSize, eventSize = fHeader->eventSize;
+    const uint64_t blockSize = fHeader->channelBlockSize;
+    if (std::memcmp(fHeader->magic, kMagic, sizeof(kMagic)) != 0 || fHeader->version != kVersion ||
+        fHeader->nChannels > (uint32_t)kMaxChannels || blockSize < sizeof(_flat_channel_header) + sizeof(int16_t) * (uint64_t)fHeader->nSamples ||
+        eventSize < sizeof(_flat_event_header) + blockSize * fHeader->nChannels || headerSize < sizeof(_flat_file_header) ||
+        headerSize > fSize || headerSize % 8 != 0 || eventSize % 8 != 0 || blockSize % 8 != 0)
+    {
+        std::cerr << "Invalid flat event store header: " << filename << std::endl;
+        CloseFile();
+        return false;
+    }
+
+    // Use the offset index if the trailer is complete, otherwise count full events by stride
+    fIndex = nullptr;
+    fNEvents = (fSize - headerSize) / eventSize;
+    if (fSize >= headerSize + sizeof(_flat_file_trailer))
+    {
+        const uint64_t trailerOffset = fSize - sizeof(_flat_file_trailer);
+        auto trailer = reinterpret_cast<const _flat_file_trailer *>(fData + trailerOffset);
+        // No products or sums of the stored values, which could wrap around
+        if (std::memcmp(trailer->magic, kMagic, sizeof(kMagic)) == 0 && trailer->indexOffset >= headerSize &&
+            trailer->indexOffset <= trailerOffset && trailer->indexOffset % 8 == 0 &&
+            (trailerOffset - trailer->indexOffset) % sizeof(uint64_t) == 0 &&
+            trailer->nEvents == (trailerOffset - trailer->indexOffset) / sizeof(uint64_t))
+        {
+            const uint64_t *index = reinterpret_cast<const uint64_t *>(fData + trailer->indexOffset);
+            for (uint64_t evt = 0; evt < trailer->nEvents; evt++)
+                if (index[evt] < headerSize || index[evt] % 8 != 0 || trailer->indexOffset < eventSize ||
+                    index[evt] > trailer->indexOffset - eventSize)
+                {
+                    std::cerr << "Corrupt offset index in flat event store " << filename << ": event " << evt << " at " << index[evt]
+                              << " is outside of the event data." << std::endl;
+                    CloseFile();
+                    return false;
+                }
+            fIndex = index;
+            fNEvents = trailer->nEvents;
+        }
+    }
+
+    fChannels.clear();
+    fmChannelSlot.clear();
+    for (uint32_t slot = 0; slot < fHeader->nChannels; slot++)
+    {
+        fChannels.push_back(fHeader->channels[slot]);
+        fmChannelSlot[fHeader->channels[slot]] = slot;
+    }
+    return true;
+}
+
+void WFDataProcessor::WFFlatReader::CloseFile()
+{
+    if (fData)
+        munmap(const_cast<char *>(fData), fSize);
+    fData = nullptr;
+    fSize = 0;
+    fHeader = nullptr;
+    fIndex = nullptr;
+    fNEvents = 0;
+    fChannels.clear();
+    fmChannelSlot.clear();
+}
+
+const char *WFDataProcessor::WFFlatReader::EventPointer(long long evt) const
+{
+    if (!fData || evt < 0 || evt >= fNEvents)
+        return nullptr;
+    uint64_t offset = fIndex ? fIndex[evt] : fHeader->headerSize + evt * fHeader->eventSize;
+    return fData + offset;
+}
+
+bool WFDataProcessor::WFFlatReader::GetWaveform(long long evt, int channel, _waveform_view &view) const
+{
+    view = _waveform_view();
+    auto event = EventPointer(evt);
+    auto iter = fmChannelSlot.find(channel);
+    if (!event || iter == fmChannelSlot.end())
+        return false;
+
+    int slot = iter->second;
+    auto evtHeader = reinterpret_cast<const _flat_event_header *>(event);
+    if (!(evtHeader->hasData & (1u << slot)))
+        return false;
+
+    const char *block = event + sizeof(_flat_event_header) + slot * fHeader->channelBlockSize;
+    auto chHeader = reinterpret_cast<const _flat_channel_header *>(block);
+    view.codes = reinterpret_cast<const int16_t *>(block + sizeof(_flat_channel_header));
+    view.nsamples = fHeader->nSamples;
+    view.verticalGain = chHeader->verticalGain;
+    view.verticalOffset = chHeader->verticalOffset;
+    view.horizInterval = fHeader->horizInterval;
+    view.horizOffset = chHeader->horizOffset;
+    return true;
+}
+
+int WFDataProcessor::WFFlatReader::GetFileIndex(long long evt) const
+{
+    auto event = EventPointer(evt);
+    if (!event)
+        return -1;
+    return reinterpret_cast<const _flat_event_header *>(event)->file_index;
+}
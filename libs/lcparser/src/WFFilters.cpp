@@ -0,0 +1,246 @@
+#include "WFKernels.h"
+#include "WFSimd.h"
+
+#include <cmath>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+namespace
+{
+    constexpr double kPi = 3.14159265358979323846;
+    constexpr int kBlock = 512;  // samples per FIR block, input and output stay in L1
+    constexpr int kMaxTaps = 255; // longest FIR, bounds the converted block on the stack
+
+    bool SameConfig(const WFDataProcessor::_filter_config &c1, const WFDataProcessor::_filter_config &c2)
+    {
+        return c1.type == c2.type && c1.taps == c2.taps && c1.cutoff == c2.cutoff;
+    }
+
+    // Sum of the taps at sample i, with indices clamped to the record
+    template <typename S>
+    double EdgeFIR(const S *x, int Nsamples, int i, const WFDataProcessor::_filter_design &design)
+    {
+        const int half = design.taps / 2;
+        double sum = 0;
+        for (int k = 0; k < design.taps; k++)
+            sum += design.h[k] * static_cast<double>(x[std::min(std::max(i - half + k, 0), Nsamples - 1)]);
+        return sum;
+    }
+}
+
+bool WFDataProcessor::DesignFilter(const _filter_config &config, double dt_ns, _filter_design &design)
+{
+    if (SameConfig(design.config, config) && design.dt == dt_ns)
+        return design.type == config.type;
+
+    design.config = config;
+    design.dt = dt_ns;
+    design.type = kNoFilter;
+    design.taps = 0;
+    design.alpha = 0;
+    design.dc_gain = 1;
+    design.h.clear();
+    if (config.type == kNoFilter)
+        return true;
+    if (!(dt_ns > 0))
+    {
+        std::cerr << "Filter needs a positive sampling interval, got " << dt_ns << " ns" << std::endl;
+        return false;
+    }
+
+    const int taps = std::max(config.taps, 1) | 1; // odd, centered on the output sample
+    if ((config.type == kMovingAverage || config.type == kLowPassFIR) && taps > kMaxTaps)
+    {
+        std::cerr << "FIR filter has " << taps << " taps, at most " << kMaxTaps << " are supported" << std::endl;
+        return false;
+    }
+    const int half = taps / 2;
+    switch (config.type)
+    {
+    case kMovingAverage:
+        design.taps = taps;
+        design.h.assign(taps, 1.0 / taps);
+        break;
+    case kLowPassFIR:
+    {
+        if (!(config.cutoff > 0))
+        {
+            std::cerr << "Low-pass FIR needs a positive cutoff frequency, got " << config.cutoff << " GHz" << std::endl;
+            return false;
+        }
+        // Windowed sinc, normalized to unit gain for a constant input
+        const double fc = std::min(config.cutoff * dt_ns, 0.5); // cycles per sample
+        design.taps = taps;
+        design.h.resize(taps);
+        double sum = 0;
+        for (int k = 0; k < taps; k++)
+        {
+            const double x = k - half;
+            const double sinc = x == 0 ? 2 * fc : std::sin(2 * kPi * fc * x) / (kPi * x);
+            const double window = taps > 1 ? 0.54 - 0.46 * std::cos(2 * kPi * k / (taps - 1)) : 1;
+            design.h[k] = sinc * window;
+            sum += design.h[k];
+        }
+        for (double &h : design.h)
+            h /= sum;
+        break;
+    }
+    case kSinglePoleIIR:
+        if (!(config.cutoff > 0))
+        {
+            std::cerr << "Single-pole IIR needs a positive cutoff frequency, got " << config.cutoff << " GHz" << std::endl;
+            return false;
+        }
+        design.alpha = 1 - std::exp(-2 * kPi * config.cutoff * dt_ns);
+        break;
+    case kDifferentiator:
+        if (config.taps < 1)
+        {
+            std::cerr << "Differentiator needs a delay of at least one sample, got " << config.taps << std::endl;
+            return false;
+        }
+        design.taps = config.taps;
+        design.dc_gain = 0;
+        break;
+    default:
+        std::cerr << "Unknown filter type " << config.type << std::endl;
+        return false;
+    }
+    design.type = config.type;
+    return true;
+}
+
+template <typename S>
+void WFDataProcessor::FilterRecord(const S *x, int Nsamples, const _filter_design &design, double *y)
+{
+    if (Nsamples <= 0)
+        return;
+    switch (design.type)
+    {
+    case kMovingAverage:
+    case kLowPassFIR:
+    {
+        const int half = design.taps / 2;
+        const double *h = design.h.data();
+        // Edges, where the taps reach outside the record
+        const int interior_begin = std::min(half, Nsamples), interior_end = std::max(Nsamples - half, interior_begin);
+        for (int i = 0; i < interior_begin; i++)
+            y[i] = EdgeFIR(x, Nsamples, i, design);
+        for (int i = interior_end; i < Nsamples; i++)
+            y[i] = EdgeFIR(x, Nsamples, i, design);
+        // Interior, decoded samples go straight to the vectorized FIR, raw codes are converted block by block
+        if constexpr (std::is_same<S, double>::value)
+        {
+            WFDataProcessor::Simd::FIR(x + interior_begin - half, interior_end - interior_begin, h, design.taps, y + interior_begin);
+        }
+        else
+        {
+            double block[kBlock + kMaxTaps - 1];
+            for (int begin = interior_begin; begin < interior_end; begin += kBlock)
+            {
+                const int n = std::min(kBlock, interior_end - begin);
+                const S *src = x + begin - half;
+                for (int j = 0; j < n + design.taps - 1; j++)
+                    block[j] = static_cast<double>(src[j]);
+                WFDataProcessor::Simd::FIR(block, n, h, design.taps, y + begin);
+            }
+        }
+        break;
+    }
+    case kSinglePoleIIR:
+    {
+        // Starts settled on the first sample
+        double state = x[0];
+        for (int i = 0; i < Nsamples; i++)
+        {
+            state += design.alpha * (static_cast<double>(x[i]) - state);
+            y[i] = state;
+        }
+        break;
+    }
+    case kDifferentiator:
+    {
+        const int delay = std::min(design.taps, Nsamples);
+        for (int i = 0; i < delay; i++)
+            y[i] = static_cast<double>(x[i]) - static_cast<double>(x[0]);
+        for (int i = delay; i < Nsamples; i++)
+            y[i] = static_cast<double>(x[i]) - static_cast<double>(x[i - design.taps]);
+        break;
+    }
+    default:
+        for (int i = 0; i < Nsamples; i++)
+            y[i] = x[i];
+        break;
+    }
+}
+
+void WFDataProcessor::FilterRows(const double *x, int nEvents, int Nsamples, const _filter_design &design, double *y)
+{
+    auto row = [nEvents](const double *base, int i)
+    { return base + static_cast<size_t>(i) * nEvents; };
+    auto out = [nEvents, y](int i)
+    { return y + static_cast<size_t>(i) * nEvents; };
+
+    switch (design.type)
+    {
+    case kMovingAverage:
+    case kLowPassFIR:
+    {
+        // Same tap order as FilterRecord, so every event gets the same sums
+        const int half = design.taps / 2;
+        for (int i = 0; i < Nsamples; i++)
+        {
+            double *yi = out(i);
+            const double *x0 = row(x, std::min(std::max(i - half, 0), Nsamples - 1));
+            for (int e = 0; e < nEvents; e++)
+                yi[e] = design.h[0] * x0[e];
+            for (int k = 1; k < design.taps; k++)
+            {
+                const double hk = design.h[k];
+                const double *xk = row(x, std::min(std::max(i - half + k, 0), Nsamples - 1));
+                for (int e = 0; e < nEvents; e++)
+                    yi[e] += hk * xk[e];
+            }
+        }
+        break;
+    }
+    case kSinglePoleIIR:
+    {
+        // The recursion runs along the samples, each event in its own lane
+        const double alpha = design.alpha;
+        const double *x0 = row(x, 0);
+        for (int e = 0; e < nEvents; e++)
+            out(0)[e] = x0[e] + alpha * (x0[e] - x0[e]);
+        for (int i = 1; i < Nsamples; i++)
+        {
+            const double *xi = row(x, i), *previous = out(i - 1);
+            double *yi = out(i);
+            for (int e = 0; e < nEvents; e++)
+                yi[e] = previous[e] + alpha * (xi[e] - previous[e]);
+        }
+        break;
+    }
+    case kDifferentiator:
+        for (int i = 0; i < Nsamples; i++)
+        {
+            const double *xi = row(x, i), *xd = row(x, std::max(i - design.taps, 0));
+            double *yi = out(i);
+            for (int e = 0; e < nEvents; e++)
+                yi[e] = xi[e] - xd[e];
+        }
+        break;
+    default:
+        std::copy(x, x + static_cast<size_t>(nEvents) * Nsamples, y);
+        break;
+    }
+}
+
+namespace WFDataProcessor
+{
+    template void FilterRecord<int8_t>(const int8_t *, int, const _filter_design &, double *);
+    template void FilterRecord<int16_t>(const int16_t *, int, const _filter_design &, double *);
+    template void FilterRecord<float>(const float *, int, const _filter_design &, double *);
+    template void FilterRecord<double>(const double *, int, const _filter_design &, double *);
+}
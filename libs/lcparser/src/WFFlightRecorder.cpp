@@ -0,0 +1,193 @@
+#include "WFDataConverter.h"
+
+#include "TFile.h"
+#include "TTree.h"
+
+#include <atomic>
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+
+namespace
+{
+    // Lock-free, so that it can be incremented from a signal handler
+    std::atomic<int> gDumpRequests(0);
+
+    void DumpSignalHandler(int) { WFDataProcessor::WFFlightRecorder::RequestDump(); }
+}
+
+void WFDataProcessor::WFFlightRecorder::SetCapacity(int capacity)
+{
+    fSlots.assign(capacity > 0 ? capacity : 0, _recorded_event());
+    fNext = 0;
+    fSize = 0;
+    fRequestsSeen = gDumpRequests.load(); // only requests made from now on
+    fReservedChannels = 0;
+    fReservedSamples = 0;
+}
+
+void WFDataProcessor::WFFlightRecorder::Reserve(int nChannels, int nSamples)
+{
+    if (nChannels <= fReservedChannels && nSamples <= fReservedSamples)
+        return;
+    fReservedChannels = std::max(fReservedChannels, nChannels);
+    fReservedSamples = std::max(fReservedSamples, nSamples);
+    for (auto &slot : fSlots)
+    {
+        if (static_cast<int>(slot.channels.size()) < fReservedChannels)
+            slot.channels.resize(fReservedChannels);
+        for (auto &channel : slot.channels)
+            if (static_cast<int>(channel.samples.size()) < fReservedSamples)
+                channel.samples.resize(fReservedSamples);
+    }
+}
+
+void WFDataProcessor::WFFlightRecorder::Commit()
+{
+    if (fSlots.empty())
+        return;
+    fNext = (fNext + 1) % static_cast<int>(fSlots.size());
+    if (fSize < static_cast<int>(fSlots.size()))
+        fSize++;
+}
+
+void WFDataProcessor::WFFlightRecorder::Record(const ScopeData &data, bool hasData, const _waveinfo &winfo, _recorded_channel &slot)
+{
+    slot.has_data = hasData;
+    slot.winfo = winfo;
+    slot.nsamples = 0;
+    if (!hasData)
+        return;
+
+    // The raw codes when they were read, they are half the size of the amplitudes and exact
+    const std::vector<char> &raw = data.getRawData();
+    if (!raw.empty())
+    {
+        const int Nsamples = data.getRawSampleCount();
+        if (static_cast<int>(slot.samples.size()) < Nsamples)
+            slot.samples.resize(Nsamples);
+        if (data.getRawSampleSize() == 1)
+        {
+            const int8_t *codes = reinterpret_cast<const int8_t *>(raw.data());
+            for (int i = 0; i < Nsamples; i++)
+                slot.samples[i] = codes[i];
+        }
+        else
+        {
+            const int16_t *codes = reinterpret_cast<const int16_t *>(raw.data());
+            for (int i = 0; i < Nsamples; i++)
+                slot.samples[i] = codes[i];
+        }
+        slot.nsamples = Nsamples;
+        slot.vertical_gain = data.getVerticalGain();
+        slot.vertical_offset = data.getVerticalOffset();
+        slot.horiz_interval = data.getHorizInterval();
+        slot.horiz_offset = data.getHorizOffset();
+        return;
+    }
+
+    const std::vector<double> &t = data.getX(), &a = data.getY();
+    const int Nsamples = std::min(t.size(), a.size());
+    if (static_cast<int>(slot.samples.size()) < Nsamples)
+        slot.samples.resize(Nsamples);
+    for (int i = 0; i < Nsamples; i++)
+        slot.samples[i] = static_cast<float>(a[i]);
+    slot.nsamples = Nsamples;
+    slot.vertical_gain = 1;
+    slot.vertical_offset = 0;
+    slot.horiz_interval = Nsamples > 1 ? (t[Nsamples - 1] - t[0]) / (Nsamples - 1) : 0;
+    slot.horiz_offset = Nsamples > 0 ? t[0] : 0;
+}
+
+bool WFDataProcessor::WFFlightRecorder::Dump(const std::string &filename) const
+{
+    if (fSize == 0)
+        return false;
+    TDirectory *previous = gDirectory;
+    TFile *file = TFile::Open(filename.c_str(), "RECREATE");
+    if (!file || file->IsZombie())
+    {
+        std::cerr << "Cannot open flight recorder dump " << filename << std::endl;
+        delete file;
+        if (previous)
+            previous->cd();
+        return false;
+    }
+    file->cd();
+
+    // Branches follow the channels of the oldest event, every event of an extractor has the same channels
+    const _recorded_event &first = Get(0);
+    const int nch = first.channels.size();
+    Long64_t event = 0;
+    int fileIndex = -1;
+    std::vector<_waveinfo> winfo(nch);
+    std::vector<char> hasData(nch, 0);
+    std::vector<std::vector<double>> time(nch), amp(nch);
+    TTree *tree = new TTree("flight", "Last events before the dump");
+    tree->Branch("event", &event, "event/L");
+    tree->Branch("file_index", &fileIndex, "file_index/I");
+    for (int k = 0; k < nch; k++)
+    {
+        const std::string prefix = Form("ch%d", first.channels[k].channel);
+        GenerateBranchForWaveInfo(tree, prefix, &winfo[k]);
+        tree->Branch((prefix + "_has_data").c_str(), &hasData[k], (prefix + "_has_data/O").c_str());
+        tree->Branch((prefix + "_time").c_str(), &time[k]);
+        tree->Branch((prefix + "_amp").c_str(), &amp[k]);
+    }
+
+    for (int e = 0; e < fSize; e++)
+    {
+        const _recorded_event &recorded = Get(e);
+        event = recorded.event;
+        fileIndex = recorded.file_index;
+        for (int k = 0; k < nch && k < static_cast<int>(recorded.channels.size()); k++)
+        {
+            const _recorded_channel &slot = recorded.channels[k];
+            winfo[k] = slot.winfo;
+            hasData[k] = slot.has_data;
+            time[k].resize(slot.nsamples);
+            amp[k].resize(slot.nsamples);
+            for (int i = 0; i < slot.nsamples; i++)
+            {
+                time[k][i] = (i * slot.horiz_interval + slot.horiz_offset) * 1e9;
+                amp[k][i] = (slot.vertical_gain * slot.samples[i] - slot.vertical_offset) * 1e3;
+            }
+        }
+        tree->Fill();
+    }
+    tree->Write("", TObject::kOverwrite);
+    file->Close();
+    delete file;
+    if (previous)
+        previous->cd();
+    std::cout << "Flight recorder: " << fSize << " events dumped to " << filename << std::endl;
+    return true;
+}
+
+void WFDataProcessor::WFFlightRecorder::RequestDump()
+{
+    gDumpRequests++;
+}
+
+bool WFDataProcessor::WFFlightRecorder::InstallSignalHandler(int signum)
+{
+#ifdef SIGUSR1
+    if (signum < 0)
+        signum = SIGUSR1;
+#endif
+    if (signum < 0 || std::signal(signum, DumpSignalHandler) == SIG_ERR)
+    {
+        std::cerr << "Cannot install the flight recorder signal handler" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool WFDataProcessor::WFFlightRecorder::DumpRequested()
+{
+    const int requests = gDumpRequests.load(std::memory_order_relaxed);
+    if (requests == fRequestsSeen)
+        return false;
+    fRequestsSeen = requests;
+    return true;
+}
@@ -0,0 +1,1175 @@
+#include "WFKernels.h"
+#include "WFSimd.h"
+
+#include <cmath>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+namespace
+{
+    constexpr double kToNs = 1.0e9; // s -> ns
+    constexpr double kToMV = 1.0e3; // V -> mV
+    constexpr double kNotFound = -100e9;
+    constexpr double kPi = 3.14159265358979323846;
+
+    // First sample with time_ns(i) >= value, Nsamples if none.
+    // On a uniform axis the index follows from the first two samples and is only checked against its
+    // neighbours, which also absorbs rounding of the division. Otherwise falls back to a binary search.
+    template <typename TimeNs>
+    int LowerBoundNs(int Nsamples, double value, TimeNs time_ns)
+    {
+        if (Nsamples >= 2)
+        {
+            const double t0 = time_ns(0);
+            const double step = time_ns(1) - t0;
+            if (step > 0)
+            {
+                const double guess = std::ceil((value - t0) / step);
+                int i = !(guess > 0) ? 0 : (guess >= Nsamples ? Nsamples : static_cast<int>(guess));
+                for (int attempt = 0; attempt < 4; attempt++)
+                {
+                    if (i < Nsamples && time_ns(i) < value)
+                        i++;
+                    else if (i > 0 && !(time_ns(i - 1) < value))
+                        i--;
+                    else
+                        return i;
+                }
+            }
+        }
+
+        int low = 0, high = Nsamples;
+        while (low < high)
+        {
+            int mid = low + (high - low) / 2;
+            if (time_ns(mid) < value)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        return low;
+    }
+
+    template <typename TimeNs>
+    void SearchWindow(int Nsamples, const WFDataProcessor::_signal_range &range, TimeNs time_ns, int &sample_up, int &sample_down)
+    {
+        // A crossing needs a sample before it, i.e. index 0 or "never reached" keep the defaults
+        int up = LowerBoundNs(Nsamples, range.first, time_ns);
+        int down = LowerBoundNs(Nsamples, range.second, time_ns);
+        sample_up = (up > 0 && up < Nsamples) ? up : 0;
+        sample_down = (down > 0 && down < Nsamples) ? down : Nsamples - 1;
+    }
+
+    // Sums and threshold comparisons on raw samples, exact 64-bit integers for integer samples.
+    // A level x in sample units is applied as code <= AtOrBelow(x) or code < Below(x).
+    template <typename S, bool = std::is_integral<S>::value>
+    struct _code_traits
+    {
+        using acc_t = double;
+        using cmp_t = double;
+        static cmp_t AtOrBelow(double x) { return x; }
+        static cmp_t Below(double x) { return x; }
+    };
+
+    template <typename S>
+    struct _code_traits<S, true>
+    {
+        using acc_t = int64_t;
+        using cmp_t = int64_t;
+        static cmp_t Clamp(double x)
+        {
+            // Levels far outside the sample range (e.g. no peak found) compare like infinities
+            if (!(x > -9.0e18))
+                return std::numeric_limits<int64_t>::min();
+            if (x > 9.0e18)
+                return std::numeric_limits<int64_t>::max();
+            return static_cast<int64_t>(x);
+        }
+        static cmp_t AtOrBelow(double x) { return Clamp(std::floor(x)); } // code <= x  <=>  code <= floor(x)
+        static cmp_t Below(double x) { return Clamp(std::ceil(x)); }      // code < x  <=>  code < ceil(x)
+    };
+
+    // interpolateTOAScaled on raw samples, with amplitudes relative to the pedestal in sample units.
+    // The crossing time does not depend on the amplitude scale.
+    template <typename S, typename TimeNs>
+    bool InterpolateCodes(const S *codes, int Nsamples, int i, double threshold, double pedestal, TimeNs time_ns, double &result,
+                          const WFDataProcessor::_interp_table *table)
+    {
+        if (Nsamples < 2)
+        {
+            result = time_ns(i);
+            return false;
+        }
+        int before = i - 1, after = i;
+        if (i == 0)
+        {
+            before = 0;
+            after = 1;
+        }
+
+        double a_before = codes[before] - pedestal;
+        double a_after = codes[after] - pedestal;
+        bool in_range = WFDataProcessor::rangeCheck(threshold, a_before, a_after);
+        if (!in_range && i > 0 && i < Nsamples - 1)
+        {
+            before = i;
+            after = i + 1;
+            a_before = codes[before] - pedestal;
+            a_after = codes[after] - pedestal;
+            in_range = WFDataProcessor::rangeCheck(threshold, a_before, a_after);
+        }
+
+        if (!in_range)
+        {
+            result = time_ns(i);
+            return false;
+        }
+        double t_before = time_ns(before);
+        double t_after = time_ns(after);
+        if (table)
+        {
+            auto amp = [codes, pedestal](int j)
+            { return codes[j] - pedestal; };
+            result = t_before + (t_after - t_before) * WFDataProcessor::RefineCrossing(*table, 0, Nsamples - 1, before, threshold, amp);
+            return true;
+        }
+        result = t_before + (t_after - t_before) * (threshold - a_before) / (a_after - a_before);
+        return true;
+    }
+
+    // Crossing of one threshold during the scans from the peak
+    struct _crossing
+    {
+        double threshold;
+        double *result;
+        bool found = false;
+    };
+
+    // Work needed by the fields of a feature mask. Crossings are indexed [side][level], side 0 before the peak (t1),
+    // side 1 after it (t2), level 0/1/2 for 90/50/10% as in the scans. The start pedestal is always computed.
+    struct _feature_needs
+    {
+        bool window = true;  // extrema and full charge of the search range
+        bool ped_end = true; // end pedestal
+        bool pm2ns = true;   // charge within ±2 ns of the peak
+        bool cfd = true;     // constant-fraction discriminator, if enabled in the configuration
+        bool tmpl = true;    // template matching, if a template is configured
+        bool level[2][3] = {{true, true, true}, {true, true, true}};
+        bool threshold[2] = {true, true};
+        uint32_t valid_bits = ~0u; // flags kept by ApplyFeatureMask
+
+        bool Scan(int side) const { return threshold[side] || level[side][0] || level[side][1] || level[side][2]; }
+        bool Peak() const { return pm2ns || Scan(0) || Scan(1); }
+    };
+
+    _feature_needs GetFeatureNeeds(uint32_t features)
+    {
+        using namespace WFDataProcessor;
+        _feature_needs needs;
+        if (features == kAllFeatures)
+            return needs;
+
+        // Field bits, looked up by name once
+        struct _bits
+        {
+            uint32_t ped_end, ped_end_std_dev, amp, t_amp, t1, t1_10, t1_50, t1_90, toa, charge;
+            uint32_t t2, t2_10, t2_50, t2_90, q_10, q_50, q_90, q_pm2ns, q_full, t_min, amp_min, t_cfd, t_tmpl, amp_tmpl;
+        };
+        static const _bits b = []
+        {
+            auto bit = [](const char *name)
+            { return 1u << FindWaveInfoField(name); };
+            return _bits{bit("ped_end"), bit("ped_end_std_dev"), bit("amp"), bit("t_amp"), bit("t1"), bit("t1_10"), bit("t1_50"),
+                         bit("t1_90"), bit("toa"), bit("charge"), bit("t2"), bit("t2_10"), bit("t2_50"), bit("t2_90"), bit("q_10"),
+                         bit("q_50"), bit("q_90"), bit("q_pm2ns"), bit("q_full"), bit("t_min"), bit("amp_min"), bit("t_cfd"),
+                         bit("t_tmpl"), bit("amp_tmpl")};
+        }();
+        auto has = [features](uint32_t bits)
+        { return (features & bits) != 0; };
+
+        // A charge up to a crossing needs the crossing on both sides, toa is t1_50 and charge is q_50
+        needs.level[0][0] = has(b.t1_90 | b.q_90);
+        needs.level[0][1] = has(b.t1_50 | b.toa | b.q_50 | b.charge);
+        needs.level[0][2] = has(b.t1_10 | b.q_10);
+        needs.level[1][0] = has(b.t2_90 | b.q_90);
+        needs.level[1][1] = has(b.t2_50 | b.q_50 | b.charge);
+        needs.level[1][2] = has(b.t2_10 | b.q_10);
+        needs.threshold[0] = has(b.t1);
+        needs.threshold[1] = has(b.t2);
+        needs.pm2ns = has(b.q_pm2ns);
+        needs.cfd = has(b.t_cfd);
+        needs.tmpl = has(b.t_tmpl | b.amp_tmpl);
+        needs.ped_end = has(b.ped_end | b.ped_end_std_dev | b.amp_min);
+        needs.window = needs.Peak() || has(b.amp | b.t_amp | b.q_full | b.t_min | b.amp_min);
+
+        const uint32_t level_flags[2][3] = {{NO_T1_90_FOUND, NO_T1_50_FOUND, NO_T1_10_FOUND}, {NO_T2_90_FOUND, NO_T2_50_FOUND, NO_T2_10_FOUND}};
+        const uint32_t threshold_flags[2] = {NO_T1_FOUND, NO_T2_FOUND};
+        for (int side = 0; side < 2; side++)
+        {
+            for (int k = 0; k < 3; k++)
+                if (!needs.level[side][k])
+                    needs.valid_bits &= ~level_flags[side][k];
+            if (!needs.threshold[side])
+                needs.valid_bits &= ~threshold_flags[side];
+        }
+        if (!needs.cfd)
+            needs.valid_bits &= ~NO_CFD_FOUND;
+        if (!needs.tmpl)
+            needs.valid_bits &= ~NO_TEMPLATE_MATCH;
+        return needs;
+    }
+}
+
+void WFDataProcessor::ApplyFeatureMask(_waveinfo &winfo, uint32_t features)
+{
+    if (features == kAllFeatures)
+        return;
+    const auto &fields = GetWaveInfoFields();
+    for (size_t i = 0; i < fields.size(); i++)
+        if (!IsFeatureSelected(features, i))
+            *(double *)((char *)&winfo + fields[i].offset) = kFeatureSkipped;
+    winfo.valid &= GetFeatureNeeds(features).valid_bits;
+}
+
+void WFDataProcessor::FindSearchWindow(const double *t, int Nsamples, const _signal_range &range, int &sample_up, int &sample_down)
+{
+    SearchWindow(Nsamples, range, [t](int i)
+                 { return t[i] * kToNs; }, sample_up, sample_down);
+}
+
+WFDataProcessor::_sample_scale WFDataProcessor::GetSampleScale(const ScopeData &data)
+{
+    _sample_scale scale;
+    scale.vertical_gain = data.getVerticalGain();
+    scale.vertical_offset = data.getVerticalOffset();
+    scale.horiz_interval = data.getHorizInterval();
+    scale.horiz_offset = data.getHorizOffset();
+    return scale;
+}
+
+namespace
+{
+    // Tabulate a kernel w(x), x the distance of a sample to the interpolated position in samples,
+    // normalized per phase so that a constant record is reproduced exactly
+    template <typename Kernel>
+    WFDataProcessor::_interp_table MakeInterpolationTable(int taps, Kernel kernel)
+    {
+        using WFDataProcessor::_interp_table;
+        _interp_table table;
+        table.taps = taps;
+        table.coef.resize(static_cast<size_t>(_interp_table::kPhases + 1) * taps);
+        for (int p = 0; p <= _interp_table::kPhases; p++)
+        {
+            const double u = static_cast<double>(p) / _interp_table::kPhases;
+            double *c = table.coef.data() + static_cast<size_t>(p) * taps;
+            double sum = 0;
+            for (int k = 0; k < taps; k++)
+            {
+                c[k] = kernel(u - (k - taps / 2 + 1));
+                sum += c[k];
+            }
+            for (int k = 0; k < taps; k++)
+                c[k] /= sum;
+        }
+        return table;
+    }
+
+    double Sinc(double x)
+    {
+        return x == 0 ? 1.0 : std::sin(kPi * x) / (kPi * x);
+    }
+}
+
+const WFDataProcessor::_interp_table *WFDataProcessor::GetInterpolationTable(InterpolationMethod method)
+{
+    // Catmull-Rom, i.e. Keys cubic convolution with a = -0.5
+    static const _interp_table cubic = MakeInterpolationTable(4, [](double x)
+                                                              {
+        x = std::fabs(x);
+        if (x < 1)
+            return 1.5 * x * x * x - 2.5 * x * x + 1;
+        if (x < 2)
+            return -0.5 * x * x * x + 2.5 * x * x - 4 * x + 2;
+        return 0.0; });
+    // Lanczos window of 4 lobes
+    static const _interp_table sinc = MakeInterpolationTable(8, [](double x)
+                                                             { return std::fabs(x) < 4 ? Sinc(x) * Sinc(x / 4) : 0.0; });
+    switch (method)
+    {
+    case kCubicInterpolation:
+        return &cubic;
+    case kSincInterpolation:
+        return &sinc;
+    default:
+        return nullptr;
+    }
+}
+
+bool WFDataProcessor::MergeAveragePulse(const _average_pulse &other, _average_pulse &average)
+{
+    if (other.count == 0)
+        return true;
+    if (average.count == 0)
+    {
+        average = other;
+        return true;
+    }
+    if (other.mean.size() != average.mean.size())
+        return false;
+    const double n = static_cast<double>(average.count) + other.count, weight = other.count / n;
+    const double product = static_cast<double>(average.count) * other.count / n;
+    for (size_t j = 0; j < average.mean.size(); j++)
+    {
+        const double delta = other.mean[j] - average.mean[j];
+        average.mean[j] += delta * weight;
+        average.m2[j] += other.m2[j] + delta * delta * product;
+    }
+    average.count += other.count;
+    return true;
+}
+
+bool WFDataProcessor::interpolateTOAScaled(const double *t, const double *a, int Nsamples, int sample_point_around_threshold, double threshold, double pedestal, double &result, const _interp_table *table)
+{
+    int i = sample_point_around_threshold;
+    if (Nsamples < 2)
+    {
+        result = t[i] * kToNs;
+        return false;
+    }
+    // Same segment choice as interpolateTOA2: the one before the sample, except at the first sample
+    int before = i - 1, after = i;
+    if (i == 0)
+    {
+        before = 0;
+        after = 1;
+    }
+
+    double t_before = t[before] * kToNs;
+    double a_before = a[before] * kToMV - pedestal;
+    double t_after = t[after] * kToNs;
+    double a_after = a[after] * kToMV - pedestal;
+    bool in_range = rangeCheck(threshold, a_before, a_after);
+    if (!in_range && i > 0 && i < Nsamples - 1)
+    {
+        // Try the segment on the other side of the sample
+        before = i;
+        t_before = t[i] * kToNs;
+        a_before = a[i] * kToMV - pedestal;
+        t_after = t[i + 1] * kToNs;
+        a_after = a[i + 1] * kToMV - pedestal;
+        in_range = rangeCheck(threshold, a_before, a_after);
+    }
+
+    if (!in_range)
+    {
+        result = t[i] * kToNs;
+        return false;
+    }
+    if (table)
+    {
+        auto amp = [a, pedestal](int j)
+        { return a[j] * kToMV - pedestal; };
+        result = t_before + (t_after - t_before) * RefineCrossing(*table, 0, Nsamples - 1, before, threshold, amp);
+        return true;
+    }
+    result = t_before + (t_after - t_before) * (threshold - a_before) / (a_after - a_before);
+    return true;
+}
+
+namespace
+{
+    // Features relative to the peak, shared by the fused and batch kernels: charge within ±2 ns of the peak,
+    // threshold and 10/50/90% crossings on both sides and the charges up to them, found by scans from the peak.
+    // Only reads a[] within [min(up - 1, sample_max, peak - 2 ns), max(down + 1, sample_max, peak + 2 ns)].
+    // Crossings the feature mask does not need count as found from the start, so the scans stop without them.
+    void PeakFeatures(const double *t, const double *a, int Nsamples, int up, int down, int sample_max, double max_a,
+                      double ped_start, double dt, double threshold, const _feature_needs &needs, const WFDataProcessor::_interp_table *table,
+                      WFDataProcessor::_waveinfo &winfo)
+    {
+        using namespace WFDataProcessor;
+
+        // Local neighbourhood of the peak: charge within ±2 ns
+        double charge_pm2ns = 0;
+        int half_width = dt != 0 ? static_cast<int>(2.0 / dt) : 0;
+        int pm_low = std::max(sample_max - half_width, 0);
+        int pm_high = std::min(sample_max + half_width, Nsamples - 1);
+        if (needs.pm2ns)
+            Simd::ScaledSum(a + pm_low, pm_high - pm_low + 1, kToMV, ped_start, dt, charge_pm2ns);
+
+        // Local scans from the peak outwards, stopping as soon as every crossing is found
+        double charge_10 = 0, charge_50 = 0, charge_90 = 0;
+        double t1_10 = kNotFound, t1_50 = kNotFound, t1_90 = kNotFound, t1 = kNotFound;
+        double t2_10 = kNotFound, t2_50 = kNotFound, t2_90 = kNotFound, t2 = kNotFound;
+        const bool search_threshold = threshold < max_a;
+
+        auto scan = [&](int side, int stop, double &t_10, double &t_50, double &t_90, double &t_thr, bool &found_10, bool &found_50, bool &found_90, bool &found_thr)
+        {
+            const int step = side == 0 ? -1 : +1;
+            _crossing c90{0.9 * max_a, &t_90, !needs.level[side][0]}, c50{0.5 * max_a, &t_50, !needs.level[side][1]}, c10{0.1 * max_a, &t_10, !needs.level[side][2]};
+            found_thr = !needs.threshold[side];
+            for (int i = sample_max; step < 0 ? i >= stop : i <= stop; i += step)
+            {
+                double amp = a[i] * kToMV - ped_start;
+                for (_crossing *c : {&c90, &c50, &c10})
+                {
+                    if (!c->found && amp <= c->threshold)
+                    {
+                        interpolateTOAScaled(t, a, Nsamples, i, c->threshold, ped_start, *c->result, table);
+                        c->found = true;
+                    }
+                }
+                if (!found_thr && amp < threshold && search_threshold)
+                {
+                    found_thr = true;
+                    interpolateTOAScaled(t, a, Nsamples, i, threshold, ped_start, t_thr, table);
+                }
+
+                if (!c10.found)
+                    charge_10 += amp * dt;
+                if (!c50.found)
+                    charge_50 += amp * dt;
+                if (!c90.found)
+                    charge_90 += amp * dt;
+
+                if (c10.found && c50.found && c90.found && found_thr)
+                    break;
+            }
+            found_10 = c10.found;
+            found_50 = c50.found;
+            found_90 = c90.found;
+        };
+
+        bool found_10, found_50, found_90, found_t1, found_t2;
+        scan(0, up, t1_10, t1_50, t1_90, t1, found_10, found_50, found_90, found_t1);
+        if (!found_10)
+            winfo.valid |= NO_T1_10_FOUND;
+        if (!found_50)
+            winfo.valid |= NO_T1_50_FOUND;
+        if (!found_90)
+            winfo.valid |= NO_T1_90_FOUND;
+        if (!found_t1)
+            winfo.valid |= NO_T1_FOUND;
+
+        scan(1, down, t2_10, t2_50, t2_90, t2, found_10, found_50, found_90, found_t2);
+        if (!found_10)
+            winfo.valid |= NO_T2_10_FOUND;
+        if (!found_50)
+            winfo.valid |= NO_T2_50_FOUND;
+        if (!found_90)
+            winfo.valid |= NO_T2_90_FOUND;
+        if (!found_t2)
+            winfo.valid |= NO_T2_FOUND;
+
+        winfo.t1 = t1;
+        winfo.t1_10 = t1_10;
+        winfo.t1_50 = t1_50;
+        winfo.t1_90 = t1_90;
+        winfo.toa = t1_50;
+        winfo.t2 = t2;
+        winfo.t2_10 = t2_10;
+        winfo.t2_50 = t2_50;
+        winfo.t2_90 = t2_90;
+        winfo.charge_10 = charge_10;
+        winfo.charge_50 = charge_50;
+        winfo.charge_90 = charge_90;
+        winfo.charge_pm2ns = charge_pm2ns;
+        winfo.charge = charge_50;
+    }
+}
+
+namespace
+{
+    // Constant-fraction discriminator of the fused and batch kernels, on a record in seconds and volts
+    double CFDTime(const double *t, const double *a, int first, int last, double ped_start, double dt, const WFDataProcessor::_extract_config &config,
+                   const WFDataProcessor::_interp_table *table, WFDataProcessor::_waveinfo &winfo)
+    {
+        double t_cfd = kNotFound;
+        auto amp = [a, ped_start](int i)
+        { return a[i] * kToMV - ped_start; };
+        auto time_ns = [t](int i)
+        { return t[i] * kToNs; };
+        if (!WFDataProcessor::CFDCrossing(first, last, WFDataProcessor::CFDDelaySamples(config.cfd_delay, dt), config.cfd_fraction, config.threshold, amp, time_ns, t_cfd, table))
+            winfo.valid |= WFDataProcessor::NO_CFD_FOUND;
+        return t_cfd;
+    }
+
+    // Pulse finder of the fused kernel, on a record in seconds and volts
+    void PulseList(const double *t, const double *a, int first, int last, double ped_start, double dt, const WFDataProcessor::_extract_config &config,
+                   WFDataProcessor::_pulse_list &pulses, WFDataProcessor::_waveinfo &winfo)
+    {
+        auto amp = [a, ped_start](int i)
+        { return a[i] * kToMV - ped_start; };
+        auto time_ns = [t](int i)
+        { return t[i] * kToNs; };
+        if (WFDataProcessor::FindPulses(first, last, config.threshold, dt, amp, time_ns, pulses) > 1)
+            winfo.valid |= WFDataProcessor::PILEUP;
+    }
+
+    // Template matching of every kernel, on samples x with the pedestal in their units and mv_per_unit to mV
+    template <typename S, typename TimeNs>
+    void TemplateFit(const S *x, int Nsamples, int first, int last, double pedestal, double mv_per_unit, double dt, TimeNs time_ns,
+                     const WFDataProcessor::_extract_config &config, WFDataProcessor::_wave_workspace &workspace, WFDataProcessor::_waveinfo &winfo)
+    {
+        using namespace WFDataProcessor;
+        winfo.t_tmpl = kNotFound;
+        winfo.amp_tmpl = kNotFound;
+        double amplitude, position;
+        if (!DesignTemplate(config.pulse_template, dt, workspace.match) ||
+            !MatchTemplate(workspace.match, x, Nsamples, first, last, pedestal, workspace.correlation, amplitude, position))
+        {
+            winfo.valid |= NO_TEMPLATE_MATCH;
+            return;
+        }
+        const int i = static_cast<int>(std::floor(position));
+        winfo.t_tmpl = time_ns(i) + (position - i) * dt + config.pulse_template.t_ref;
+        winfo.amp_tmpl = mv_per_unit * amplitude;
+    }
+}
+
+void WFDataProcessor::processWaveFused(const double *t, const double *a, int Nsamples, _waveinfo &winfo, const _extract_config &config, _wave_workspace &workspace)
+{
+    const double threshold = config.threshold;
+    const _signal_range &search_range = config.search_range;
+
+    winfo.valid = VALID;
+    workspace.pulses.Clear();
+    workspace.tot.Clear();
+    if (Nsamples <= 0 || t == nullptr || a == nullptr)
+    {
+        winfo.valid = NO_WAVEFORM;
+        return;
+    }
+
+    int up, down;
+    FindSearchWindow(t, Nsamples, search_range, up, down);
+    workspace.sample_up = up;
+    workspace.sample_down = down;
+    const double dt = Nsamples > 1 ? (t[1] - t[0]) * kToNs : 0;
+
+    // Pass over [0, up): start pedestal
+    auto amp_mv = [a](int i)
+    { return a[i] * kToMV; };
+    const bool robust = config.baseline.method != kMeanBaseline;
+    double ped_start = 0, ped_start_std_dev = 0;
+    if (robust)
+        RobustBaseline(config.baseline, 0, up, amp_mv, workspace.baseline, workspace.baseline_slots, ped_start, ped_start_std_dev);
+    else
+    {
+        double ped_sum = 0, ped_square_sum = 0;
+        Simd::ScaledSumSquares(a, up, kToMV, ped_sum, ped_square_sum);
+        ped_start = up > 0 ? ped_sum / up : 0;
+        ped_start_std_dev = up > 0 ? std::sqrt((ped_square_sum / up) - (ped_start * ped_start)) : 0;
+    }
+
+    // Pass over [up, down] restricted to the search range: extrema and full charge.
+    // Time is monotonic, so the samples inside the range are contiguous.
+    int first = up, last = down;
+    while (first <= last && t[first] * kToNs < search_range.first)
+        first++;
+    while (last >= first && t[last] * kToNs > search_range.second)
+        last--;
+
+    double max_a = -1.0e9, max_t = 0, min_a = 1.0e9, min_t = 0;
+    double charge_full = 0;
+    int sample_max = 0;
+    int argmax = -1, argmin = -1;
+    const _feature_needs needs = GetFeatureNeeds(config.features);
+    const bool multi_threshold = !config.tot_thresholds.empty();
+    if (needs.window || multi_threshold)
+        Simd::ScaledWindowStats(a + first, last - first + 1, kToMV, ped_start, dt, charge_full, max_a, argmax, min_a, argmin);
+    if (argmax >= 0)
+    {
+        sample_max = first + argmax;
+        max_t = t[sample_max] * kToNs;
+    }
+    if (argmin >= 0)
+        min_t = t[first + argmin] * kToNs;
+
+    // Pass over [down, N) after the start of the range: end pedestal
+    int tail = down;
+    while (tail < Nsamples && !(t[tail] * kToNs > search_range.first))
+        tail++;
+    double ped_end = 0, ped_end_std_dev = 0;
+    if (robust)
+    {
+        if (needs.ped_end)
+            RobustBaseline(config.baseline, tail, Nsamples, amp_mv, workspace.baseline, workspace.baseline_slots, ped_end, ped_end_std_dev);
+    }
+    else
+    {
+        double ped_sum_end = 0, ped_square_sum_end = 0;
+        if (needs.ped_end)
+            Simd::ScaledSumSquares(a + tail, Nsamples - tail, kToMV, ped_sum_end, ped_square_sum_end);
+        const int ped_count_end = Nsamples - tail;
+        ped_end = ped_count_end > 0 ? ped_sum_end / ped_count_end : 0;
+        ped_end_std_dev = ped_count_end > 0 ? std::sqrt((ped_square_sum_end / ped_count_end) - (ped_end * ped_end)) : 0;
+    }
+
+    const _interp_table *table = GetInterpolationTable(config.interpolation);
+    PeakFeatures(t, a, Nsamples, up, down, sample_max, max_a, ped_start, dt, threshold, needs, table, winfo);
+    if (multi_threshold)
+        MultiThresholdCrossings(up, down, sample_max, config.tot_thresholds, [a, ped_start](int i)
+                                { return a[i] * kToMV - ped_start; }, [t](int i)
+                                { return t[i] * kToNs; }, workspace.tot, table);
+
+    winfo.nsamples = Nsamples;
+    winfo.ped_start = ped_start;
+    winfo.ped_start_std_dev = ped_start_std_dev;
+    winfo.ped_end = ped_end;
+    winfo.ped_end_std_dev = ped_end_std_dev;
+    winfo.amp = max_a;
+    winfo.t_amp = max_t;
+    winfo.charge_full = charge_full;
+    winfo.t_min = min_t;
+    winfo.amp_min = min_a + ped_start - ped_end;
+    winfo.t_cfd = needs.cfd && config.cfd_fraction > 0 ? CFDTime(t, a, first, last, ped_start, dt, config, table, winfo) : kNotFound;
+    if (config.find_pulses)
+        PulseList(t, a, first, last, ped_start, dt, config, workspace.pulses, winfo);
+    winfo.t_tmpl = kNotFound;
+    winfo.amp_tmpl = kNotFound;
+    if (needs.tmpl && !config.pulse_template.shape.empty())
+        TemplateFit(a, Nsamples, first, last, ped_start / kToMV, kToMV, dt, [t](int i)
+                    { return t[i] * kToNs; }, config, workspace, winfo);
+    ApplyFeatureMask(winfo, config.features);
+}
+
+void WFDataProcessor::_wave_batch::Resize(const std::vector<int> &channelList, int events, int samples)
+{
+    channels = channelList;
+    nEvents = events;
+    nSamples = samples;
+    const size_t axisSize = channels.size() * static_cast<size_t>(nSamples);
+    if (t.size() < axisSize)
+        t.resize(axisSize);
+    if (a.size() < axisSize * nEvents)
+        a.resize(axisSize * nEvents);
+}
+
+void WFDataProcessor::_wave_batch::SetRecord(int slot, int event, const double *time, const double *amplitude)
+{
+    if (event == 0)
+        std::copy(time, time + nSamples, t.begin() + static_cast<size_t>(slot) * nSamples);
+    double *dst = a.data() + static_cast<size_t>(slot) * nSamples * nEvents + event;
+    for (int i = 0; i < nSamples; i++)
+        dst[static_cast<size_t>(i) * nEvents] = amplitude[i];
+}
+
+bool WFDataProcessor::processWaveBatch(const _wave_batch &batch, const std::map<int, _extract_config> &configs, _waveinfo_columns &columns, _wave_workspace &workspace)
+{
+    const int nEvents = batch.nEvents;
+    const int Nsamples = batch.nSamples;
+    columns.first = 0;
+    columns.size = nEvents;
+    columns.file_index.clear();
+
+    // Events are processed in tiles of one cache line per sample row, one event per vector lane.
+    // The per-event accumulators are updated in the same order as in the per-event scalar kernel.
+    constexpr int kTile = Simd::kLanes;
+    std::vector<double> tileRecords; // contiguous copies of the samples the peak scans of a tile can reach
+    std::vector<double> record;
+
+    const auto &fields = GetWaveInfoFields();
+    for (size_t slot = 0; slot < batch.channels.size(); slot++)
+    {
+        const int channel = batch.channels[slot];
+        auto itConfig = configs.find(channel);
+        if (itConfig == configs.end())
+        {
+            std::cerr << "No extraction configuration for channel " << channel << std::endl;
+            return false;
+        }
+        const _extract_config &config = itConfig->second;
+
+        // Resolve the destination columns once, events are then stored by index
+        std::vector<std::vector<double> *> dst(fields.size());
+        for (size_t f = 0; f < fields.size(); f++)
+        {
+            dst[f] = &columns.data[channel][fields[f].name];
+            dst[f]->resize(nEvents);
+        }
+        auto store = [&](int event, const _waveinfo &winfo)
+        {
+            for (size_t f = 0; f < fields.size(); f++)
+            {
+                const char *src = (const char *)&winfo + fields[f].offset;
+                double value;
+                if (fields[f].type == 'D')
+                    value = *(const double *)src;
+                else if (fields[f].type == 'i')
+                    value = *(const uint32_t *)src;
+                else
+                    value = *(const int *)src;
+                (*dst[f])[event] = value;
+            }
+        };
+
+        const double *t = batch.t.data() + slot * Nsamples;
+        const double *a = batch.a.data() + slot * Nsamples * static_cast<size_t>(nEvents); // replaced by the filtered slot below
+        auto row = [&](int i)
+        { return a + static_cast<size_t>(i) * nEvents; };
+        _waveinfo winfo;
+        // Robust pedestals and the pulse finder (PILEUP) work on one record at a time, like plotting they go through processWave
+        if (config.need_draw || config.baseline.method != kMeanBaseline || config.find_pulses || Nsamples < 2 || t[1] <= t[0])
+        {
+            record.resize(Nsamples);
+            for (int e = 0; e < nEvents; e++)
+            {
+                for (int i = 0; i < Nsamples; i++)
+                    record[i] = row(i)[e];
+                processWave(t, record.data(), Nsamples, winfo, config, workspace);
+                store(e, winfo);
+            }
+            continue;
+        }
+
+        // Filter stage on the whole slot, across events
+        if (config.filter.type != kNoFilter && DesignFilter(config.filter, (t[1] - t[0]) * kToNs, workspace.filter))
+        {
+            const size_t slotSize = static_cast<size_t>(nEvents) * Nsamples;
+            if (workspace.filtered.size() < slotSize)
+                workspace.filtered.resize(slotSize);
+            FilterRows(a, nEvents, Nsamples, workspace.filter, workspace.filtered.data());
+            workspace.filtered_samples = 0; // a slot, not one record
+            a = workspace.filtered.data();
+        }
+
+        // The window only depends on the shared time axis
+        const double threshold = config.threshold;
+        const _signal_range &search_range = config.search_range;
+        int up, down;
+        FindSearchWindow(t, Nsamples, search_range, up, down);
+        workspace.sample_up = up;
+        workspace.sample_down = down;
+        const double dt = (t[1] - t[0]) * kToNs;
+        int first = up, last = down;
+        while (first <= last && t[first] * kToNs < search_range.first)
+            first++;
+        while (last >= first && t[last] * kToNs > search_range.second)
+            last--;
+        int tail = down;
+        while (tail < Nsamples && !(t[tail] * kToNs > search_range.first))
+            tail++;
+        const int ped_count_end = Nsamples - tail;
+        const int half_width = static_cast<int>(2.0 / dt);
+        const _feature_needs needs = GetFeatureNeeds(config.features);
+        const bool cfd = needs.cfd && config.cfd_fraction > 0;
+        const int cfd_delay = CFDDelaySamples(config.cfd_delay, dt);
+        const _interp_table *table = GetInterpolationTable(config.interpolation);
+        const int margin = table ? table->taps / 2 : 0;
+        // Template placements with the peak in the search range, designed once for the slot
+        const bool tmpl = needs.tmpl && !config.pulse_template.shape.empty();
+        int tmpl_low = Nsamples, tmpl_high = -1;
+        if (tmpl && DesignTemplate(config.pulse_template, dt, workspace.match))
+        {
+            const int taps = workspace.match.h.size();
+            tmpl_low = std::max(first - workspace.match.peak - 1, 0);
+            tmpl_high = std::min(last - workspace.match.peak + 1, Nsamples - taps) + taps - 1;
+        }
+
+        for (int e0 = 0; e0 < nEvents; e0 += kTile)
+        {
+            const int n = std::min(kTile, nEvents - e0);
+
+            // [0, up): start pedestal
+            double ped_sum[kTile] = {}, ped_square_sum[kTile] = {};
+            Simd::LaneSumSquares(row(0) + e0, nEvents, up, n, kToMV, ped_sum, ped_square_sum);
+            double ped_start[kTile], ped_start_std_dev[kTile];
+            for (int l = 0; l < n; l++)
+            {
+                ped_start[l] = up > 0 ? ped_sum[l] / up : 0;
+                ped_start_std_dev[l] = up > 0 ? std::sqrt((ped_square_sum[l] / up) - (ped_start[l] * ped_start[l])) : 0;
+            }
+
+            // [first, last]: extrema and full charge
+            double charge_full[kTile] = {}, max_a[kTile], min_a[kTile];
+            int argmax[kTile], argmin[kTile];
+            std::fill(max_a, max_a + kTile, -1.0e9);
+            std::fill(min_a, min_a + kTile, 1.0e9);
+            std::fill(argmax, argmax + kTile, -1);
+            std::fill(argmin, argmin + kTile, -1);
+            if (needs.window)
+                Simd::LaneWindowStats(row(first) + e0, nEvents, last - first + 1, n, kToMV, ped_start, dt, charge_full, max_a, argmax, min_a, argmin);
+            for (int l = 0; l < n; l++)
+            {
+                if (argmax[l] >= 0)
+                    argmax[l] += first;
+                if (argmin[l] >= 0)
+                    argmin[l] += first;
+            }
+
+            // [tail, N): end pedestal
+            double ped_sum_end[kTile] = {}, ped_square_sum_end[kTile] = {};
+            if (needs.ped_end)
+                Simd::LaneSumSquares(row(tail) + e0, nEvents, Nsamples - tail, n, kToMV, ped_sum_end, ped_square_sum_end);
+
+            // Copy the samples the peak scans can reach, [up - 1, down + 1] and ±2 ns around each peak,
+            // the delayed samples of the discriminator, the taps of the interpolation around the crossings
+            // and the samples under the template placements
+            int low = std::max((cfd ? std::min(up - 1, first - cfd_delay) : up - 1) - margin, 0), high = std::min(down + 1 + margin, Nsamples - 1);
+            low = std::min(low, tmpl_low);
+            high = std::min(std::max(high, tmpl_high), Nsamples - 1);
+            for (int l = 0; l < n; l++)
+            {
+                const int sample_max = argmax[l] >= 0 ? argmax[l] : 0;
+                low = std::max(0, std::min({low, sample_max - half_width, sample_max}));
+                high = std::min(Nsamples - 1, std::max({high, sample_max + half_width, sample_max}));
+            }
+            tileRecords.resize(static_cast<size_t>(kTile) * Nsamples);
+            for (int i = low; (needs.Peak() || cfd || tmpl) && i <= high; i++)
+            {
+                const double *x = row(i) + e0;
+                for (int l = 0; l < n; l++)
+                    tileRecords[static_cast<size_t>(l) * Nsamples + i] = x[l];
+            }
+
+            // Peak-relative features per event
+            for (int l = 0; l < n; l++)
+            {
+                const int sample_max = argmax[l] >= 0 ? argmax[l] : 0;
+                winfo.valid = VALID;
+                if (needs.Peak())
+                    PeakFeatures(t, tileRecords.data() + static_cast<size_t>(l) * Nsamples, Nsamples, up, down, sample_max, max_a[l], ped_start[l], dt, threshold, needs, table, winfo);
+
+                const double ped_end = ped_count_end > 0 ? ped_sum_end[l] / ped_count_end : 0;
+                winfo.nsamples = Nsamples;
+                winfo.ped_start = ped_start[l];
+                winfo.ped_start_std_dev = ped_start_std_dev[l];
+                winfo.ped_end = ped_end;
+                winfo.ped_end_std_dev = ped_count_end > 0 ? std::sqrt((ped_square_sum_end[l] / ped_count_end) - (ped_end * ped_end)) : 0;
+                winfo.amp = max_a[l];
+                winfo.t_amp = argmax[l] >= 0 ? t[argmax[l]] * kToNs : 0;
+                winfo.charge_full = charge_full[l];
+                winfo.t_min = argmin[l] >= 0 ? t[argmin[l]] * kToNs : 0;
+                winfo.amp_min = min_a[l] + ped_start[l] - ped_end;
+                winfo.t_cfd = cfd ? CFDTime(t, tileRecords.data() + static_cast<size_t>(l) * Nsamples, first, last, ped_start[l], dt, config, table, winfo) : kNotFound;
+                winfo.t_tmpl = kNotFound;
+                winfo.amp_tmpl = kNotFound;
+                if (tmpl)
+                    TemplateFit(tileRecords.data() + static_cast<size_t>(l) * Nsamples, Nsamples, first, last, ped_start[l] / kToMV, kToMV, dt, [t](int i)
+                                { return t[i] * kToNs; }, config, workspace, winfo);
+                ApplyFeatureMask(winfo, config.features);
+                store(e0 + l, winfo);
+            }
+        }
+    }
+    return true;
+}
+
+namespace
+{
+    // processWaveRaw on a positive gain and increasing time axis
+    template <typename S>
+    void ProcessCodes(const S *codes, int Nsamples, const WFDataProcessor::_sample_scale &scale, WFDataProcessor::_waveinfo &winfo,
+                      const WFDataProcessor::_extract_config &config, WFDataProcessor::_wave_workspace &workspace)
+    {
+        using namespace WFDataProcessor;
+        using traits = _code_traits<S>;
+        using acc_t = typename traits::acc_t;
+        using cmp_t = typename traits::cmp_t;
+
+        const double threshold = config.threshold;
+        const _signal_range &search_range = config.search_range;
+        winfo.valid = VALID;
+
+        auto time_ns = [&scale](int i)
+        { return (i * scale.horiz_interval + scale.horiz_offset) * kToNs; };
+        int up, down;
+        SearchWindow(Nsamples, search_range, time_ns, up, down);
+        workspace.sample_up = up;
+        workspace.sample_down = down;
+        // Same rounding as t[1] - t[0] on the decoded axis
+        const double dt = Nsamples > 1 ? (scale.horiz_interval + scale.horiz_offset - scale.horiz_offset) * kToNs : 0;
+        const double mv_per_code = scale.vertical_gain * kToMV;
+
+        // [0, up): start pedestal. Without samples the pedestal is 0 mV, i.e. the code of 0 V.
+        // Robust pedestals are estimated on the codes and converted once.
+        const bool robust = config.baseline.method != kMeanBaseline;
+        auto code_value = [codes](int i)
+        { return static_cast<double>(codes[i]); };
+        acc_t ped_sum = 0, ped_square_sum = 0;
+        for (int i = 0; i < (robust ? 0 : up); i++)
+        {
+            ped_sum += codes[i];
+            ped_square_sum += static_cast<acc_t>(codes[i]) * codes[i];
+        }
+        double ped_code = up > 0 ? static_cast<double>(ped_sum) / up : scale.vertical_offset / scale.vertical_gain;
+        double ped_start = up > 0 ? (scale.vertical_gain * ped_code - scale.vertical_offset) * kToMV : 0;
+        double ped_start_std_dev = up > 0 ? mv_per_code * std::sqrt(std::max(0.0, static_cast<double>(ped_square_sum) / up - ped_code * ped_code)) : 0;
+        if (robust && up > 0)
+        {
+            RobustBaseline(config.baseline, 0, up, code_value, workspace.baseline, workspace.baseline_slots, ped_code, ped_start_std_dev);
+            ped_start = (scale.vertical_gain * ped_code - scale.vertical_offset) * kToMV;
+            ped_start_std_dev *= mv_per_code;
+        }
+
+        // [up, down] restricted to the search range: extrema and full charge
+        int first = up, last = down;
+        while (first <= last && time_ns(first) < search_range.first)
+            first++;
+        while (last >= first && time_ns(last) > search_range.second)
+            last--;
+
+        double max_a = -1.0e9, max_t = 0, min_a = 1.0e9, min_t = 0;
+        int sample_max = 0;
+        acc_t window_sum = 0;
+        const _feature_needs needs = GetFeatureNeeds(config.features);
+        const bool multi_threshold = !config.tot_thresholds.empty();
+        if ((needs.window || multi_threshold) && first <= last)
+        {
+            S max_code = codes[first], min_code = codes[first];
+            int argmax = first, argmin = first;
+            for (int i = first; i <= last; i++)
+            {
+                const S code = codes[i];
+                window_sum += code;
+                if (code > max_code)
+                {
+                    max_code = code;
+                    argmax = i;
+                }
+                if (code < min_code)
+                {
+                    min_code = code;
+                    argmin = i;
+                }
+            }
+            sample_max = argmax;
+            max_a = mv_per_code * (max_code - ped_code);
+            max_t = time_ns(argmax);
+            min_a = mv_per_code * (min_code - ped_code);
+            min_t = time_ns(argmin);
+        }
+        const double charge_full = mv_per_code * (static_cast<double>(window_sum) - (last - first + 1) * ped_code) * dt;
+
+        // [down, N) after the start of the range: end pedestal
+        int tail = down;
+        while (tail < Nsamples && !(time_ns(tail) > search_range.first))
+            tail++;
+        acc_t ped_sum_end = 0, ped_square_sum_end = 0;
+        for (int i = needs.ped_end && !robust ? tail : Nsamples; i < Nsamples; i++)
+        {
+            ped_sum_end += codes[i];
+            ped_square_sum_end += static_cast<acc_t>(codes[i]) * codes[i];
+        }
+        const int ped_count_end = Nsamples - tail;
+        double ped_code_end = ped_count_end > 0 ? static_cast<double>(ped_sum_end) / ped_count_end : 0;
+        double ped_end_std_dev = ped_count_end > 0 ? mv_per_code * std::sqrt(std::max(0.0, static_cast<double>(ped_square_sum_end) / ped_count_end - ped_code_end * ped_code_end)) : 0;
+        if (robust && needs.ped_end && ped_count_end > 0)
+        {
+            RobustBaseline(config.baseline, tail, Nsamples, code_value, workspace.baseline, workspace.baseline_slots, ped_code_end, ped_end_std_dev);
+            ped_end_std_dev *= mv_per_code;
+        }
+        const double ped_end = ped_count_end > 0 ? (scale.vertical_gain * ped_code_end - scale.vertical_offset) * kToMV : 0;
+
+        // Charge within ±2 ns of the peak
+        int half_width = dt != 0 ? static_cast<int>(2.0 / dt) : 0;
+        int pm_low = std::max(sample_max - half_width, 0);
+        int pm_high = std::min(sample_max + half_width, Nsamples - 1);
+        acc_t pm_sum = 0;
+        if (needs.pm2ns)
+            for (int i = pm_low; i <= pm_high; i++)
+                pm_sum += codes[i];
+        const double charge_pm2ns = mv_per_code * (static_cast<double>(pm_sum) - (pm_high - pm_low + 1) * ped_code) * dt;
+
+        // Levels of the 90/50/10% crossings and of the threshold, relative to the pedestal in sample units
+        const double fractions[3] = {0.9, 0.5, 0.1};
+        double level[3];
+        cmp_t level_code[3];
+        for (int k = 0; k < 3; k++)
+        {
+            level[k] = fractions[k] * max_a / mv_per_code;
+            level_code[k] = traits::AtOrBelow(ped_code + level[k]);
+        }
+        const double threshold_level = threshold / mv_per_code;
+        const cmp_t threshold_code = traits::Below(ped_code + threshold_level);
+        const bool search_threshold = threshold < max_a;
+
+        // Local scans from the peak outwards, charges summed on the codes until their level is crossed
+        const _interp_table *table = GetInterpolationTable(config.interpolation);
+        acc_t charge_sum[3] = {0, 0, 0};
+        int charge_count[3] = {0, 0, 0};
+        auto scan = [&](int side, int stop, double *t_levels, double &t_thr, bool *found, bool &found_thr)
+        {
+            const int step = side == 0 ? -1 : +1;
+            for (int k = 0; k < 3; k++)
+                found[k] = !needs.level[side][k];
+            found_thr = !needs.threshold[side];
+            for (int i = sample_max; step < 0 ? i >= stop : i <= stop; i += step)
+            {
+                const S code = codes[i];
+                for (int k = 0; k < 3; k++)
+                {
+                    if (!found[k] && code <= level_code[k])
+                    {
+                        InterpolateCodes(codes, Nsamples, i, level[k], ped_code, time_ns, t_levels[k], table);
+                        found[k] = true;
+                    }
+                }
+                if (!found_thr && search_threshold && code < threshold_code)
+                {
+                    found_thr = true;
+                    InterpolateCodes(codes, Nsamples, i, threshold_level, ped_code, time_ns, t_thr, table);
+                }
+
+                for (int k = 0; k < 3; k++)
+                {
+                    if (!found[k])
+                    {
+                        charge_sum[k] += code;
+                        charge_count[k]++;
+                    }
+                }
+
+                if (found[0] && found[1] && found[2] && found_thr)
+                    break;
+            }
+        };
+
+        double t1_levels[3] = {kNotFound, kNotFound, kNotFound}, t1 = kNotFound;
+        double t2_levels[3] = {kNotFound, kNotFound, kNotFound}, t2 = kNotFound;
+        bool found[3], found_t1, found_t2;
+        scan(0, up, t1_levels, t1, found, found_t1);
+        if (!found[2])
+            winfo.valid |= NO_T1_10_FOUND;
+        if (!found[1])
+            winfo.valid |= NO_T1_50_FOUND;
+        if (!found[0])
+            winfo.valid |= NO_T1_90_FOUND;
+        if (!found_t1)
+            winfo.valid |= NO_T1_FOUND;
+
+        scan(1, down, t2_levels, t2, found, found_t2);
+        if (!found[2])
+            winfo.valid |= NO_T2_10_FOUND;
+        if (!found[1])
+            winfo.valid |= NO_T2_50_FOUND;
+        if (!found[0])
+            winfo.valid |= NO_T2_90_FOUND;
+        if (!found_t2)
+            winfo.valid |= NO_T2_FOUND;
+
+        double charge[3];
+        for (int k = 0; k < 3; k++)
+            charge[k] = mv_per_code * (static_cast<double>(charge_sum[k]) - charge_count[k] * ped_code) * dt;
+
+        // Multi-threshold crossings, the levels stay in mV and the codes are converted as they are walked
+        if (multi_threshold)
+            MultiThresholdCrossings(up, down, sample_max, config.tot_thresholds, [codes, ped_code, mv_per_code](int i)
+                                    { return mv_per_code * (codes[i] - ped_code); }, time_ns, workspace.tot, table);
+
+        winfo.nsamples = Nsamples;
+        winfo.ped_start = ped_start;
+        winfo.ped_start_std_dev = ped_start_std_dev;
+        winfo.ped_end = ped_end;
+        winfo.ped_end_std_dev = ped_end_std_dev;
+        winfo.amp = max_a;
+        winfo.t_amp = max_t;
+        winfo.t1 = t1;
+        winfo.t1_10 = t1_levels[2];
+        winfo.t1_50 = t1_levels[1];
+        winfo.t1_90 = t1_levels[0];
+        winfo.toa = t1_levels[1];
+        winfo.t2 = t2;
+        winfo.t2_10 = t2_levels[2];
+        winfo.t2_50 = t2_levels[1];
+        winfo.t2_90 = t2_levels[0];
+        winfo.charge_10 = charge[2];
+        winfo.charge_50 = charge[1];
+        winfo.charge_90 = charge[0];
+        winfo.charge_pm2ns = charge_pm2ns;
+        winfo.charge_full = charge_full;
+        winfo.charge = charge[1];
+        winfo.t_min = min_t;
+        winfo.amp_min = min_a + ped_start - ped_end;
+
+        // Constant-fraction discriminator on the codes, the crossing does not depend on the amplitude scale
+        winfo.t_cfd = kNotFound;
+        if (needs.cfd && config.cfd_fraction > 0)
+        {
+            auto amp = [codes, ped_code](int i)
+            { return codes[i] - ped_code; };
+            if (!CFDCrossing(first, last, CFDDelaySamples(config.cfd_delay, dt), config.cfd_fraction, threshold_level, amp, time_ns, winfo.t_cfd, table))
+                winfo.valid |= NO_CFD_FOUND;
+        }
+        // Pulse finder on the codes, amplitudes converted to mV on the fly
+        if (config.find_pulses)
+        {
+            auto amp = [codes, ped_code, mv_per_code](int i)
+            { return mv_per_code * (codes[i] - ped_code); };
+            if (FindPulses(first, last, threshold, dt, amp, time_ns, workspace.pulses) > 1)
+                winfo.valid |= PILEUP;
+        }
+        // Template matching on the codes, the fitted amplitude is converted to mV
+        winfo.t_tmpl = kNotFound;
+        winfo.amp_tmpl = kNotFound;
+        if (needs.tmpl && !config.pulse_template.shape.empty())
+            TemplateFit(codes, Nsamples, first, last, ped_code, mv_per_code, dt, time_ns, config, workspace, winfo);
+        ApplyFeatureMask(winfo, config.features);
+    }
+}
+
+template <typename S>
+void WFDataProcessor::processWaveRaw(const S *codes, int Nsamples, const _sample_scale &scale, _waveinfo &winfo, const _extract_config &config, _wave_workspace &workspace)
+{
+    workspace.pulses.Clear();
+    workspace.tot.Clear();
+    workspace.filtered_samples = 0;
+    if (Nsamples <= 0 || codes == nullptr)
+    {
+        winfo.valid = NO_WAVEFORM;
+        return;
+    }
+    if (!(scale.vertical_gain > 0) || (Nsamples > 1 && !(scale.horiz_interval > 0)))
+    {
+        // Comparisons on codes need the amplitude to grow with the code, and the scans a monotonic axis:
+        // decode (in s and V here) and use the generic path, which also filters and fills the pulse and
+        // crossing lists. Not into t and a, which the reference kernel uses as its own buffers.
+        if (workspace.decoded.size() < 2 * static_cast<size_t>(Nsamples))
+            workspace.decoded.resize(2 * static_cast<size_t>(Nsamples));
+        double *t = workspace.decoded.data(), *a = t + Nsamples;
+        for (int i = 0; i < Nsamples; i++)
+        {
+            t[i] = i * scale.horiz_interval + scale.horiz_offset;
+            a[i] = scale.vertical_gain * codes[i] - scale.vertical_offset;
+        }
+        processWave(t, a, Nsamples, winfo, config, workspace);
+        return;
+    }
+
+    // Filter stage on the codes: the filters are linear, so decoding commutes with them, except for the
+    // offset which is scaled by the gain of the filter for a constant input
+    if (config.filter.type != kNoFilter && Nsamples >= 2 && DesignFilter(config.filter, scale.horiz_interval * kToNs, workspace.filter))
+    {
+        if ((int)workspace.filtered.size() < Nsamples)
+            workspace.filtered.resize(Nsamples);
+        FilterRecord(codes, Nsamples, workspace.filter, workspace.filtered.data());
+        _sample_scale filtered_scale = scale;
+        filtered_scale.vertical_offset *= workspace.filter.dc_gain;
+        workspace.filtered_samples = Nsamples;
+        workspace.filtered_gain = filtered_scale.vertical_gain;
+        workspace.filtered_offset = filtered_scale.vertical_offset;
+        ProcessCodes(workspace.filtered.data(), Nsamples, filtered_scale, winfo, config, workspace);
+        return;
+    }
+    ProcessCodes(codes, Nsamples, scale, winfo, config, workspace);
+}
+
+void WFDataProcessor::processWaveRaw(const ScopeData &data, _waveinfo &winfo, const _extract_config &config, _wave_workspace &workspace)
+{
+    const std::vector<char> &raw = data.getRawData();
+    if (data.getRawSampleSize() == 1)
+        processWaveRaw(reinterpret_cast<const int8_t *>(raw.data()), data.getRawSampleCount(), GetSampleScale(data), winfo, config, workspace);
+    else
+        processWaveRaw(reinterpret_cast<const int16_t *>(raw.data()), data.getRawSampleCount(), GetSampleScale(data), winfo, config, workspace);
+}
+
+namespace WFDataProcessor
+{
+    template void processWaveRaw<int8_t>(const int8_t *, int, const _sample_scale &, _waveinfo &, const _extract_config &, _wave_workspace &);
+    template void processWaveRaw<int16_t>(const int16_t *, int, const _sample_scale &, _waveinfo &, const _extract_config &, _wave_workspace &);
+    template void processWaveRaw<float>(const float *, int, const _sample_scale &, _waveinfo &, const _extract_config &, _wave_workspace &);
+    template void processWaveRaw<double>(const double *, int, const _sample_scale &, _waveinfo &, const _extract_config &, _wave_workspace &);
+}
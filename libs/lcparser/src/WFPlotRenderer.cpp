@@ -0,0 +1,184 @@
+#include "WFDataConverter.h"
+
+#include "TROOT.h"
+#include "TCanvas.h"
+#include "TGraph.h"
+#include "TAxis.h"
+#include "TLine.h"
+
+#include <vector>
+
+namespace
+{
+    constexpr double kNotFound = -100e9; // crossings not found, fields left out of the feature mask are below it
+
+    bool Found(double value) { return value > kNotFound; }
+}
+
+void WFDataProcessor::FillPlotJob(const double *t, const double *a, int Nsamples, const _waveinfo &winfo, const _extract_config &config, _plot_job &job)
+{
+    job.t.resize(Nsamples);
+    job.a.resize(Nsamples);
+    for (int i = 0; i < Nsamples; i++)
+    {
+        job.t[i] = t[i] * 1.0e9; // convert to ns
+        job.a[i] = a[i] * 1.0e3; // convert to mV
+    }
+    job.winfo = winfo;
+    job.search_range = config.search_range;
+    job.threshold = config.threshold;
+    job.savePrefix = config.savePrefix;
+}
+
+void WFDataProcessor::DrawPlotJob(const _plot_job &job, TCanvas *canvas)
+{
+    const int Nsamples = job.t.size();
+    if (Nsamples == 0 || canvas == nullptr)
+        return;
+    canvas->cd();
+
+    TGraph tg(Nsamples, job.t.data(), job.a.data());
+    tg.SetTitle(";Time (ns);Amplitude (mV)");
+    const double y_low = tg.GetYaxis()->GetXmin();
+    const double y_high = tg.GetYaxis()->GetXmax();
+    tg.Draw("AL");
+
+    // Reserved, the pad keeps pointers to the lines drawn
+    std::vector<TLine> lines;
+    lines.reserve(16);
+    auto line = [&lines](double x1, double y1, double x2, double y2, int color, int width = 1)
+    {
+        lines.emplace_back(x1, y1, x2, y2);
+        lines.back().SetLineColor(color);
+        lines.back().SetLineStyle(2);
+        lines.back().SetLineWidth(width);
+        lines.back().Draw("same");
+    };
+    const _waveinfo &w = job.winfo;
+    const double x_low = job.search_range.first, x_high = job.search_range.second;
+
+    // Gray for range & pedestal
+    line(x_low, y_low, x_low, y_high, kGray);
+    line(x_high, y_low, x_high, y_high, kGray);
+    // Green for max, red for t1 and t2, blue for toa
+    if (Found(w.t_amp) && Found(w.amp))
+        line(w.t_amp, y_low, w.t_amp, y_high, kGreen + 2);
+    if (Found(w.t1))
+        line(w.t1, y_low, w.t1, y_high, kRed);
+    if (Found(w.t2))
+        line(w.t2, y_low, w.t2, y_high, kRed);
+    if (Found(w.toa))
+        line(w.toa, y_low, w.toa, y_high, kBlue);
+
+    // Levels above the start pedestal: pedestal +- 3 sigma, threshold, 50% and maximum
+    if (Found(w.ped_start))
+    {
+        line(x_low, w.ped_start, x_high, w.ped_start, kGray);
+        if (Found(w.ped_start_std_dev))
+        {
+            line(x_low, w.ped_start + 3 * w.ped_start_std_dev, x_high, w.ped_start + 3 * w.ped_start_std_dev, kGray);
+            line(x_low, w.ped_start - 3 * w.ped_start_std_dev, x_high, w.ped_start - 3 * w.ped_start_std_dev, kGray);
+        }
+        line(x_low, w.ped_start + job.threshold, x_high, w.ped_start + job.threshold, kRed);
+        if (Found(w.amp))
+        {
+            line(x_low, w.ped_start + 0.5 * w.amp, x_high, w.ped_start + 0.5 * w.amp, kBlue);
+            line(x_low, w.ped_start + w.amp, x_high, w.ped_start + w.amp, kGreen + 2);
+        }
+    }
+    if (Found(w.ped_end))
+        line(x_high, w.ped_end, job.t.back(), w.ped_end, kGray + 2, 3);
+
+    canvas->SaveAs(Form("%s.png", job.savePrefix.c_str()));
+}
+
+WFDataProcessor::WFPlotRenderer::~WFPlotRenderer()
+{
+    if (fThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fStop = true;
+        }
+        fWake.notify_one();
+        fThread.join();
+    }
+    delete fCanvas;
+}
+
+void WFDataProcessor::WFPlotRenderer::Start()
+{
+    ROOT::EnableThreadSafety();
+    // Made in batch mode on the submitting thread, the renderer thread only draws into it and saves png files
+    const bool batch = gROOT->IsBatch();
+    gROOT->SetBatch(true);
+    fCanvas = new TCanvas(Form("wfplot_%p", static_cast<void *>(this)), "Waveform", 800, 600);
+    gROOT->SetBatch(batch);
+    fThread = std::thread(&WFPlotRenderer::Run, this);
+}
+
+bool WFDataProcessor::WFPlotRenderer::Submit(_plot_job &job)
+{
+    std::call_once(fStarted, &WFPlotRenderer::Start, this);
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        if (fPending.size() >= fMaxPending)
+        {
+            fDropped++;
+            return false;
+        }
+        fPending.emplace_back();
+        std::swap(fPending.back(), job);
+        if (!fRecycled.empty())
+        {
+            std::swap(job, fRecycled.back());
+            fRecycled.pop_back();
+        }
+    }
+    fWake.notify_one();
+    return true;
+}
+
+void WFDataProcessor::WFPlotRenderer::Flush()
+{
+    std::unique_lock<std::mutex> lock(fMutex);
+    fIdle.wait(lock, [this]
+               { return fPending.empty() && !fBusy; });
+}
+
+size_t WFDataProcessor::WFPlotRenderer::GetDrawn() const
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fDrawn;
+}
+
+size_t WFDataProcessor::WFPlotRenderer::GetDropped() const
+{
+    std::lock_guard<std::mutex> lock(fMutex);
+    return fDropped;
+}
+
+void WFDataProcessor::WFPlotRenderer::Run()
+{
+    std::unique_lock<std::mutex> lock(fMutex);
+    while (true)
+    {
+        fWake.wait(lock, [this]
+                   { return fStop || !fPending.empty(); });
+        // Stopped with an empty queue, everything submitted was drawn
+        if (fPending.empty())
+            break;
+        _plot_job job = std::move(fPending.front());
+        fPending.pop_front();
+        fBusy = true;
+        lock.unlock();
+        DrawPlotJob(job, fCanvas);
+        lock.lock();
+        fBusy = false;
+        fDrawn++;
+        if (fRecycled.size() < fMaxPending)
+            fRecycled.push_back(std::move(job));
+        if (fPending.empty())
+            fIdle.notify_all();
+    }
+}
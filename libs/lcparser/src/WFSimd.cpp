@@ -0,0 +1,640 @@
+#include "WFSimd.h"
+
+#include <atomic>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define WF_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace WFDataProcessor::Simd;
+
+namespace
+{
+    std::atomic<int> &ActiveLevel()
+    {
+        static std::atomic<int> level(DetectLevel());
+        return level;
+    }
+
+    // Scalar versions, identical to the sequential loops of processWaveReference
+
+    void SumSquaresScalar(const double *x, int n, double scale, double &sum, double &sum_sq)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            double v = x[i] * scale;
+            sum += v;
+            sum_sq += v * v;
+        }
+    }
+
+    void SumScalar(const double *x, int n, double scale, double offset, double weight, double &sum)
+    {
+        for (int i = 0; i < n; i++)
+            sum += (x[i] * scale - offset) * weight;
+    }
+
+    void WindowStatsScalar(const double *x, int n, double scale, double offset, double weight, double &sum,
+                           double &max, int &argmax, double &min, int &argmin)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            double v = x[i] * scale - offset;
+            sum += v * weight;
+            if (v > max)
+            {
+                max = v;
+                argmax = i;
+            }
+            if (v < min)
+            {
+                min = v;
+                argmin = i;
+            }
+        }
+    }
+
+    void FIRScalar(const double *x, int n, const double *h, int taps, double *y)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            double acc = h[0] * x[i];
+            for (int k = 1; k < taps; k++)
+                acc += h[k] * x[i + k];
+            y[i] = acc;
+        }
+    }
+
+    void LaneSumSquaresScalar(const double *x, size_t stride, int rows, int lanes, double scale, double *sum, double *sum_sq)
+    {
+        for (int r = 0; r < rows; r++, x += stride)
+        {
+            for (int l = 0; l < lanes; l++)
+            {
+                double v = x[l] * scale;
+                sum[l] += v;
+                sum_sq[l] += v * v;
+            }
+        }
+    }
+
+    void LaneWindowStatsScalar(const double *x, size_t stride, int rows, int lanes, double scale, const double *offset, double weight,
+                               double *sum, double *max, int *argmax, double *min, int *argmin)
+    {
+        for (int r = 0; r < rows; r++, x += stride)
+        {
+            for (int l = 0; l < lanes; l++)
+            {
+                double v = x[l] * scale - offset[l];
+                sum[l] += v * weight;
+                if (v > max[l])
+                {
+                    max[l] = v;
+                    argmax[l] = r;
+                }
+                if (v < min[l])
+                {
+                    min[l] = v;
+                    argmin[l] = r;
+                }
+            }
+        }
+    }
+
+    // Merge per-lane extrema: the largest value wins, the lowest index among equal values.
+    // Lanes never updated carry index -1 and the input value, so the result keeps the "strictly above" rule.
+    void MergeLanes(const double *laneValue, const double *laneIndex, int lanes, bool isMax, double &value, int &index)
+    {
+        double best = value;
+        int bestIndex = -1;
+        for (int l = 0; l < lanes; l++)
+        {
+            if (laneIndex[l] < 0)
+                continue;
+            bool better = isMax ? laneValue[l] > best : laneValue[l] < best;
+            if (better || (bestIndex >= 0 && laneValue[l] == best && laneIndex[l] < bestIndex))
+            {
+                best = laneValue[l];
+                bestIndex = (int)laneIndex[l];
+            }
+        }
+        if (bestIndex >= 0)
+        {
+            value = best;
+            index = bestIndex;
+        }
+    }
+
+#ifdef WF_SIMD_X86
+    // AVX2 without FMA, so that x * scale - offset is never contracted and extrema stay exact
+
+    __attribute__((target("avx2"))) double HorizontalSum256(__m256d v)
+    {
+        __m128d low = _mm256_castpd256_pd128(v);
+        __m128d high = _mm256_extractf128_pd(v, 1);
+        low = _mm_add_pd(low, high);
+        return _mm_cvtsd_f64(_mm_add_sd(low, _mm_unpackhi_pd(low, low)));
+    }
+
+    __attribute__((target("avx2"))) void SumSquaresAVX2(const double *x, int n, double scale, double &sum, double &sum_sq)
+    {
+        const __m256d vscale = _mm256_set1_pd(scale);
+        __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+        __m256d sq0 = _mm256_setzero_pd(), sq1 = _mm256_setzero_pd();
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256d v0 = _mm256_mul_pd(_mm256_loadu_pd(x + i), vscale);
+            __m256d v1 = _mm256_mul_pd(_mm256_loadu_pd(x + i + 4), vscale);
+            acc0 = _mm256_add_pd(acc0, v0);
+            acc1 = _mm256_add_pd(acc1, v1);
+            sq0 = _mm256_add_pd(sq0, _mm256_mul_pd(v0, v0));
+            sq1 = _mm256_add_pd(sq1, _mm256_mul_pd(v1, v1));
+        }
+        sum += HorizontalSum256(_mm256_add_pd(acc0, acc1));
+        sum_sq += HorizontalSum256(_mm256_add_pd(sq0, sq1));
+        SumSquaresScalar(x + i, n - i, scale, sum, sum_sq);
+    }
+
+    __attribute__((target("avx2"))) void SumAVX2(const double *x, int n, double scale, double offset, double weight, double &sum)
+    {
+        const __m256d vscale = _mm256_set1_pd(scale), voffset = _mm256_set1_pd(offset), vweight = _mm256_set1_pd(weight);
+        __m256d acc = _mm256_setzero_pd();
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256d v = _mm256_sub_pd(_mm256_mul_pd(_mm256_loadu_pd(x + i), vscale), voffset);
+            acc = _mm256_add_pd(acc, _mm256_mul_pd(v, vweight));
+        }
+        sum += HorizontalSum256(acc);
+        SumScalar(x + i, n - i, scale, offset, weight, sum);
+    }
+
+    __attribute__((target("avx2"))) void WindowStatsAVX2(const double *x, int n, double scale, double offset, double weight, double &sum,
+                                                         double &max, int &argmax, double &min, int &argmin)
+    {
+        int i = 0;
+        if (n >= 4)
+        {
+            const __m256d vscale = _mm256_set1_pd(scale), voffset = _mm256_set1_pd(offset), vweight = _mm256_set1_pd(weight);
+            const __m256d step = _mm256_set1_pd(4);
+            __m256d acc = _mm256_setzero_pd();
+            __m256d vmax = _mm256_set1_pd(max), vmin = _mm256_set1_pd(min);
+            __m256d imax = _mm256_set1_pd(-1), imin = _mm256_set1_pd(-1);
+            __m256d index = _mm256_setr_pd(0, 1, 2, 3);
+            for (; i + 4 <= n; i += 4)
+            {
+                __m256d v = _mm256_sub_pd(_mm256_mul_pd(_mm256_loadu_pd(x + i), vscale), voffset);
+                acc = _mm256_add_pd(acc, _mm256_mul_pd(v, vweight));
+                // Strict comparisons keep the first occurrence within each lane
+                __m256d gt = _mm256_cmp_pd(v, vmax, _CMP_GT_OQ);
+                vmax = _mm256_blendv_pd(vmax, v, gt);
+                imax = _mm256_blendv_pd(imax, index, gt);
+                __m256d lt = _mm256_cmp_pd(v, vmin, _CMP_LT_OQ);
+                vmin = _mm256_blendv_pd(vmin, v, lt);
+                imin = _mm256_blendv_pd(imin, index, lt);
+                index = _mm256_add_pd(index, step);
+            }
+            sum += HorizontalSum256(acc);
+
+            alignas(32) double laneValue[4], laneIndex[4];
+            _mm256_store_pd(laneValue, vmax);
+            _mm256_store_pd(laneIndex, imax);
+            MergeLanes(laneValue, laneIndex, 4, true, max, argmax);
+            _mm256_store_pd(laneValue, vmin);
+            _mm256_store_pd(laneIndex, imin);
+            MergeLanes(laneValue, laneIndex, 4, false, min, argmin);
+        }
+
+        // Remaining samples come after every vector lane, so strict updates keep the first occurrence
+        int tailMax = -1, tailMin = -1;
+        WindowStatsScalar(x + i, n - i, scale, offset, weight, sum, max, tailMax, min, tailMin);
+        if (tailMax >= 0)
+            argmax = i + tailMax;
+        if (tailMin >= 0)
+            argmin = i + tailMin;
+    }
+
+    // Lane versions keep one event per vector lane in registers: full groups of 8 lanes as two vectors,
+    // other widths go to the scalar loop
+
+    // Four independent accumulators hide the latency of the additions, each output is summed in tap order
+    __attribute__((target("avx2"))) void FIRAVX2(const double *x, int n, const double *h, int taps, double *y)
+    {
+        int i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m256d h0 = _mm256_set1_pd(h[0]);
+            __m256d acc0 = _mm256_mul_pd(h0, _mm256_loadu_pd(x + i));
+            __m256d acc1 = _mm256_mul_pd(h0, _mm256_loadu_pd(x + i + 4));
+            __m256d acc2 = _mm256_mul_pd(h0, _mm256_loadu_pd(x + i + 8));
+            __m256d acc3 = _mm256_mul_pd(h0, _mm256_loadu_pd(x + i + 12));
+            for (int k = 1; k < taps; k++)
+            {
+                const __m256d hk = _mm256_set1_pd(h[k]);
+                const double *xk = x + i + k;
+                acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(hk, _mm256_loadu_pd(xk)));
+                acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(hk, _mm256_loadu_pd(xk + 4)));
+                acc2 = _mm256_add_pd(acc2, _mm256_mul_pd(hk, _mm256_loadu_pd(xk + 8)));
+                acc3 = _mm256_add_pd(acc3, _mm256_mul_pd(hk, _mm256_loadu_pd(xk + 12)));
+            }
+            _mm256_storeu_pd(y + i, acc0);
+            _mm256_storeu_pd(y + i + 4, acc1);
+            _mm256_storeu_pd(y + i + 8, acc2);
+            _mm256_storeu_pd(y + i + 12, acc3);
+        }
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256d acc = _mm256_mul_pd(_mm256_set1_pd(h[0]), _mm256_loadu_pd(x + i));
+            for (int k = 1; k < taps; k++)
+                acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_set1_pd(h[k]), _mm256_loadu_pd(x + i + k)));
+            _mm256_storeu_pd(y + i, acc);
+        }
+        FIRScalar(x + i, n - i, h, taps, y + i);
+    }
+
+    __attribute__((target("avx2"))) void LaneSumSquaresAVX2(const double *x, size_t stride, int rows, double scale, double *sum, double *sum_sq)
+    {
+        const __m256d vscale = _mm256_set1_pd(scale);
+        __m256d acc0 = _mm256_loadu_pd(sum), acc1 = _mm256_loadu_pd(sum + 4);
+        __m256d sq0 = _mm256_loadu_pd(sum_sq), sq1 = _mm256_loadu_pd(sum_sq + 4);
+        for (int r = 0; r < rows; r++, x += stride)
+        {
+            __m256d v0 = _mm256_mul_pd(_mm256_loadu_pd(x), vscale);
+            __m256d v1 = _mm256_mul_pd(_mm256_loadu_pd(x + 4), vscale);
+            acc0 = _mm256_add_pd(acc0, v0);
+            acc1 = _mm256_add_pd(acc1, v1);
+            sq0 = _mm256_add_pd(sq0, _mm256_mul_pd(v0, v0));
+            sq1 = _mm256_add_pd(sq1, _mm256_mul_pd(v1, v1));
+        }
+        _mm256_storeu_pd(sum, acc0);
+        _mm256_storeu_pd(sum + 4, acc1);
+        _mm256_storeu_pd(sum_sq, sq0);
+        _mm256_storeu_pd(sum_sq + 4, sq1);
+    }
+
+    __attribute__((target("avx2"))) void LaneWindowStatsAVX2(const double *x, size_t stride, int rows, double scale, const double *offset, double weight,
+                                                             double *sum, double *max, int *argmax, double *min, int *argmin)
+    {
+        const __m256d vscale = _mm256_set1_pd(scale), vweight = _mm256_set1_pd(weight), one = _mm256_set1_pd(1);
+        for (int half = 0; half < 8; half += 4)
+        {
+            const double *xh = x + half;
+            const __m256d voffset = _mm256_loadu_pd(offset + half);
+            __m256d acc = _mm256_loadu_pd(sum + half);
+            __m256d vmax = _mm256_loadu_pd(max + half), vmin = _mm256_loadu_pd(min + half);
+            __m256d imax = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(argmax + half)));
+            __m256d imin = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(argmin + half)));
+            __m256d index = _mm256_setzero_pd();
+            for (int r = 0; r < rows; r++, xh += stride)
+            {
+                __m256d v = _mm256_sub_pd(_mm256_mul_pd(_mm256_loadu_pd(xh), vscale), voffset);
+                acc = _mm256_add_pd(acc, _mm256_mul_pd(v, vweight));
+                __m256d gt = _mm256_cmp_pd(v, vmax, _CMP_GT_OQ);
+                vmax = _mm256_blendv_pd(vmax, v, gt);
+                imax = _mm256_blendv_pd(imax, index, gt);
+                __m256d lt = _mm256_cmp_pd(v, vmin, _CMP_LT_OQ);
+                vmin = _mm256_blendv_pd(vmin, v, lt);
+                imin = _mm256_blendv_pd(imin, index, lt);
+                index = _mm256_add_pd(index, one);
+            }
+            _mm256_storeu_pd(sum + half, acc);
+            _mm256_storeu_pd(max + half, vmax);
+            _mm256_storeu_pd(min + half, vmin);
+            _mm_storeu_si128((__m128i *)(argmax + half), _mm256_cvtpd_epi32(imax));
+            _mm_storeu_si128((__m128i *)(argmin + half), _mm256_cvtpd_epi32(imin));
+        }
+    }
+
+    // AVX-512F includes FMA, the explicitly rounded intrinsics keep x * scale - offset from being contracted
+
+    constexpr int kRound = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+
+    // Zero-masked forms of the plain intrinsics, avoiding the undefined source register they start from
+    __attribute__((target("avx512f"))) inline __m512d LoadMasked(__mmask8 mask, const double *x)
+    {
+        return _mm512_mask_loadu_pd(_mm512_setzero_pd(), mask, x);
+    }
+    __attribute__((target("avx512f"))) double HorizontalSum512(__m512d v)
+    {
+        alignas(64) double lanes[8];
+        _mm512_store_pd(lanes, v);
+        return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    }
+    __attribute__((target("avx512f"))) inline __m512d ScaleExact(__m512d x, __m512d scale, __m512d offset)
+    {
+        return _mm512_maskz_sub_round_pd(0xFF, _mm512_maskz_mul_round_pd(0xFF, x, scale, kRound), offset, kRound);
+    }
+
+    __attribute__((target("avx512f"))) void SumSquaresAVX512(const double *x, int n, double scale, double &sum, double &sum_sq)
+    {
+        const __m512d vscale = _mm512_set1_pd(scale);
+        __m512d acc = _mm512_setzero_pd(), sq = _mm512_setzero_pd();
+        for (int i = 0; i < n; i += 8)
+        {
+            __mmask8 mask = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+            __m512d v = _mm512_maskz_mul_round_pd(0xFF, LoadMasked(mask, x + i), vscale, kRound);
+            acc = _mm512_add_pd(acc, v);
+            sq = _mm512_add_pd(sq, _mm512_mul_pd(v, v));
+        }
+        sum += HorizontalSum512(acc);
+        sum_sq += HorizontalSum512(sq);
+    }
+
+    __attribute__((target("avx512f"))) void SumAVX512(const double *x, int n, double scale, double offset, double weight, double &sum)
+    {
+        const __m512d vscale = _mm512_set1_pd(scale), voffset = _mm512_set1_pd(offset), vweight = _mm512_set1_pd(weight);
+        __m512d acc = _mm512_setzero_pd();
+        for (int i = 0; i < n; i += 8)
+        {
+            __mmask8 mask = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+            __m512d v = ScaleExact(LoadMasked(mask, x + i), vscale, voffset);
+            acc = _mm512_mask_add_pd(acc, mask, acc, _mm512_mul_pd(v, vweight));
+        }
+        sum += HorizontalSum512(acc);
+    }
+
+    __attribute__((target("avx512f"))) void WindowStatsAVX512(const double *x, int n, double scale, double offset, double weight, double &sum,
+                                                             double &max, int &argmax, double &min, int &argmin)
+    {
+        const __m512d vscale = _mm512_set1_pd(scale), voffset = _mm512_set1_pd(offset), vweight = _mm512_set1_pd(weight);
+        const __m512d step = _mm512_set1_pd(8);
+        __m512d acc = _mm512_setzero_pd();
+        __m512d vmax = _mm512_set1_pd(max), vmin = _mm512_set1_pd(min);
+        __m512d imax = _mm512_set1_pd(-1), imin = _mm512_set1_pd(-1);
+        __m512d index = _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7);
+        for (int i = 0; i < n; i += 8)
+        {
+            __mmask8 mask = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+            __m512d v = ScaleExact(LoadMasked(mask, x + i), vscale, voffset);
+            acc = _mm512_mask_add_pd(acc, mask, acc, _mm512_mul_pd(v, vweight));
+            __mmask8 gt = _mm512_mask_cmp_pd_mask(mask, v, vmax, _CMP_GT_OQ);
+            vmax = _mm512_mask_blend_pd(gt, vmax, v);
+            imax = _mm512_mask_blend_pd(gt, imax, index);
+            __mmask8 lt = _mm512_mask_cmp_pd_mask(mask, v, vmin, _CMP_LT_OQ);
+            vmin = _mm512_mask_blend_pd(lt, vmin, v);
+            imin = _mm512_mask_blend_pd(lt, imin, index);
+            index = _mm512_add_pd(index, step);
+        }
+        sum += HorizontalSum512(acc);
+
+        alignas(64) double laneValue[8], laneIndex[8];
+        _mm512_store_pd(laneValue, vmax);
+        _mm512_store_pd(laneIndex, imax);
+        MergeLanes(laneValue, laneIndex, 8, true, max, argmax);
+        _mm512_store_pd(laneValue, vmin);
+        _mm512_store_pd(laneIndex, imin);
+        MergeLanes(laneValue, laneIndex, 8, false, min, argmin);
+    }
+
+    // Every lane is one independent sequential sum, rounded operations keep it identical to the scalar loop
+
+    __attribute__((target("avx512f"))) inline __m512d MulExact(__m512d a, __m512d b)
+    {
+        return _mm512_maskz_mul_round_pd(0xFF, a, b, kRound);
+    }
+
+    __attribute__((target("avx512f"))) void FIRAVX512(const double *x, int n, const double *h, int taps, double *y)
+    {
+        int i = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            __m512d h0 = _mm512_set1_pd(h[0]);
+            __m512d acc0 = MulExact(h0, _mm512_loadu_pd(x + i));
+            __m512d acc1 = MulExact(h0, _mm512_loadu_pd(x + i + 8));
+            __m512d acc2 = MulExact(h0, _mm512_loadu_pd(x + i + 16));
+            __m512d acc3 = MulExact(h0, _mm512_loadu_pd(x + i + 24));
+            for (int k = 1; k < taps; k++)
+            {
+                const __m512d hk = _mm512_set1_pd(h[k]);
+                const double *xk = x + i + k;
+                acc0 = _mm512_add_pd(acc0, MulExact(hk, _mm512_loadu_pd(xk)));
+                acc1 = _mm512_add_pd(acc1, MulExact(hk, _mm512_loadu_pd(xk + 8)));
+                acc2 = _mm512_add_pd(acc2, MulExact(hk, _mm512_loadu_pd(xk + 16)));
+                acc3 = _mm512_add_pd(acc3, MulExact(hk, _mm512_loadu_pd(xk + 24)));
+            }
+            _mm512_storeu_pd(y + i, acc0);
+            _mm512_storeu_pd(y + i + 8, acc1);
+            _mm512_storeu_pd(y + i + 16, acc2);
+            _mm512_storeu_pd(y + i + 24, acc3);
+        }
+        for (; i < n; i += 8)
+        {
+            __mmask8 mask = n - i >= 8 ? 0xFF : (__mmask8)((1u << (n - i)) - 1);
+            __m512d acc = MulExact(_mm512_set1_pd(h[0]), LoadMasked(mask, x + i));
+            for (int k = 1; k < taps; k++)
+                acc = _mm512_add_pd(acc, MulExact(_mm512_set1_pd(h[k]), LoadMasked(mask, x + i + k)));
+            _mm512_mask_storeu_pd(y + i, mask, acc);
+        }
+    }
+
+    __attribute__((target("avx512f"))) void LaneSumSquaresAVX512(const double *x, size_t stride, int rows, int lanes, double scale, double *sum, double *sum_sq)
+    {
+        const __mmask8 mask = (__mmask8)((1u << lanes) - 1);
+        const __m512d vscale = _mm512_set1_pd(scale);
+        __m512d acc = LoadMasked(mask, sum), sq = LoadMasked(mask, sum_sq);
+        for (int r = 0; r < rows; r++, x += stride)
+        {
+            __m512d v = _mm512_maskz_mul_round_pd(0xFF, LoadMasked(mask, x), vscale, kRound);
+            acc = _mm512_maskz_add_round_pd(0xFF, acc, v, kRound);
+            sq = _mm512_maskz_add_round_pd(0xFF, sq, _mm512_maskz_mul_round_pd(0xFF, v, v, kRound), kRound);
+        }
+        _mm512_mask_storeu_pd(sum, mask, acc);
+        _mm512_mask_storeu_pd(sum_sq, mask, sq);
+    }
+
+    __attribute__((target("avx512f"))) void LaneWindowStatsAVX512(const double *x, size_t stride, int rows, int lanes, double scale, const double *offset, double weight,
+                                                                 double *sum, double *max, int *argmax, double *min, int *argmin)
+    {
+        const __mmask8 mask = (__mmask8)((1u << lanes) - 1);
+        const __m512d vscale = _mm512_set1_pd(scale), vweight = _mm512_set1_pd(weight), one = _mm512_set1_pd(1);
+        const __m512d voffset = LoadMasked(mask, offset);
+        __m512d acc = LoadMasked(mask, sum), vmax = LoadMasked(mask, max), vmin = LoadMasked(mask, min);
+        // Indices go through local arrays, masked 32-bit loads and stores would need AVX-512VL
+        alignas(32) int laneMax[8] = {}, laneMin[8] = {};
+        for (int l = 0; l < lanes; l++)
+        {
+            laneMax[l] = argmax[l];
+            laneMin[l] = argmin[l];
+        }
+        __m512d imax = _mm512_maskz_cvtepi32_pd(0xFF, _mm256_load_si256((const __m256i *)laneMax));
+        __m512d imin = _mm512_maskz_cvtepi32_pd(0xFF, _mm256_load_si256((const __m256i *)laneMin));
+        __m512d index = _mm512_setzero_pd();
+        for (int r = 0; r < rows; r++, x += stride)
+        {
+            __m512d v = ScaleExact(LoadMasked(mask, x), vscale, voffset);
+            acc = _mm512_maskz_add_round_pd(0xFF, acc, _mm512_maskz_mul_round_pd(0xFF, v, vweight, kRound), kRound);
+            __mmask8 gt = _mm512_mask_cmp_pd_mask(mask, v, vmax, _CMP_GT_OQ);
+            vmax = _mm512_mask_blend_pd(gt, vmax, v);
+            imax = _mm512_mask_blend_pd(gt, imax, index);
+            __mmask8 lt = _mm512_mask_cmp_pd_mask(mask, v, vmin, _CMP_LT_OQ);
+            vmin = _mm512_mask_blend_pd(lt, vmin, v);
+            imin = _mm512_mask_blend_pd(lt, imin, index);
+            index = _mm512_add_pd(index, one);
+        }
+        _mm512_mask_storeu_pd(sum, mask, acc);
+        _mm512_mask_storeu_pd(max, mask, vmax);
+        _mm512_mask_storeu_pd(min, mask, vmin);
+        _mm256_store_si256((__m256i *)laneMax, _mm512_maskz_cvtpd_epi32(0xFF, imax));
+        _mm256_store_si256((__m256i *)laneMin, _mm512_maskz_cvtpd_epi32(0xFF, imin));
+        for (int l = 0; l < lanes; l++)
+        {
+            argmax[l] = laneMax[l];
+            argmin[l] = laneMin[l];
+        }
+    }
+#endif
+}
+
+Level WFDataProcessor::Simd::DetectLevel()
+{
+#ifdef WF_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return kAVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return kAVX2;
+#endif
+    return kScalar;
+}
+
+Level WFDataProcessor::Simd::GetLevel()
+{
+    return (Level)ActiveLevel().load(std::memory_order_relaxed);
+}
+
+bool WFDataProcessor::Simd::SetLevel(Level level)
+{
+    if (level < kScalar || level > DetectLevel())
+        return false;
+    ActiveLevel().store(level, std::memory_order_relaxed);
+    return true;
+}
+
+const char *WFDataProcessor::Simd::LevelName(Level level)
+{
+    switch (level)
+    {
+    case kAVX512:
+        return "AVX-512";
+    case kAVX2:
+        return "AVX2";
+    default:
+        return "scalar";
+    }
+}
+
+void WFDataProcessor::Simd::ScaledSumSquares(const double *x, int n, double scale, double &sum, double &sum_sq)
+{
+    if (n <= 0)
+        return;
+#ifdef WF_SIMD_X86
+    switch (GetLevel())
+    {
+    case kAVX512:
+        return SumSquaresAVX512(x, n, scale, sum, sum_sq);
+    case kAVX2:
+        return SumSquaresAVX2(x, n, scale, sum, sum_sq);
+    default:
+        break;
+    }
+#endif
+    SumSquaresScalar(x, n, scale, sum, sum_sq);
+}
+
+void WFDataProcessor::Simd::ScaledSum(const double *x, int n, double scale, double offset, double weight, double &sum)
+{
+    if (n <= 0)
+        return;
+#ifdef WF_SIMD_X86
+    switch (GetLevel())
+    {
+    case kAVX512:
+        return SumAVX512(x, n, scale, offset, weight, sum);
+    case kAVX2:
+        return SumAVX2(x, n, scale, offset, weight, sum);
+    default:
+        break;
+    }
+#endif
+    SumScalar(x, n, scale, offset, weight, sum);
+}
+
+void WFDataProcessor::Simd::ScaledWindowStats(const double *x, int n, double scale, double offset, double weight, double &sum,
+                                              double &max, int &argmax, double &min, int &argmin)
+{
+    if (n <= 0)
+        return;
+#ifdef WF_SIMD_X86
+    switch (GetLevel())
+    {
+    case kAVX512:
+        return WindowStatsAVX512(x, n, scale, offset, weight, sum, max, argmax, min, argmin);
+    case kAVX2:
+        return WindowStatsAVX2(x, n, scale, offset, weight, sum, max, argmax, min, argmin);
+    default:
+        break;
+    }
+#endif
+    WindowStatsScalar(x, n, scale, offset, weight, sum, max, argmax, min, argmin);
+}
+
+void WFDataProcessor::Simd::LaneSumSquares(const double *x, size_t stride, int rows, int lanes, double scale, double *sum, double *sum_sq)
+{
+    if (rows <= 0 || lanes <= 0)
+        return;
+#ifdef WF_SIMD_X86
+    switch (GetLevel())
+    {
+    case kAVX512:
+        return LaneSumSquaresAVX512(x, stride, rows, lanes, scale, sum, sum_sq);
+    case kAVX2:
+        if (lanes == kLanes)
+            return LaneSumSquaresAVX2(x, stride, rows, scale, sum, sum_sq);
+        break;
+    default:
+        break;
+    }
+#endif
+    LaneSumSquaresScalar(x, stride, rows, lanes, scale, sum, sum_sq);
+}
+
+void WFDataProcessor::Simd::LaneWindowStats(const double *x, size_t stride, int rows, int lanes, double scale, const double *offset, double weight,
+                                            double *sum, double *max, int *argmax, double *min, int *argmin)
+{
+    if (rows <= 0 || lanes <= 0)
+        return;
+#ifdef WF_SIMD_X86
+    switch (GetLevel())
+    {
+    case kAVX512:
+        return LaneWindowStatsAVX512(x, stride, rows, lanes, scale, offset, weight, sum, max, argmax, min, argmin);
+    case kAVX2:
+        if (lanes == kLanes)
+            return LaneWindowStatsAVX2(x, stride, rows, scale, offset, weight, sum, max, argmax, min, argmin);
+        break;
+    default:
+        break;
+    }
+#endif
+    LaneWindowStatsScalar(x, stride, rows, lanes, scale, offset, weight, sum, max, argmax, min, argmin);
+}
+
+void WFDataProcessor::Simd::FIR(const double *x, int n, const double *h, int taps, double *y)
+{
+    if (n <= 0 || taps <= 0)
+        return;
+#ifdef WF_SIMD_X86
+    switch (GetLevel())
+    {
+    case kAVX512:
+        return FIRAVX512(x, n, h, taps, y);
+    case kAVX2:
+        return FIRAVX2(x, n, h, taps, y);
+    default:
+        break;
+    }
+#endif
+    FIRScalar(x, n, h, taps, y);
+}
@@ -0,0 +1,159 @@
+#include "WFKernels.h"
+
+#include <cmath>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+
+namespace
+{
+    constexpr double kPi = 3.14159265358979323846;
+
+    bool SameConfig(const WFDataProcessor::_spectrum_config &c1, const WFDataProcessor::_spectrum_config &c2)
+    {
+        return c1.length == c2.length && c1.window == c2.window && c1.every == c2.every;
+    }
+
+    // Window, plan and buffers of a configuration, the average restarts
+    void PrepareSpectrum(const WFDataProcessor::_spectrum_config &config, WFDataProcessor::_noise_spectrum &spectrum)
+    {
+        using namespace WFDataProcessor;
+        spectrum = _noise_spectrum();
+        spectrum.config = config;
+        const int n = config.length;
+        if (n <= 0)
+            return;
+        if (n < 4 || (n & (n - 1)) != 0)
+        {
+            std::cerr << "Noise spectrum needs a power of two of at least 4 samples per segment, got " << n << std::endl;
+            return;
+        }
+        MakeFFTPlan(n, spectrum.plan);
+        spectrum.window.resize(n);
+        for (int i = 0; i < n; i++)
+        {
+            // Periodic windows, so that the segment repeats without a step
+            const double x = 2 * kPi * i / n;
+            switch (config.window)
+            {
+            case kHannWindow:
+                spectrum.window[i] = 0.5 - 0.5 * std::cos(x);
+                break;
+            case kBlackmanHarrisWindow:
+                spectrum.window[i] = 0.35875 - 0.48829 * std::cos(x) + 0.14128 * std::cos(2 * x) - 0.01168 * std::cos(3 * x);
+                break;
+            default:
+                spectrum.window[i] = 1;
+            }
+            spectrum.window_norm += spectrum.window[i] * spectrum.window[i];
+        }
+        spectrum.power.assign(n / 2 + 1, 0.0);
+        spectrum.z.assign(2 * static_cast<size_t>(n), 0.0);
+    }
+
+    // FFT of the segments in the real and imaginary parts of z: X_k = (Z_k + conj Z_{n-k}) / 2 is the spectrum of
+    // the real part, Y_k = (Z_k - conj Z_{n-k}) / 2i that of the imaginary part
+    void TransformPair(WFDataProcessor::_noise_spectrum &spectrum, bool two)
+    {
+        const int n = spectrum.config.length;
+        double *z = spectrum.z.data();
+        if (!two)
+            for (int i = 0; i < n; i++)
+                z[2 * i + 1] = 0;
+        WFDataProcessor::FFT(spectrum.plan, z);
+        // Running means, both segments are added at bin k before moving on, so z is only read
+        const double weight_x = 1.0 / (spectrum.events + 1), weight_y = 1.0 / (spectrum.events + 2);
+        const double scale = spectrum.dt / spectrum.window_norm;
+        for (int k = 0; k <= n / 2; k++)
+        {
+            const int m = (n - k) % n;
+            const double zr = z[2 * k], zi = z[2 * k + 1], mr = z[2 * m], mi = z[2 * m + 1];
+            const double fold = k == 0 || k == n / 2 ? scale : 2 * scale; // one-sided: bins k and n - k together
+            const double x2 = 0.25 * ((zr + mr) * (zr + mr) + (zi - mi) * (zi - mi));
+            spectrum.power[k] += (fold * x2 - spectrum.power[k]) * weight_x;
+            if (two)
+            {
+                const double y2 = 0.25 * ((zi + mi) * (zi + mi) + (zr - mr) * (zr - mr));
+                spectrum.power[k] += (fold * y2 - spectrum.power[k]) * weight_y;
+            }
+        }
+        spectrum.events += two ? 2 : 1;
+    }
+}
+
+template <typename S>
+bool WFDataProcessor::AccumulateNoiseSpectrum(const S *x, int Nsamples, int up, double mv_per_unit, double dt_ns, const _spectrum_config &config,
+                                              _noise_spectrum &spectrum)
+{
+    if (!SameConfig(spectrum.config, config))
+        PrepareSpectrum(config, spectrum);
+    if (spectrum.power.empty() || spectrum.offered++ % std::max(config.every, 1) != 0)
+        return false;
+    const int n = config.length;
+    if (x == nullptr || up < n || up > Nsamples || !(dt_ns > 0))
+    {
+        spectrum.skipped++;
+        return false;
+    }
+    if (spectrum.events == 0 && !spectrum.pending)
+        spectrum.dt = dt_ns;
+    else if (std::fabs(dt_ns - spectrum.dt) > 1e-6 * spectrum.dt)
+    {
+        spectrum.skipped++;
+        return false;
+    }
+
+    const S *segment = x + up - n;
+    double mean = 0;
+    for (int i = 0; i < n; i++)
+        mean += static_cast<double>(segment[i]);
+    mean /= n;
+    double *z = spectrum.z.data() + (spectrum.pending ? 1 : 0);
+    for (int i = 0; i < n; i++)
+        z[2 * i] = (static_cast<double>(segment[i]) - mean) * mv_per_unit * spectrum.window[i];
+    if (!spectrum.pending)
+    {
+        spectrum.pending = true;
+        return true;
+    }
+    TransformPair(spectrum, true);
+    spectrum.pending = false;
+    return true;
+}
+
+void WFDataProcessor::FinishNoiseSpectrum(_noise_spectrum &spectrum)
+{
+    if (!spectrum.pending)
+        return;
+    TransformPair(spectrum, false);
+    spectrum.pending = false;
+}
+
+bool WFDataProcessor::MergeNoiseSpectrum(const _noise_spectrum &other, _noise_spectrum &spectrum)
+{
+    FinishNoiseSpectrum(spectrum);
+    if (other.events == 0)
+        return true;
+    if ((!spectrum.power.empty() && other.power.size() != spectrum.power.size()) ||
+        (spectrum.events > 0 && std::fabs(other.dt - spectrum.dt) > 1e-6 * spectrum.dt))
+        return false;
+    if (spectrum.events == 0)
+    {
+        spectrum.dt = other.dt;
+        spectrum.power.assign(other.power.size(), 0.0);
+    }
+    const double weight = static_cast<double>(other.events) / (spectrum.events + other.events);
+    for (size_t k = 0; k < spectrum.power.size(); k++)
+        spectrum.power[k] += (other.power[k] - spectrum.power[k]) * weight;
+    spectrum.events += other.events;
+    spectrum.skipped += other.skipped;
+    return true;
+}
+
+namespace WFDataProcessor
+{
+    template bool AccumulateNoiseSpectrum<int8_t>(const int8_t *, int, int, double, double, const _spectrum_config &, _noise_spectrum &);
+    template bool AccumulateNoiseSpectrum<int16_t>(const int16_t *, int, int, double, double, const _spectrum_config &, _noise_spectrum &);
+    template bool AccumulateNoiseSpectrum<float>(const float *, int, int, double, double, const _spectrum_config &, _noise_spectrum &);
+    template bool AccumulateNoiseSpectrum<double>(const double *, int, int, double, double, const _spectrum_config &, _noise_spectrum &);
+}
@@ -0,0 +1,283 @@
+#include "WFKernels.h"
+#include "WFSimd.h"
+
+#include <cmath>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
+
+namespace
+{
+    constexpr double kPi = 3.14159265358979323846;
+    constexpr int kDirectTaps = 16; // longest template always correlated directly, no FFT is prepared
+    constexpr int kBlock = 512;     // samples per converted block of the direct correlation
+
+    bool SameConfig(const WFDataProcessor::_template_config &c1, const WFDataProcessor::_template_config &c2)
+    {
+        return c1.dt == c2.dt && c1.t_ref == c2.t_ref && c1.shape == c2.shape;
+    }
+
+    // Whether the FFT blocks take fewer operations than the direct correlation of n lags. An FFT of nfft points takes
+    // nfft / 2 * log2(nfft) butterflies, each worth several multiply-adds of Simd::FIR, more when it is vectorized.
+    bool UseFFT(const WFDataProcessor::_template_design &design, int n)
+    {
+        if (design.block == 0)
+            return false;
+        const int nfft = design.plan.n;
+        int log2n = 0;
+        while ((1 << log2n) < nfft)
+            log2n++;
+        const double butterfly = WFDataProcessor::Simd::GetLevel() == WFDataProcessor::Simd::kScalar ? 8.0 : 48.0;
+        const double transforms = std::ceil(n / (2.0 * design.block)); // pairs of blocks, forward and inverse
+        return transforms * nfft * (log2n + 1) * butterfly < static_cast<double>(n) * design.h.size();
+    }
+
+    // c[j] = sum_k h[k] x[j + k] for j in [0, n), raw codes are converted block by block
+    template <typename S>
+    void CorrelateDirect(const WFDataProcessor::_template_design &design, const S *x, int n, double *c, double *block)
+    {
+        const int taps = design.h.size();
+        if constexpr (std::is_same<S, double>::value)
+        {
+            WFDataProcessor::Simd::FIR(x, n, design.h.data(), taps, c);
+        }
+        else
+        {
+            for (int begin = 0; begin < n; begin += kBlock)
+            {
+                const int m = std::min(kBlock, n - begin);
+                for (int j = 0; j < m + taps - 1; j++)
+                    block[j] = static_cast<double>(x[begin + j]);
+                WFDataProcessor::Simd::FIR(block, m, design.h.data(), taps, c + begin);
+            }
+        }
+    }
+
+    // Same correlation by overlap-save: a block of plan.n samples times the conjugate template spectrum gives
+    // the circular correlation, whose first design.block lags do not wrap around. The template is real, so two
+    // blocks go through one complex transform, one in the real and one in the imaginary part.
+    template <typename S>
+    void CorrelateFFT(const WFDataProcessor::_template_design &design, const S *x, int n, double *c, double *z)
+    {
+        const int nfft = design.plan.n, step = design.block;
+        const int available = n + static_cast<int>(design.h.size()) - 1;
+        const double *spectrum = design.spectrum.data();
+        const double scale = 1.0 / nfft;
+        for (int s0 = 0; s0 < n; s0 += 2 * step)
+        {
+            const int s1 = s0 + step;
+            const int m0 = std::min(nfft, available - s0), m1 = s1 < n ? std::min(nfft, available - s1) : 0;
+            for (int j = 0; j < m0; j++)
+                z[2 * j] = static_cast<double>(x[s0 + j]);
+            for (int j = m0; j < nfft; j++)
+                z[2 * j] = 0;
+            for (int j = 0; j < m1; j++)
+                z[2 * j + 1] = static_cast<double>(x[s1 + j]);
+            for (int j = m1; j < nfft; j++)
+                z[2 * j + 1] = 0;
+
+            WFDataProcessor::FFT(design.plan, z);
+            for (int j = 0; j < nfft; j++)
+            {
+                const double re = z[2 * j], im = z[2 * j + 1];
+                z[2 * j] = re * spectrum[2 * j] - im * spectrum[2 * j + 1];
+                z[2 * j + 1] = re * spectrum[2 * j + 1] + im * spectrum[2 * j];
+            }
+            WFDataProcessor::FFT(design.plan, z, true);
+
+            for (int j = 0; j < std::min(step, n - s0); j++)
+                c[s0 + j] = z[2 * j] * scale;
+            for (int j = 0; s1 < n && j < std::min(step, n - s1); j++)
+                c[s1 + j] = z[2 * j + 1] * scale;
+        }
+    }
+}
+
+void WFDataProcessor::MakeFFTPlan(int n, _fft_plan &plan)
+{
+    if (plan.n == n)
+        return;
+    plan.n = n;
+    // Twiddles of the stage combining blocks of half points at [half, 2 * half), contiguous for the butterflies
+    plan.twiddle.assign(2 * static_cast<size_t>(n), 0.0);
+    for (int half = 1; half < n; half *= 2)
+        for (int k = 0; k < half; k++)
+        {
+            const double angle = -kPi * k / half;
+            plan.twiddle[2 * (half + k)] = std::cos(angle);
+            plan.twiddle[2 * (half + k) + 1] = std::sin(angle);
+        }
+    int bits = 0;
+    while ((1 << bits) < n)
+        bits++;
+    plan.bitrev.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        int r = 0;
+        for (int b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        plan.bitrev[i] = r;
+    }
+}
+
+void WFDataProcessor::FFT(const _fft_plan &plan, double *z, bool inverse)
+{
+    const int n = plan.n;
+    for (int i = 0; i < n; i++)
+    {
+        const int j = plan.bitrev[i];
+        if (i < j)
+        {
+            std::swap(z[2 * i], z[2 * j]);
+            std::swap(z[2 * i + 1], z[2 * j + 1]);
+        }
+    }
+    // Iterative radix-2 butterflies, the first stage has no twiddle
+    for (int i = 0; i + 1 < n; i += 2)
+    {
+        double *u = z + 2 * i;
+        const double vr = u[2], vi = u[3];
+        u[2] = u[0] - vr;
+        u[3] = u[1] - vi;
+        u[0] += vr;
+        u[1] += vi;
+    }
+    const double sign = inverse ? -1.0 : 1.0;
+    for (int half = 2; half < n; half *= 2)
+    {
+        const double *w = plan.twiddle.data() + 2 * half;
+        for (int i = 0; i < n; i += 2 * half)
+        {
+            double *u = z + 2 * i, *v = z + 2 * (i + half);
+            for (int k = 0; k < half; k++)
+            {
+                const double wr = w[2 * k], wi = sign * w[2 * k + 1];
+                const double vr = v[2 * k] * wr - v[2 * k + 1] * wi, vi = v[2 * k] * wi + v[2 * k + 1] * wr;
+                v[2 * k] = u[2 * k] - vr;
+                v[2 * k + 1] = u[2 * k + 1] - vi;
+                u[2 * k] += vr;
+                u[2 * k + 1] += vi;
+            }
+        }
+    }
+}
+
+bool WFDataProcessor::DesignTemplate(const _template_config &config, double dt_ns, _template_design &design)
+{
+    if (SameConfig(design.config, config) && design.dt == dt_ns)
+        return design.valid;
+
+    design.config = config;
+    design.dt = dt_ns;
+    design.valid = false;
+    design.h.clear();
+    design.peak = 0;
+    design.sum = 0;
+    design.norm = 0;
+    design.block = 0;
+    design.spectrum.clear();
+    if (config.shape.empty())
+        return false;
+    if (!(dt_ns > 0))
+    {
+        std::cerr << "Template matching needs a positive sampling interval, got " << dt_ns << " ns" << std::endl;
+        return false;
+    }
+
+    // Resample on the sampling of the records, h[0] stays on shape[0]
+    const int length = config.shape.size();
+    const double step = config.dt > 0 ? dt_ns / config.dt : 1.0; // shape samples per record sample
+    const int taps = static_cast<int>(std::floor((length - 1) / step + 1e-9)) + 1;
+    design.h.resize(taps);
+    for (int k = 0; k < taps; k++)
+    {
+        const double x = k * step;
+        const int i = std::min(static_cast<int>(x), length - 1);
+        design.h[k] = i + 1 < length ? config.shape[i] + (x - i) * (config.shape[i + 1] - config.shape[i]) : config.shape[i];
+    }
+    design.peak = std::max_element(design.h.begin(), design.h.end()) - design.h.begin();
+    const double peak = design.h[design.peak];
+    if (!(peak > 0))
+    {
+        std::cerr << "Template has no positive peak, template matching disabled" << std::endl;
+        design.h.clear();
+        return false;
+    }
+    for (double &h : design.h)
+    {
+        h /= peak;
+        design.sum += h;
+        design.norm += h * h;
+    }
+
+    if (taps > kDirectTaps)
+    {
+        // Blocks of at least 4 templates, most of each transform gives valid lags
+        int n = 64;
+        while (n < 4 * taps)
+            n *= 2;
+        MakeFFTPlan(n, design.plan);
+        design.block = n - taps + 1;
+        design.spectrum.assign(2 * static_cast<size_t>(n), 0.0);
+        for (int k = 0; k < taps; k++)
+            design.spectrum[2 * k] = design.h[k];
+        FFT(design.plan, design.spectrum.data());
+        for (int k = 0; k < n; k++)
+            design.spectrum[2 * k + 1] = -design.spectrum[2 * k + 1];
+    }
+    design.valid = true;
+    return true;
+}
+
+template <typename S>
+bool WFDataProcessor::MatchTemplate(const _template_design &design, const S *x, int Nsamples, int first, int last, double pedestal,
+                                    std::vector<double> &scratch, double &amplitude, double &position)
+{
+    if (!design.valid || first > last)
+        return false;
+    const int taps = design.h.size();
+    // Placements with the peak on [first, last], plus one on each side for the refinement
+    const int lo = std::max(first - design.peak - 1, 0), hi = std::min(last - design.peak + 1, Nsamples - taps);
+    const int begin = std::max(first - design.peak, 0) - lo, end = std::min(last - design.peak, Nsamples - taps) - lo;
+    const int n = hi - lo + 1;
+    if (n <= 0 || begin > end)
+        return false;
+
+    const bool fft = UseFFT(design, n);
+    const size_t size = n + (fft ? 2 * static_cast<size_t>(design.plan.n) : static_cast<size_t>(kBlock + taps - 1));
+    if (scratch.size() < size)
+        scratch.resize(size);
+    double *c = scratch.data();
+    if (fft)
+        CorrelateFFT(design, x + lo, n, c, c + n);
+    else
+        CorrelateDirect(design, x + lo, n, c, c + n);
+
+    int best = begin;
+    for (int j = begin + 1; j <= end; j++)
+        if (c[j] > c[best])
+            best = j;
+    double offset = 0, peak = c[best];
+    if (best > 0 && best < n - 1)
+    {
+        const double below = c[best - 1], above = c[best + 1];
+        const double curvature = below - 2 * peak + above;
+        if (curvature < 0)
+        {
+            offset = 0.5 * (below - above) / curvature;
+            peak -= 0.25 * (below - above) * offset;
+        }
+    }
+    amplitude = (peak - pedestal * design.sum) / design.norm;
+    position = lo + best + offset;
+    return amplitude > 0;
+}
+
+namespace WFDataProcessor
+{
+    template bool MatchTemplate<int8_t>(const _template_design &, const int8_t *, int, int, int, double, std::vector<double> &, double &, double &);
+    template bool MatchTemplate<int16_t>(const _template_design &, const int16_t *, int, int, int, double, std::vector<double> &, double &, double &);
+    template bool MatchTemplate<float>(const _template_design &, const float *, int, int, int, double, std::vector<double> &, double &, double &);
+    template bool MatchTemplate<double>(const _template_design &, const double *, int, int, int, double, std::vector<double> &, double &, double &);
+}
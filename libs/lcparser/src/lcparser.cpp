@@ -110,6 +110,7 @@ void ScopeData::Clean()
     x.clear();
     y.clear();
     yAll.clear();
+    rawData.clear();
 
     endianness = "";
     templateName = "";
@@ -184,7 +185,53 @@ ScopeData::errorCodes ScopeData::InitData(const std::string &path, bool parseAll
     return kSUCCESS;
 }
 
+ScopeData::errorCodes ScopeData::InitRawData(const std::string &path)
+{
+    Clean();
+    fPath = path;
+
+    std::vector<char> buffer;
+    auto rtn = readFile(path, buffer);
+    if (rtn != kSUCCESS)
+        return rtn;
+
+    size_t start = 0;
+    rtn = parseHeader(buffer, start);
+    if (rtn != kSUCCESS)
+        return rtn;
+
+    // 保留原始ADC码, 16位数据转换为本机字节序
+    rawData.assign(buffer.begin() + start, buffer.begin() + start + waveArray1);
+    if (getRawSampleSize() == 2)
+    {
+        rawData.resize(rawData.size() / 2 * 2);
+        if (needSwap)
+        {
+            for (size_t i = 0; i < rawData.size(); i += 2)
+                std::swap(rawData[i], rawData[i + 1]);
+        }
+    }
+    return kSUCCESS;
+}
+
+void ScopeData::DecodeRawData()
+{
+    x.clear();
+    y.clear();
+    decodeSamples(rawData.data(), rawData.size(), false, x, y);
+}
+
 ScopeData::errorCodes ScopeData::parseFile(const std::string &path, std::vector<double> &x, std::vector<double> &y, int sparse)
+{
+    std::vector<char> buffer;
+    auto rtn = readFile(path, buffer);
+    if (rtn != kSUCCESS)
+        return rtn;
+
+    return parseData(buffer, x, y, sparse);
+}
+
+ScopeData::errorCodes ScopeData::readFile(const std::string &path, std::vector<char> &buffer)
 {
     std::ifstream file(path, std::ios::binary | std::ios::ate);
     if (!file.is_open())
@@ -196,7 +243,7 @@ ScopeData::errorCodes ScopeData::parseFile(const std::string &path, std::vector<
     std::streamsize size = file.tellg();
     file.seekg(0, std::ios::beg);
 
-    std::vector<char> buffer(size);
+    buffer.resize(size);
     if (!file.read(buffer.data(), size))
     {
         std::runtime_error("Cannot read file: " + path);
@@ -204,8 +251,7 @@ ScopeData::errorCodes ScopeData::parseFile(const std::string &path, std::vector<
     }
 
     file.close();
-
-    return parseData(buffer, x, y, sparse);
+    return kSUCCESS;
 }
 
 TGraph *ScopeData::createGraph() const
@@ -227,6 +273,38 @@ TGraph *ScopeData::createGraph() const
 }
 
 ScopeData::errorCodes ScopeData::parseData(const std::vector<char> &data, std::vector<double> &x, std::vector<double> &y, int sparse)
+{
+    size_t start = 0;
+    auto rtn = parseHeader(data, start);
+    if (rtn != kSUCCESS)
+        return rtn;
+
+    // 解析波形数据, 生成X/Y数据
+    decodeSamples(data.data() + start, waveArray1, needSwap, x, y);
+
+    // 稀疏采样
+    if (sparse > 0 && static_cast<int>(x.size()) > sparse)
+    {
+        std::vector<double> xSparse, ySparse;
+        int step = static_cast<int>(x.size()) / sparse;
+
+        for (int i = 0; i < sparse; i++)
+        {
+            int idx = i * step;
+            if (idx < static_cast<int>(x.size()))
+            {
+                xSparse.push_back(x[idx]);
+                ySparse.push_back(y[idx]);
+            }
+        }
+
+        x = xSparse;
+        y = ySparse;
+    }
+    return kSUCCESS;
+}
+
+ScopeData::errorCodes ScopeData::parseHeader(const std::vector<char> &data, size_t &start)
 {
     // 查找WAVEDESC位置
     std::string header(data.begin(), data.begin() + std::min(static_cast<size_t>(50), data.size()));
@@ -292,7 +370,7 @@ ScopeData::errorCodes ScopeData::parseData(const std::vector<char> &data, std::v
                      : "Unknown";
 
     // 解析波形数据
-    size_t start = posWAVEDESC + waveDescriptor + userText + trigTimeArray;
+    start = posWAVEDESC + waveDescriptor + userText + trigTimeArray;
 
     if (start + waveArray1 > data.size())
     {
@@ -306,21 +384,26 @@ ScopeData::errorCodes ScopeData::parseData(const std::vector<char> &data, std::v
         return kZERO_ARRAY_COUNT;
     }
 
+    return kSUCCESS;
+}
+
+void ScopeData::decodeSamples(const char *codes, size_t nbytes, bool swap, std::vector<double> &x, std::vector<double> &y) const
+{
     if (commType == 0)
     { // 8位整数数据
-        for (size_t i = start; i < start + waveArray1; i++)
+        for (size_t i = 0; i < nbytes; i++)
         {
-            int8_t value = static_cast<int8_t>(data[i]);
+            int8_t value = static_cast<int8_t>(codes[i]);
             y.push_back(verticalGain * value - verticalOffset);
         }
     }
     else
     { // 16位整数数据
-        for (size_t i = start; i < start + waveArray1; i += 2)
+        for (size_t i = 0; i + 1 < nbytes; i += 2)
         {
             int16_t value;
-            memcpy(&value, &data[i], sizeof(int16_t));
-            if (needSwap)
+            memcpy(&value, &codes[i], sizeof(int16_t));
+            if (swap)
             {
                 value = Endian::swap16(value);
             }
@@ -333,27 +416,6 @@ ScopeData::errorCodes ScopeData::parseData(const std::vector<char> &data, std::v
     {
         x.push_back(i * horizInterval + horizOffset);
     }
-
-    // 稀疏采样
-    if (sparse > 0 && static_cast<int>(x.size()) > sparse)
-    {
-        std::vector<double> xSparse, ySparse;
-        int step = static_cast<int>(x.size()) / sparse;
-
-        for (int i = 0; i < sparse; i++)
-        {
-            int idx = i * step;
-            if (idx < static_cast<int>(x.size()))
-            {
-                xSparse.push_back(x[idx]);
-                ySparse.push_back(y[idx]);
-            }
-        }
-
-        x = xSparse;
-        y = ySparse;
-    }
-    return kSUCCESS;
 }
 
 int16_t ScopeData::parseInt16(const std::vector<char> &data, size_t pos) const
@@ -0,0 +1,76 @@
+#ifndef SyntheticPulses_H
+#define SyntheticPulses_H
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Synthetic LGAD-like records for the tests and benchmarks: a pedestal with white noise and one pulse of the shape
+// x^2 exp(2 - 2x) of random amplitude and start, optionally quantized to int16 codes. Checks needing more pulses,
+// afterpulses or spikes add them to the generated records and quantize afterwards.
+
+struct _synthetic_wave
+{
+    std::vector<double> t;      // s
+    std::vector<double> a;      // V
+    std::vector<int16_t> codes; // round((a + offset) / gain), when quantized
+    double start = 0;           // s, start of the generated pulse
+    double amp = 0;             // V, amplitude of the generated pulse
+};
+
+struct _synthetic_config
+{
+    double pedestal = 0.002;                    // V
+    double noise = 1.5e-3;                      // V, sigma of the white noise
+    double amp_min = 0, amp_max = 0.3;          // V, uniform amplitude of the pulse, both 0 for pedestal and noise only
+    double start_min = -2e-9, start_max = 3e-9; // s, uniform start of the pulse
+    double tau = 0.4e-9;                        // s, from the start to the maximum
+    double gain = 0, offset = 0;                // V per code and V, codes are filled when gain is not 0
+};
+
+// Pulse of unit amplitude, 0 before x = 0 and maximal at x = 1
+inline double PulseShape(double x)
+{
+    return x > 0 ? x * x * std::exp(2 - 2 * x) : 0.0;
+}
+
+inline void AddPulse(_synthetic_wave &wave, double amp, double start, double tau)
+{
+    for (size_t i = 0; i < wave.a.size(); i++)
+        wave.a[i] += amp * PulseShape((wave.t[i] - start) / tau);
+}
+
+inline void Quantize(_synthetic_wave &wave, double gain, double offset)
+{
+    wave.codes.resize(wave.a.size());
+    for (size_t i = 0; i < wave.a.size(); i++)
+        wave.codes[i] = static_cast<int16_t>(std::round((wave.a[i] + offset) / gain));
+}
+
+// Records of nSamples samples every dt seconds, centered on 0
+inline std::vector<_synthetic_wave> GenerateWaves(int nWaves, int nSamples, double dt, unsigned seed, const _synthetic_config &config = {})
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0, config.noise);
+    std::uniform_real_distribution<double> amp(config.amp_min, config.amp_max);
+    std::uniform_real_distribution<double> start(config.start_min, config.start_max);
+
+    std::vector<_synthetic_wave> waves(nWaves);
+    for (auto &wave : waves)
+    {
+        wave.amp = amp(rng);
+        wave.start = start(rng);
+        wave.t.resize(nSamples);
+        wave.a.resize(nSamples);
+        for (int i = 0; i < nSamples; i++)
+        {
+            wave.t[i] = -nSamples / 2 * dt + i * dt;
+            wave.a[i] = config.pedestal + noise(rng) + wave.amp * PulseShape((wave.t[i] - wave.start) / config.tau);
+        }
+        if (config.gain != 0)
+            Quantize(wave, config.gain, config.offset);
+    }
+    return waves;
+}
+
+#endif // SyntheticPulses_H
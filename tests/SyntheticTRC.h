@@ -0,0 +1,43 @@
+#ifndef SyntheticTRC_H
+#define SyntheticTRC_H
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Minimal LeCroy .trc files for the tests: a WAVEDESC block with the fields ScopeData reads, followed by the codes.
+// int8_t codes are written as byte data (COMM_TYPE 0), int16_t codes as word data, both in host byte order.
+namespace SyntheticTRC
+{
+    template <typename Code>
+    bool Write(const std::string &path, const std::vector<Code> &codes, float gain, float offset, float dt, double t0)
+    {
+        static_assert(sizeof(Code) == 1 || sizeof(Code) == 2, "LeCroy records hold int8 or int16 codes");
+        const int32_t descriptorSize = 346;
+        std::vector<char> desc(descriptorSize, 0);
+        auto put = [&desc](size_t pos, const void *value, size_t size)
+        { std::memcpy(desc.data() + pos, value, size); };
+        const int one = 1;
+        const int16_t commType = sizeof(Code) == 1 ? 0 : 1, commOrder = *(const char *)&one == 1 ? 1 : 0;
+        const int32_t nbytes = sizeof(Code) * codes.size(), count = codes.size();
+        put(0, "WAVEDESC", 8);
+        put(16, "LECROY_2_3", 10);
+        put(32, &commType, 2);
+        put(34, &commOrder, 2);
+        put(36, &descriptorSize, 4);
+        put(60, &nbytes, 4);
+        put(116, &count, 4);
+        put(156, &gain, 4);
+        put(160, &offset, 4);
+        put(176, &dt, 4);
+        put(180, &t0, 8);
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(desc.data(), desc.size());
+        out.write(reinterpret_cast<const char *>(codes.data()), nbytes);
+        return out.good();
+    }
+}
+
+#endif // SyntheticTRC_H
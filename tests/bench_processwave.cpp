@@ -0,0 +1,1203 @@
+#include "WFDataConverter.h"
+#include "WFKernels.h"
+#include "WFSimd.h"
+#include "SyntheticPulses.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Benchmark of the fused processWave kernel against the reference implementation, on synthetic LGAD-like pulses.
+// Also compares processWaveRaw on quantized samples with the fused kernel on the decoded samples,
+// the quick-look extraction of a few features with the full one, the interpolation methods of the crossings,
+// the filter stage in every kernel, the pulse finder on records with several pulses, the robust pedestals,
+// template matching, the multi-threshold crossings, the noise spectrum and the average pulse accumulators.
+// Returns non-zero if the implementations give a different _waveinfo.
+
+// Bit by bit comparison, or relative tolerance when vectorized sums are reordered
+bool SameWaveInfo(const WFDataProcessor::_waveinfo &w1, const WFDataProcessor::_waveinfo &w2, double tolerance = 0)
+{
+    for (const auto &field : WFDataProcessor::GetWaveInfoFields())
+    {
+        const char *p1 = (const char *)&w1 + field.offset;
+        const char *p2 = (const char *)&w2 + field.offset;
+        if (std::memcmp(p1, p2, field.size) == 0)
+            continue;
+        if (tolerance > 0 && field.type == 'D')
+        {
+            double v1 = *(const double *)p1, v2 = *(const double *)p2;
+            if (std::fabs(v1 - v2) <= tolerance * std::max({1.0, std::fabs(v1), std::fabs(v2)}))
+                continue;
+        }
+        std::cerr << "Field " << field.name << " differs" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// _waveinfo of one event of a batch, from the columns of processWaveBatch
+WFDataProcessor::_waveinfo WaveInfoFromColumns(const WFDataProcessor::_waveinfo_columns &columns, int channel, int event)
+{
+    WFDataProcessor::_waveinfo winfo;
+    for (const auto &field : WFDataProcessor::GetWaveInfoFields())
+    {
+        double value = columns.Column(channel, field.name)[event];
+        char *dst = (char *)&winfo + field.offset;
+        if (field.type == 'D')
+            *(double *)dst = value;
+        else if (field.type == 'i')
+            *(uint32_t *)dst = value;
+        else
+            *(int *)dst = value;
+    }
+    return winfo;
+}
+
+template <typename F>
+double MicrosecondsPerCall(int nCalls, F &&func)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nCalls; i++)
+        func(i);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / nCalls;
+}
+
+// FindSearchWindow against the linear scan of processWaveReference, on uniform axes (computed indices)
+// and jittered ones (binary search). Returns the number of mismatching windows.
+int CheckSearchWindow(unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> edge(-60, 60), jitter(-0.2, 0.2);
+    int nDiff = 0;
+    for (int trial = 0; trial < 2000; trial++)
+    {
+        const int nSamples = 2 + trial % 3000;
+        const double dt = 1e-9 * (0.01 + 0.09 * (trial % 7) / 6.0), t0 = 1e-9 * edge(rng);
+        const bool uniform = trial % 2 == 0;
+        std::vector<double> t(nSamples);
+        for (int i = 0; i < nSamples; i++)
+            t[i] = i * dt + t0 + (uniform ? 0 : jitter(rng) * dt);
+
+        // Snap an edge onto a sample time once in a while, to test the boundaries
+        WFDataProcessor::_signal_range range{edge(rng), edge(rng)};
+        if (range.first > range.second)
+            std::swap(range.first, range.second);
+        if (trial % 5 == 0)
+            range.first = t[rng() % nSamples] * 1e9;
+
+        int up = 0, down = nSamples - 1;
+        for (int i = 1; i < nSamples; i++)
+        {
+            if (t[i - 1] * 1e9 < range.first && t[i] * 1e9 >= range.first)
+                up = i;
+            if (t[i - 1] * 1e9 < range.second && t[i] * 1e9 >= range.second)
+                down = i;
+        }
+        int fastUp, fastDown;
+        WFDataProcessor::FindSearchWindow(t.data(), nSamples, range, fastUp, fastDown);
+        if (fastUp != up || fastDown != down)
+            nDiff++;
+    }
+    std::cout << "Search window: " << nDiff << " mismatches against the linear scan" << std::endl;
+    return nDiff;
+}
+
+// Raw-sample kernel against decoding the same samples to doubles followed by the fused kernel.
+// Returns the number of mismatching waves. With coarse codes a crossing level can fall exactly on a code,
+// which the raw kernel compares exactly and the decoded path after rounding: such waves are only counted
+// when strict is set.
+template <typename S>
+int CompareRaw(const char *name, const std::vector<_synthetic_wave> &waves, double gain, double offset, double dt, const WFDataProcessor::_extract_config &config, bool strict = true)
+{
+    using namespace WFDataProcessor;
+    const int nWaves = waves.size(), nSamples = waves[0].a.size();
+    _sample_scale scale;
+    scale.vertical_gain = gain;
+    scale.vertical_offset = offset;
+    scale.horiz_interval = dt;
+    scale.horiz_offset = waves[0].t[0];
+
+    std::vector<std::vector<S>> codes(nWaves, std::vector<S>(nSamples));
+    for (int i = 0; i < nWaves; i++)
+        for (int j = 0; j < nSamples; j++)
+        {
+            double code = (waves[i].a[j] + offset) / gain;
+            if (std::is_integral<S>::value)
+                code = std::min<double>(std::max<double>(std::round(code), std::numeric_limits<S>::lowest()), std::numeric_limits<S>::max());
+            codes[i][j] = static_cast<S>(code);
+        }
+
+    std::vector<_waveinfo> infoDecoded(nWaves), infoRaw(nWaves);
+    _wave_workspace workspace;
+    std::vector<double> t(nSamples), a(nSamples);
+    double usDecoded = MicrosecondsPerCall(nWaves, [&](int i)
+                                           {
+        for (int j = 0; j < nSamples; j++)
+        {
+            t[j] = j * scale.horiz_interval + scale.horiz_offset;
+            a[j] = gain * codes[i][j] - offset;
+        }
+        processWaveFused(t.data(), a.data(), nSamples, infoDecoded[i], config, workspace); });
+    double usRaw = MicrosecondsPerCall(nWaves, [&](int i)
+                                       { processWaveRaw(codes[i].data(), nSamples, scale, infoRaw[i], config, workspace); });
+
+    int nDiff = 0;
+    for (int i = 0; i < nWaves; i++)
+        if (!SameWaveInfo(infoDecoded[i], infoRaw[i], 1e-9))
+            nDiff++;
+    std::cout << "  raw " << name << std::string(12 - std::string(name).size(), ' ') << usRaw << " us/wave, decode + fused "
+              << usDecoded << " us/wave, mismatches " << nDiff << (strict ? "" : " (ties, not counted)") << std::endl;
+    return strict ? nDiff : 0;
+}
+
+// Quick-look extraction with a feature mask against the full extraction, with the fused, batch and raw kernels.
+// Selected fields must be identical (the batch kernel is run at the scalar level, where it must be exact, and at the
+// current level, where its sums are ordered differently and agree within tolerance), the others kFeatureSkipped.
+// Returns the number of mismatching waves.
+int CheckFeatureMask(const std::vector<_synthetic_wave> &waves, const WFDataProcessor::_extract_config &config, const std::vector<std::string> &features)
+{
+    using namespace WFDataProcessor;
+    const int nWaves = waves.size(), nSamples = waves[0].a.size();
+    _extract_config masked = config;
+    masked.features = MakeFeatureMask(features);
+    _wave_workspace workspace;
+
+    auto sameSelected = [&](const _waveinfo &full, const _waveinfo &quick, double tolerance = 0)
+    {
+        const auto &fields = GetWaveInfoFields();
+        for (size_t f = 0; f < fields.size(); f++)
+        {
+            if (fields[f].type != 'D')
+                continue;
+            double vFull = *(const double *)((const char *)&full + fields[f].offset);
+            double vQuick = *(const double *)((const char *)&quick + fields[f].offset);
+            if (!IsFeatureSelected(masked.features, f) ? vQuick != kFeatureSkipped
+                                                       : std::memcmp(&vFull, &vQuick, sizeof(double)) != 0 &&
+                                                             !(std::fabs(vFull - vQuick) <= tolerance * std::max({1.0, std::fabs(vFull), std::fabs(vQuick)})))
+                return false;
+        }
+        return true;
+    };
+
+    std::vector<_waveinfo> infoFull(nWaves), infoQuick(nWaves);
+    double usFull = MicrosecondsPerCall(nWaves, [&](int i)
+                                        { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, infoFull[i], config, workspace); });
+    double usQuick = MicrosecondsPerCall(nWaves, [&](int i)
+                                         { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, infoQuick[i], masked, workspace); });
+    int nDiff = 0;
+    for (int i = 0; i < nWaves; i++)
+        nDiff += !sameSelected(infoFull[i], infoQuick[i]);
+
+    // Batch kernel
+    _wave_batch batch;
+    batch.Resize({1}, nWaves, nSamples);
+    for (int i = 0; i < nWaves; i++)
+        batch.SetRecord(0, i, waves[i].t.data(), waves[i].a.data());
+    _waveinfo_columns columns;
+    const Simd::Level level = Simd::GetLevel();
+    for (Simd::Level batchLevel : {Simd::kScalar, level})
+    {
+        Simd::SetLevel(batchLevel);
+        processWaveBatch(batch, {{1, masked}}, columns, workspace);
+        for (int i = 0; i < nWaves; i++)
+        {
+            _waveinfo fromBatch = infoQuick[i], full;
+            processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, full, config, workspace);
+            for (const auto &field : GetWaveInfoFields())
+                if (field.type == 'D')
+                    *(double *)((char *)&fromBatch + field.offset) = columns.Column(1, field.name)[i];
+            nDiff += !sameSelected(full, fromBatch, batchLevel == Simd::kScalar ? 0 : 1e-9);
+        }
+    }
+    Simd::SetLevel(level);
+
+    // Raw kernel on the same samples stored as doubles
+    _sample_scale scale;
+    scale.horiz_interval = waves[0].t[1] - waves[0].t[0];
+    scale.horiz_offset = waves[0].t[0];
+    std::vector<_waveinfo> infoRawFull(nWaves), infoRawQuick(nWaves);
+    double usRawFull = MicrosecondsPerCall(nWaves, [&](int i)
+                                           { processWaveRaw(waves[i].a.data(), nSamples, scale, infoRawFull[i], config, workspace); });
+    double usRawQuick = MicrosecondsPerCall(nWaves, [&](int i)
+                                            { processWaveRaw(waves[i].a.data(), nSamples, scale, infoRawQuick[i], masked, workspace); });
+    for (int i = 0; i < nWaves; i++)
+        nDiff += !sameSelected(infoRawFull[i], infoRawQuick[i]);
+
+    std::cout << "  feature mask     " << usQuick << " us/wave (full " << usFull << "), raw " << usRawQuick << " us/wave (full "
+              << usRawFull << "), mismatches " << nDiff << std::endl;
+    return nDiff;
+}
+
+// Timing bias with the sub-sample phase of the pulse: smooth pulses with little noise shifted over one sample interval,
+// spread of toa and t_cfd around the true pulse time for each interpolation method. toa also inherits the phase bias
+// of the sampled maximum, t_cfd does not. Raw and batch kernels must agree with the fused one.
+// Returns the number of mismatches, plus one if requireGain and a table method does not reduce the t_cfd spread.
+int CheckInterpolation(double dt, const WFDataProcessor::_extract_config &config, bool requireGain)
+{
+    using namespace WFDataProcessor;
+    const int nWaves = 400, nSamples = 1002;
+    _synthetic_config quiet;
+    quiet.noise = 1e-4;
+    quiet.amp_max = 0;
+    auto waves = GenerateWaves(nWaves, nSamples, dt, 7, quiet);
+    std::vector<double> t0(nWaves);
+    for (int w = 0; w < nWaves; w++)
+    {
+        t0[w] = dt * w / nWaves;
+        for (int i = 0; i < nSamples; i++)
+        {
+            double x = (waves[w].t[i] - t0[w]) / 0.4e-9;
+            waves[w].a[i] += 0.2 * std::exp(-0.5 * (x - 1.5) * (x - 1.5));
+        }
+    }
+    _sample_scale scale;
+    scale.horiz_interval = dt;
+    scale.horiz_offset = waves[0].t[0];
+    _wave_batch batch;
+    batch.Resize({1}, nWaves, nSamples);
+    for (int w = 0; w < nWaves; w++)
+        batch.SetRecord(0, w, waves[w].t.data(), waves[w].a.data());
+
+    auto spread = [&](const std::vector<double> &values)
+    {
+        double sum = 0, sum_sq = 0;
+        for (int w = 0; w < nWaves; w++)
+        {
+            sum += values[w] - t0[w] * 1e9;
+            sum_sq += (values[w] - t0[w] * 1e9) * (values[w] - t0[w] * 1e9);
+        }
+        return std::sqrt(std::max(0.0, sum_sq / nWaves - sum * sum / nWaves / nWaves)) * 1e3; // ps
+    };
+
+    int nFailed = 0;
+    double linearCFD = 0;
+    _wave_workspace workspace;
+    _waveinfo_columns columns;
+    for (auto method : {kLinearInterpolation, kCubicInterpolation, kSincInterpolation})
+    {
+        _extract_config methodConfig = config;
+        methodConfig.interpolation = method;
+        std::vector<double> toa(nWaves), tcfd(nWaves);
+        std::vector<_waveinfo> infoFused(nWaves);
+        double us = MicrosecondsPerCall(nWaves, [&](int w)
+                                        { processWaveFused(waves[w].t.data(), waves[w].a.data(), nSamples, infoFused[w], methodConfig, workspace); });
+        processWaveBatch(batch, {{1, methodConfig}}, columns, workspace);
+        int nDiff = 0;
+        for (int w = 0; w < nWaves; w++)
+        {
+            toa[w] = infoFused[w].toa;
+            tcfd[w] = infoFused[w].t_cfd;
+            _waveinfo infoRaw;
+            processWaveRaw(waves[w].a.data(), nSamples, scale, infoRaw, methodConfig, workspace);
+            nDiff += !SameWaveInfo(infoFused[w], infoRaw, 1e-9);
+            for (const char *name : {"toa", "t1", "t2_10", "t_cfd"})
+            {
+                double v = *(const double *)((const char *)&infoFused[w] + GetWaveInfoFields()[FindWaveInfoField(name)].offset);
+                nDiff += std::fabs(columns.Column(1, name)[w] - v) > 1e-9 * std::max(1.0, std::fabs(v));
+            }
+        }
+        const char *names[] = {"linear", "cubic", "sinc"};
+        std::cout << "  " << names[method] << std::string(17 - std::string(names[method]).size(), ' ') << us << " us/wave, phase spread toa "
+                  << spread(toa) << " ps, t_cfd " << spread(tcfd) << " ps, mismatches " << nDiff << std::endl;
+        nFailed += nDiff;
+        if (method == kLinearInterpolation)
+            linearCFD = spread(tcfd);
+        else if (requireGain && !(spread(tcfd) < linearCFD))
+            nFailed++;
+    }
+    return nFailed;
+}
+
+// Missing records (null axis or amplitudes, no samples) flagged NO_WAVEFORM by processWave as by the reference, without
+// the filter stage or the dispatch reading the samples. Returns the number of failures.
+int CheckMissingRecord(const std::vector<_synthetic_wave> &waves, const WFDataProcessor::_extract_config &config)
+{
+    using namespace WFDataProcessor;
+    const double *t = waves[0].t.data(), *a = waves[0].a.data();
+    const int nSamples = waves[0].a.size();
+    const std::pair<const double *, const double *> records[] = {{nullptr, a}, {t, nullptr}, {nullptr, nullptr}};
+    _extract_config filtered = config, masked = config;
+    filtered.filter = {kLowPassFIR, 15, 2.0};
+    masked.features = MakeFeatureMask({"amp", "toa"});
+    const _extract_config *configs[] = {&config, &filtered, &masked};
+    int nFailed = 0, nCases = 0;
+    _wave_workspace workspace;
+    for (const _extract_config *cfg : configs)
+        for (int n : {nSamples, 1, 0, -1})
+            for (int k = 0; k < 4; k++)
+            {
+                // Records of n samples are only missing through a null pointer, empty ones through their length
+                const double *tk = k < 3 ? records[k].first : t, *ak = k < 3 ? records[k].second : a;
+                if (k == 3 && n > 0)
+                    continue;
+                _waveinfo info, infoRef;
+                processWave(waves[1].t.data(), waves[1].a.data(), nSamples, info, *cfg, workspace); // stale features
+                infoRef = info;
+                processWave(tk, ak, n, info, *cfg, workspace);
+                processWaveReference(tk, ak, n, infoRef, *cfg, workspace);
+                nFailed += info.valid != NO_WAVEFORM || !SameWaveInfo(info, infoRef) || workspace.pulses.Size() != 0;
+                nCases++;
+            }
+    std::cout << "  " << nCases << " missing records, failures " << nFailed << std::endl;
+    return nFailed;
+}
+
+// Filter stage of processWave against the same filter in processWaveRaw (on int16 codes and on doubles) and in
+// processWaveBatch. Returns the number of mismatching waves. Filtered codes are rounded differently from filtered
+// decoded samples, so extrema of equal samples may resolve differently: int16 mismatches are reported, not counted.
+int CheckFilters(std::vector<_synthetic_wave> waves, const WFDataProcessor::_extract_config &config)
+{
+    using namespace WFDataProcessor;
+    const int nWaves = waves.size(), nSamples = waves[0].a.size();
+    const double gain = 1e-5, offset = 0.05;
+    _sample_scale scale, codeScale;
+    scale.horiz_interval = codeScale.horiz_interval = waves[0].t[1] - waves[0].t[0];
+    scale.horiz_offset = codeScale.horiz_offset = waves[0].t[0];
+    codeScale.vertical_gain = gain;
+    codeScale.vertical_offset = offset;
+
+    // Decoded and raw versions of the same int16 records
+    std::vector<std::vector<double>> decoded(nWaves, std::vector<double>(nSamples));
+    _wave_batch batch;
+    batch.Resize({1}, nWaves, nSamples);
+    for (int i = 0; i < nWaves; i++)
+    {
+        Quantize(waves[i], gain, offset);
+        for (int j = 0; j < nSamples; j++)
+            decoded[i][j] = gain * waves[i].codes[j] - offset;
+        batch.SetRecord(0, i, waves[i].t.data(), decoded[i].data());
+    }
+
+    const std::pair<const char *, _filter_config> filters[] = {
+        {"moving average", {kMovingAverage, 5, 0}},
+        {"FIR low-pass", {kLowPassFIR, 15, 2.0}},
+        {"IIR low-pass", {kSinglePoleIIR, 1, 2.0}},
+        {"differentiator", {kDifferentiator, 4, 0}},
+    };
+    int nFailed = 0;
+    _wave_workspace workspace;
+    _waveinfo_columns columns;
+    for (const auto &filter : filters)
+    {
+        _extract_config filtered = config;
+        filtered.filter = filter.second;
+        std::vector<_waveinfo> info(nWaves);
+        double us = MicrosecondsPerCall(nWaves, [&](int i)
+                                        { processWave(waves[i].t.data(), decoded[i].data(), nSamples, info[i], filtered, workspace); });
+        double usRaw = MicrosecondsPerCall(nWaves, [&](int i)
+                                           { _waveinfo infoRaw;
+                                             processWaveRaw(waves[i].codes.data(), nSamples, codeScale, infoRaw, filtered, workspace); });
+        processWaveBatch(batch, {{1, filtered}}, columns, workspace);
+
+        int nDiff = 0, nTies = 0;
+        for (int i = 0; i < nWaves; i++)
+        {
+            _waveinfo infoRaw, infoDouble, fromBatch = info[i];
+            processWaveRaw(waves[i].codes.data(), nSamples, codeScale, infoRaw, filtered, workspace);
+            processWaveRaw(decoded[i].data(), nSamples, scale, infoDouble, filtered, workspace);
+            for (const auto &field : GetWaveInfoFields())
+                if (field.type == 'D')
+                    *(double *)((char *)&fromBatch + field.offset) = columns.Column(1, field.name)[i];
+            nTies += !SameWaveInfo(info[i], infoRaw, 1e-9);
+            nDiff += !SameWaveInfo(info[i], infoDouble, 1e-9) || !SameWaveInfo(info[i], fromBatch, 1e-9);
+        }
+        std::cout << "  " << filter.first << std::string(17 - std::string(filter.first).size(), ' ') << us << " us/wave, raw int16 "
+                  << usRaw << " us/wave, mismatches " << nDiff << " (int16 " << nTies << ", not counted)" << std::endl;
+        nFailed += nDiff;
+    }
+    return nFailed;
+}
+
+// Pulse finder on records with 0 to 3 pulses, 1.2 to 10 ns apart, the later ones possibly on the tail of the
+// earlier ones. The number of pulses must match the truth and the PILEUP flag, and the fused kernel the reference.
+// The raw int16 kernel is reported, codes rounded across the threshold may change a count. Returns the number of failures.
+int CheckPulses(const WFDataProcessor::_extract_config &config)
+{
+    using namespace WFDataProcessor;
+    const int nWaves = 4000, nSamples = 1002;
+    const double dt = 50e-12, gain = 2e-5, offset = 0.05;
+    _synthetic_config empty;
+    empty.amp_max = 0;
+    auto waves = GenerateWaves(nWaves, nSamples, dt, 41, empty);
+    std::mt19937 rng(41);
+    std::uniform_real_distribution<double> amp(0.06, 0.3), gap(1.2e-9, 10e-9);
+    std::vector<int> truth(nWaves);
+    for (int w = 0; w < nWaves; w++)
+    {
+        truth[w] = w % 4;
+        double start = -2e-9;
+        for (int k = 0; k < truth[w]; k++)
+        {
+            start += k == 0 ? 0 : gap(rng);
+            AddPulse(waves[w], amp(rng), start, empty.tau);
+        }
+        Quantize(waves[w], gain, offset);
+    }
+
+    _extract_config pulseConfig = config;
+    pulseConfig.search_range = {-5.0, 24.0};
+    pulseConfig.find_pulses = true;
+    _sample_scale scale;
+    scale.vertical_gain = gain;
+    scale.vertical_offset = offset;
+    scale.horiz_interval = dt;
+    scale.horiz_offset = waves[0].t[0];
+
+    _extract_config noPulseConfig = pulseConfig;
+    noPulseConfig.find_pulses = false;
+    _wave_workspace workspace;
+    _waveinfo info;
+    double usOff = MicrosecondsPerCall(nWaves, [&](int i)
+                                       { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, info, noPulseConfig, workspace); });
+    double usOn = MicrosecondsPerCall(nWaves, [&](int i)
+                                      { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, info, pulseConfig, workspace); });
+
+    int nWrong = 0, nDiff = 0, nRaw = 0;
+    for (int i = 0; i < nWaves; i++)
+    {
+        processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, info, pulseConfig, workspace);
+        const _pulse_list fused = workspace.pulses;
+        const bool pileup = (info.valid & PILEUP) != 0;
+        processWaveReference(waves[i].t.data(), waves[i].a.data(), nSamples, info, pulseConfig, workspace);
+        const _pulse_list reference = workspace.pulses;
+        processWaveRaw(waves[i].codes.data(), nSamples, scale, info, pulseConfig, workspace);
+
+        nWrong += fused.Size() != truth[i] || pileup != (truth[i] > 1);
+        nRaw += workspace.pulses.Size() != fused.Size();
+        bool same = reference.Size() == fused.Size();
+        for (int k = 0; same && k < fused.Size(); k++)
+            for (auto member : {&_pulse_list::amp, &_pulse_list::toa, &_pulse_list::charge, &_pulse_list::width})
+                same &= std::fabs((fused.*member)[k] - (reference.*member)[k]) <= 1e-9 * std::max(1.0, std::fabs((fused.*member)[k]));
+        nDiff += !same;
+    }
+    // Negative gain: processWaveRaw decodes and falls back to processWave, which must fill the caller's workspace
+    _sample_scale negative = scale;
+    negative.vertical_gain = -gain;
+    std::vector<int16_t> flipped(nSamples);
+    std::vector<double> t(nSamples), a(nSamples);
+    int nFallback = 0;
+    for (int i = 0; i < nWaves; i++)
+    {
+        for (int j = 0; j < nSamples; j++)
+        {
+            flipped[j] = -waves[i].codes[j];
+            t[j] = j * negative.horiz_interval + negative.horiz_offset;
+            a[j] = negative.vertical_gain * flipped[j] - negative.vertical_offset;
+        }
+        _waveinfo decoded;
+        processWaveFused(t.data(), a.data(), nSamples, decoded, pulseConfig, workspace);
+        const _pulse_list expected = workspace.pulses;
+        processWaveRaw(flipped.data(), nSamples, negative, info, pulseConfig, workspace);
+        nFallback += !SameWaveInfo(decoded, info) || workspace.pulses.Size() != expected.Size() || workspace.pulses.toa != expected.toa;
+    }
+
+    // Batch kernel: the same _waveinfo, PILEUP included
+    _wave_batch batch;
+    batch.Resize({1}, nWaves, nSamples);
+    for (int i = 0; i < nWaves; i++)
+        batch.SetRecord(0, i, waves[i].t.data(), waves[i].a.data());
+    _waveinfo_columns columns;
+    processWaveBatch(batch, {{1, pulseConfig}}, columns, workspace);
+    int nBatch = 0;
+    for (int i = 0; i < nWaves; i++)
+    {
+        processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, info, pulseConfig, workspace);
+        nBatch += !SameWaveInfo(info, WaveInfoFromColumns(columns, 1, i));
+    }
+    std::cout << "  " << usOn << " us/wave (" << usOff << " without), wrong pulse counts " << nWrong << ", mismatches against the reference "
+              << nDiff << ", batch mismatches " << nBatch << ", negative gain mismatches " << nFallback << ", raw int16 count mismatches "
+              << nRaw << " (not counted)" << std::endl;
+    return nWrong + nDiff + nBatch + nFallback;
+}
+
+// Robust pedestals on records with a 40 mV afterpulse of 1 ns in the start pedestal region of every other record.
+// The median and trimmed mean must be less biased than the mean, and the fused, reference and raw int16 kernels
+// must agree. Returns the number of failures.
+int CheckBaseline(const WFDataProcessor::_extract_config &config)
+{
+    using namespace WFDataProcessor;
+    const int nWaves = 2000, nSamples = 1002;
+    const double dt = 50e-12, gain = 2e-5, offset = 0.05, truePedestal = 2.0; // mV
+    auto waves = GenerateWaves(nWaves, nSamples, dt, 42);
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> position(-22e-9, -4e-9);
+    for (int w = 0; w < nWaves; w++)
+    {
+        const double t0 = position(rng);
+        if (w % 2)
+            AddPulse(waves[w], 0.04, t0, 0.25e-9);
+        Quantize(waves[w], gain, offset);
+    }
+    _sample_scale scale;
+    scale.vertical_gain = gain;
+    scale.vertical_offset = offset;
+    scale.horiz_interval = dt;
+    scale.horiz_offset = waves[0].t[0];
+
+    int nFailed = 0;
+    double meanBias = 0;
+    const std::pair<const char *, BaselineMethod> methods[] = {{"mean", kMeanBaseline}, {"running median", kMedianBaseline}, {"trimmed mean", kTrimmedMeanBaseline}};
+    for (const auto &method : methods)
+    {
+        _extract_config baselineConfig = config;
+        baselineConfig.baseline.method = method.second;
+        baselineConfig.baseline.window = 41; // about twice the afterpulse
+        _wave_workspace workspace;
+        std::vector<_waveinfo> info(nWaves);
+        double us = MicrosecondsPerCall(nWaves, [&](int i)
+                                        { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, info[i], baselineConfig, workspace); });
+        double bias = 0, spread = 0;
+        int nDiff = 0;
+        for (int i = 0; i < nWaves; i++)
+        {
+            bias += std::fabs(info[i].ped_start - truePedestal) / nWaves;
+            spread += info[i].ped_start_std_dev / nWaves;
+            _waveinfo infoRef, infoRaw;
+            processWaveReference(waves[i].t.data(), waves[i].a.data(), nSamples, infoRef, baselineConfig, workspace);
+            processWaveRaw(waves[i].codes.data(), nSamples, scale, infoRaw, baselineConfig, workspace);
+            // The raw kernel sees the quantized record, only its pedestals are compared, within a code
+            nDiff += !SameWaveInfo(info[i], infoRef, 1e-9) || std::fabs(infoRaw.ped_start - info[i].ped_start) > gain * 1e3 ||
+                     std::fabs(infoRaw.ped_end - info[i].ped_end) > gain * 1e3;
+        }
+        if (method.second == kMeanBaseline)
+            meanBias = bias;
+        const bool better = method.second == kMeanBaseline || bias < meanBias;
+        std::cout << "  " << method.first << std::string(17 - std::string(method.first).size(), ' ') << us << " us/wave, mean |bias| "
+                  << bias << " mV, mean std dev " << spread << " mV, mismatches " << nDiff << (better ? "" : ", more biased than the mean") << std::endl;
+        nFailed += nDiff + !better;
+    }
+
+    // Running median against a sort of every window, on codes (many ties) and window sizes up to the whole record
+    std::vector<double> buffer, sorted;
+    std::vector<int> slots;
+    int nMedian = 0;
+    for (int window : {1, 2, 15, 41, 201, 2001})
+        for (int n : {1, 7, 500})
+        {
+            _baseline_config median;
+            median.method = kMedianBaseline;
+            median.window = window;
+            for (int w = 0; w < 20; w++)
+            {
+                auto code = [&](int i)
+                { return static_cast<double>(waves[w].codes[i]); };
+                double mean, stdDev;
+                RobustBaseline(median, 0, n, code, buffer, slots, mean, stdDev);
+                const int half = window / 2;
+                double expMean = 0, residualMean = 0, m2 = 0;
+                for (int k = 0; k < n; k++)
+                {
+                    sorted.clear();
+                    for (int j = std::max(k - half, 0); j <= std::min(k + half, n - 1); j++)
+                        sorted.push_back(code(j));
+                    std::sort(sorted.begin(), sorted.end());
+                    const int size = sorted.size();
+                    const double value = size % 2 ? sorted[size / 2] : 0.5 * (sorted[size / 2 - 1] + sorted[size / 2]);
+                    const double residual = code(k) - value, weight = 1.0 / (k + 1), delta = residual - residualMean;
+                    expMean += (value - expMean) * weight;
+                    residualMean += delta * weight;
+                    m2 += delta * (residual - residualMean);
+                }
+                nMedian += mean != expMean || stdDev != std::sqrt(m2 / n);
+            }
+        }
+    std::cout << "  running median against sorted windows: mismatches " << nMedian << "; per record of " << nSamples << " samples,";
+    for (int window : {15, 201, 1001})
+    {
+        _baseline_config median;
+        median.method = kMedianBaseline;
+        median.window = window;
+        double mean, stdDev;
+        const double us = MicrosecondsPerCall(nWaves, [&](int w)
+                                              { RobustBaseline(median, 0, nSamples, [&](int i)
+                                                               { return waves[w].a[i]; }, buffer, slots, mean, stdDev); });
+        std::cout << " window " << window << " " << us << " us";
+    }
+    std::cout << std::endl;
+    return nFailed + nMedian;
+}
+
+// Template matching of pulses of known start time and amplitude: a short template on records sampled every 200 ps
+// (direct correlation), and a long one sampled twice as finely as records sampled every 50 ps (resampled, FFT blocks
+// where they are cheaper). The fits must be accurate to a tenth of the sampling interval and 1% of the mean amplitude
+// of 180 mV (the parabola through the coarse correlation biases the amplitude slightly), the fused, reference,
+// batch and raw int16 kernels must agree, and the FFT blocks, chosen at Simd::kScalar for the long template over
+// a long range, must agree with the direct correlation. Returns the number of failures.
+int CheckTemplate(const WFDataProcessor::_extract_config &config)
+{
+    using namespace WFDataProcessor;
+    const int nWaves = 2000;
+    _synthetic_config pulses;
+    pulses.amp_min = 0.06;
+    pulses.gain = 2e-5;
+    pulses.offset = 0.05;
+
+    int nFailed = 0;
+    struct _case
+    {
+        const char *name;
+        double dt;        // s, sampling of the records
+        double length;    // ns, template length
+        double tmpl_step; // ns, sampling of the template
+    };
+    for (const _case &c : {_case{"short", 200e-12, 3.0, 0.2}, _case{"long", 50e-12, 8.0, 0.025}})
+    {
+        const int nSamples = static_cast<int>(std::lround(50e-9 / c.dt)) + 2;
+        auto waves = GenerateWaves(nWaves, nSamples, c.dt, 43, pulses);
+        _sample_scale scale;
+        scale.vertical_gain = pulses.gain;
+        scale.vertical_offset = pulses.offset;
+        scale.horiz_interval = c.dt;
+        scale.horiz_offset = waves[0].t[0];
+        _wave_batch batch;
+        batch.Resize({1}, nWaves, nSamples);
+        for (int i = 0; i < nWaves; i++)
+            batch.SetRecord(0, i, waves[i].t.data(), waves[i].a.data());
+
+        _extract_config tmplConfig = config;
+        tmplConfig.search_range = {-3.0, 5.0};
+        _wave_workspace workspace;
+        _waveinfo info;
+        double usOff = MicrosecondsPerCall(nWaves, [&](int i)
+                                           { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, info, tmplConfig, workspace); });
+        tmplConfig.pulse_template.dt = c.tmpl_step;
+        for (double t = 0; t <= c.length + 1e-9; t += c.tmpl_step)
+            tmplConfig.pulse_template.shape.push_back(PulseShape(t / (pulses.tau * 1e9)));
+        tmplConfig.pulse_template.t_ref = 0; // t_tmpl estimates the start of the pulse
+
+        std::vector<_waveinfo> fused(nWaves);
+        double us = MicrosecondsPerCall(nWaves, [&](int i)
+                                        { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, fused[i], tmplConfig, workspace); });
+        _waveinfo_columns columns;
+        processWaveBatch(batch, {{1, tmplConfig}}, columns, workspace);
+
+        double timeRms = 0, ampError = 0;
+        int nDiff = 0, nRaw = 0;
+        for (int i = 0; i < nWaves; i++)
+        {
+            timeRms += std::pow(fused[i].t_tmpl - waves[i].start * 1e9, 2) / nWaves;
+            ampError += std::fabs(fused[i].amp_tmpl - waves[i].amp * 1e3) / nWaves;
+            _waveinfo infoRef, infoRaw;
+            processWaveReference(waves[i].t.data(), waves[i].a.data(), nSamples, infoRef, tmplConfig, workspace);
+            processWaveRaw(waves[i].codes.data(), nSamples, scale, infoRaw, tmplConfig, workspace);
+            nDiff += !SameWaveInfo(fused[i], infoRef, 1e-9) || (fused[i].valid & NO_TEMPLATE_MATCH) != 0 ||
+                     std::fabs(columns.Column(1, "t_tmpl")[i] - fused[i].t_tmpl) > 1e-9 ||
+                     std::fabs(columns.Column(1, "amp_tmpl")[i] - fused[i].amp_tmpl) > 1e-9 * fused[i].amp_tmpl;
+            nRaw += std::fabs(infoRaw.t_tmpl - fused[i].t_tmpl) > 1e-3 || std::fabs(infoRaw.amp_tmpl - fused[i].amp_tmpl) > 0.05;
+        }
+        timeRms = std::sqrt(timeRms);
+        const bool accurate = timeRms < 0.1 * c.dt * 1e9 && ampError < 1.8;
+        std::cout << "  " << c.name << " template" << std::string(7 - std::string(c.name).size(), ' ') << us << " us/wave ("
+                  << workspace.match.h.size() << " taps at " << c.dt * 1e12 << " ps, " << usOff << " without), rms time error "
+                  << timeRms * 1e3 << " ps, mean |amplitude error| " << ampError << " mV, mismatches " << nDiff << ", raw int16 " << nRaw
+                  << (accurate ? "" : ", inaccurate") << std::endl;
+        nFailed += nDiff + nRaw + !accurate;
+
+        // Long range: FFT blocks at the scalar level against the direct correlation of the vector levels
+        if (workspace.match.block > 0 && Simd::GetLevel() != Simd::kScalar)
+        {
+            const Simd::Level level = Simd::GetLevel();
+            tmplConfig.search_range = {-20.0, 20.0};
+            std::vector<_waveinfo> direct(nWaves), blocks(nWaves);
+            double usDirect = MicrosecondsPerCall(nWaves, [&](int i)
+                                                  { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, direct[i], tmplConfig, workspace); });
+            Simd::SetLevel(Simd::kScalar);
+            double usBlocks = MicrosecondsPerCall(nWaves, [&](int i)
+                                                  { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, blocks[i], tmplConfig, workspace); });
+            Simd::SetLevel(level);
+            int nBlocks = 0;
+            for (int i = 0; i < nWaves; i++)
+                nBlocks += std::fabs(direct[i].t_tmpl - blocks[i].t_tmpl) > 1e-9 || std::fabs(direct[i].amp_tmpl - blocks[i].amp_tmpl) > 1e-9 * direct[i].amp_tmpl;
+            std::cout << "  long range     " << usDirect << " us/wave direct (" << Simd::LevelName(level) << "), " << usBlocks
+                      << " us/wave FFT blocks (scalar), mismatches " << nBlocks << std::endl;
+            nFailed += nBlocks;
+        }
+    }
+    return nFailed;
+}
+
+// Multi-threshold crossings against a separate walk from the peak for each level, with linear interpolation, and the
+// fused kernel against the reference and raw int16 kernels. Returns the number of mismatches.
+int CheckMultiThreshold(const WFDataProcessor::_extract_config &config)
+{
+    using namespace WFDataProcessor;
+    const int nWaves = 4000, nSamples = 1002;
+    const double dt = 50e-12, gain = 2e-5, offset = 0.05, notFound = -100e9;
+    _synthetic_config quantized;
+    quantized.gain = gain;
+    quantized.offset = offset;
+    auto waves = GenerateWaves(nWaves, nSamples, dt, 46, quantized);
+    _sample_scale scale;
+    scale.vertical_gain = gain;
+    scale.vertical_offset = offset;
+    scale.horiz_interval = dt;
+    scale.horiz_offset = waves[0].t[0];
+
+    _extract_config totConfig = config;
+    for (int k = 1; k <= 20; k++)
+        totConfig.tot_thresholds.push_back(5.0 * k);
+    _wave_workspace workspace;
+    _waveinfo info;
+    double usOff = MicrosecondsPerCall(nWaves, [&](int i)
+                                       { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, info, config, workspace); });
+    double usOn = MicrosecondsPerCall(nWaves, [&](int i)
+                                      { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, info, totConfig, workspace); });
+
+    int nWrong = 0, nDiff = 0, nRaw = 0, nFound = 0;
+    auto close = [notFound](double v1, double v2, double tolerance)
+    { return (v1 == notFound) == (v2 == notFound) && std::fabs(v1 - v2) <= tolerance; };
+    for (int w = 0; w < nWaves; w++)
+    {
+        const double *t = waves[w].t.data(), *a = waves[w].a.data();
+        processWaveFused(t, a, nSamples, info, totConfig, workspace);
+        const _tot_list fused = workspace.tot;
+
+        // Level by level: from the maximum of the window outwards to the first sample below the level
+        int up, down;
+        FindSearchWindow(t, nSamples, totConfig.search_range, up, down);
+        const int peak = std::max_element(a + up, a + down + 1) - a;
+        auto amp = [&](int i)
+        { return a[i] * 1e3 - info.ped_start; };
+        bool same = fused.Size() == static_cast<int>(totConfig.tot_thresholds.size());
+        for (int k = 0; same && k < fused.Size(); k++)
+        {
+            const double level = totConfig.tot_thresholds[k];
+            double lead = notFound, trail = notFound;
+            if (amp(peak) > level)
+            {
+                for (int i = peak - 1; i >= up && lead == notFound; i--)
+                    if (amp(i) < level)
+                        lead = (t[i] + (t[i + 1] - t[i]) * (level - amp(i)) / (amp(i + 1) - amp(i))) * 1e9;
+                for (int i = peak + 1; i <= down && trail == notFound; i++)
+                    if (amp(i) < level)
+                        trail = (t[i - 1] + (t[i] - t[i - 1]) * (level - amp(i - 1)) / (amp(i) - amp(i - 1))) * 1e9;
+            }
+            const double tot = lead != notFound && trail != notFound ? trail - lead : notFound;
+            same &= close(fused.t_lead[k], lead, 1e-9) && close(fused.t_trail[k], trail, 1e-9) && close(fused.tot[k], tot, 1e-9);
+            nFound += tot != notFound;
+        }
+        nWrong += !same;
+
+        processWaveReference(t, a, nSamples, info, totConfig, workspace);
+        same = workspace.tot.Size() == fused.Size();
+        for (int k = 0; same && k < fused.Size(); k++)
+            same &= close(fused.t_lead[k], workspace.tot.t_lead[k], 1e-9) && close(fused.t_trail[k], workspace.tot.t_trail[k], 1e-9);
+        nDiff += !same;
+
+        processWaveRaw(waves[w].codes.data(), nSamples, scale, info, totConfig, workspace);
+        for (int k = 0; k < fused.Size(); k++)
+            nRaw += !close(fused.tot[k], workspace.tot.tot[k], 0.05);
+    }
+    std::cout << "  " << usOn << " us/wave with " << totConfig.tot_thresholds.size() << " levels (" << usOff << " without), " << nFound
+              << " levels over threshold, mismatches against separate walks " << nWrong << ", against the reference " << nDiff
+              << ", raw int16 levels off by more than 50 ps " << nRaw << " (not counted)" << std::endl;
+    return nWrong + nDiff;
+}
+
+// Noise spectrum of the pre-signal region: the paired FFT against a direct DFT of each segment, white noise
+// against its flat density, a sine in the right bin, two halves merged against the whole, and raw int16 codes against
+// the decoded samples. Returns the number of failures.
+int CheckNoiseSpectrum()
+{
+    using namespace WFDataProcessor;
+    const int nWaves = 4001, nSamples = 1002, up = 500; // odd, a segment is left pending
+    const double dt = 50e-12, gain = 2e-5, offset = 0.05, sigma = 1.5, pi = 3.14159265358979323846;
+    const double fSine = 2.5; // GHz, on bin 32 of 256 points at 50 ps
+    _synthetic_config noiseOnly;
+    noiseOnly.noise = sigma * 1e-3;
+    noiseOnly.amp_max = 0;
+    auto waves = GenerateWaves(nWaves, nSamples, dt, 47, noiseOnly);
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<double> phase(0, 2 * pi);
+    for (int w = 0; w < nWaves; w++)
+    {
+        const double p0 = phase(rng);
+        for (int i = 0; i < nSamples; i++)
+            waves[w].a[i] += 0.5e-3 * std::sin(2 * pi * fSine * i * dt * 1e9 + p0);
+        Quantize(waves[w], gain, offset);
+    }
+
+    int nFailed = 0;
+    for (SpectrumWindow window : {kRectangularWindow, kHannWindow, kBlackmanHarrisWindow})
+    {
+        _spectrum_config config;
+        config.length = 256;
+        config.window = window;
+        _noise_spectrum spectrum, raw;
+        double us = MicrosecondsPerCall(nWaves, [&](int w)
+                                        { AccumulateNoiseSpectrum(waves[w].a.data(), nSamples, up, 1e3, dt * 1e9, config, spectrum); });
+        FinishNoiseSpectrum(spectrum);
+        for (int w = 0; w < nWaves; w++)
+            AccumulateNoiseSpectrum(waves[w].codes.data(), nSamples, up, gain * 1e3, dt * 1e9, config, raw);
+        FinishNoiseSpectrum(raw);
+
+        // Two halves merged, as a resumed output merges its spectrum with the new events
+        _noise_spectrum head, tail;
+        for (int w = 0; w < nWaves; w++)
+            AccumulateNoiseSpectrum(waves[w].a.data(), nSamples, up, 1e3, dt * 1e9, config, w < nWaves / 2 ? head : tail);
+        FinishNoiseSpectrum(tail);
+        int nMerge = !MergeNoiseSpectrum(tail, head) || head.events != spectrum.events;
+        for (int k = 0; k <= config.length / 2; k++)
+            nMerge += std::fabs(head.power[k] - spectrum.power[k]) > 1e-9 * spectrum.power[k];
+
+        // Direct DFT of the first segments, averaged the same way
+        const int n = config.length, nDirect = 9;
+        std::vector<double> direct(n / 2 + 1, 0.0);
+        double norm = 0;
+        for (double w : spectrum.window)
+            norm += w * w;
+        for (int w = 0; w < nDirect; w++)
+        {
+            double mean = 0;
+            for (int i = 0; i < n; i++)
+                mean += waves[w].a[up - n + i] / n;
+            for (int k = 0; k <= n / 2; k++)
+            {
+                double re = 0, im = 0;
+                for (int i = 0; i < n; i++)
+                {
+                    const double x = (waves[w].a[up - n + i] - mean) * 1e3 * spectrum.window[i];
+                    re += x * std::cos(2 * pi * k * i / n);
+                    im -= x * std::sin(2 * pi * k * i / n);
+                }
+                direct[k] += (k == 0 || k == n / 2 ? 1 : 2) * dt * 1e9 / norm * (re * re + im * im) / nDirect;
+            }
+        }
+        _noise_spectrum first;
+        for (int w = 0; w < nDirect; w++)
+            AccumulateNoiseSpectrum(waves[w].a.data(), nSamples, up, 1e3, dt * 1e9, config, first);
+        FinishNoiseSpectrum(first);
+        int nDiff = first.events != nDirect;
+        for (int k = 0; k <= n / 2; k++)
+            nDiff += std::fabs(first.power[k] - direct[k]) > 1e-9 * std::max(1e-6, direct[k]);
+
+        // White noise: 2 sigma^2 dt away from the sine, the sine in bin fSine * n * dt
+        const int sineBin = static_cast<int>(std::lround(fSine * n * dt * 1e9));
+        double floor = 0, rawDiff = 0;
+        int nFloor = 0;
+        for (int k = 1; k < n / 2; k++)
+        {
+            rawDiff = std::max(rawDiff, std::fabs(raw.power[k] - spectrum.power[k]) / spectrum.power[k]);
+            if (std::abs(k - sineBin) > 4)
+            {
+                floor += spectrum.power[k];
+                nFloor++;
+            }
+        }
+        floor /= nFloor;
+        const double expected = 2 * sigma * sigma * dt * 1e9;
+        const int peak = std::max_element(spectrum.power.begin() + 1, spectrum.power.end()) - spectrum.power.begin();
+        const bool good = std::fabs(floor / expected - 1) < 0.05 && peak == sineBin && spectrum.events == nWaves && rawDiff < 0.05 && nMerge == 0;
+        const char *names[] = {"rectangular", "Hann", "Blackman-Harris"};
+        std::cout << "  " << names[window] << std::string(16 - std::string(names[window]).size(), ' ') << us << " us/event, noise floor "
+                  << floor << " mV^2/GHz (expected " << expected << "), peak at " << spectrum.Frequency(peak) << " GHz, mismatches against the DFT "
+                  << nDiff << ", merged halves " << nMerge << ", raw int16 max relative difference " << rawDiff << (good ? "" : ", wrong") << std::endl;
+        nFailed += nDiff + !good;
+    }
+    return nFailed;
+}
+
+// Average pulse aligned on toa: normalized pulses of random amplitude and phase against the known shape, with the
+// linear and windowed-sinc fractional shifts, the running variance against a second pass, a third of the pulses merged
+// with the others against the whole, and raw int16 codes against the decoded samples. Returns the number of failures.
+int CheckPulseShape(const WFDataProcessor::_extract_config &config)
+{
+    using namespace WFDataProcessor;
+    const int nWaves = 4000, nSamples = 1002;
+    const double dt = 200e-12, gain = 2e-5, offset = 0.05, tau = 0.8; // ns, slow pulses sampled at 200 ps
+    // Leading-edge 50% point of the shape, where toa is found
+    double x50 = 0.5;
+    for (int k = 0; k < 60; k++)
+        x50 += PulseShape(x50) < 0.5 ? std::ldexp(0.5, -k - 1) : -std::ldexp(0.5, -k - 1);
+
+    _synthetic_config slow;
+    slow.noise = 0.3e-3;
+    slow.amp_min = 0.1;
+    slow.tau = tau * 1e-9;
+    slow.gain = gain;
+    slow.offset = offset;
+    auto waves = GenerateWaves(nWaves, nSamples, dt, 48, slow);
+
+    _extract_config shapeConfig = config;
+    shapeConfig.search_range = {-5.0, 10.0};
+    _pulse_shape_config grid;
+    grid.step = 0.01;
+    grid.start = -1.0;
+    grid.stop = 3.0;
+    grid.normalize = true;
+    _wave_workspace workspace;
+    std::vector<_waveinfo> info(nWaves);
+    for (int w = 0; w < nWaves; w++)
+        processWaveFused(waves[w].t.data(), waves[w].a.data(), nSamples, info[w], shapeConfig, workspace);
+
+    int nFailed = 0;
+    for (InterpolationMethod method : {kLinearInterpolation, kSincInterpolation})
+    {
+        grid.interpolation = method;
+        _average_pulse average, raw;
+        const double t0_ns = waves[0].t[0] * 1e9, dt_ns = dt * 1e9;
+        int nUsed = 0;
+        double us = MicrosecondsPerCall(nWaves, [&](int w)
+                                        {
+            const double *a = waves[w].a.data(), ped = info[w].ped_start;
+            nUsed += AccumulatePulseShape(nSamples, t0_ns, dt_ns, info[w].toa, 1.0 / info[w].amp, [a, ped](int i)
+                                          { return a[i] * 1e3 - ped; }, grid, average); });
+        for (int w = 0; w < nWaves; w++)
+        {
+            const int16_t *c = waves[w].codes.data();
+            const double mv = gain * 1e3, off = offset * 1e3 + info[w].ped_start;
+            AccumulatePulseShape(nSamples, t0_ns, dt_ns, info[w].toa, 1.0 / info[w].amp, [c, mv, off](int i)
+                                 { return mv * c[i] - off; }, grid, raw);
+        }
+
+        // Two halves merged, as a resumed output merges its pulses with the new ones
+        _average_pulse head, tail;
+        for (int w = 0; w < nWaves; w++)
+        {
+            const double *a = waves[w].a.data(), ped = info[w].ped_start;
+            AccumulatePulseShape(nSamples, t0_ns, dt_ns, info[w].toa, 1.0 / info[w].amp, [a, ped](int i)
+                                 { return a[i] * 1e3 - ped; }, grid, w < nWaves / 3 ? head : tail);
+        }
+        double maxMerge = MergeAveragePulse(tail, head) && head.count == average.count ? 0 : 1;
+
+        // Shape error, running variance against the mean of the squares, raw against decoded
+        double maxError = 0, maxVariance = 0, maxRaw = 0;
+        for (int j = 0; j < grid.Points(); j++)
+        {
+            maxError = std::max(maxError, std::fabs(average.mean[j] - PulseShape(x50 + grid.Time(j) / tau)));
+            maxRaw = std::max(maxRaw, std::fabs(raw.mean[j] - average.mean[j]));
+            maxMerge = std::max({maxMerge, std::fabs(head.mean[j] - average.mean[j]), std::fabs(head.StdDev(j) - average.StdDev(j))});
+        }
+        // Second pass: every pulse resampled alone
+        std::vector<double> sum(grid.Points(), 0.0), square(grid.Points(), 0.0);
+        _average_pulse single;
+        for (int w = 0; w < nWaves; w++)
+        {
+            const double *a = waves[w].a.data(), ped = info[w].ped_start;
+            single.count = 0;
+            AccumulatePulseShape(nSamples, t0_ns, dt_ns, info[w].toa, 1.0 / info[w].amp, [a, ped](int i)
+                                 { return a[i] * 1e3 - ped; }, grid, single);
+            for (int j = 0; j < grid.Points(); j++)
+            {
+                sum[j] += single.mean[j];
+                square[j] += single.mean[j] * single.mean[j];
+            }
+        }
+        for (int j = 0; j < grid.Points(); j++)
+        {
+            const double mean = sum[j] / nWaves;
+            maxVariance = std::max(maxVariance, std::fabs(square[j] / nWaves - mean * mean - average.StdDev(j) * average.StdDev(j)));
+        }
+        const bool good = average.count == nWaves && nUsed == nWaves && maxError < (method == kLinearInterpolation ? 0.05 : 0.02) &&
+                          maxVariance < 1e-9 && maxRaw < 1e-3 && maxMerge < 1e-9;
+        std::cout << "  " << (method == kLinearInterpolation ? "linear" : "sinc  ") << " " << us << " us/pulse (" << grid.Points() << " points), "
+                  << average.count << " pulses, max error of the normalized shape " << maxError << ", running variance off by " << maxVariance
+                  << ", merged thirds off by " << maxMerge << ", raw int16 off by " << maxRaw << (good ? "" : ", wrong") << std::endl;
+        nFailed += !good;
+    }
+    return nFailed;
+}
+
+// A reference (trigger) pulse jittering by +-8 ns, a DUT pulse 1.5 ns after it on most events and a narrow noise spike
+// anywhere in the record on some. Fixed window wide enough for the jitter against the window placed on the reference toa.
+int CheckAdaptiveWindow(const WFDataProcessor::_extract_config &config)
+{
+    using namespace WFDataProcessor;
+    const int nWaves = 4000, nSamples = 1002;
+    const double dt = 50e-12, tau = 0.4, delay = 1.5; // ns
+    _synthetic_config trigger, empty;
+    trigger.amp_min = trigger.amp_max = 0.2;
+    trigger.start_min = -8e-9;
+    trigger.start_max = 8e-9;
+    empty.amp_max = 0;
+    auto reference = GenerateWaves(nWaves, nSamples, dt, 50, trigger), dut = GenerateWaves(nWaves, nSamples, dt, 51, empty);
+    std::mt19937 rng(50);
+    std::uniform_real_distribution<double> uniform(0, 1), anywhere(-24, 24);
+    std::vector<double> dutTime(nWaves, -100e9); // ns, start of the DUT pulse, -100e9 without one
+    for (int w = 0; w < nWaves; w++)
+    {
+        const double spike = uniform(rng) < 0.3 ? anywhere(rng) : -100e9;
+        if (uniform(rng) < 0.7)
+        {
+            dutTime[w] = reference[w].start * 1e9 + delay;
+            AddPulse(dut[w], 0.1, dutTime[w] * 1e-9, tau * 1e-9);
+        }
+        for (int i = 0; i < nSamples; i++)
+        {
+            const double ns = dut[w].t[i] * 1e9;
+            dut[w].a[i] += 0.15 * std::exp(-0.5 * (ns - spike) * (ns - spike) / 0.01);
+        }
+    }
+
+    _extract_config fixed = config;
+    fixed.search_range = {-9.0, 13.0};
+    _extract_config relative = fixed;
+    relative.relative_range.reference = 1;
+    relative.relative_range.offset = 0.5;
+    relative.relative_range.width = 4.0;
+    _wave_workspace refWorkspace, workspace;
+    std::vector<_waveinfo> refInfo(nWaves);
+    for (int w = 0; w < nWaves; w++)
+        processWave(reference[w].t.data(), reference[w].a.data(), nSamples, refInfo[w], fixed, refWorkspace);
+
+    int nFailed = 0;
+    if (RelativeSearchRange(relative, -100e9) != fixed.search_range)
+    {
+        std::cout << "  no reference toa does not fall back to the fixed range" << std::endl;
+        nFailed++;
+    }
+    double efficiency[2], fakes[2];
+    for (int mode = 0; mode < 2; mode++)
+    {
+        _extract_config dutConfig = fixed;
+        std::vector<_waveinfo> info(nWaves);
+        double us = MicrosecondsPerCall(nWaves, [&](int w)
+                                        {
+            if (mode == 1)
+                dutConfig.search_range = RelativeSearchRange(relative, refInfo[w].toa);
+            processWave(dut[w].t.data(), dut[w].a.data(), nSamples, info[w], dutConfig, workspace); });
+        // Found: above threshold with toa within 1 ns of the DUT pulse; fake: above threshold without a DUT pulse. Spikes
+        // inside the relative window still count, a few percent of the events
+        int nPulses = 0, nFound = 0, nEmpty = 0, nFake = 0;
+        for (int w = 0; w < nWaves; w++)
+        {
+            const bool above = info[w].amp > config.threshold;
+            if (dutTime[w] > -100e9)
+            {
+                nPulses++;
+                nFound += above && std::fabs(info[w].toa - dutTime[w]) < 1.0;
+            }
+            else
+            {
+                nEmpty++;
+                nFake += above;
+            }
+        }
+        efficiency[mode] = static_cast<double>(nFound) / nPulses;
+        fakes[mode] = static_cast<double>(nFake) / nEmpty;
+        std::cout << "  " << (mode == 0 ? "fixed    " : "relative ") << us << " us/wave, window "
+                  << (mode == 0 ? fixed.search_range.second - fixed.search_range.first : relative.relative_range.width) << " ns, efficiency "
+                  << efficiency[mode] << ", fake rate " << fakes[mode] << std::endl;
+    }
+    const bool good = efficiency[1] > 0.97 && efficiency[1] >= efficiency[0] && fakes[1] < fakes[0];
+    if (!good)
+        std::cout << "  relative window not better than the fixed one" << std::endl;
+    return nFailed + !good;
+}
+
+int main()
+{
+    using namespace WFDataProcessor;
+    const double dt = 50e-12;
+    _extract_config config{{-1.0, 4.0}, 20.0, false, ""};
+    config.cfd_fraction = 0.5; // discriminator delay of about the rise time of the pulses
+    config.cfd_delay = 0.4;
+    const Simd::Level bestLevel = Simd::DetectLevel();
+    std::cout << "Best SIMD level: " << Simd::LevelName(bestLevel) << std::endl;
+
+    int nFailed = CheckSearchWindow(1);
+    std::cout << "Interpolation of the crossings (" << dt * 1e12 << " ps sampling):" << std::endl;
+    nFailed += CheckInterpolation(dt, config, false);
+    std::cout << "Interpolation of the crossings (" << 4 * dt * 1e12 << " ps sampling):" << std::endl;
+    nFailed += CheckInterpolation(4 * dt, config, true);
+    {
+        auto waves = GenerateWaves(2000, 1002, dt, 11);
+        std::cout << "Missing records:" << std::endl;
+        nFailed += CheckMissingRecord(waves, config);
+        std::cout << "Filter stage (1002 samples):" << std::endl;
+        nFailed += CheckFilters(waves, config);
+    }
+    std::cout << "Pulse finder (1002 samples):" << std::endl;
+    nFailed += CheckPulses(config);
+    std::cout << "Robust pedestals (1002 samples):" << std::endl;
+    nFailed += CheckBaseline(config);
+    std::cout << "Template matching (50 ns records):" << std::endl;
+    nFailed += CheckTemplate(config);
+    std::cout << "Multi-threshold crossings (1002 samples):" << std::endl;
+    nFailed += CheckMultiThreshold(config);
+    std::cout << "Noise spectrum (256-point segments):" << std::endl;
+    nFailed += CheckNoiseSpectrum();
+    std::cout << "Average pulse aligned on toa (200 ps sampling):" << std::endl;
+    nFailed += CheckPulseShape(config);
+    std::cout << "Search window relative to a reference channel (1002 samples):" << std::endl;
+    nFailed += CheckAdaptiveWindow(config);
+    for (int nSamples : {252, 1002, 5002, 20002, 100002})
+    {
+        const int nWaves = std::max(100, 4000000 / nSamples);
+        auto waves = GenerateWaves(nWaves, nSamples, dt, nSamples);
+        std::vector<_waveinfo> infoRef(nWaves), infoFused(nWaves);
+        _wave_workspace workspace;
+        std::cout << "Samples " << nSamples << " (" << nWaves << " waves):" << std::endl;
+
+        double usRef = MicrosecondsPerCall(nWaves, [&](int i)
+                                           { processWaveReference(waves[i].t.data(), waves[i].a.data(), nSamples, infoRef[i], config, workspace); });
+        std::cout << "  reference        " << usRef << " us/wave" << std::endl;
+
+        // Scalar fused kernel must reproduce the reference exactly, vector levels within tolerance
+        for (int level = Simd::kScalar; level <= bestLevel; level++)
+        {
+            Simd::SetLevel((Simd::Level)level);
+            double usFused = MicrosecondsPerCall(nWaves, [&](int i)
+                                                 { processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, infoFused[i], config, workspace); });
+            int nDiff = 0;
+            for (int i = 0; i < nWaves; i++)
+                if (!SameWaveInfo(infoRef[i], infoFused[i], level == Simd::kScalar ? 0 : 1e-9))
+                    nDiff++;
+            nFailed += nDiff;
+
+            // Reduction alone: window sum and extrema over the whole record
+            double sum = 0;
+            double usReduce = MicrosecondsPerCall(nWaves, [&](int i)
+                                                  {
+                double max = -1e9, min = 1e9;
+                int argmax = -1, argmin = -1;
+                Simd::ScaledWindowStats(waves[i].a.data(), nSamples, 1e3, 0.5, 0.05, sum, max, argmax, min, argmin); });
+
+            std::cout << "  fused " << Simd::LevelName((Simd::Level)level) << std::string(10 - std::string(Simd::LevelName((Simd::Level)level)).size(), ' ')
+                      << usFused << " us/wave, speedup " << usRef / usFused << ", mismatches " << nDiff
+                      << "; window reduction " << usReduce << " us (checksum " << sum << ")" << std::endl;
+        }
+        Simd::SetLevel(bestLevel);
+
+        // Batch kernel over all waves at once, bit-identical to the fused kernel at the scalar level,
+        // vector levels reorder the sums of the fused kernel only
+        _wave_batch batch;
+        batch.Resize({1}, nWaves, nSamples);
+        for (int i = 0; i < nWaves; i++)
+            batch.SetRecord(0, i, waves[i].t.data(), waves[i].a.data());
+        _waveinfo_columns columns;
+        for (int level : {(int)Simd::kScalar, (int)bestLevel})
+        {
+            Simd::SetLevel((Simd::Level)level);
+            double usBatch = MicrosecondsPerCall(1, [&](int)
+                                                 { processWaveBatch(batch, {{1, config}}, columns, workspace); }) /
+                             nWaves;
+            for (int i = 0; i < nWaves; i++)
+                processWaveFused(waves[i].t.data(), waves[i].a.data(), nSamples, infoFused[i], config, workspace);
+            int nDiff = 0;
+            for (int i = 0; i < nWaves; i++)
+                if (!SameWaveInfo(infoFused[i], WaveInfoFromColumns(columns, 1, i), level == Simd::kScalar ? 0 : 1e-9))
+                    nDiff++;
+            nFailed += nDiff;
+            std::cout << "  batch " << Simd::LevelName((Simd::Level)level) << std::string(10 - std::string(Simd::LevelName((Simd::Level)level)).size(), ' ')
+                      << usBatch << " us/wave, mismatches " << nDiff << std::endl;
+        }
+        Simd::SetLevel(bestLevel);
+
+        nFailed += CompareRaw<int8_t>("int8", waves, 2.5e-3, 0.05, dt, config, false);
+        nFailed += CompareRaw<int16_t>("int16", waves, 1e-5, 0.05, dt, config);
+        nFailed += CompareRaw<float>("float", waves, 1.0, 0.0, dt, config);
+        nFailed += CompareRaw<double>("double", waves, 1.0, 0.0, dt, config);
+        nFailed += CheckFeatureMask(waves, config, {"amp", "t_amp", "toa", "charge", "t_cfd"});
+    }
+    return nFailed == 0 ? 0 : 1;
+}
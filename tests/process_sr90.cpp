@@ -36,10 +36,18 @@ void plot()
     int maxFiles = 20;
     for (int idx_file = 0; idx_file < maxFiles; idx_file++)
         extractor.ExtractFromTRCFiles(gInputTRCFolder, idx_file);
+    // Plots are saved on a background thread
+    extractor.FlushPlots();
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    // "--resume" appends to an existing output and skips waveforms already extracted, so an interrupted run can be restarted
+    bool resume = false;
+    for (int i = 1; i < argc; i++)
+        if (std::string(argv[i]) == "--resume")
+            resume = true;
+
     WFDataProcessor::WFDataExtractor extractor({1, 2, 3, 4});
     extractor.SetExtractConfig(1, ch1_config);
     extractor.SetExtractConfig(2, ch2_config);
@@ -47,7 +55,12 @@ int main()
     extractor.SetExtractConfig(4, ch4_config);
 
     extractor.SetForceMatch(true);
-    extractor.OpenFile(gOutputROOTFile);
+    extractor.SetResume(resume);
+    if (!extractor.OpenFile(gOutputROOTFile))
+    {
+        std::cerr << "Cannot open output " << gOutputROOTFile << std::endl;
+        return 1;
+    }
 
     int maxFiles = 3739;
     for (int idx_file = 0; idx_file < maxFiles; idx_file++)
@@ -58,6 +71,7 @@ int main()
             std::cout <<"\r"<< std::endl;
         extractor.ExtractFromTRCFiles(gInputTRCFolder, idx_file);
     }
+    extractor.CloseFile();
 
     return 0;
 }
\ No newline at end of file
@@ -42,18 +42,20 @@ void NormalizeTOA(WFDataProcessor::WFDataTreeReader &reader)
         mhTOA[ch] = new TH1D(hname.c_str(), hname.c_str(), 1000, -10, 10);
     }
 
-    for (int entry = 0; entry < reader.GetTree()->GetEntries(); entry++)
+    // Only toa and charge branches are read, in batches of columns
+    WFDataProcessor::_waveinfo_columns columns;
+    const Long64_t batchSize = 10000;
+    for (Long64_t first = 0; reader.ReadBatch(first, batchSize, columns) > 0; first += columns.size)
     {
-        reader.GetTree()->GetEntry(entry);
-        double toaTrigger = waveInfoMap[1]->toa; // Channel 1 is trigger
-
-        for (auto &iter : waveInfoMap)
+        const auto &toaTrigger = columns.Column(1, "toa"); // Channel 1 is trigger
+        for (auto &iter : mhTOA)
         {
             int ch = iter.first;
-            double toa = iter.second->toa;
-            double charge = iter.second->charge;
-            if (charge >= 50.0) // Skip small signals
-                mhTOA[ch]->Fill(toa - toaTrigger);
+            const auto &toa = columns.Column(ch, "toa");
+            const auto &charge = columns.Column(ch, "charge");
+            for (Long64_t i = 0; i < columns.size; i++)
+                if (charge[i] >= 50.0) // Skip small signals
+                    iter.second->Fill(toa[i] - toaTrigger[i]);
         }
     }
     // Determine time offsets
@@ -135,6 +137,8 @@ int main()
         std::cerr << "Failed to open scope data file: " << gExtractedFile << std::endl;
         return -1;
     }
+    // Position and time reconstruction only need these two features
+    reader.SetActiveFeatures({"toa", "charge"});
     NormalizeTOA(reader);
 
     std::map<int, double> toa;
@@ -160,7 +164,7 @@ int main()
     for (int entry = 0; entry < reader.GetTree()->GetEntries(); entry++)
     {
 
-        reader.GetTree()->GetEntry(entry);
+        reader.GetEntry(entry);
         auto waveInfoMap = reader.GetChannelDataMap();
         double doubleX = -9999.0;
         double doubleY = -9999.0;
@@ -0,0 +1,139 @@
+#include "WFEventStore.h"
+#include "WFDataConverter.h"
+#include "lcparser.h"
+#include "SyntheticTRC.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Flat event store round trip: synthetic .trc files (int16 channel 1, int8 channel 2) are stored from their raw codes
+// and must be read back bit by bit. Then the file is truncated, and its offset index and trailer corrupted: the reader
+// falls back to the fixed stride or refuses the file, but never returns an event outside of the mapping.
+// Returns non-zero on any failure.
+
+namespace
+{
+    using namespace WFDataProcessor;
+
+    constexpr int kEvents = 6, kSamples = 500;
+    const float kGain = 1e-4f, kOffset = 0.02f, kDt = 50e-12f;
+
+    std::vector<char> ReadAll(const std::string &path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    void WriteAll(const std::string &path, const std::vector<char> &data)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), data.size());
+    }
+
+    // Events of a store compared with the codes written, nEvents expected
+    int CheckStore(const std::string &path, long long nEvents, const std::vector<std::vector<int16_t>> &codes1,
+                   const std::vector<std::vector<int8_t>> &codes2)
+    {
+        WFFlatReader reader;
+        if (!reader.OpenFile(path))
+            return 1;
+        int nFailed = reader.GetEntries() != nEvents;
+        for (long long evt = 0; evt < reader.GetEntries(); evt++)
+        {
+            _waveform_view view1, view2;
+            if (reader.GetFileIndex(evt) != evt || !reader.GetWaveform(evt, 1, view1) || !reader.GetWaveform(evt, 2, view2) ||
+                view1.nsamples != kSamples || view1.verticalGain != kGain || view1.verticalOffset != kOffset)
+            {
+                nFailed++;
+                continue;
+            }
+            for (int i = 0; i < kSamples; i++)
+                if (view1.codes[i] != codes1[evt][i] || view2.codes[i] != codes2[evt][i])
+                {
+                    nFailed++;
+                    break;
+                }
+        }
+        return nFailed;
+    }
+}
+
+int main()
+{
+    const std::string folder = (std::filesystem::temp_directory_path() / "test_eventstore").string();
+    std::filesystem::create_directories(folder);
+    const std::string store = folder + "/events.flat";
+
+    std::mt19937 rng(28);
+    std::uniform_int_distribution<int> code(-32768, 32767), byte(-128, 127);
+    std::vector<std::vector<int16_t>> codes1(kEvents, std::vector<int16_t>(kSamples));
+    std::vector<std::vector<int8_t>> codes2(kEvents, std::vector<int8_t>(kSamples));
+    for (int evt = 0; evt < kEvents; evt++)
+    {
+        for (int i = 0; i < kSamples; i++)
+        {
+            codes1[evt][i] = code(rng);
+            codes2[evt][i] = byte(rng);
+        }
+        SyntheticTRC::Write(GenerateScopeFileName(folder, 1, evt), codes1[evt], kGain, kOffset, kDt, -1e-8 + evt * 1e-11);
+        SyntheticTRC::Write(GenerateScopeFileName(folder, 2, evt), codes2[evt], kGain, kOffset, kDt, -1e-8 + evt * 1e-11);
+    }
+
+    int nFailed = 0;
+    {
+        WFFlatWriter writer({1, 2});
+        writer.OpenFile(store);
+        for (int evt = 0; evt < kEvents; evt++)
+            nFailed += !writer.FillFromTRCFiles(folder, evt);
+        writer.CloseFile();
+    }
+    int nDiff = CheckStore(store, kEvents, codes1, codes2);
+    std::cout << "Round trip of the raw codes: " << kEvents << " events, failures " << nFailed + nDiff << std::endl;
+    nFailed += nDiff;
+
+    const std::vector<char> good = ReadAll(store);
+    const size_t trailerSize = sizeof(FlatStore::_flat_file_trailer);
+    const size_t indexOffset = good.size() - trailerSize - kEvents * sizeof(uint64_t);
+    const std::string damaged = folder + "/damaged.flat";
+
+    // Interrupted job: no index, the events are counted by stride, the last one is incomplete
+    WriteAll(damaged, std::vector<char>(good.begin(), good.begin() + indexOffset - 8));
+    nDiff = CheckStore(damaged, kEvents - 1, codes1, codes2);
+    std::cout << "Truncated store: failures " << nDiff << std::endl;
+    nFailed += nDiff;
+
+    // Offset of an event pointing past the end of the events
+    {
+        std::vector<char> data = good;
+        const uint64_t offset = good.size();
+        std::memcpy(data.data() + indexOffset + 3 * sizeof(uint64_t), &offset, sizeof(offset));
+        WriteAll(damaged, data);
+        WFFlatReader reader;
+        nDiff = reader.OpenFile(damaged);
+        std::cout << "Offset outside of the events: " << (nDiff ? "accepted" : "refused") << std::endl;
+        nFailed += nDiff;
+    }
+
+    // Event count wrapping indexOffset + 8 * nEvents around to the file size: not taken as an index
+    {
+        std::vector<char> data = good;
+        FlatStore::_flat_file_trailer trailer;
+        std::memcpy(&trailer, data.data() + data.size() - trailerSize, trailerSize);
+        trailer.nEvents += uint64_t(1) << 61;
+        std::memcpy(data.data() + data.size() - trailerSize, &trailer, trailerSize);
+        WriteAll(damaged, data);
+        nDiff = CheckStore(damaged, kEvents, codes1, codes2);
+        std::cout << "Overflowing event count: failures " << nDiff << std::endl;
+        nFailed += nDiff;
+    }
+
+    std::filesystem::remove_all(folder);
+    if (nFailed)
+        std::cerr << nFailed << " failures" << std::endl;
+    return nFailed != 0;
+}
@@ -0,0 +1,246 @@
+#include "WFDataConverter.h"
+#include "WFKernels.h"
+#include "lcparser.h"
+#include "SyntheticPulses.h"
+#include "SyntheticTRC.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// WFDataExtractor driven with in-memory ScopeData read from synthetic .trc files, without an output file.
+// Average pulses: the extractor, on decoded and raw-only records, with and without the filter stage and with a
+// negative gain (raw kernel falling back to the decoded path), against the pulses accumulated directly from the
+// decoded records, per scan position and amplitude class.
+// Relative search range: a DUT channel with a small pulse after the reference pulse and a larger one later in the
+// fixed search range, extracted with the window placed on the reference toa, whether the reference channel number is
+// lower or higher; and falling back to the fixed range when the reference has no data, is itself relative, or is not
+// a channel. Both against the features extracted directly with the expected search range.
+// Returns non-zero on any failure.
+
+namespace
+{
+    using namespace WFDataProcessor;
+
+    constexpr int kEvents = 240, kSamples = 1002;
+    const double kGain = 2e-5, kOffset = 0.05, kDt = 50e-12;
+
+    // Quantized records of one channel written as .trc files, codes negated for a negative gain
+    void WriteWaves(const std::string &folder, int channel, const std::vector<_synthetic_wave> &waves, double gain)
+    {
+        for (int evt = 0; evt < static_cast<int>(waves.size()); evt++)
+        {
+            std::vector<int16_t> codes = waves[evt].codes;
+            if (gain < 0)
+                for (auto &code : codes)
+                    code = -code;
+            SyntheticTRC::Write(GenerateScopeFileName(folder, channel, evt), codes, gain, kOffset, kDt, waves[evt].t[0]);
+        }
+    }
+
+    std::vector<_synthetic_wave> WriteChannel(const std::string &folder, int channel, unsigned seed, double gain, const _synthetic_config &config = {})
+    {
+        _synthetic_config quantized = config;
+        quantized.gain = kGain;
+        quantized.offset = kOffset;
+        auto waves = GenerateWaves(kEvents, kSamples, kDt, seed, quantized);
+        WriteWaves(folder, channel, waves, gain);
+        return waves;
+    }
+
+    bool ReadRecord(const std::string &path, bool rawOnly, ScopeData &data)
+    {
+        return (rawOnly ? data.InitRawData(path) : data.InitData(path)) == ScopeData::kSUCCESS;
+    }
+
+    // Average pulses of every (scan position, amplitude class) from the extractor against a direct accumulation
+    int CheckPulseShapes(const std::string &folder, const char *name, bool rawOnly, bool filter, double gain)
+    {
+        WriteChannel(folder, 1, 48, gain);
+        _extract_config config;
+        config.search_range = {-5.0, 10.0};
+        config.pulse_shape.step = 0.05;
+        config.pulse_shape.amp_bins = {20, 80, 160, 300};
+        if (filter)
+        {
+            config.filter.type = kLowPassFIR;
+            config.filter.taps = 15;
+            config.filter.cutoff = 2.0;
+        }
+        WFDataExtractor extractor({1});
+        extractor.SetExtractConfig(1, config);
+
+        std::map<std::tuple<int, int>, _average_pulse> expected; // (scan position, amplitude class) -> average
+        _wave_workspace workspace;
+        _filter_design design;
+        std::vector<double> filtered(kSamples);
+        int nFailed = 0;
+        for (int evt = 0; evt < kEvents; evt++)
+        {
+            const std::string path = GenerateScopeFileName(folder, 1, evt);
+            ScopeData data, decoded;
+            if (!ReadRecord(path, rawOnly, data) || !ReadRecord(path, false, decoded))
+            {
+                nFailed++;
+                continue;
+            }
+            const int position = evt % 3 - 1;
+            extractor.SetScanPosition(position);
+            nFailed += !extractor.ExtractFromScopeData({{1, &data}}, {{1, true}});
+
+            // Same features as the extractor, the pulse taken from the decoded (and filtered) record
+            _waveinfo winfo;
+            if (rawOnly)
+                processWaveRaw(data, winfo, config, workspace);
+            else
+                processWave(decoded.getX().data(), decoded.getY().data(), kSamples, winfo, config, workspace);
+            const double dt_ns = (decoded.getX().back() - decoded.getX().front()) / (kSamples - 1) * 1e9;
+            const double *record = decoded.getY().data();
+            if (filter && DesignFilter(config.filter, dt_ns, design))
+            {
+                FilterRecord(record, kSamples, design, filtered.data());
+                record = filtered.data();
+            }
+            const auto &bins = config.pulse_shape.amp_bins;
+            const int ampClass = static_cast<int>(std::upper_bound(bins.begin(), bins.end(), winfo.amp) - bins.begin()) - 1;
+            if (winfo.valid != VALID || !(winfo.toa > -100e9) || ampClass < 0 || ampClass + 1 >= static_cast<int>(bins.size()))
+                continue;
+            const double ped = winfo.ped_start;
+            AccumulatePulseShape(kSamples, decoded.getX().front() * 1e9, dt_ns, winfo.toa, 1.0, [record, ped](int i)
+                                 { return record[i] * 1e3 - ped; }, config.pulse_shape, expected[std::make_tuple(position, ampClass)]);
+        }
+
+        long long nPulses = 0;
+        double maxDiff = 0;
+        for (int position = -1; position <= 1; position++)
+            for (int ampClass = -1; ampClass <= 3; ampClass++)
+            {
+                auto it = expected.find(std::make_tuple(position, ampClass));
+                const _average_pulse *average = extractor.GetAveragePulse(1, position, ampClass);
+                if (it == expected.end() || it->second.count == 0)
+                {
+                    nFailed += average != nullptr;
+                    continue;
+                }
+                if (average == nullptr || average->count != it->second.count)
+                {
+                    nFailed++;
+                    continue;
+                }
+                nPulses += average->count;
+                for (int j = 0; j < config.pulse_shape.Points(); j++)
+                    maxDiff = std::max({maxDiff, std::fabs(average->mean[j] - it->second.mean[j]), std::fabs(average->StdDev(j) - it->second.StdDev(j))});
+            }
+        // ScopeData decodes in single precision, the extractor scales the codes in double precision
+        nFailed += maxDiff > (rawOnly ? 1e-4 : 1e-9) || nPulses == 0;
+        std::cout << "Average pulses, " << name << ": " << nPulses << " pulses in " << expected.size() << " classes, max difference "
+                  << maxDiff << " mV, failures " << nFailed << std::endl;
+        return nFailed;
+    }
+
+    enum _reference_case
+    {
+        kReferenceData,     // reference with data, the window follows its toa
+        kReferenceMissing,  // reference without data in every event
+        kReferenceRelative, // reference with a relative range itself
+        kReferenceNotRead,  // reference not a channel of the extractor
+    };
+
+    // DUT features extracted with the window on the reference toa, or with the fixed range when the reference cannot
+    // place it, against processWave with that search range
+    int CheckRelativeRange(const std::string &folder, const char *name, int reference, int dut, _reference_case mode)
+    {
+        const double delay = 4e-9, decoyTime = 14e-9; // s, DUT pulse after the reference start, and the larger pulse
+        _synthetic_config refConfig;
+        refConfig.amp_min = 0.1;
+        refConfig.gain = kGain;
+        refConfig.offset = kOffset;
+        auto refWaves = GenerateWaves(kEvents, kSamples, kDt, 50, refConfig);
+        _synthetic_config dutConfig;
+        dutConfig.amp_max = 0;
+        auto dutWaves = GenerateWaves(kEvents, kSamples, kDt, 51, dutConfig);
+        for (int evt = 0; evt < kEvents; evt++)
+        {
+            AddPulse(dutWaves[evt], 0.08, refWaves[evt].start + delay, dutConfig.tau);
+            AddPulse(dutWaves[evt], 0.25, decoyTime, dutConfig.tau);
+            Quantize(dutWaves[evt], kGain, kOffset);
+        }
+        WriteWaves(folder, reference, refWaves, kGain);
+        WriteWaves(folder, dut, dutWaves, kGain);
+
+        _extract_config fixed;
+        fixed.search_range = {-5.0, 20.0};
+        _extract_config relative = fixed;
+        relative.relative_range.reference = mode == kReferenceNotRead ? 7 : reference;
+        relative.relative_range.offset = 2.0;
+        relative.relative_range.width = 5.0;
+        _extract_config refExtract = fixed;
+        if (mode == kReferenceRelative)
+            refExtract.relative_range = {dut == 1 ? 9 : 1, 0.0, 5.0};
+        WFDataExtractor extractor({reference, dut});
+        extractor.SetForceMatch(false);
+        extractor.SetExtractConfig(reference, refExtract);
+        extractor.SetExtractConfig(dut, relative);
+
+        const bool placed = mode == kReferenceData;
+        int nFailed = 0, nExpected = 0;
+        for (int evt = 0; evt < kEvents; evt++)
+        {
+            ScopeData refData, dutData;
+            if (!ReadRecord(GenerateScopeFileName(folder, reference, evt), false, refData) ||
+                !ReadRecord(GenerateScopeFileName(folder, dut, evt), false, dutData))
+            {
+                nFailed++;
+                continue;
+            }
+            const bool refHasData = mode != kReferenceMissing;
+            nFailed += !extractor.ExtractFromScopeData({{reference, &refData}, {dut, &dutData}}, {{reference, refHasData}, {dut, true}});
+
+            _waveinfo refInfo, expected;
+            processWave(refData.getX().data(), refData.getY().data(), kSamples, refInfo, fixed);
+            _extract_config config = fixed;
+            if (placed)
+                config.search_range = RelativeSearchRange(relative, refInfo.toa);
+            processWave(dutData.getX().data(), dutData.getY().data(), kSamples, expected, config);
+            const _waveinfo &winfo = *extractor.GetChannelDataMap().at(dut);
+            nFailed += winfo.valid != expected.valid || winfo.amp != expected.amp || winfo.toa != expected.toa;
+
+            // The window selects the small pulse, the fixed range the larger one
+            const double pulse = placed ? refWaves[evt].start + delay : decoyTime;
+            nExpected += std::fabs(winfo.toa * 1e-9 - pulse) < 1e-9;
+        }
+        nFailed += nExpected < kEvents * 9 / 10;
+        std::cout << "Relative search range, " << name << ": " << nExpected << " of " << kEvents << " events on the "
+                  << (placed ? "delayed" : "larger") << " pulse, failures " << nFailed << std::endl;
+        return nFailed;
+    }
+}
+
+int main()
+{
+    const std::string folder = (std::filesystem::temp_directory_path() / "test_extractor").string();
+    std::filesystem::create_directories(folder);
+
+    int nFailed = 0;
+    nFailed += CheckPulseShapes(folder, "decoded", false, false, kGain);
+    nFailed += CheckPulseShapes(folder, "decoded, filtered", false, true, kGain);
+    nFailed += CheckPulseShapes(folder, "raw codes", true, false, kGain);
+    nFailed += CheckPulseShapes(folder, "raw codes, filtered", true, true, kGain);
+    nFailed += CheckPulseShapes(folder, "negative gain, filtered", true, true, -kGain);
+    nFailed += CheckRelativeRange(folder, "reference on channel 1", 1, 2, kReferenceData);
+    nFailed += CheckRelativeRange(folder, "reference on channel 2", 2, 1, kReferenceData);
+    nFailed += CheckRelativeRange(folder, "reference without data", 1, 2, kReferenceMissing);
+    nFailed += CheckRelativeRange(folder, "relative reference", 1, 2, kReferenceRelative);
+    nFailed += CheckRelativeRange(folder, "reference not read", 1, 2, kReferenceNotRead);
+
+    std::filesystem::remove_all(folder);
+    if (nFailed)
+        std::cerr << nFailed << " failures" << std::endl;
+    return nFailed != 0;
+}
@@ -0,0 +1,203 @@
+#include "WFDataConverter.h"
+#include "lcparser.h"
+#include "SyntheticPulses.h"
+#include "SyntheticTRC.h"
+
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Flight recorder without ROOT files: ring order across the wrap, raw and decoded records copied into reserved slots
+// without allocating, dump requests seen once per recorder and only after they are made, and the extractor recording
+// the events it rejects for a missing channel, which trigger as NO_WAVEFORM.
+// Returns non-zero on any failure.
+
+namespace
+{
+    using namespace WFDataProcessor;
+
+    constexpr int kSamples = 600;
+    const float kGain = 1e-4f, kOffset = 0.02f, kDt = 50e-12f;
+    const double kT0 = -1e-8;
+
+    // Events 0 to 9 in 4 slots: the last 4 are kept, oldest first
+    int CheckRing()
+    {
+        WFFlightRecorder recorder;
+        recorder.SetCapacity(4);
+        int nFailed = 0;
+        for (int evt = 0; evt < 10; evt++)
+        {
+            recorder.NextSlot().event = evt;
+            recorder.Commit();
+            const int size = evt < 4 ? evt + 1 : 4;
+            nFailed += recorder.Size() != size;
+            for (int i = 0; i < recorder.Size(); i++)
+                nFailed += recorder.Get(i).event != evt + 1 - size + i;
+        }
+        recorder.Clear();
+        nFailed += recorder.Size() != 0;
+
+        WFFlightRecorder disabled;
+        disabled.SetCapacity(0);
+        disabled.Commit();
+        nFailed += disabled.GetCapacity() != 0 || disabled.Size() != 0;
+        std::cout << "Ring order across the wrap: failures " << nFailed << std::endl;
+        return nFailed;
+    }
+
+    // Raw int16 and int8 codes, and the amplitudes of a decoded record, against ScopeData
+    int CheckRecord(const std::string &folder)
+    {
+        std::mt19937 rng(49);
+        std::uniform_int_distribution<int> code(-32768, 32767), byte(-128, 127);
+        std::vector<int16_t> codes1(kSamples);
+        std::vector<int8_t> codes2(kSamples);
+        for (int i = 0; i < kSamples; i++)
+        {
+            codes1[i] = code(rng);
+            codes2[i] = byte(rng);
+        }
+        const std::string path1 = GenerateScopeFileName(folder, 1, 0), path2 = GenerateScopeFileName(folder, 2, 0);
+        SyntheticTRC::Write(path1, codes1, kGain, kOffset, kDt, kT0);
+        SyntheticTRC::Write(path2, codes2, kGain, kOffset, kDt, kT0);
+
+        ScopeData raw1, raw2, decoded;
+        if (raw1.InitRawData(path1) != ScopeData::kSUCCESS || raw2.InitRawData(path2) != ScopeData::kSUCCESS ||
+            decoded.InitData(path1) != ScopeData::kSUCCESS)
+            return 1;
+
+        // Slots reserved for the record length keep their buffers
+        WFFlightRecorder recorder;
+        recorder.SetCapacity(2);
+        recorder.Reserve(3, kSamples);
+        _recorded_event &slot = recorder.NextSlot();
+        int nFailed = slot.channels.size() != 3;
+        if (nFailed)
+            return nFailed;
+        std::vector<const float *> buffers;
+        for (const auto &channel : slot.channels)
+            buffers.push_back(channel.samples.data());
+
+        _waveinfo winfo{};
+        winfo.valid = VALID;
+        winfo.amp = 12.5;
+        WFFlightRecorder::Record(raw1, true, winfo, slot.channels[0]);
+        WFFlightRecorder::Record(raw2, true, winfo, slot.channels[1]);
+        WFFlightRecorder::Record(decoded, true, winfo, slot.channels[2]);
+        recorder.Commit();
+        for (int k = 0; k < 3; k++)
+        {
+            const _recorded_channel &channel = slot.channels[k];
+            const ScopeData &data = k == 0 ? raw1 : k == 1 ? raw2 : decoded;
+            nFailed += channel.samples.data() != buffers[k] || channel.nsamples != kSamples || !channel.has_data ||
+                       channel.winfo.amp != winfo.amp || channel.winfo.valid != VALID;
+            for (int i = 0; i < kSamples; i++)
+            {
+                const float expected = k == 0 ? codes1[i] : k == 1 ? codes2[i] : static_cast<float>(data.getY()[i]);
+                if (channel.samples[i] != expected)
+                {
+                    nFailed++;
+                    break;
+                }
+            }
+            if (k < 2)
+                nFailed += channel.vertical_gain != data.getVerticalGain() || channel.vertical_offset != data.getVerticalOffset() ||
+                           channel.horiz_interval != data.getHorizInterval() || channel.horiz_offset != data.getHorizOffset();
+            else
+                nFailed += channel.vertical_gain != 1 || channel.vertical_offset != 0 ||
+                           std::fabs(channel.horiz_interval - kDt) > 1e-15 || channel.horiz_offset != data.getX().front();
+        }
+
+        // A channel without data keeps its buffer and holds no samples
+        WFFlightRecorder::Record(raw1, false, winfo, recorder.NextSlot().channels[0]);
+        nFailed += recorder.NextSlot().channels[0].nsamples != 0 || recorder.NextSlot().channels[0].has_data;
+        std::cout << "Raw and decoded records: failures " << nFailed << std::endl;
+        return nFailed;
+    }
+
+    // A request is seen once by every recorder set up before it
+    int CheckDumpRequests()
+    {
+        WFFlightRecorder before;
+        before.SetCapacity(1);
+        int nFailed = before.DumpRequested();
+        WFFlightRecorder::RequestDump();
+        WFFlightRecorder after;
+        after.SetCapacity(1);
+        nFailed += !before.DumpRequested() + before.DumpRequested() + after.DumpRequested();
+        std::cout << "Dump requests: failures " << nFailed << std::endl;
+        return nFailed;
+    }
+
+    // Events missing channel 2 are rejected by SetForceMatch but kept, channel 2 as NO_WAVEFORM
+    int CheckForceMatch(const std::string &folder)
+    {
+        _synthetic_config config;
+        config.gain = kGain;
+        config.offset = kOffset;
+        config.amp_min = 0.05;
+        auto waves = GenerateWaves(6, kSamples, kDt, 149, config);
+        ScopeData data1[6], data2[6];
+        int nFailed = 0;
+        for (int evt = 0; evt < 6; evt++)
+        {
+            const std::string path = GenerateScopeFileName(folder, 1, evt);
+            SyntheticTRC::Write(path, waves[evt].codes, kGain, kOffset, kDt, waves[evt].t[0]);
+            nFailed += data1[evt].InitRawData(path) != ScopeData::kSUCCESS || data2[evt].InitRawData(path) != ScopeData::kSUCCESS;
+        }
+
+        WFDataExtractor extractor({1, 2});
+        extractor.SetForceMatch(true);
+        _flight_policy policy;
+        policy.capacity = 4;
+        policy.valid_mask = NO_WAVEFORM;
+        policy.max_dumps = 0; // counted only
+        extractor.SetFlightPolicy(policy);
+        for (int evt = 0; evt < 6; evt++)
+        {
+            const bool complete = evt % 2 == 0;
+            nFailed += extractor.ExtractFromScopeData({{1, &data1[evt]}, {2, &data2[evt]}}, {{1, true}, {2, complete}}) != complete;
+        }
+
+        const WFFlightRecorder &recorder = extractor.GetFlightRecorder();
+        nFailed += recorder.Size() != 4 || extractor.GetFlightTriggers() != 3;
+        for (int i = 0; i < recorder.Size(); i++)
+        {
+            const _recorded_event &recorded = recorder.Get(i);
+            const bool complete = i % 2 == 0; // events 2 to 5
+            if (recorded.channels.size() != 2)
+            {
+                nFailed++;
+                continue;
+            }
+            const _recorded_channel &ch1 = recorded.channels[0], &ch2 = recorded.channels[1];
+            nFailed += ch1.channel != 1 || !ch1.has_data || ch1.nsamples != kSamples || ch1.winfo.valid == NO_WAVEFORM;
+            nFailed += ch2.channel != 2 || ch2.has_data != complete || (ch2.winfo.valid == NO_WAVEFORM) == complete;
+            nFailed += complete ? ch2.nsamples != kSamples : ch2.nsamples != 0;
+        }
+        std::cout << "Events rejected by SetForceMatch: " << extractor.GetFlightTriggers() << " triggers, failures " << nFailed << std::endl;
+        return nFailed;
+    }
+}
+
+int main()
+{
+    const std::string folder = (std::filesystem::temp_directory_path() / "test_flightrecorder").string();
+    std::filesystem::create_directories(folder);
+
+    int nFailed = 0;
+    nFailed += CheckRing();
+    nFailed += CheckRecord(folder);
+    nFailed += CheckDumpRequests();
+    nFailed += CheckForceMatch(folder);
+
+    std::filesystem::remove_all(folder);
+    if (nFailed)
+        std::cerr << nFailed << " failures" << std::endl;
+    return nFailed != 0;
+}
@@ -196,10 +196,12 @@ std::vector<TRCInfo> ScanFolder(const std::string &folderName, const std::vector
     return trcFiles;
 }
 
-void ConvertToROOT()
+/// @param resume only convert waveforms not yet present in PRData/*.root, instead of recreating the files
+bool ConvertToROOT(bool resume = false)
 {
     WFDataProcessor::WFtrc2ROOT converter({1, 2, 3, 4});
     converter.SetForceMatch(true);
+    converter.SetResume(resume);
 
     // Search all sub directories in gScopeDataFolder
     auto dir = gSystem->OpenDirectory(gScopeDataFolder.c_str());
@@ -245,7 +247,13 @@ void ConvertToROOT()
         if (counter == total)
             std::cout << std::endl;
 
-        converter.OpenFile(Form("PRData/%s.root", iter.first.c_str()));
+        const std::string output = Form("PRData/%s.root", iter.first.c_str());
+        if (!converter.OpenFile(output))
+        {
+            std::cerr << std::endl
+                      << "Cannot open output " << output << std::endl;
+            return false;
+        }
 
         for (int idx_file = 0; idx_file < vector.size(); idx_file++)
         {
@@ -257,11 +265,12 @@ void ConvertToROOT()
         converter.CloseFile();
         // return 1;
     }
+    return true;
 }
 
-int main_forConvertROOT()
+int main_forConvertROOT(bool resume = false)
 {
-    ConvertToROOT();
+    ConvertToROOT(resume);
     return 1;
 }
 
@@ -0,0 +1,249 @@
+#include "WFDataConverter.h"
+#include "lcparser.h"
+#include "SyntheticPulses.h"
+#include "SyntheticTRC.h"
+
+#include "TFile.h"
+#include "TParameter.h"
+#include "TTree.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// ROOT round trip of WFDataExtractor on synthetic .trc files: a job stopped partway and resumed, into one file (the tree
+// is taken over, the checkpoint kept) and into a split output (new parts listed in the manifest), in both branch layouts.
+// Read back with WFDataTreeReader, every waveform index must appear exactly once with the features of processWave.
+// The feature arrays must read as the scalar branches, inactive channels and features untouched, also through ReadBatch.
+// A rollover whose next part cannot be opened must fail the extraction from that event on.
+// Returns non-zero on any failure.
+
+namespace
+{
+    using namespace WFDataProcessor;
+
+    constexpr int kEvents = 40, kSamples = 1002, kStop = 17, kRollover = 7, kCheckpoint = 5;
+    const double kGain = 2e-5, kOffset = 0.05, kDt = 50e-12;
+    const std::vector<int> kChannels = {1, 2};
+
+    _extract_config MakeConfig()
+    {
+        _extract_config config;
+        config.search_range = {-5.0, 10.0};
+        return config;
+    }
+
+    // Fields of GetWaveInfoFields() compared bit by bit, all of them if fieldIndices is empty
+    bool SameFields(const _waveinfo &w1, const _waveinfo &w2, const std::vector<int> &fieldIndices = {})
+    {
+        const auto &fields = GetWaveInfoFields();
+        for (size_t k = 0; k < (fieldIndices.empty() ? fields.size() : fieldIndices.size()); k++)
+        {
+            const auto &field = fields[fieldIndices.empty() ? k : fieldIndices[k]];
+            if (std::memcmp((const char *)&w1 + field.offset, (const char *)&w2 + field.offset, field.size) != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // Synthetic records of every channel, and their features extracted directly
+    std::map<int, std::vector<_waveinfo>> WriteEvents(const std::string &folder)
+    {
+        std::map<int, std::vector<_waveinfo>> expected;
+        for (int channel : kChannels)
+        {
+            _synthetic_config config;
+            config.gain = kGain;
+            config.offset = kOffset;
+            auto waves = GenerateWaves(kEvents, kSamples, kDt, 26 + channel, config);
+            expected[channel].resize(kEvents);
+            for (int evt = 0; evt < kEvents; evt++)
+            {
+                const std::string path = GenerateScopeFileName(folder, channel, evt);
+                SyntheticTRC::Write(path, waves[evt].codes, kGain, kOffset, kDt, waves[evt].t[0]);
+                ScopeData data;
+                if (data.InitData(path) == ScopeData::kSUCCESS)
+                    processWave(data.getX().data(), data.getY().data(), data.getX().size(), expected[channel][evt], MakeConfig());
+            }
+        }
+        return expected;
+    }
+
+    // One job over events [0, last), skipping those already in a resumed output
+    int Extract(const std::string &folder, const std::string &output, WaveInfoLayout layout, Long64_t rollover, bool resume,
+                int last, int &nSkipped)
+    {
+        WFDataExtractor extractor(kChannels);
+        for (int channel : kChannels)
+            extractor.SetExtractConfig(channel, MakeConfig());
+        extractor.SetBranchLayout(layout);
+        extractor.SetRollover(rollover);
+        extractor.SetResume(resume);
+        extractor.SetCheckpointInterval(kCheckpoint);
+        if (!extractor.OpenFile(output))
+            return 1;
+        int nFailed = 0;
+        nSkipped = 0;
+        for (int evt = 0; evt < last; evt++)
+        {
+            nFailed += !extractor.ExtractFromTRCFiles(folder, evt);
+            nSkipped += extractor.GetLastSkipped();
+        }
+        extractor.CloseFile();
+        return nFailed;
+    }
+
+    // Every waveform index exactly once in the output, with the features of processWave
+    int CheckOutput(const std::string &path, const std::map<int, std::vector<_waveinfo>> &expected)
+    {
+        WFDataTreeReader reader(kChannels);
+        if (!reader.OpenFile(path))
+            return 1;
+        std::vector<int> seen(kEvents, 0);
+        int nFailed = 0;
+        const Long64_t nEntries = reader.GetTree()->GetEntries();
+        for (Long64_t entry = 0; entry < nEntries; entry++)
+        {
+            reader.GetEntry(entry);
+            const int idx = reader.GetFileIndex();
+            if (idx < 0 || idx >= kEvents)
+            {
+                nFailed++;
+                continue;
+            }
+            seen[idx]++;
+            for (int channel : kChannels)
+                nFailed += !SameFields(*reader.GetChannelDataMap().at(channel), expected.at(channel)[idx]);
+        }
+        for (int n : seen)
+            nFailed += n != 1;
+        reader.CloseFile();
+        return nFailed;
+    }
+
+    // Stopped after kStop events and resumed: the tree and its processed indices are taken over
+    int CheckResumeFile(const std::string &folder, const std::map<int, std::vector<_waveinfo>> &expected)
+    {
+        const std::string output = folder + "/single.root";
+        int nSkipped = 0;
+        int nFailed = Extract(folder, output, kScalarBranches, 0, false, kStop, nSkipped);
+        {
+            // Last checkpoint at the last multiple of kCheckpoint entries
+            TFile file(output.c_str());
+            auto checkpoint = (TParameter<int> *)file.Get("checkpoint");
+            nFailed += !checkpoint || checkpoint->GetVal() != kStop / kCheckpoint * kCheckpoint - 1;
+        }
+        nFailed += Extract(folder, output, kScalarBranches, 0, true, kEvents, nSkipped);
+        nFailed += nSkipped != kStop;
+        const int nDiff = CheckOutput(output, expected);
+        std::cout << "Resumed file: " << nSkipped << " events skipped, failures " << nFailed + nDiff << std::endl;
+        return nFailed + nDiff;
+    }
+
+    // Split output stopped after kStop events and resumed: the existing parts are kept, new ones added to the manifest
+    int CheckResumeSplit(const std::string &folder, const std::string &base, WaveInfoLayout layout,
+                         const std::map<int, std::vector<_waveinfo>> &expected)
+    {
+        int nSkipped = 0;
+        int nFailed = Extract(folder, base + ".root", layout, kRollover, false, kStop, nSkipped);
+        nFailed += Extract(folder, base + ".root", layout, kRollover, true, kEvents, nSkipped);
+        nFailed += nSkipped != kStop;
+        std::vector<std::string> parts;
+        std::string treeName;
+        nFailed += !ReadChainManifest(base + ".manifest", treeName, parts) || treeName != "waveinfo";
+        // Parts of the first job, including the one opened after its last full part, then those of the second job
+        const int nParts = (kStop / kRollover + 1) + ((kEvents - kStop) / kRollover + 1);
+        nFailed += static_cast<int>(parts.size()) != nParts;
+        const int nDiff = CheckOutput(base + ".manifest", expected);
+        std::cout << "Resumed split output (" << (layout == kFeatureArrays ? "feature arrays" : "scalar branches") << "): "
+                  << parts.size() << " parts, " << nSkipped << " events skipped, failures " << nFailed + nDiff << std::endl;
+        return nFailed + nDiff;
+    }
+
+    // Both layouts read with channel 1 and all features but amp and toa inactive: the inactive members keep a marker
+    int CompareLayouts(const std::string &scalarPath, const std::string &arraysPath)
+    {
+        WFDataTreeReader scalar(kChannels), arrays(kChannels);
+        WFDataTreeReader *readers[] = {&scalar, &arrays};
+        for (auto *reader : readers)
+        {
+            reader->SetActiveChannels({2});
+            reader->SetActiveFeatures({"amp", "toa"});
+        }
+        if (!scalar.OpenFile(scalarPath) || !arrays.OpenFile(arraysPath))
+            return 1;
+        int nFailed = (scalar.GetBranchLayout() != kScalarBranches) + (arrays.GetBranchLayout() != kFeatureArrays);
+
+        _waveinfo marker;
+        std::memset(&marker, 0x5A, sizeof(marker));
+        const std::vector<int> active = {FindWaveInfoField("amp"), FindWaveInfoField("toa")};
+        std::vector<int> inactive;
+        for (int i = 0; i < static_cast<int>(GetWaveInfoFields().size()); i++)
+            if (std::find(active.begin(), active.end(), i) == active.end())
+                inactive.push_back(i);
+        for (auto *reader : readers)
+            for (int channel : kChannels)
+                *reader->GetChannelDataMap().at(channel) = marker;
+
+        const Long64_t nEntries = scalar.GetTree()->GetEntries();
+        nFailed += arrays.GetTree()->GetEntries() != nEntries;
+        for (Long64_t entry = 0; entry < nEntries; entry++)
+        {
+            scalar.GetEntry(entry);
+            arrays.GetEntry(entry);
+            const _waveinfo &s1 = *scalar.GetChannelDataMap().at(1), &s2 = *scalar.GetChannelDataMap().at(2);
+            const _waveinfo &a1 = *arrays.GetChannelDataMap().at(1), &a2 = *arrays.GetChannelDataMap().at(2);
+            nFailed += scalar.GetFileIndex() != arrays.GetFileIndex() || !SameFields(s2, a2, active);
+            nFailed += !SameFields(s1, marker) || !SameFields(a1, marker) || !SameFields(s2, marker, inactive) || !SameFields(a2, marker, inactive);
+        }
+
+        // Batches hold the active columns only, with the same values
+        _waveinfo_columns scalarColumns, arraysColumns;
+        nFailed += scalar.ReadBatch(0, nEntries, scalarColumns) != nEntries || arrays.ReadBatch(0, nEntries, arraysColumns) != nEntries;
+        nFailed += scalarColumns.file_index != arraysColumns.file_index || scalarColumns.data != arraysColumns.data;
+        nFailed += scalarColumns.data.size() != 1 || !scalarColumns.data.count(2) || scalarColumns.data.at(2).size() != active.size();
+        std::cout << "Feature arrays against scalar branches: " << nEntries << " entries, failures " << nFailed << std::endl;
+        return nFailed;
+    }
+
+    // The part after the first one is a directory: the event filling the first part fails, and every later one
+    int CheckRolloverFailure(const std::string &folder)
+    {
+        const int rollover = 5;
+        std::filesystem::create_directories(folder + "/blocked_0001.root");
+        WFDataExtractor extractor(kChannels);
+        extractor.SetRollover(rollover);
+        if (!extractor.OpenFile(folder + "/blocked.root"))
+            return 1;
+        int nFailed = 0;
+        for (int evt = 0; evt < 3 * rollover; evt++)
+            nFailed += extractor.ExtractFromTRCFiles(folder, evt) != (evt < rollover - 1);
+        extractor.CloseFile();
+        std::cout << "Rollover into a part that cannot be opened: failures " << nFailed << std::endl;
+        return nFailed;
+    }
+}
+
+int main()
+{
+    const std::string folder = (std::filesystem::temp_directory_path() / "test_roundtrip").string();
+    std::filesystem::remove_all(folder);
+    std::filesystem::create_directories(folder);
+    const auto expected = WriteEvents(folder);
+
+    int nFailed = 0;
+    nFailed += CheckResumeFile(folder, expected);
+    nFailed += CheckResumeSplit(folder, folder + "/scalar", kScalarBranches, expected);
+    nFailed += CheckResumeSplit(folder, folder + "/arrays", kFeatureArrays, expected);
+    nFailed += CompareLayouts(folder + "/scalar.manifest", folder + "/arrays.manifest");
+    nFailed += CheckRolloverFailure(folder);
+
+    std::filesystem::remove_all(folder);
+    if (nFailed)
+        std::cerr << nFailed << " failures" << std::endl;
+    return nFailed != 0;
+}
@@ -0,0 +1,211 @@
+#include "WFDataConverter.h"
+#include "WFKernels.h"
+#include "SyntheticPulses.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Stress test of concurrent feature extraction: many threads run processWave and processWaveRaw over the same
+// synthetic events, each with its own workspaces, and must reproduce a serial run bit by bit. Every channel has
+// different settings (filter, interpolation, pulse finder, robust pedestal, template), so that the designs cached
+// in the workspaces are exercised as well. Also checks that each thread sees its own gWFDataExtractor.
+// Returns non-zero on any difference.
+
+namespace
+{
+    using namespace WFDataProcessor;
+
+    constexpr int kChannels = 4;
+
+    struct _event
+    {
+        _synthetic_wave channel[kChannels];
+    };
+
+    struct _result
+    {
+        _waveinfo winfo[kChannels];
+        _waveinfo raw[kChannels];
+        int pulses[kChannels];
+    };
+
+    const double kGain = 1e-5, kOffset = 0.05;
+
+    std::vector<_event> GenerateEvents(int nEvents, int nSamples, double dt, unsigned seed)
+    {
+        auto waves = GenerateWaves(nEvents * kChannels, nSamples, dt, seed);
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<double> amp(0.0, 0.3);
+        std::vector<_event> events(nEvents);
+        for (int e = 0; e < nEvents; e++)
+            for (int ch = 0; ch < kChannels; ch++)
+            {
+                // A second, later pulse on some events for the pulse finder
+                _synthetic_wave &wave = events[e].channel[ch];
+                wave = std::move(waves[e * kChannels + ch]);
+                if (rng() % 3 == 0)
+                    AddPulse(wave, amp(rng), wave.start + 6e-9, 0.4e-9);
+                Quantize(wave, kGain, kOffset);
+            }
+        return events;
+    }
+
+    std::vector<_extract_config> MakeConfigs()
+    {
+        std::vector<_extract_config> configs(kChannels, _extract_config{{-3.0, 10.0}, 20.0, false, ""});
+        configs[0].cfd_fraction = 0.5;
+        configs[0].cfd_delay = 0.4;
+        configs[1].filter.type = kLowPassFIR;
+        configs[1].filter.taps = 15;
+        configs[1].filter.cutoff = 2.0;
+        configs[1].interpolation = kSincInterpolation;
+        configs[2].find_pulses = true;
+        configs[2].baseline.method = kMedianBaseline;
+        configs[3].baseline.method = kTrimmedMeanBaseline;
+        configs[3].interpolation = kCubicInterpolation;
+        for (int k = 0; k < 80; k++)
+            configs[3].pulse_template.shape.push_back(PulseShape(k * 0.025 / 0.4));
+        configs[3].pulse_template.dt = 0.025;
+        return configs;
+    }
+
+    // Extract events first, first + step, ..., the workspaces belong to the caller
+    void Extract(const std::vector<_event> &events, const std::vector<_extract_config> &configs, int first, int step,
+                 std::vector<_wave_workspace> &workspaces, std::vector<_result> &results)
+    {
+        for (size_t e = first; e < events.size(); e += step)
+            for (int ch = 0; ch < kChannels; ch++)
+            {
+                const _event &event = events[e];
+                const int nSamples = event.channel[ch].t.size();
+                _result &result = results[e];
+                processWave(event.channel[ch].t.data(), event.channel[ch].a.data(), nSamples, result.winfo[ch], configs[ch], workspaces[ch]);
+                result.pulses[ch] = workspaces[ch].pulses.Size();
+
+                _sample_scale scale;
+                scale.vertical_gain = kGain;
+                scale.vertical_offset = kOffset;
+                scale.horiz_interval = event.channel[ch].t[1] - event.channel[ch].t[0];
+                scale.horiz_offset = event.channel[ch].t[0];
+                processWaveRaw(event.channel[ch].codes.data(), nSamples, scale, result.raw[ch], configs[ch], workspaces[ch]);
+            }
+    }
+
+    bool SameWaveInfo(const _waveinfo &w1, const _waveinfo &w2)
+    {
+        for (const auto &field : GetWaveInfoFields())
+            if (std::memcmp((const char *)&w1 + field.offset, (const char *)&w2 + field.offset, field.size) != 0)
+                return false;
+        return true;
+    }
+
+    int CompareResults(const std::vector<_result> &serial, const std::vector<_result> &parallel)
+    {
+        int nDiff = 0;
+        for (size_t e = 0; e < serial.size(); e++)
+            for (int ch = 0; ch < kChannels; ch++)
+                if (!SameWaveInfo(serial[e].winfo[ch], parallel[e].winfo[ch]) || !SameWaveInfo(serial[e].raw[ch], parallel[e].raw[ch]) ||
+                    serial[e].pulses[ch] != parallel[e].pulses[ch])
+                    nDiff++;
+        return nDiff;
+    }
+
+    // Each thread constructs its own extractor, and must find it (and only it) as gWFDataExtractor
+    int CheckCurrentInstance(int nThreads)
+    {
+        std::atomic<int> nFailed(0);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.emplace_back([&nFailed]
+                                 {
+                for (int round = 0; round < 50; round++)
+                {
+                    WFDataExtractor extractor({1, 2});
+                    if (gWFDataExtractor != &extractor)
+                        nFailed++;
+                    std::this_thread::yield();
+                    if (gWFDataExtractor != &extractor)
+                        nFailed++;
+                }
+                if (gWFDataExtractor != nullptr)
+                    nFailed++; });
+        for (auto &thread : threads)
+            thread.join();
+        return nFailed;
+    }
+}
+
+int main()
+{
+    const int nEvents = 2000, nSamples = 1002;
+    const double dt = 50e-12;
+    const int nThreads = std::max(8u, std::thread::hardware_concurrency());
+    const auto events = GenerateEvents(nEvents, nSamples, dt, 45);
+    const auto configs = MakeConfigs();
+
+    std::vector<_result> serial(nEvents);
+    {
+        std::vector<_wave_workspace> workspaces(kChannels);
+        Extract(events, configs, 0, 1, workspaces, serial);
+    }
+
+    int nFailed = 0;
+    for (int round = 0; round < 3; round++)
+    {
+        // Interleaved events, so that all threads run through the records at the same time
+        std::vector<_result> parallel(nEvents);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.emplace_back([&, i]
+                                 {
+                std::vector<_wave_workspace> workspaces(kChannels);
+                Extract(events, configs, i, nThreads, workspaces, parallel); });
+        for (auto &thread : threads)
+            thread.join();
+        const int nDiff = CompareResults(serial, parallel);
+        std::cout << "Round " << round << ": " << nThreads << " threads, " << nEvents << " events x " << kChannels
+                  << " channels, mismatches " << nDiff << std::endl;
+        nFailed += nDiff;
+    }
+
+    // Workspace owned by each thread (processWave without a workspace argument), every 7th record missing its time axis
+    {
+        auto extract = [&](int e, _waveinfo &winfo)
+        {
+            const double *t = e % 7 == 3 ? nullptr : events[e].channel[1].t.data();
+            processWave(t, events[e].channel[1].a.data(), nSamples, winfo, configs[1]);
+        };
+        std::vector<_waveinfo> expected(nEvents), found(nEvents);
+        for (int e = 0; e < nEvents; e++)
+            extract(e, expected[e]);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.emplace_back([&, i]
+                                 {
+                for (int e = i; e < nEvents; e += nThreads)
+                    extract(e, found[e]); });
+        for (auto &thread : threads)
+            thread.join();
+        int nDiff = 0;
+        for (int e = 0; e < nEvents; e++)
+            if (!SameWaveInfo(expected[e], found[e]) || (expected[e].valid == NO_WAVEFORM) != (e % 7 == 3))
+                nDiff++;
+        std::cout << "Thread-owned workspaces: mismatches " << nDiff << std::endl;
+        nFailed += nDiff;
+    }
+
+    const int nInstance = CheckCurrentInstance(nThreads);
+    std::cout << "Per-thread current extractor: failures " << nInstance << std::endl;
+    nFailed += nInstance;
+
+    if (nFailed)
+        std::cerr << nFailed << " failures" << std::endl;
+    return nFailed != 0;
+}
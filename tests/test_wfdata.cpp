@@ -95,7 +95,7 @@ int main_testall()
     auto readTreeDataMap = treeReader.GetChannelDataMap();
     for (int entry = 0; entry < readTree->GetEntries(); entry++)
     {
-        readTree->GetEntry(entry);
+        treeReader.GetEntry(entry);
         std::cout << "Entry " << entry << ":" << std::endl;
         for (const auto &pair : readTreeDataMap)
         {